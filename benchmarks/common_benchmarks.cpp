@@ -0,0 +1,78 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include "common.hpp"
+#include "websocket.hpp"
+
+namespace common {
+
+static void BM_Unmask(benchmark::State& state) {
+  const std::uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  std::string data(state.range(0), 'x');
+  for (auto _ : state) {
+    Unmask(data.data(), data.size(), key);
+    benchmark::DoNotOptimize(data.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Unmask)->RangeMultiplier(4)->Range(16, 1 << 20);
+
+static void BM_SHA1(benchmark::State& state) {
+  std::string data(state.range(0), 'x');
+  char digest[sha1DigestLength];
+  for (auto _ : state) {
+    SHA1(data, digest);
+    benchmark::DoNotOptimize(digest);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SHA1)->RangeMultiplier(8)->Range(64, 1 << 18);
+
+static void BM_Base64(benchmark::State& state) {
+  std::string data(state.range(0), 'x');
+  std::string encoded(Base64(data).size(), '\0');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Base64(data, encoded.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64)->RangeMultiplier(8)->Range(16, 1 << 18);
+
+static void BM_Base64Decode(benchmark::State& state) {
+  std::string encoded = Base64(std::string(state.range(0), 'x'));
+  std::string decoded(encoded.size(), '\0');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Base64Decode(encoded, decoded.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Decode)->RangeMultiplier(8)->Range(16, 1 << 18);
+
+}  // namespace common
+
+namespace network {
+
+static void BM_WebsocketAccept(benchmark::State& state) {
+  char accept[websocketAcceptLength];
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ComputeWebsocketAccept("dGhlIHNhbXBsZSBub25jZQ==", accept));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WebsocketAccept);
+
+static void BM_WebsocketHandshake(benchmark::State& state) {
+  HttpRequest req;
+  req.method = HttpMethod::GET;
+  req.headers.emplace("upgrade", "websocket");
+  req.headers.emplace("connection", "Upgrade");
+  req.headers.emplace("sec-websocket-key", "dGhlIHNhbXBsZSBub25jZQ==");
+  req.headers.emplace("sec-websocket-version", "13");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(WebsocketHandshakeBuilder{req}.Build());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WebsocketHandshake);
+
+}  // namespace network
@@ -0,0 +1,135 @@
+#include "cache.hpp"
+#include <sstream>
+#include "common.hpp"
+
+namespace {
+
+// Without a root only absolute paths are opened as given, a relative one would resolve against the working directory.
+bool Unrooted(int root, std::string_view path) {
+  return root < 0 and path.starts_with('/');
+}
+
+}  // namespace
+
+namespace network {
+
+FileCache::FileCache(const FileCacheOptions& options) : options{options} {
+}
+
+std::shared_ptr<const CachedFile> FileCache::Get(std::string_view path) {
+  return Get(-1, path);
+}
+
+std::shared_ptr<const CachedFile> FileCache::Get(int root, std::string_view path) {
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard lock{cacheMut};
+  if (auto it = index.find(Key{root, path}); it != index.end()) {
+    auto entry = it->second;
+    entries.splice(entries.begin(), entries, entry);
+    if (now - entry->validated >= options.validity) {
+      Revalidate(*entry, now);
+    }
+    return entry->cached;
+  }
+  Entry entry;
+  entry.root = root;
+  entry.path = path;
+  entry.validated = now;
+  Load(entry);
+  if (options.capacity == 0) {
+    return entry.cached;
+  }
+  if (entries.size() >= options.capacity) {
+    index.erase(Key{entries.back().root, entries.back().path});
+    entries.pop_back();
+  }
+  entries.emplace_front(std::move(entry));
+  index.emplace(Key{entries.front().root, entries.front().path}, entries.begin());
+  return entries.front().cached;
+}
+
+void FileCache::Load(Entry& entry) const {
+  auto file = Unrooted(entry.root, entry.path) ? os::File{entry.path} : os::File{entry.root, entry.path};
+  if (not file.Ok()) {
+    entry.status = std::nullopt;
+    entry.cached = nullptr;
+    return;
+  }
+  entry.status = file.Status();
+  if (not entry.status->regular) {
+    entry.cached = nullptr;
+    return;
+  }
+  auto cached = std::make_shared<CachedFile>();
+  const auto& status = *entry.status;
+  std::stringstream etag;
+  etag << std::hex << "W/\"" << status.inode << "-" << status.size << "-" << status.modifiedTime << "\"";
+  cached->etag = etag.str();
+  cached->lastModified = common::HttpDate(status.modifiedTime / 1'000'000'000);
+  cached->headers = "Accept-Ranges: bytes\r\nContent-Length: " + std::to_string(file.Size()) + "\r\nETag: " +
+                    cached->etag + "\r\nLast-Modified: " + cached->lastModified + "\r\n";
+  cached->file = std::make_shared<const os::File>(std::move(file));
+  entry.cached = std::move(cached);
+}
+
+void FileCache::Revalidate(Entry& entry, std::chrono::steady_clock::time_point now) const {
+  entry.validated = now;
+  auto status = Unrooted(entry.root, entry.path) ? os::Status(entry.path) : os::Status(entry.root, entry.path);
+  if (status == entry.status) {
+    return;
+  }
+  Load(entry);
+}
+
+ResponseCache::ResponseCache(const ResponseCacheOptions& options) : options{options} {
+}
+
+bool ResponseCache::Cacheable(std::size_t fileSize) const {
+  return fileSize <= options.maxEntrySize and fileSize <= options.capacity;
+}
+
+std::shared_ptr<const std::string> ResponseCache::Get(int root, std::string_view path, std::string_view coding,
+    const os::FileStatus& status, const HttpHeaders& headers) {
+  std::lock_guard lock{cacheMut};
+  auto it = index.find(Key{root, path, coding});
+  if (it == index.end()) {
+    return nullptr;
+  }
+  auto entry = it->second;
+  if (entry->status != status or entry->headers != headers) {
+    Erase(entry);
+    return nullptr;
+  }
+  entries.splice(entries.begin(), entries, entry);
+  return entry->payload;
+}
+
+void ResponseCache::Put(int root, std::string_view path, std::string_view coding, const os::FileStatus& status,
+    const HttpHeaders& headers, std::shared_ptr<const std::string> payload) {
+  if (payload->size() > options.capacity) {
+    return;
+  }
+  std::lock_guard lock{cacheMut};
+  if (auto it = index.find(Key{root, path, coding}); it != index.end()) {
+    Erase(it->second);
+  }
+  while (size + payload->size() > options.capacity) {
+    Erase(std::prev(entries.end()));
+  }
+  size += payload->size();
+  entries.emplace_front(Entry{root, std::string{path}, std::string{coding}, status, headers, std::move(payload)});
+  index.emplace(Key{root, entries.front().path, entries.front().coding}, entries.begin());
+}
+
+std::size_t ResponseCache::Size() const {
+  std::lock_guard lock{cacheMut};
+  return size;
+}
+
+void ResponseCache::Erase(Entries::iterator entry) {
+  size -= entry->payload->size();
+  index.erase(Key{entry->root, entry->path, entry->coding});
+  entries.erase(entry);
+}
+
+}  // namespace network
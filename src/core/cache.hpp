@@ -0,0 +1,120 @@
+#pragma once
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "file.hpp"
+#include "network.hpp"
+
+namespace network {
+
+struct FileCacheOptions {
+  std::size_t capacity{1024};
+  std::chrono::milliseconds validity{1000};
+};
+
+struct CachedFile {
+  std::shared_ptr<const os::File> file;
+  std::string etag;
+  std::string lastModified;
+  std::string headers;
+};
+
+class FileCache {
+public:
+  FileCache() = default;
+  explicit FileCache(const FileCacheOptions&);
+  FileCache(const FileCache&) = delete;
+  FileCache(FileCache&&) = delete;
+  FileCache& operator=(const FileCache&) = delete;
+  FileCache& operator=(FileCache&&) = delete;
+  ~FileCache() = default;
+
+  std::shared_ptr<const CachedFile> Get(std::string_view);
+  std::shared_ptr<const CachedFile> Get(int, std::string_view);
+
+private:
+  using Key = std::pair<int, std::string_view>;
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const {
+      return std::hash<std::string_view>{}(key.second) ^ static_cast<std::size_t>(key.first);
+    }
+  };
+  struct Entry {
+    int root;
+    std::string path;
+    std::optional<os::FileStatus> status;
+    std::shared_ptr<const CachedFile> cached;
+    std::chrono::steady_clock::time_point validated;
+  };
+  using Entries = std::list<Entry>;
+
+  void Load(Entry&) const;
+  void Revalidate(Entry&, std::chrono::steady_clock::time_point) const;
+
+  FileCacheOptions options;
+  Entries entries;
+  std::unordered_map<Key, Entries::iterator, KeyHash> index;
+  std::mutex cacheMut;
+};
+
+struct ResponseCacheOptions {
+  std::size_t capacity{16 << 20};
+  std::size_t maxEntrySize{64 << 10};
+};
+
+class ResponseCache {
+public:
+  ResponseCache() = default;
+  explicit ResponseCache(const ResponseCacheOptions&);
+  ResponseCache(const ResponseCache&) = delete;
+  ResponseCache(ResponseCache&&) = delete;
+  ResponseCache& operator=(const ResponseCache&) = delete;
+  ResponseCache& operator=(ResponseCache&&) = delete;
+  ~ResponseCache() = default;
+
+  bool Cacheable(std::size_t) const;
+  // Entries are told apart by root, path and content coding, so that every representation of a file is kept.
+  std::shared_ptr<const std::string> Get(
+      int, std::string_view, std::string_view, const os::FileStatus&, const HttpHeaders&);
+  void Put(int, std::string_view, std::string_view, const os::FileStatus&, const HttpHeaders&,
+      std::shared_ptr<const std::string>);
+  std::size_t Size() const;
+
+private:
+  struct Key {
+    int root;
+    std::string_view path;
+    std::string_view coding;
+    bool operator==(const Key&) const = default;
+  };
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const {
+      return std::hash<std::string_view>{}(key.path) ^ std::hash<std::string_view>{}(key.coding) * 31 ^
+             static_cast<std::size_t>(key.root);
+    }
+  };
+  struct Entry {
+    int root;
+    std::string path;
+    std::string coding;
+    os::FileStatus status;
+    HttpHeaders headers;
+    std::shared_ptr<const std::string> payload;
+  };
+  using Entries = std::list<Entry>;
+
+  void Erase(Entries::iterator);
+
+  ResponseCacheOptions options;
+  Entries entries;
+  std::unordered_map<Key, Entries::iterator, KeyHash> index;
+  std::size_t size{0};
+  mutable std::mutex cacheMut;
+};
+
+}  // namespace network
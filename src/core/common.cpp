@@ -1,4 +1,14 @@
 #include "common.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <utility>
+#include "kernels.hpp"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace {
 
@@ -6,67 +16,108 @@ std::uint32_t LeftRotate(std::uint32_t a, std::uint8_t k) {
   return (a << k) | (a >> (32 - k));
 }
 
+int HexValue(char c) {
+  if (c >= '0' and c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' and c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' and c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
 }  // namespace
 
-namespace common {
+namespace common::kernels {
 
-char ToChar(std::uint64_t n) {
-  char c;
-  reinterpret_cast<std::uint8_t&>(c) = static_cast<std::uint8_t>(n & 0xff);
-  return c;
+void MaskPattern(const std::uint8_t (&key)[4], std::size_t offset, std::uint8_t (&pattern)[maskPatternLength]) {
+  for (std::size_t i = 0; i < 4; i++) {
+    pattern[i] = key[(offset + i) % 4];
+  }
+  for (std::size_t i = 4; i < sizeof pattern; i += 4) {
+    std::memcpy(pattern + i, pattern, 4);
+  }
 }
 
-void ToLower(std::string& s) {
-  for (char& c : s) {
-    c = static_cast<char>(tolower(c));
+void UnmaskWords(std::uint8_t* data, std::size_t len, const std::uint8_t* pattern) {
+  std::uint64_t key;
+  std::memcpy(&key, pattern, sizeof key);
+  std::size_t i = 0;
+  for (; i + sizeof key <= len; i += sizeof key) {
+    std::uint64_t word;
+    std::memcpy(&word, data + i, sizeof word);
+    word ^= key;
+    std::memcpy(data + i, &word, sizeof word);
+  }
+  for (; i < len; i++) {
+    data[i] ^= pattern[i % 4];
   }
 }
 
-std::string SHA1(std::string_view s) {
-  std::string payload{s};
-  std::uint32_t h0 = 0x67452301;
-  std::uint32_t h1 = 0xEFCDAB89;
-  std::uint32_t h2 = 0x98BADCFE;
-  std::uint32_t h3 = 0x10325476;
-  std::uint32_t h4 = 0xC3D2E1F0;
-
-  std::uint64_t ml = payload.size();
-  std::uint64_t padLen = (56 - ((ml + 1) % 64) + 64) % 64;
-  payload.reserve(ml + padLen + 8);
-  payload += ToChar(0x80);
-  for (std::uint64_t i = 0; i < padLen; i++) {
-    payload += ToChar(0);
-  }
-  ml <<= 3;
-  payload += ToChar(ml >> 56);
-  payload += ToChar(ml >> 48);
-  payload += ToChar(ml >> 40);
-  payload += ToChar(ml >> 32);
-  payload += ToChar(ml >> 24);
-  payload += ToChar(ml >> 16);
-  payload += ToChar(ml >> 8);
-  payload += ToChar(ml >> 0);
-
-  std::uint64_t len = payload.size();
-  std::uint8_t* p = reinterpret_cast<std::uint8_t*>(payload.data());
-  for (std::uint64_t chunk = 0; chunk < len; chunk += 64) {
-    std::uint32_t w[80] = {0};
+#if defined(__x86_64__)
+void UnmaskSse2(std::uint8_t* data, std::size_t len, const std::uint8_t* pattern) {
+  const __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+  std::size_t i = 0;
+  for (; i + sizeof key <= len; i += sizeof key) {
+    auto* p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key));
+  }
+  UnmaskWords(data + i, len - i, pattern);
+}
+
+__attribute__((target("avx2"))) void UnmaskAvx2(std::uint8_t* data, std::size_t len, const std::uint8_t* pattern) {
+  const __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern));
+  std::size_t i = 0;
+  for (; i + sizeof key <= len; i += sizeof key) {
+    auto* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), key));
+  }
+  UnmaskSse2(data + i, len - i, pattern);
+}
+#endif
+
+}  // namespace common::kernels
+
+namespace {
+
+using UnmaskImpl = void (*)(std::uint8_t*, std::size_t, const std::uint8_t*);
+
+UnmaskImpl SelectUnmask() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return common::kernels::UnmaskAvx2;
+  }
+  return common::kernels::UnmaskSse2;
+#else
+  return common::kernels::UnmaskWords;
+#endif
+}
+
+using Sha1Impl = void (*)(std::uint32_t*, const std::uint8_t*, std::size_t);
+
+}  // namespace
+
+namespace common::kernels {
+
+void Sha1Scalar(std::uint32_t* state, const std::uint8_t* data, std::size_t blocks) {
+  for (; blocks > 0; blocks--, data += 64) {
+    std::uint32_t w[80];
     for (int i = 0; i < 16; i++) {
-      int x = i * 4;
-      w[i] |= p[chunk + x] << 24;
-      w[i] |= p[chunk + x + 1] << 16;
-      w[i] |= p[chunk + x + 2] << 8;
-      w[i] |= p[chunk + x + 3];
+      w[i] = data[i * 4] << 24 | data[i * 4 + 1] << 16 | data[i * 4 + 2] << 8 | data[i * 4 + 3];
     }
     for (int i = 16; i < 80; i++) {
       w[i] = LeftRotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
     }
 
-    std::uint32_t a = h0;
-    std::uint32_t b = h1;
-    std::uint32_t c = h2;
-    std::uint32_t d = h3;
-    std::uint32_t e = h4;
+    std::uint32_t a = state[0];
+    std::uint32_t b = state[1];
+    std::uint32_t c = state[2];
+    std::uint32_t d = state[3];
+    std::uint32_t e = state[4];
 
     for (int i = 0; i < 80; i++) {
       std::uint32_t f = 0, k = 0;
@@ -91,76 +142,454 @@ std::string SHA1(std::string_view s) {
       a = temp;
     }
 
-    h0 = h0 + a;
-    h1 = h1 + b;
-    h2 = h2 + c;
-    h3 = h3 + d;
-    h4 = h4 + e;
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
   }
+}
 
-  constexpr std::uint32_t shaDigestLen = 20;
-  char r[shaDigestLen];
-  r[0] = ToChar(h0 >> 24);
-  r[1] = ToChar(h0 >> 16);
-  r[2] = ToChar(h0 >> 8);
-  r[3] = ToChar(h0 >> 0);
+}  // namespace common::kernels
 
-  r[4] = ToChar(h1 >> 24);
-  r[5] = ToChar(h1 >> 16);
-  r[6] = ToChar(h1 >> 8);
-  r[7] = ToChar(h1 >> 0);
+namespace {
 
-  r[8] = ToChar(h2 >> 24);
-  r[9] = ToChar(h2 >> 16);
-  r[10] = ToChar(h2 >> 8);
-  r[11] = ToChar(h2 >> 0);
+#if defined(__x86_64__)
+// Four rounds of SHA-1 with the SHA extensions. Group g consumes schedule word msg[g % 4] and already prepares
+// the words the following groups need, e alternates between the two E registers.
+template <int g>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void Sha1NiRounds(
+    __m128i& abcd, __m128i (&e)[2], __m128i (&msg)[4], const std::uint8_t* data, __m128i byteSwap) {
+  if constexpr (g < 4) {
+    msg[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + g * 16)), byteSwap);
+  }
+  auto& w = msg[g % 4];
+  auto& current = e[g % 2];
+  if constexpr (g == 0) {
+    current = _mm_add_epi32(current, w);
+  } else {
+    current = _mm_sha1nexte_epu32(current, w);
+  }
+  e[(g + 1) % 2] = abcd;
+  if constexpr (g >= 3 and g <= 18) {
+    msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], w);
+  }
+  abcd = _mm_sha1rnds4_epu32(abcd, current, g / 5);
+  if constexpr (g >= 1 and g <= 16) {
+    msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], w);
+  }
+  if constexpr (g >= 2 and g <= 17) {
+    msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], w);
+  }
+}
+
+template <int... g>
+__attribute__((target("sha,sse4.1"))) void Sha1NiBlocks(
+    std::uint32_t* state, const std::uint8_t* data, std::size_t blocks, std::integer_sequence<int, g...>) {
+  const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607, 0x08090a0b0c0d0e0f);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1b);
+  __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+  for (; blocks > 0; blocks--, data += 64) {
+    const __m128i abcdSaved = abcd;
+    __m128i e[2] = {e0, _mm_setzero_si128()};
+    __m128i msg[4];
+    (Sha1NiRounds<g>(abcd, e, msg, data, byteSwap), ...);
+    e0 = _mm_sha1nexte_epu32(e[0], e0);
+    abcd = _mm_add_epi32(abcd, abcdSaved);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = static_cast<std::uint32_t>(_mm_extract_epi32(e0, 3));
+}
 
-  r[12] = ToChar(h3 >> 24);
-  r[13] = ToChar(h3 >> 16);
-  r[14] = ToChar(h3 >> 8);
-  r[15] = ToChar(h3 >> 0);
+}  // namespace
 
-  r[16] = ToChar(h4 >> 24);
-  r[17] = ToChar(h4 >> 16);
-  r[18] = ToChar(h4 >> 8);
-  r[19] = ToChar(h4 >> 0);
+namespace common::kernels {
 
-  return std::string{r, r + shaDigestLen};
+void Sha1Ni(std::uint32_t* state, const std::uint8_t* data, std::size_t blocks) {
+  Sha1NiBlocks(state, data, blocks, std::make_integer_sequence<int, 20>{});
 }
 
-std::string Base64(std::string_view payload) {
-  const char* alpha =
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-      "abcdefghijklmnopqrstuvwxyz"
-      "0123456789+/";
-  size_t len = payload.size();
-  const unsigned char* p = reinterpret_cast<const unsigned char*>(payload.data());
-  std::string result;
-  while (len >= 3) {
-    std::uint32_t d = p[0] << 16 | p[1] << 8 | p[2];
-    result += alpha[d >> 18 & 0b111111];
-    result += alpha[d >> 12 & 0b111111];
-    result += alpha[d >> 6 & 0b111111];
-    result += alpha[d & 0b111111];
-    p += 3;
-    len -= 3;
+}  // namespace common::kernels
+
+namespace {
+#endif
+
+Sha1Impl SelectSha1() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sha") and __builtin_cpu_supports("sse4.1")) {
+    return common::kernels::Sha1Ni;
+  }
+#endif
+  return common::kernels::Sha1Scalar;
+}
+
+constexpr char base64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+constexpr std::uint8_t base64Invalid = 0xff;
+
+constexpr auto base64Values = [] {
+  std::array<std::uint8_t, 256> values{};
+  values.fill(base64Invalid);
+  for (std::uint8_t i = 0; i < 64; i++) {
+    values[static_cast<std::uint8_t>(base64Alphabet[i])] = i;
+  }
+  return values;
+}();
+
+// Encoders and decoders handle as much of the input as they can and return how many bytes they consumed, the
+// scalar versions then finish the rest including the padding.
+using Base64EncodeImpl = std::size_t (*)(const std::uint8_t*, std::size_t, char*);
+using Base64DecodeImpl = std::size_t (*)(const char*, std::size_t, std::uint8_t*);
+
+}  // namespace
+
+namespace common::kernels {
+
+std::size_t Base64EncodeScalar(const std::uint8_t* p, std::size_t len, char* out) {
+  std::size_t i = 0;
+  for (; i + 3 <= len; i += 3) {
+    std::uint32_t d = p[i] << 16 | p[i + 1] << 8 | p[i + 2];
+    *out++ = base64Alphabet[d >> 18 & 0b111111];
+    *out++ = base64Alphabet[d >> 12 & 0b111111];
+    *out++ = base64Alphabet[d >> 6 & 0b111111];
+    *out++ = base64Alphabet[d & 0b111111];
+  }
+  return i;
+}
+
+std::size_t Base64DecodeScalar(const char* p, std::size_t len, std::uint8_t* out) {
+  std::size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    std::uint32_t a = base64Values[static_cast<std::uint8_t>(p[i])];
+    std::uint32_t b = base64Values[static_cast<std::uint8_t>(p[i + 1])];
+    std::uint32_t c = base64Values[static_cast<std::uint8_t>(p[i + 2])];
+    std::uint32_t d = base64Values[static_cast<std::uint8_t>(p[i + 3])];
+    if ((a | b | c | d) == base64Invalid) {
+      break;
+    }
+    std::uint32_t n = a << 18 | b << 12 | c << 6 | d;
+    *out++ = static_cast<std::uint8_t>(n >> 16);
+    *out++ = static_cast<std::uint8_t>(n >> 8);
+    *out++ = static_cast<std::uint8_t>(n);
+  }
+  return i;
+}
+
+#if defined(__x86_64__)
+// Vectorised base64 after Wojciech Muła and Daniel Lemire: 12 bytes become 16 characters per step and back.
+__attribute__((target("ssse3"))) std::size_t Base64EncodeSsse3(const std::uint8_t* p, std::size_t len, char* out) {
+  const __m128i split = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i offsets =
+      _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+          '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  std::size_t i = 0;
+  for (; i + 16 <= len; i += 12, out += 16) {
+    __m128i in = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), split);
+    const __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    const __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(high, low);
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    const __m128i encoded = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encoded);
   }
+  return i;
+}
+
+__attribute__((target("ssse3"))) std::size_t Base64DecodeSsse3(const char* p, std::size_t len, std::uint8_t* out) {
+  const __m128i lowBits = _mm_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i highBits = _mm_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i rolls = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  std::size_t i = 0;
+  for (; i + 16 <= len; i += 16, out += 12) {
+    const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    const __m128i high = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+    const __m128i invalid = _mm_and_si128(
+        _mm_shuffle_epi8(lowBits, _mm_and_si128(in, nibble)), _mm_shuffle_epi8(highBits, high));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128())) != 0) {
+      break;
+    }
+    const __m128i roll = _mm_shuffle_epi8(rolls, _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), high));
+    const __m128i values = _mm_add_epi8(in, roll);
+    const __m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)),
+        _mm_set1_epi32(0x00011000));
+    std::uint8_t decoded[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(decoded), _mm_shuffle_epi8(merged, pack));
+    std::memcpy(out, decoded, 12);
+  }
+  return i;
+}
+#endif
+
+}  // namespace common::kernels
+
+namespace {
+
+Base64EncodeImpl SelectBase64Encode() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return common::kernels::Base64EncodeSsse3;
+  }
+#endif
+  return common::kernels::Base64EncodeScalar;
+}
+
+Base64DecodeImpl SelectBase64Decode() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return common::kernels::Base64DecodeSsse3;
+  }
+#endif
+  return common::kernels::Base64DecodeScalar;
+}
+
+}  // namespace
+
+namespace common {
+
+char ToChar(std::uint64_t n) {
+  char c;
+  reinterpret_cast<std::uint8_t&>(c) = static_cast<std::uint8_t>(n & 0xff);
+  return c;
+}
+
+void ToLower(std::string& s) {
+  for (char& c : s) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+}
+
+std::string_view Trim(std::string_view s) {
+  while (not s.empty() and (s.front() == ' ' or s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while (not s.empty() and (s.back() == ' ' or s.back() == '\t')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+SHA1Hasher::SHA1Hasher() : state{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0} {
+}
+
+void SHA1Hasher::Update(std::string_view s) {
+  static const Sha1Impl impl = SelectSha1();
+  const auto* p = reinterpret_cast<const std::uint8_t*>(s.data());
+  std::size_t len = s.size();
+  length += len;
+  if (buffered > 0) {
+    const std::size_t n = std::min(len, sizeof block - buffered);
+    std::memcpy(block + buffered, p, n);
+    buffered += n;
+    p += n;
+    len -= n;
+    if (buffered < sizeof block) {
+      return;
+    }
+    impl(state, block, 1);
+    buffered = 0;
+  }
+  if (len >= sizeof block) {
+    impl(state, p, len / sizeof block);
+    p += len / sizeof block * sizeof block;
+    len %= sizeof block;
+  }
+  std::memcpy(block, p, len);
+  buffered = len;
+}
+
+void SHA1Hasher::Final(char (&digest)[sha1DigestLength]) {
+  const std::uint64_t bits = length << 3;
+  const std::uint8_t pad[64] = {0x80};
+  Update({reinterpret_cast<const char*>(pad), (sizeof block * 2 - 9 - buffered) % sizeof block + 1});
+  char encodedLength[8];
+  for (int i = 0; i < 8; i++) {
+    encodedLength[i] = ToChar(bits >> (56 - i * 8));
+  }
+  Update({encodedLength, sizeof encodedLength});
+  for (std::size_t i = 0; i < sha1DigestLength; i++) {
+    digest[i] = ToChar(state[i / 4] >> (24 - i % 4 * 8));
+  }
+}
+
+void SHA1(std::string_view s, char (&digest)[sha1DigestLength]) {
+  SHA1Hasher hasher;
+  hasher.Update(s);
+  hasher.Final(digest);
+}
+
+std::string SHA1(std::string_view s) {
+  char digest[sha1DigestLength];
+  SHA1(s, digest);
+  return {digest, sizeof digest};
+}
+
+std::size_t Base64(std::string_view payload, char* out) {
+  static const Base64EncodeImpl impl = SelectBase64Encode();
+  const auto* p = reinterpret_cast<const std::uint8_t*>(payload.data());
+  std::size_t len = payload.size();
+  char* begin = out;
+  std::size_t done = impl(p, len, out);
+  done += kernels::Base64EncodeScalar(p + done, len - done, out + done / 3 * 4);
+  out += done / 3 * 4;
+  p += done;
+  len -= done;
   if (len > 1) {
     std::uint32_t d = p[0] << 16 | p[1] << 8;
-    result += alpha[d >> 18 & 0b111111];
-    result += alpha[d >> 12 & 0b111111];
-    result += alpha[d >> 6 & 0b111111];
-    result += '=';
-    return result;
-  }
-  if (len > 0) {
+    *out++ = base64Alphabet[d >> 18 & 0b111111];
+    *out++ = base64Alphabet[d >> 12 & 0b111111];
+    *out++ = base64Alphabet[d >> 6 & 0b111111];
+    *out++ = '=';
+  } else if (len > 0) {
     std::uint32_t d = p[0] << 16;
-    result += alpha[d >> 18 & 0b111111];
-    result += alpha[d >> 12 & 0b111111];
-    result += "==";
-    return result;
+    *out++ = base64Alphabet[d >> 18 & 0b111111];
+    *out++ = base64Alphabet[d >> 12 & 0b111111];
+    *out++ = '=';
+    *out++ = '=';
+  }
+  return out - begin;
+}
+
+std::string Base64(std::string_view payload) {
+  std::string result;
+  result.resize((payload.size() + 2) / 3 * 4);
+  Base64(payload, result.data());
+  return result;
+}
+
+std::optional<std::size_t> Base64Decode(std::string_view encoded, char* out) {
+  static const Base64DecodeImpl impl = SelectBase64Decode();
+  if (encoded.size() % 4 != 0) {
+    return std::nullopt;
+  }
+  std::size_t padding = 0;
+  if (encoded.ends_with("==")) {
+    padding = 2;
+  } else if (encoded.ends_with("=")) {
+    padding = 1;
+  }
+  auto* decoded = reinterpret_cast<std::uint8_t*>(out);
+  const std::size_t full = encoded.size() - (padding > 0 ? 4 : 0);
+  std::size_t done = impl(encoded.data(), full, decoded);
+  done += kernels::Base64DecodeScalar(encoded.data() + done, full - done, decoded + done / 4 * 3);
+  if (done != full) {
+    return std::nullopt;
+  }
+  std::size_t length = done / 4 * 3;
+  if (padding == 0) {
+    return length;
+  }
+  char last[4] = {encoded[full], encoded[full + 1], padding == 2 ? 'A' : encoded[full + 2], 'A'};
+  std::uint8_t tail[3];
+  if (kernels::Base64DecodeScalar(last, sizeof last, tail) != sizeof last) {
+    return std::nullopt;
+  }
+  std::memcpy(decoded + length, tail, 3 - padding);
+  return length + 3 - padding;
+}
+
+std::string PercentDecode(std::string_view s) {
+  std::string result;
+  result.reserve(s.size());
+  const char* p = s.data();
+  const char* end = p + s.size();
+  while (p < end) {
+    const char* escape = static_cast<const char*>(memchr(p, '%', end - p));
+    if (escape == nullptr) {
+      result.append(p, end);
+      break;
+    }
+    result.append(p, escape);
+    int hi = escape + 2 < end ? HexValue(escape[1]) : -1;
+    int lo = hi >= 0 ? HexValue(escape[2]) : -1;
+    if (lo < 0) {
+      result += '%';
+      p = escape + 1;
+      continue;
+    }
+    result += ToChar(hi << 4 | lo);
+    p = escape + 3;
   }
   return result;
 }
 
+std::string HttpDate(std::int64_t seconds) {
+  const std::time_t t = seconds;
+  std::tm tm;
+  gmtime_r(&t, &tm);
+  char buf[32];
+  size_t n = std::strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return {buf, n};
+}
+
+std::optional<std::int64_t> ParseHttpDate(std::string_view date) {
+  const std::string s{date};
+  std::tm tm{};
+  const char* end = strptime(s.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (not end or *end != '\0') {
+    return std::nullopt;
+  }
+  return timegm(&tm);
+}
+
+void Unmask(char* data, std::size_t len, const std::uint8_t (&key)[4], std::size_t offset) {
+  static const UnmaskImpl impl = SelectUnmask();
+  std::uint8_t pattern[kernels::maskPatternLength];
+  kernels::MaskPattern(key, offset, pattern);
+  impl(reinterpret_cast<std::uint8_t*>(data), len, pattern);
+}
+
+bool Utf8Validator::Update(std::string_view data) {
+  std::size_t i = 0;
+  while (i < data.size()) {
+    if (pending == 0) {
+      std::uint64_t word;
+      if (data.size() - i >= sizeof word) {
+        std::memcpy(&word, data.data() + i, sizeof word);
+        if ((word & 0x8080808080808080) == 0) {
+          i += sizeof word;
+          continue;
+        }
+      }
+    }
+    const auto c = static_cast<std::uint8_t>(data[i++]);
+    if (pending > 0) {
+      if (c < lower or c > upper) {
+        return false;
+      }
+      lower = 0x80;
+      upper = 0xbf;
+      pending--;
+    } else if (c >= 0xc2 and c <= 0xdf) {
+      pending = 1;
+    } else if (c >= 0xe0 and c <= 0xef) {
+      // Overlong forms and UTF-16 surrogates are excluded through the range of the first continuation byte.
+      pending = 2;
+      lower = c == 0xe0 ? 0xa0 : 0x80;
+      upper = c == 0xed ? 0x9f : 0xbf;
+    } else if (c >= 0xf0 and c <= 0xf4) {
+      pending = 3;
+      lower = c == 0xf0 ? 0x90 : 0x80;
+      upper = c == 0xf4 ? 0x8f : 0xbf;
+    } else if (c >= 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Utf8Validator::Complete() const {
+  return pending == 0;
+}
+
 }  // namespace common
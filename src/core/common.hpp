@@ -1,6 +1,9 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 
 namespace common {
 
@@ -8,8 +11,53 @@ char ToChar(std::uint64_t);
 
 void ToLower(std::string&);
 
+std::string_view Trim(std::string_view);
+
+constexpr std::size_t sha1DigestLength = 20;
+
+class SHA1Hasher {
+public:
+  SHA1Hasher();
+  void Update(std::string_view);
+  void Final(char (&)[sha1DigestLength]);
+
+private:
+  std::uint32_t state[5];
+  std::uint8_t block[64];
+  std::size_t buffered{0};
+  std::uint64_t length{0};
+};
+
+void SHA1(std::string_view, char (&)[sha1DigestLength]);
+
 std::string SHA1(std::string_view);
 
+// Writes 4 * ceil(n / 3) characters and returns how many were written.
+std::size_t Base64(std::string_view, char*);
+
 std::string Base64(std::string_view);
 
+// Expects padded input and room for 3 * n / 4 bytes, returns the decoded length or nullopt on malformed input.
+std::optional<std::size_t> Base64Decode(std::string_view, char*);
+
+std::string PercentDecode(std::string_view);
+
+std::string HttpDate(std::int64_t);
+
+std::optional<std::int64_t> ParseHttpDate(std::string_view);
+
+void Unmask(char*, std::size_t, const std::uint8_t (&)[4], std::size_t = 0);
+
+// Checks UTF-8 piece by piece, so that a sequence split between two pieces is still judged as a whole.
+class Utf8Validator {
+public:
+  bool Update(std::string_view);
+  bool Complete() const;
+
+private:
+  int pending{0};
+  std::uint8_t lower{0x80};
+  std::uint8_t upper{0xbf};
+};
+
 }  // namespace common
@@ -0,0 +1,189 @@
+#include "compression.hpp"
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+namespace {
+
+int WindowBitsOf(network::HttpContentCoding coding) {
+  return coding == network::HttpContentCoding::Gzip ? MAX_WBITS + 16 : MAX_WBITS;
+}
+
+}  // namespace
+
+namespace network {
+
+std::string_view ContentEncodingOf(HttpContentCoding coding) {
+  switch (coding) {
+    case HttpContentCoding::Gzip:
+      return "gzip";
+    case HttpContentCoding::Deflate:
+      return "deflate";
+  }
+  return "";
+}
+
+Deflater::Deflater(HttpContentCoding coding, int level) : stream{std::make_unique<z_stream>()} {
+  Init(WindowBitsOf(coding), level);
+}
+
+Deflater::Deflater(int windowBits, int level) : stream{std::make_unique<z_stream>()} {
+  Init(-windowBits, level);
+}
+
+void Deflater::Init(int windowBits, int level) {
+  int r = deflateInit2(stream.get(), level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+  if (r != Z_OK) {
+    spdlog::error("zlib deflateInit2(): {}", r);
+    return;
+  }
+  ok = true;
+}
+
+Deflater::~Deflater() {
+  if (ok) {
+    deflateEnd(stream.get());
+  }
+}
+
+bool Deflater::Ok() const {
+  return ok;
+}
+
+std::string Deflater::Compress(std::string_view input, bool finish) {
+  std::string output;
+  if (not ok) {
+    return output;
+  }
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream->avail_in = static_cast<uInt>(input.size());
+  const int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+  size_t produced = 0;
+  do {
+    output.resize(produced + deflateBound(stream.get(), stream->avail_in) + 64);
+    stream->next_out = reinterpret_cast<Bytef*>(output.data() + produced);
+    stream->avail_out = static_cast<uInt>(output.size() - produced);
+    int r = deflate(stream.get(), flush);
+    if (r == Z_STREAM_ERROR) {
+      spdlog::error("zlib deflate(): {}", r);
+      ok = false;
+      return {};
+    }
+    produced = output.size() - stream->avail_out;
+  } while (stream->avail_out == 0);
+  output.resize(produced);
+  if (finish) {
+    deflateEnd(stream.get());
+    ok = false;
+  }
+  return output;
+}
+
+Inflater::Inflater(int windowBits) : stream{std::make_unique<z_stream>()} {
+  int r = inflateInit2(stream.get(), -windowBits);
+  if (r != Z_OK) {
+    spdlog::error("zlib inflateInit2(): {}", r);
+    return;
+  }
+  ok = true;
+}
+
+Inflater::~Inflater() {
+  if (ok) {
+    inflateEnd(stream.get());
+  }
+}
+
+bool Inflater::Ok() const {
+  return ok;
+}
+
+std::optional<std::string> Inflater::Decompress(std::string_view input, std::size_t limit) {
+  if (not ok) {
+    return std::nullopt;
+  }
+  constexpr size_t chunk = 16 << 10;
+  std::string output;
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream->avail_in = static_cast<uInt>(input.size());
+  size_t produced = 0;
+  do {
+    output.resize(produced + chunk);
+    stream->next_out = reinterpret_cast<Bytef*>(output.data() + produced);
+    stream->avail_out = static_cast<uInt>(chunk);
+    int r = inflate(stream.get(), Z_SYNC_FLUSH);
+    produced = output.size() - stream->avail_out;
+    if (r == Z_STREAM_END) {
+      inflateReset(stream.get());
+    } else if (r != Z_OK and r != Z_BUF_ERROR) {
+      spdlog::debug("zlib inflate(): {}", r);
+      ok = false;
+      return std::nullopt;
+    }
+    if (produced > limit) {
+      return std::nullopt;
+    }
+  } while (stream->avail_out == 0 or stream->avail_in > 0);
+  output.resize(produced);
+  return output;
+}
+
+std::optional<std::string> Compress(std::string_view input, HttpContentCoding coding, int level) {
+  Deflater deflater{coding, level};
+  if (not deflater.Ok()) {
+    return std::nullopt;
+  }
+  return deflater.Compress(input, true);
+}
+
+CompressionCache::CompressionCache(const CompressionCacheOptions& options) : options{options} {
+}
+
+std::optional<std::string> CompressionCache::Compress(std::string_view input, HttpContentCoding coding, int level) {
+  if (input.size() > options.maxEntrySize) {
+    return network::Compress(input, coding, level);
+  }
+  const Key key{std::hash<std::string_view>{}(input), coding, level};
+  {
+    std::lock_guard lock{cacheMut};
+    if (auto it = index.find(key); it != index.end()) {
+      auto entry = it->second;
+      if (entry->content == input) {
+        entries.splice(entries.begin(), entries, entry);
+        return entry->compressed;
+      }
+      Erase(entry);
+    }
+  }
+  auto compressed = network::Compress(input, coding, level);
+  if (not compressed) {
+    return std::nullopt;
+  }
+  const size_t entrySize = input.size() + compressed->size();
+  if (entrySize > options.capacity) {
+    return compressed;
+  }
+  std::lock_guard lock{cacheMut};
+  if (auto it = index.find(key); it != index.end()) {
+    Erase(it->second);
+  }
+  while (size + entrySize > options.capacity) {
+    Erase(std::prev(entries.end()));
+  }
+  size += entrySize;
+  entries.emplace_front(Entry{key, std::string{input}, *compressed});
+  index.emplace(key, entries.begin());
+  return compressed;
+}
+
+std::size_t CompressionCache::Size() const {
+  std::lock_guard lock{cacheMut};
+  return size;
+}
+
+void CompressionCache::Erase(Entries::iterator entry) {
+  size -= entry->content.size() + entry->compressed.size();
+  index.erase(entry->key);
+  entries.erase(entry);
+}
+
+}  // namespace network
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include "network.hpp"
+
+struct z_stream_s;
+
+namespace network {
+
+enum class HttpContentCoding { Gzip, Deflate };
+
+std::string_view ContentEncodingOf(HttpContentCoding);
+
+class Deflater {
+public:
+  Deflater(HttpContentCoding, int);
+  // Raw DEFLATE stream without zlib or gzip framing, as used by permessage-deflate.
+  Deflater(int windowBits, int level);
+  Deflater(const Deflater&) = delete;
+  Deflater(Deflater&&) = delete;
+  Deflater& operator=(const Deflater&) = delete;
+  Deflater& operator=(Deflater&&) = delete;
+  ~Deflater();
+
+  bool Ok() const;
+  std::string Compress(std::string_view, bool);
+
+private:
+  void Init(int windowBits, int level);
+
+  std::unique_ptr<z_stream_s> stream;
+  bool ok{false};
+};
+
+class Inflater {
+public:
+  explicit Inflater(int windowBits);
+  Inflater(const Inflater&) = delete;
+  Inflater(Inflater&&) = delete;
+  Inflater& operator=(const Inflater&) = delete;
+  Inflater& operator=(Inflater&&) = delete;
+  ~Inflater();
+
+  bool Ok() const;
+  std::optional<std::string> Decompress(std::string_view, std::size_t);
+
+private:
+  std::unique_ptr<z_stream_s> stream;
+  bool ok{false};
+};
+
+std::optional<std::string> Compress(std::string_view, HttpContentCoding, int);
+
+struct CompressionCacheOptions {
+  std::size_t capacity{4 << 20};
+  std::size_t maxEntrySize{256 << 10};
+};
+
+class CompressionCache {
+public:
+  CompressionCache() = default;
+  explicit CompressionCache(const CompressionCacheOptions&);
+  CompressionCache(const CompressionCache&) = delete;
+  CompressionCache(CompressionCache&&) = delete;
+  CompressionCache& operator=(const CompressionCache&) = delete;
+  CompressionCache& operator=(CompressionCache&&) = delete;
+  ~CompressionCache() = default;
+
+  std::optional<std::string> Compress(std::string_view, HttpContentCoding, int);
+  std::size_t Size() const;
+
+private:
+  using Key = std::tuple<std::size_t, HttpContentCoding, int>;
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const {
+      return std::get<0>(key) ^ (static_cast<std::size_t>(std::get<1>(key)) << 4) ^ std::get<2>(key);
+    }
+  };
+  struct Entry {
+    Key key;
+    std::string content;
+    std::string compressed;
+  };
+  using Entries = std::list<Entry>;
+
+  void Erase(Entries::iterator);
+
+  CompressionCacheOptions options;
+  Entries entries;
+  std::unordered_map<Key, Entries::iterator, KeyHash> index;
+  std::size_t size{0};
+  mutable std::mutex cacheMut;
+};
+
+}  // namespace network
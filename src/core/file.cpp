@@ -1,18 +1,131 @@
 #include "file.hpp"
 #include <fcntl.h>
+#include <linux/openat2.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <atomic>
+#include <cerrno>
 #include <string>
 
+namespace {
+
+os::FileStatus ToFileStatus(const struct stat& statbuf) {
+  os::FileStatus status;
+  status.size = statbuf.st_size;
+  status.modifiedTime = statbuf.st_mtim.tv_sec * 1'000'000'000LL + statbuf.st_mtim.tv_nsec;
+  status.inode = statbuf.st_ino;
+  status.device = statbuf.st_dev;
+  status.regular = S_ISREG(statbuf.st_mode);
+  return status;
+}
+
+std::atomic<bool> openat2Supported{true};
+
+int OpenBeneathByComponents(int dirFd, std::string_view path, int flags) {
+  int current = dirFd;
+  while (true) {
+    auto start = path.find_first_not_of('/');
+    path = start == path.npos ? std::string_view{} : path.substr(start);
+    auto slash = path.find('/');
+    const std::string component{path.substr(0, slash)};
+    path = slash == path.npos ? std::string_view{} : path.substr(slash);
+    const bool last = path.find_first_not_of('/') == path.npos;
+    int fd = -1;
+    if (component == "..") {
+      errno = EXDEV;
+    } else {
+      const int componentFlags = last ? flags | O_NOFOLLOW | O_CLOEXEC : O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+      fd = openat(current, component.empty() ? "." : component.c_str(), componentFlags);
+    }
+    if (current != dirFd) {
+      close(current);
+    }
+    if (fd < 0 or last) {
+      return fd;
+    }
+    current = fd;
+  }
+}
+
+int OpenBeneath(int dirFd, std::string_view path, int flags) {
+  const std::string s{path};
+  if (openat2Supported.load(std::memory_order_relaxed)) {
+    struct open_how how {};
+    how.flags = flags | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd = syscall(SYS_openat2, dirFd, s.c_str(), &how, sizeof how);
+    if (fd >= 0 or (errno != ENOSYS and errno != EPERM)) {
+      return fd;
+    }
+    openat2Supported.store(false, std::memory_order_relaxed);
+  }
+  return OpenBeneathByComponents(dirFd, path, flags);
+}
+
+}  // namespace
+
 namespace os {
 
+std::optional<FileStatus> Status(std::string_view filename) {
+  const std::string s{filename};
+  struct stat statbuf;
+  if (stat(s.c_str(), &statbuf) < 0) {
+    return std::nullopt;
+  }
+  return ToFileStatus(statbuf);
+}
+
+std::optional<FileStatus> Status(int dirFd, std::string_view filename) {
+  // Resolved the same way File does, so the status is never that of a file outside the directory.
+  const int fd = OpenBeneath(dirFd, filename, O_PATH);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat statbuf;
+  const int r = fstat(fd, &statbuf);
+  close(fd);
+  if (r < 0) {
+    return std::nullopt;
+  }
+  return ToFileStatus(statbuf);
+}
+
+Directory::Directory(std::string_view dirname) {
+  const std::string s{dirname};
+  fd = open(s.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+Directory::~Directory() {
+  if (Ok()) {
+    close(fd);
+  }
+}
+
+int Directory::Fd() const {
+  return fd;
+}
+
+bool Directory::Ok() const {
+  return fd >= 0;
+}
+
 File::File(std::string_view filename) {
   const std::string s{filename};
   fd = open(s.c_str(), O_RDONLY);
   if (Ok()) {
     struct stat statbuf;
     fstat(fd, &statbuf);
-    size = statbuf.st_size;
+    status = ToFileStatus(statbuf);
+  }
+}
+
+File::File(int dirFd, std::string_view filename) {
+  fd = OpenBeneath(dirFd, filename, O_RDONLY);
+  if (Ok()) {
+    struct stat statbuf;
+    fstat(fd, &statbuf);
+    status = ToFileStatus(statbuf);
   }
 }
 
@@ -28,9 +141,9 @@ File::File(File&& f) {
 
 File& File::operator=(File&& f) {
   fd = f.fd;
-  size = f.size;
+  status = f.status;
   f.fd = -1;
-  f.size = 0;
+  f.status = {};
   return *this;
 }
 
@@ -39,7 +152,30 @@ int File::Fd() const {
 }
 
 size_t File::Size() const {
-  return size;
+  return status.size;
+}
+
+const FileStatus& File::Status() const {
+  return status;
+}
+
+std::optional<std::string> File::Read() const {
+  if (not Ok()) {
+    return std::nullopt;
+  }
+  std::string content(status.size, '\0');
+  size_t offset = 0;
+  while (offset < content.size()) {
+    ssize_t r = pread(fd, content.data() + offset, content.size() - offset, offset);
+    if (r < 0 and errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return std::nullopt;
+    }
+    offset += r;
+  }
+  return content;
 }
 
 bool File::Ok() const {
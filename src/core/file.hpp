@@ -1,11 +1,44 @@
 #pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
 #include <string_view>
 
 namespace os {
 
+struct FileStatus {
+  std::size_t size{0};
+  std::int64_t modifiedTime{0};
+  std::uint64_t inode{0};
+  std::uint64_t device{0};
+  bool regular{false};
+
+  bool operator==(const FileStatus&) const = default;
+};
+
+std::optional<FileStatus> Status(std::string_view);
+std::optional<FileStatus> Status(int, std::string_view);
+
+class Directory {
+public:
+  explicit Directory(std::string_view);
+  ~Directory();
+  Directory(const Directory&) = delete;
+  Directory(Directory&&) = delete;
+  Directory& operator=(const Directory&) = delete;
+  Directory& operator=(Directory&&) = delete;
+
+  int Fd() const;
+  bool Ok() const;
+
+private:
+  int fd;
+};
+
 class File {
 public:
   explicit File(std::string_view);
+  File(int, std::string_view);
   ~File();
   File(const File&) = delete;
   File(File&&);
@@ -14,11 +47,13 @@ public:
 
   int Fd() const;
   size_t Size() const;
+  const FileStatus& Status() const;
+  std::optional<std::string> Read() const;
   bool Ok() const;
 
 private:
   int fd;
-  std::size_t size;
+  FileStatus status;
 };
 
 }  // namespace os
@@ -0,0 +1,474 @@
+#include "hpack.hpp"
+#include <algorithm>
+#include <array>
+
+namespace {
+
+constexpr std::size_t huffmanSymbols = 257;
+constexpr std::size_t huffmanEos = 256;
+constexpr std::uint8_t huffmanMinLength = 5;
+constexpr std::uint8_t huffmanMaxLength = 30;
+constexpr std::size_t hpackEntryOverhead = 32;
+
+// Code lengths from RFC 7541 Appendix B, the code is canonical so the codes themselves follow from the lengths.
+constexpr std::uint8_t huffmanLengths[huffmanSymbols] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28,
+    28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12, 13, 6, 8, 11,
+    10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8,
+    15, 6, 12, 10, 13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6, 15, 5, 6, 5,
+    6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5, 6, 7, 6, 5, 5, 6, 7, 7,
+    7, 7, 7, 15, 11, 14, 13, 28, 20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23,
+    23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21,
+    23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23, 26, 26, 20, 19, 22, 23, 22, 25,
+    26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26,
+    28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30,
+};
+
+struct HuffmanTables {
+  std::uint32_t codes[huffmanSymbols]{};
+  // Left-aligned 32-bit bound below which a code of the given length is complete.
+  std::uint64_t limits[huffmanMaxLength + 1]{};
+  std::int32_t bases[huffmanMaxLength + 1]{};
+  std::uint16_t symbols[huffmanSymbols]{};
+};
+
+constexpr HuffmanTables BuildHuffmanTables() {
+  HuffmanTables tables;
+  std::uint32_t code = 0;
+  std::size_t sorted = 0;
+  for (std::uint8_t length = huffmanMinLength; length <= huffmanMaxLength; length++) {
+    tables.bases[length] = static_cast<std::int32_t>(sorted) - static_cast<std::int32_t>(code);
+    for (std::size_t symbol = 0; symbol < huffmanSymbols; symbol++) {
+      if (huffmanLengths[symbol] == length) {
+        tables.codes[symbol] = code++;
+        tables.symbols[sorted++] = static_cast<std::uint16_t>(symbol);
+      }
+    }
+    tables.limits[length] = static_cast<std::uint64_t>(code) << (32 - length);
+    code <<= 1;
+  }
+  return tables;
+}
+
+constexpr HuffmanTables huffman = BuildHuffmanTables();
+
+// Returns the symbol at the top of a left-aligned 32-bit window along with its code length.
+std::pair<std::size_t, std::uint8_t> DecodeHuffmanSymbol(std::uint64_t window) {
+  for (std::uint8_t length = huffmanMinLength; length <= huffmanMaxLength; length++) {
+    if (window < huffman.limits[length]) {
+      const auto code = static_cast<std::int32_t>(window >> (32 - length));
+      return {huffman.symbols[huffman.bases[length] + code], length};
+    }
+  }
+  return {huffmanEos, huffmanMaxLength};
+}
+
+const network::HttpHeader staticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+constexpr std::size_t staticTableSize = std::size(staticTable);
+
+struct StaticIndex {
+  std::unordered_map<std::string, std::size_t> fields;
+  std::unordered_map<std::string_view, std::size_t> names;
+};
+
+const StaticIndex& GetStaticIndex() {
+  static const StaticIndex index = [] {
+    StaticIndex index;
+    for (std::size_t i = staticTableSize; i > 0; i--) {
+      const auto& entry = staticTable[i - 1];
+      index.fields[entry.field + '\0' + entry.value] = i;
+      index.names[entry.field] = i;
+    }
+    return index;
+  }();
+  return index;
+}
+
+void EncodeInteger(std::uint64_t value, std::uint8_t flags, std::uint8_t prefix, std::string& out) {
+  const std::uint64_t max = (1u << prefix) - 1;
+  if (value < max) {
+    out += static_cast<char>(flags | value);
+    return;
+  }
+  out += static_cast<char>(flags | max);
+  value -= max;
+  while (value >= 128) {
+    out += static_cast<char>(value % 128 + 128);
+    value /= 128;
+  }
+  out += static_cast<char>(value);
+}
+
+void EncodeString(std::string_view s, std::string& out) {
+  const size_t length = network::HuffmanEncodedLength(s);
+  if (length < s.size()) {
+    EncodeInteger(length, 0x80, 7, out);
+    network::HuffmanEncode(s, out);
+    return;
+  }
+  EncodeInteger(s.size(), 0, 7, out);
+  out += s;
+}
+
+// Values that change with nearly every response would only churn the dynamic table.
+bool Indexable(std::string_view name) {
+  static constexpr std::string_view volatileNames[] = {
+      "age", "content-length", "content-range", "date", "etag", "expires", "last-modified", "set-cookie"};
+  return std::find(std::begin(volatileNames), std::end(volatileNames), name) == std::end(volatileNames);
+}
+
+}  // namespace
+
+namespace network {
+
+void HuffmanEncode(std::string_view s, std::string& out) {
+  std::uint64_t bits = 0;
+  std::uint8_t count = 0;
+  for (auto c : s) {
+    const auto symbol = static_cast<std::uint8_t>(c);
+    bits = (bits << huffmanLengths[symbol]) | huffman.codes[symbol];
+    count += huffmanLengths[symbol];
+    while (count >= 8) {
+      count -= 8;
+      out += static_cast<char>(bits >> count);
+    }
+  }
+  if (count > 0) {
+    out += static_cast<char>((bits << (8 - count)) | (0xff >> count));
+  }
+}
+
+std::size_t HuffmanEncodedLength(std::string_view s) {
+  std::size_t bits = 0;
+  for (auto c : s) {
+    bits += huffmanLengths[static_cast<std::uint8_t>(c)];
+  }
+  return (bits + 7) / 8;
+}
+
+bool HuffmanDecode(std::string_view s, std::string& out) {
+  std::uint64_t bits = 0;
+  std::uint8_t count = 0;
+  auto next = s.begin();
+  while (true) {
+    while (count < huffmanMaxLength and next != s.end()) {
+      bits = (bits << 8) | static_cast<std::uint8_t>(*next++);
+      count += 8;
+    }
+    if (count == 0) {
+      return true;
+    }
+    const std::uint64_t mask = (std::uint64_t{1} << count) - 1;
+    if (next == s.end() and count < 8 and (bits & mask) == mask) {
+      return true;
+    }
+    // Pads a short tail with ones, which never completes a code that the remaining bits could not.
+    const std::uint64_t window =
+        count >= 32 ? bits >> (count - 32) : (bits << (32 - count)) | ((std::uint64_t{1} << (32 - count)) - 1);
+    auto [symbol, length] = DecodeHuffmanSymbol(window);
+    if (symbol == huffmanEos or length > count) {
+      return false;
+    }
+    out += static_cast<char>(symbol);
+    count -= length;
+    bits &= (std::uint64_t{1} << count) - 1;
+  }
+}
+
+HpackTable::HpackTable(std::size_t capacity) : capacity{capacity} {
+}
+
+const HttpHeader* HpackTable::Get(std::size_t index) const {
+  if (index == 0) {
+    return nullptr;
+  }
+  if (index <= staticTableSize) {
+    return &staticTable[index - 1];
+  }
+  index -= staticTableSize + 1;
+  return index < entries.size() ? &entries[index] : nullptr;
+}
+
+std::string HpackTable::Key(std::string_view name, std::string_view value) {
+  std::string key;
+  key.reserve(name.size() + value.size() + 1);
+  key += name;
+  key += '\0';
+  key += value;
+  return key;
+}
+
+void HpackTable::Insert(std::string_view name, std::string_view value) {
+  const std::size_t entrySize = name.size() + value.size() + hpackEntryOverhead;
+  while (not entries.empty() and size + entrySize > capacity) {
+    Evict();
+  }
+  if (entrySize > capacity) {
+    return;
+  }
+  entries.emplace_front(HttpHeader{std::string{name}, std::string{value}});
+  fieldIndex[Key(name, value)] = inserted;
+  nameIndex[std::string{name}] = inserted;
+  inserted++;
+  size += entrySize;
+}
+
+void HpackTable::Evict() {
+  const auto& entry = entries.back();
+  const std::uint64_t sequence = inserted - entries.size();
+  if (auto it = fieldIndex.find(Key(entry.field, entry.value)); it != fieldIndex.end() and it->second == sequence) {
+    fieldIndex.erase(it);
+  }
+  if (auto it = nameIndex.find(entry.field); it != nameIndex.end() and it->second == sequence) {
+    nameIndex.erase(it);
+  }
+  size -= entry.field.size() + entry.value.size() + hpackEntryOverhead;
+  entries.pop_back();
+}
+
+void HpackTable::Resize(std::size_t newCapacity) {
+  capacity = newCapacity;
+  while (size > capacity) {
+    Evict();
+  }
+}
+
+std::size_t HpackTable::Capacity() const {
+  return capacity;
+}
+
+std::pair<std::size_t, bool> HpackTable::Find(std::string_view name, std::string_view value) const {
+  const auto& statics = GetStaticIndex();
+  const auto key = Key(name, value);
+  if (auto it = statics.fields.find(key); it != statics.fields.end()) {
+    return {it->second, true};
+  }
+  if (auto it = fieldIndex.find(key); it != fieldIndex.end()) {
+    return {staticTableSize + inserted - it->second, true};
+  }
+  if (auto it = statics.names.find(name); it != statics.names.end()) {
+    return {it->second, false};
+  }
+  if (auto it = nameIndex.find(std::string{name}); it != nameIndex.end()) {
+    return {staticTableSize + inserted - it->second, false};
+  }
+  return {0, false};
+}
+
+HpackDecoder::HpackDecoder(std::size_t capacity) : table{capacity}, maxCapacity{capacity} {
+}
+
+std::variant<std::vector<HttpHeader>, HttpRequestError> HpackDecoder::Decode(
+    std::string_view block, std::size_t maxLength) {
+  std::vector<HttpHeader> headers;
+  std::size_t length = 0;
+  while (not block.empty()) {
+    const auto first = static_cast<std::uint8_t>(block.front());
+    if ((first & 0xe0) == 0x20) {
+      auto capacity = DecodeInteger(block, 5);
+      if (not capacity or *capacity > maxCapacity or length > 0) {
+        return HttpRequestError::Malformed;
+      }
+      table.Resize(*capacity);
+      continue;
+    }
+    HttpHeader header;
+    if (first & 0x80) {
+      auto index = DecodeInteger(block, 7);
+      const auto* entry = index ? table.Get(*index) : nullptr;
+      if (not entry) {
+        return HttpRequestError::Malformed;
+      }
+      header = *entry;
+    } else {
+      const bool indexing = (first & 0xc0) == 0x40;
+      auto index = DecodeInteger(block, indexing ? 6 : 4);
+      if (not index) {
+        return HttpRequestError::Malformed;
+      }
+      if (*index == 0) {
+        auto name = DecodeString(block);
+        if (not name) {
+          return HttpRequestError::Malformed;
+        }
+        header.field = std::move(*name);
+      } else {
+        const auto* entry = table.Get(*index);
+        if (not entry) {
+          return HttpRequestError::Malformed;
+        }
+        header.field = entry->field;
+      }
+      auto value = DecodeString(block);
+      if (not value) {
+        return HttpRequestError::Malformed;
+      }
+      header.value = std::move(*value);
+      if (indexing) {
+        table.Insert(header.field, header.value);
+      }
+    }
+    length += header.field.size() + header.value.size() + hpackEntryOverhead;
+    if (length <= maxLength) {
+      headers.emplace_back(std::move(header));
+    }
+  }
+  if (length > maxLength) {
+    return HttpRequestError::HeadersTooLarge;
+  }
+  return headers;
+}
+
+std::optional<std::uint64_t> HpackDecoder::DecodeInteger(std::string_view& block, std::uint8_t prefix) const {
+  const std::uint64_t max = (1u << prefix) - 1;
+  std::uint64_t value = static_cast<std::uint8_t>(block.front()) & max;
+  block.remove_prefix(1);
+  if (value < max) {
+    return value;
+  }
+  for (std::uint8_t shift = 0; shift <= 28; shift += 7) {
+    if (block.empty()) {
+      return std::nullopt;
+    }
+    const auto b = static_cast<std::uint8_t>(block.front());
+    block.remove_prefix(1);
+    value += static_cast<std::uint64_t>(b & 0x7f) << shift;
+    if (not(b & 0x80)) {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string> HpackDecoder::DecodeString(std::string_view& block) const {
+  if (block.empty()) {
+    return std::nullopt;
+  }
+  const bool huffmanCoded = block.front() & 0x80;
+  auto length = DecodeInteger(block, 7);
+  if (not length or *length > block.size()) {
+    return std::nullopt;
+  }
+  std::string s;
+  const auto raw = block.substr(0, *length);
+  block.remove_prefix(*length);
+  if (not huffmanCoded) {
+    s = raw;
+    return s;
+  }
+  s.reserve(raw.size() * 8 / 5);
+  if (not HuffmanDecode(raw, s)) {
+    return std::nullopt;
+  }
+  return s;
+}
+
+HpackEncoder::HpackEncoder(std::size_t capacity) : table{capacity}, smallestCapacity{capacity} {
+}
+
+void HpackEncoder::Resize(std::size_t capacity) {
+  capacity = std::min(capacity, hpackDefaultTableSize);
+  smallestCapacity = std::min(smallestCapacity, capacity);
+  pendingCapacity = capacity;
+}
+
+void HpackEncoder::Encode(const std::vector<HttpHeader>& headers, std::string& out) {
+  if (pendingCapacity) {
+    if (smallestCapacity < *pendingCapacity) {
+      table.Resize(smallestCapacity);
+      EncodeInteger(smallestCapacity, 0x20, 5, out);
+    }
+    table.Resize(*pendingCapacity);
+    EncodeInteger(*pendingCapacity, 0x20, 5, out);
+    smallestCapacity = *pendingCapacity;
+    pendingCapacity.reset();
+  }
+  for (const auto& header : headers) {
+    EncodeField(header, out);
+  }
+}
+
+void HpackEncoder::EncodeField(const HttpHeader& header, std::string& out) {
+  auto [index, exact] = table.Find(header.field, header.value);
+  if (exact) {
+    EncodeInteger(index, 0x80, 7, out);
+    return;
+  }
+  const bool indexable = Indexable(header.field);
+  EncodeInteger(index, indexable ? 0x40 : 0, indexable ? 6 : 4, out);
+  if (index == 0) {
+    EncodeString(header.field, out);
+  }
+  EncodeString(header.value, out);
+  if (indexable) {
+    table.Insert(header.field, header.value);
+  }
+}
+
+}  // namespace network
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "network.hpp"
+
+namespace network {
+
+constexpr std::size_t hpackDefaultTableSize = 4096;
+
+void HuffmanEncode(std::string_view, std::string&);
+
+std::size_t HuffmanEncodedLength(std::string_view);
+
+bool HuffmanDecode(std::string_view, std::string&);
+
+class HpackTable {
+public:
+  explicit HpackTable(std::size_t);
+
+  // Resolves a 1-based index across the static table followed by the dynamic table.
+  const HttpHeader* Get(std::size_t) const;
+  void Insert(std::string_view, std::string_view);
+  void Resize(std::size_t);
+  std::size_t Capacity() const;
+  // Returns the index of the best match and whether the value matched as well, zero when nothing matched.
+  std::pair<std::size_t, bool> Find(std::string_view, std::string_view) const;
+
+private:
+  static std::string Key(std::string_view, std::string_view);
+  void Evict();
+
+  std::deque<HttpHeader> entries;
+  std::unordered_map<std::string, std::uint64_t> fieldIndex;
+  std::unordered_map<std::string, std::uint64_t> nameIndex;
+  std::uint64_t inserted{0};
+  std::size_t size{0};
+  std::size_t capacity;
+};
+
+class HpackDecoder {
+public:
+  explicit HpackDecoder(std::size_t = hpackDefaultTableSize);
+
+  // Keeps decoding past the given number of bytes so the table stays in sync, but then drops the fields.
+  std::variant<std::vector<HttpHeader>, HttpRequestError> Decode(std::string_view, std::size_t);
+
+private:
+  std::optional<std::uint64_t> DecodeInteger(std::string_view&, std::uint8_t) const;
+  std::optional<std::string> DecodeString(std::string_view&) const;
+
+  HpackTable table;
+  const std::size_t maxCapacity;
+};
+
+class HpackEncoder {
+public:
+  explicit HpackEncoder(std::size_t = hpackDefaultTableSize);
+
+  // Applies the peer's SETTINGS_HEADER_TABLE_SIZE, the change is announced at the start of the next block.
+  void Resize(std::size_t);
+  void Encode(const std::vector<HttpHeader>&, std::string&);
+
+private:
+  void EncodeField(const HttpHeader&, std::string&);
+
+  HpackTable table;
+  std::optional<std::size_t> pendingCapacity;
+  std::size_t smallestCapacity;
+};
+
+}  // namespace network
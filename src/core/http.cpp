@@ -1,6 +1,9 @@
 #include "http.hpp"
 #include <spdlog/spdlog.h>
+#include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <limits>
 #include <sstream>
 #include "common.hpp"
 #include "file.hpp"
@@ -10,14 +13,30 @@ namespace {
 
 std::string ToString(network::HttpStatus status) {
   switch (status) {
+    case network::HttpStatus::Continue:
+      return "100 Continue";
     case network::HttpStatus::SwitchingProtocols:
       return "101 Switching Protocols";
     case network::HttpStatus::OK:
       return "200 OK";
+    case network::HttpStatus::PartialContent:
+      return "206 Partial Content";
+    case network::HttpStatus::NotModified:
+      return "304 Not Modified";
     case network::HttpStatus::BadRequest:
       return "400 Bad Request";
     case network::HttpStatus::NotFound:
       return "404 Not Found";
+    case network::HttpStatus::PayloadTooLarge:
+      return "413 Payload Too Large";
+    case network::HttpStatus::UriTooLong:
+      return "414 URI Too Long";
+    case network::HttpStatus::RangeNotSatisfiable:
+      return "416 Range Not Satisfiable";
+    case network::HttpStatus::RequestHeaderFieldsTooLarge:
+      return "431 Request Header Fields Too Large";
+    case network::HttpStatus::InternalServerError:
+      return "500 Internal Server Error";
   }
   return "";
 }
@@ -26,6 +45,8 @@ std::string ToString(network::HttpMethod method) {
   switch (method) {
     case network::HttpMethod::GET:
       return "GET";
+    case network::HttpMethod::HEAD:
+      return "HEAD";
     case network::HttpMethod::PUT:
       return "PUT";
     case network::HttpMethod::POST:
@@ -40,6 +61,9 @@ std::optional<network::HttpMethod> ConvertMethod(std::string_view method) {
   if (method == "get") {
     return network::HttpMethod::GET;
   }
+  if (method == "head") {
+    return network::HttpMethod::HEAD;
+  }
   if (method == "put") {
     return network::HttpMethod::PUT;
   }
@@ -52,12 +76,151 @@ std::optional<network::HttpMethod> ConvertMethod(std::string_view method) {
   return std::nullopt;
 }
 
+bool IsInformational(network::HttpStatus status) {
+  return status == network::HttpStatus::Continue or status == network::HttpStatus::SwitchingProtocols;
+}
+
+constexpr std::pair<std::string_view, std::string_view> mimeTypes[] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".css", "text/css"},
+    {".js", "text/javascript"},
+    {".mjs", "text/javascript"},
+    {".json", "application/json"},
+    {".map", "application/json"},
+    {".xml", "application/xml"},
+    {".txt", "text/plain"},
+    {".csv", "text/csv"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".webp", "image/webp"},
+    {".avif", "image/avif"},
+    {".ico", "image/x-icon"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".ttf", "font/ttf"},
+    {".otf", "font/otf"},
+    {".wasm", "application/wasm"},
+    {".pdf", "application/pdf"},
+    {".zip", "application/zip"},
+    {".mp3", "audio/mpeg"},
+    {".ogg", "audio/ogg"},
+    {".wav", "audio/wav"},
+    {".mp4", "video/mp4"},
+    {".webm", "video/webm"},
+};
+
+constexpr size_t maxChunkLineLength = 4096;
+constexpr size_t maxRangeCount = 16;
+constexpr size_t writerChunkLength = 16 << 10;
+
+void AppendChunk(std::string& payload, std::string_view data) {
+  if (data.empty()) {
+    return;
+  }
+  std::stringstream ss;
+  ss << std::hex << data.size() << "\r\n";
+  payload += ss.str();
+  payload += data;
+  payload += "\r\n";
+}
+
+std::optional<size_t> ParseRangeNumber(std::string_view s) {
+  size_t n = 0;
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+  if (s.empty() or ec != std::errc{} or ptr != s.data() + s.size()) {
+    return std::nullopt;
+  }
+  return n;
+}
+
+bool EntityTagMatches(std::string_view header, std::string_view etag) {
+  auto opaque = [](std::string_view tag) {
+    if (tag.starts_with("W/")) {
+      tag.remove_prefix(2);
+    }
+    return tag;
+  };
+  while (not header.empty()) {
+    auto comma = header.find(',');
+    auto tag = common::Trim(header.substr(0, comma));
+    header = comma == header.npos ? std::string_view{} : header.substr(comma + 1);
+    if (tag == "*" or opaque(tag) == opaque(etag)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](unsigned char x, unsigned char y) {
+    return std::tolower(x) == std::tolower(y);
+  });
+}
+
+const std::string* FindHeader(const network::HttpHeaders& headers, std::string_view key) {
+  for (const auto& [k, v] : headers) {
+    if (EqualsIgnoreCase(k, key)) {
+      return &v;
+    }
+  }
+  return nullptr;
+}
+
 }  // namespace
 
 namespace network {
 
+ConcreteHttpParser::ConcreteHttpParser(const HttpLimits& limits) : limits{limits} {
+}
+
 std::optional<HttpRequest> ConcreteHttpParser::Parse(std::string& payload_) const {
   std::string payload = payload_;
+  auto head = ParseHead(payload);
+  auto* request = std::get_if<HttpRequest>(&head);
+  if (not request) {
+    return std::nullopt;
+  }
+  HttpBodyDecoder decoder{request->headers, limits.maxBodyLength};
+  if (not decoder.Decode(payload, request->body) or not decoder.Done()) {
+    return std::nullopt;
+  }
+  payload_ = std::move(payload);
+  return std::move(*request);
+}
+
+std::variant<std::monostate, HttpRequest, HttpRequestError> ConcreteHttpParser::ParseHead(std::string& payload) const {
+  const auto requestLineLength = std::min(payload.find("\r\n"), payload.size());
+  if (requestLineLength > limits.maxRequestLineLength) {
+    return HttpRequestError::RequestLineTooLong;
+  }
+  const auto headLength = payload.find("\r\n\r\n");
+  if (headLength == payload.npos) {
+    if (payload.size() > requestLineLength + limits.maxHeaderLength) {
+      return HttpRequestError::HeadersTooLarge;
+    }
+    return std::monostate{};
+  }
+  if (headLength - requestLineLength > limits.maxHeaderLength) {
+    return HttpRequestError::HeadersTooLarge;
+  }
+  std::string head = payload.substr(0, headLength + 4);
+  const size_t headerCount = std::count(head.begin(), head.end(), '\n') - 2;
+  if (headerCount > limits.maxHeaderCount) {
+    return HttpRequestError::TooManyHeaders;
+  }
+  auto request = ParseRequest(head);
+  if (not request) {
+    return HttpRequestError::Malformed;
+  }
+  payload.erase(0, headLength + 4);
+  return std::move(*request);
+}
+
+std::optional<HttpRequest> ConcreteHttpParser::ParseRequest(std::string& payload) const {
   auto methodStr = ParseToken(payload);
   if (not methodStr) {
     return std::nullopt;
@@ -71,8 +234,6 @@ std::optional<HttpRequest> ConcreteHttpParser::Parse(std::string& payload_) cons
   if (not uri) {
     return std::nullopt;
   }
-  auto uriBase = ParseUriBase(*uri);
-  auto query = ParseQueryString(*uri);
   auto version = ParseToken(payload);
   if (not version) {
     return std::nullopt;
@@ -90,16 +251,8 @@ std::optional<HttpRequest> ConcreteHttpParser::Parse(std::string& payload_) cons
   if (not headersEndingParsed) {
     return std::nullopt;
   }
-  auto bodyRemaining = FindContentLength(headers);
-  if (payload.length() < bodyRemaining) {
-    return std::nullopt;
-  }
-  std::string body = payload.substr(0, bodyRemaining);
-  payload.erase(0, bodyRemaining);
-  HttpRequest request{std::move(*method), std::move(uriBase), std::move(*version), std::move(headers), std::move(query),
-      std::move(body)};
-  payload_ = payload;
-  return request;
+  return HttpRequest{
+      std::move(*method), Uri{std::move(*uri)}, std::move(*version), std::move(headers), {}};
 }
 
 void ConcreteHttpParser::SkipWhiteSpaces(std::string& payload) const {
@@ -183,140 +336,775 @@ std::optional<std::string> ConcreteHttpParser::ParseLine(std::string& payload) c
   return s;
 }
 
-size_t ConcreteHttpParser::FindContentLength(const HttpHeaders& headers) const {
-  const auto it = headers.find("content-length");
-  if (it != headers.end()) {
-    size_t r = stoul(it->second);
-    return r > 0 ? r : 0;
+HttpBodyDecoder::HttpBodyDecoder(const HttpHeaders& headers, size_t maxLength) : maxLength{maxLength} {
+  const auto transferEncodingIt = headers.find("transfer-encoding");
+  if (transferEncodingIt != headers.end()) {
+    // Any other final coding leaves the body length unknown, so the request cannot be framed and is refused.
+    auto transferEncoding = transferEncodingIt->second;
+    common::ToLower(transferEncoding);
+    const auto comma = transferEncoding.rfind(',');
+    const auto first = comma == transferEncoding.npos ? 0 : comma + 1;
+    const auto last = common::Trim(std::string_view{transferEncoding}.substr(first));
+    if (last != "chunked") {
+      Fail(HttpRequestError::Malformed);
+      return;
+    }
+    state = State::ChunkSize;
+    return;
+  }
+  const auto contentLengthIt = headers.find("content-length");
+  if (contentLengthIt == headers.end()) {
+    return;
+  }
+  const auto& contentLength = contentLengthIt->second;
+  const auto* end = contentLength.data() + contentLength.size();
+  auto [p, ec] = std::from_chars(contentLength.data(), end, remaining);
+  if (ec == std::errc::result_out_of_range) {
+    Fail(HttpRequestError::BodyTooLarge);
+    return;
+  }
+  if (ec != std::errc{} or p != end) {
+    Fail(HttpRequestError::Malformed);
+    return;
+  }
+  if (remaining > maxLength) {
+    Fail(HttpRequestError::BodyTooLarge);
+    return;
+  }
+  state = remaining > 0 ? State::Length : State::Done;
+}
+
+bool HttpBodyDecoder::Decode(std::string& payload, std::string& data) {
+  while (true) {
+    switch (state) {
+      case State::Length:
+      case State::ChunkData: {
+        const size_t n = std::min(remaining, payload.size());
+        data.append(payload, 0, n);
+        payload.erase(0, n);
+        remaining -= n;
+        if (remaining > 0) {
+          return true;
+        }
+        state = state == State::Length ? State::Done : State::ChunkDataEnding;
+        break;
+      }
+      case State::ChunkSize:
+        if (not DecodeChunkSize(payload)) {
+          return false;
+        }
+        if (state == State::ChunkSize) {
+          return true;
+        }
+        break;
+      case State::ChunkDataEnding:
+        if (payload.size() < 2) {
+          return true;
+        }
+        if (not payload.starts_with("\r\n")) {
+          return Fail(HttpRequestError::Malformed);
+        }
+        payload.erase(0, 2);
+        state = State::ChunkSize;
+        break;
+      case State::Trailer:
+        if (not DecodeTrailer(payload)) {
+          return false;
+        }
+        if (state == State::Trailer) {
+          return true;
+        }
+        break;
+      case State::Done:
+        return true;
+      case State::Failed:
+        return false;
+    }
+  }
+}
+
+bool HttpBodyDecoder::DecodeChunkSize(std::string& payload) {
+  const auto n = payload.find("\r\n");
+  if (n == payload.npos) {
+    if (payload.size() > maxChunkLineLength) {
+      return Fail(HttpRequestError::Malformed);
+    }
+    return true;
+  }
+  const auto* begin = payload.data();
+  const auto* end = begin + payload.find_first_of("; \t\r");
+  auto [p, ec] = std::from_chars(begin, end, remaining, 16);
+  if (ec == std::errc::result_out_of_range) {
+    return Fail(HttpRequestError::BodyTooLarge);
+  }
+  const auto extension = common::Trim({end, begin + n});
+  if (ec != std::errc{} or p == begin or p != end or (not extension.empty() and extension.front() != ';')) {
+    return Fail(HttpRequestError::Malformed);
+  }
+  if (remaining > maxLength - length) {
+    return Fail(HttpRequestError::BodyTooLarge);
+  }
+  length += remaining;
+  payload.erase(0, n + 2);
+  state = remaining > 0 ? State::ChunkData : State::Trailer;
+  return true;
+}
+
+bool HttpBodyDecoder::DecodeTrailer(std::string& payload) {
+  while (state == State::Trailer) {
+    const auto n = payload.find("\r\n");
+    if (n == payload.npos) {
+      if (payload.size() > maxChunkLineLength) {
+        return Fail(HttpRequestError::Malformed);
+      }
+      return true;
+    }
+    payload.erase(0, n + 2);
+    if (n == 0) {
+      state = State::Done;
+    }
+  }
+  return true;
+}
+
+bool HttpBodyDecoder::Fail(HttpRequestError e) {
+  state = State::Failed;
+  error = e;
+  return false;
+}
+
+size_t HttpBodyDecoder::Raw() const {
+  if (state == State::Length or state == State::ChunkData) {
+    return remaining;
   }
   return 0;
 }
 
-std::string ConcreteHttpParser::ParseUriBase(std::string& uri) const {
-  const auto n = uri.find('?');
-  const auto r = uri.substr(0, n);
-  uri.erase(0, n);
-  return r;
+void HttpBodyDecoder::Skip(size_t n) {
+  remaining -= n;
+  if (remaining > 0) {
+    return;
+  }
+  state = state == State::Length ? State::Done : State::ChunkDataEnding;
+}
+
+bool HttpBodyDecoder::Done() const {
+  return state == State::Done;
 }
 
-std::string ConcreteHttpParser::ParseQueryKey(std::string& uri) const {
-  const auto n = uri.find('=');
-  const auto r = uri.substr(0, n);
-  uri.erase(0, n);
-  return r;
+bool HttpBodyDecoder::Failed() const {
+  return state == State::Failed;
 }
 
-std::string ConcreteHttpParser::ParseQueryValue(std::string& uri) const {
-  const auto n = uri.find('&');
-  const auto r = uri.substr(0, n);
-  uri.erase(0, n);
-  return r;
+HttpRequestError HttpBodyDecoder::Error() const {
+  return error;
 }
 
-HttpQuery ConcreteHttpParser::ParseQueryString(std::string& uri) const {
-  HttpQuery result;
-  if (uri.empty() or not Consume(uri, "?")) {
-    return result;
+bool AcceptsEncoding(std::string_view header, std::string_view coding) {
+  std::optional<bool> wildcard;
+  while (not header.empty()) {
+    auto comma = header.find(',');
+    auto item = header.substr(0, comma);
+    header = comma == header.npos ? std::string_view{} : header.substr(comma + 1);
+    auto semicolon = item.find(';');
+    auto token = common::Trim(item.substr(0, semicolon));
+    const bool exact = EqualsIgnoreCase(token, coding);
+    if (not exact and token != "*") {
+      continue;
+    }
+    bool accepted = true;
+    auto params = semicolon == item.npos ? std::string_view{} : item.substr(semicolon + 1);
+    while (not params.empty()) {
+      semicolon = params.find(';');
+      auto param = common::Trim(params.substr(0, semicolon));
+      params = semicolon == params.npos ? std::string_view{} : params.substr(semicolon + 1);
+      if (param.starts_with("q=") or param.starts_with("Q=")) {
+        accepted = param.substr(2).find_first_not_of("0.") != param.npos;
+      }
+    }
+    if (exact) {
+      return accepted;
+    }
+    wildcard = accepted;
   }
-  while (true) {
-    auto key = ParseQueryKey(uri);
-    if (not Consume(uri, "=")) {
-      result.emplace(std::move(key), "");
-      break;
+  return wildcard.value_or(false);
+}
+
+std::string_view MimeTypeOf(std::string_view path) {
+  for (const auto& [extension, mimeType] : mimeTypes) {
+    if (path.ends_with(extension)) {
+      return mimeType;
+    }
+  }
+  return "text/plain";
+}
+
+std::optional<std::vector<HttpRange>> ParseHttpRanges(std::string_view header, size_t size) {
+  constexpr std::string_view unit = "bytes=";
+  if (not header.starts_with(unit)) {
+    return std::nullopt;
+  }
+  header.remove_prefix(unit.size());
+  std::vector<HttpRange> ranges;
+  size_t count = 0;
+  while (not header.empty()) {
+    auto comma = header.find(',');
+    auto spec = common::Trim(header.substr(0, comma));
+    header = comma == header.npos ? std::string_view{} : header.substr(comma + 1);
+    if (spec.empty()) {
+      continue;
     }
-    auto value = ParseQueryValue(uri);
-    result.emplace(std::move(key), std::move(value));
-    if (not Consume(uri, "&")) {
-      break;
+    if (++count > maxRangeCount) {
+      return std::nullopt;
+    }
+    auto dash = spec.find('-');
+    if (dash == spec.npos) {
+      return std::nullopt;
+    }
+    auto firstPart = spec.substr(0, dash);
+    auto lastPart = spec.substr(dash + 1);
+    if (firstPart.empty()) {
+      auto suffix = ParseRangeNumber(lastPart);
+      if (not suffix) {
+        return std::nullopt;
+      }
+      if (*suffix > 0 and size > 0) {
+        ranges.push_back({size - std::min(*suffix, size), size - 1});
+      }
+      continue;
+    }
+    auto first = ParseRangeNumber(firstPart);
+    auto last = lastPart.empty() ? std::optional<size_t>{size - 1} : ParseRangeNumber(lastPart);
+    if (not first or not last or (not lastPart.empty() and *last < *first)) {
+      return std::nullopt;
+    }
+    if (*first < size) {
+      ranges.push_back({*first, std::min(*last, size - 1)});
     }
   }
-  return result;
+  if (count == 0) {
+    return std::nullopt;
+  }
+  return ranges;
+}
+
+ConcreteHttpSender::ConcreteHttpSender(TcpSender& sender, const HttpCaches& caches)
+    : sender{sender},
+      fileCache{caches.fileCache},
+      responseCache{caches.responseCache},
+      compressionCache{caches.compressionCache} {
 }
 
-ConcreteHttpSender::ConcreteHttpSender(TcpSender& sender) : sender{sender} {
+ConcreteHttpSender::~ConcreteHttpSender() {
+  if (writerToken) {
+    std::lock_guard lock{writerToken->tokenMut};
+    writerToken->sender = nullptr;
+  }
 }
 
 void ConcreteHttpSender::Send(HttpResponse&& response) const {
+  if (not IsInformational(response.status) and response.body.size() >= request.compression.minLength) {
+    if (auto coding = NegotiateCoding(response.headers)) {
+      const int level = request.compression.level;
+      auto compressed = compressionCache and request.compression.cacheable
+                            ? compressionCache->Compress(response.body, *coding, level)
+                            : network::Compress(response.body, *coding, level);
+      if (compressed) {
+        response.body = std::move(*compressed);
+        response.headers.emplace("Content-Encoding", ContentEncodingOf(*coding));
+        response.headers.emplace("Vary", "Accept-Encoding");
+      }
+    }
+  }
   std::string respPayload = "HTTP/1.1 " + ToString(response.status) + "\r\n";
-  response.headers.emplace("Content-Length", std::to_string(response.body.length()));
+  if (not IsInformational(response.status)) {
+    response.headers.emplace("Content-Length", std::to_string(response.body.length()));
+  }
   for (const auto& [k, v] : response.headers) {
     respPayload += k + ": " + v + "\r\n";
   }
   respPayload += "\r\n";
-  respPayload += std::move(response.body);
+  if (not request.headOnly) {
+    respPayload += std::move(response.body);
+  }
   sender.Send(std::move(respPayload));
 }
 
 void ConcreteHttpSender::Send(FileHttpResponse&& response) const {
-  os::File file{response.path};
-  if (not file.Ok()) {
-    spdlog::error("http open(\"{}\"): {}", response.path, strerror(errno));
+  if (response.precompressed) {
+    SelectEncoding(response);
+  }
+  auto cached = fileCache.Get(response.root, response.path);
+  if (not cached) {
+    spdlog::error("http open(\"{}\"): no such regular file", response.path);
     HttpResponse resp;
     resp.status = HttpStatus::NotFound;
     return Send(std::move(resp));
   }
+  if (NotModified(*cached)) {
+    std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::NotModified) + "\r\n";
+    respPayload += "ETag: " + cached->etag + "\r\nLast-Modified: " + cached->lastModified + "\r\n\r\n";
+    sender.Send(std::move(respPayload));
+    return;
+  }
+  const auto& status = cached->file->Status();
+  if (RangeApplies(*cached)) {
+    if (auto ranges = ParseHttpRanges(request.range, status.size)) {
+      return SendRanges(std::move(response), *cached, *ranges);
+    }
+  }
+  if (request.headOnly) {
+    std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::OK) + "\r\n";
+    for (const auto& [k, v] : response.headers) {
+      respPayload += k + ": " + v + "\r\n";
+    }
+    respPayload += cached->headers;
+    respPayload += "\r\n";
+    sender.Send(std::move(respPayload));
+    return;
+  }
+  const auto contentEncoding = response.headers.find("Content-Encoding");
+  const std::string_view coding = contentEncoding == response.headers.end() ? "" : contentEncoding->second;
+  if (responseCache and responseCache->Cacheable(status.size)) {
+    if (auto payload = responseCache->Get(response.root, response.path, coding, status, response.headers)) {
+      return sender.Send(std::move(payload));
+    }
+  }
   std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::OK) + "\r\n";
-  response.headers.emplace("Content-Length", std::to_string(file.Size()));
   for (const auto& [k, v] : response.headers) {
     respPayload += k + ": " + v + "\r\n";
   }
+  respPayload += cached->headers;
   respPayload += "\r\n";
+  if (responseCache and responseCache->Cacheable(status.size)) {
+    if (auto content = cached->file->Read()) {
+      respPayload += *content;
+      auto payload = std::make_shared<const std::string>(std::move(respPayload));
+      responseCache->Put(response.root, response.path, coding, status, response.headers, payload);
+      return sender.Send(std::move(payload));
+    }
+  }
   sender.Send(std::move(respPayload));
-  sender.Send(std::move(file));
+  sender.Send(cached->file);
 }
 
-void ConcreteHttpSender::Send(MixedReplaceHeaderHttpResponse&&) const {
+void ConcreteHttpSender::SendRanges(
+    FileHttpResponse&& response, const CachedFile& cached, const std::vector<HttpRange>& ranges) const {
+  const size_t size = cached.file->Size();
+  const std::string completeLength = std::to_string(size);
+  if (ranges.empty()) {
+    HttpResponse resp;
+    resp.status = HttpStatus::RangeNotSatisfiable;
+    resp.headers.emplace("Content-Range", "bytes */" + completeLength);
+    return Send(std::move(resp));
+  }
+  std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::PartialContent) + "\r\n";
+  if (ranges.size() == 1) {
+    const auto& range = ranges.front();
+    for (const auto& [k, v] : response.headers) {
+      respPayload += k + ": " + v + "\r\n";
+    }
+    respPayload += "Content-Range: bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" +
+                   completeLength + "\r\n";
+    respPayload += "Content-Length: " + std::to_string(range.last - range.first + 1) + "\r\n\r\n";
+    sender.Send(std::move(respPayload));
+    sender.Send(cached.file, range.first, range.last - range.first + 1);
+    return;
+  }
+  constexpr std::string_view boundary = "BYTERANGES";
+  const auto* contentType = FindHeader(response.headers, "Content-Type");
+  std::string partType;
+  if (contentType) {
+    partType = "Content-Type: " + *contentType + "\r\n";
+  }
+  std::vector<std::string> partHeads;
+  size_t contentLength = 0;
+  for (const auto& range : ranges) {
+    std::string partHead = (partHeads.empty() ? "--" : "\r\n--") + std::string{boundary} + "\r\n" + partType;
+    partHead += "Content-Range: bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" +
+                completeLength + "\r\n\r\n";
+    contentLength += partHead.size() + range.last - range.first + 1;
+    partHeads.emplace_back(std::move(partHead));
+  }
+  const std::string ending = "\r\n--" + std::string{boundary} + "--\r\n";
+  contentLength += ending.size();
+  for (const auto& [k, v] : response.headers) {
+    if (&v != contentType) {
+      respPayload += k + ": " + v + "\r\n";
+    }
+  }
+  respPayload += "Content-Type: multipart/byteranges; boundary=" + std::string{boundary} + "\r\n";
+  respPayload += "Content-Length: " + std::to_string(contentLength) + "\r\n\r\n";
+  sender.Send(std::move(respPayload));
+  for (size_t i = 0; i < ranges.size(); i++) {
+    sender.Send(partHeads[i]);
+    sender.Send(cached.file, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+  }
+  sender.Send(ending);
+}
+
+void ConcreteHttpSender::SelectEncoding(FileHttpResponse& response) const {
+  static constexpr std::pair<std::string_view, std::string_view> encodings[] = {{"br", ".br"}, {"gzip", ".gz"}};
+  response.headers.emplace("Vary", "Accept-Encoding");
+  if (request.acceptEncoding.empty()) {
+    return;
+  }
+  for (const auto& [coding, extension] : encodings) {
+    if (not AcceptsEncoding(request.acceptEncoding, coding)) {
+      continue;
+    }
+    std::string path = response.path + std::string{extension};
+    if (fileCache.Get(response.root, path)) {
+      response.path = std::move(path);
+      response.headers.emplace("Content-Encoding", coding);
+      return;
+    }
+  }
+}
+
+bool ConcreteHttpSender::RangeApplies(const CachedFile& cached) const {
+  if (request.range.empty()) {
+    return false;
+  }
+  if (request.ifRange.empty()) {
+    return true;
+  }
+  return request.ifRange == cached.lastModified;
+}
+
+bool ConcreteHttpSender::NotModified(const CachedFile& cached) const {
+  if (not request.ifNoneMatch.empty()) {
+    return EntityTagMatches(request.ifNoneMatch, cached.etag);
+  }
+  if (request.ifModifiedSince.empty()) {
+    return false;
+  }
+  auto since = common::ParseHttpDate(request.ifModifiedSince);
+  return since and cached.file->Status().modifiedTime / 1'000'000'000 <= *since;
+}
+
+void ConcreteHttpSender::Send(MixedReplaceHeaderHttpResponse&& response) const {
+  if (not response.boundary.empty()) {
+    mixedReplaceBoundary = std::move(response.boundary);
+  }
+  mixedReplaceHeadOnly.store(request.headOnly, std::memory_order_relaxed);
   std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::OK) +
                             "\r\n"
-                            "Content-Type: multipart/x-mixed-replace; boundary=\"BND\"\r\n\r\n";
+                            "Content-Type: multipart/x-mixed-replace; boundary=\"" +
+                            mixedReplaceBoundary + "\"\r\n\r\n";
   sender.Send(std::move(respPayload));
 }
 
 void ConcreteHttpSender::Send(MixedReplaceDataHttpResponse&& response) const {
-  std::string respPayload = "--BND\r\n";
-  response.headers.emplace("Content-Length", std::to_string(response.body.size()));
-  for (const auto& [k, v] : response.headers) {
-    respPayload += k + ": " + v + "\r\n";
+  if (mixedReplaceHeadOnly.load(std::memory_order_relaxed)) {
+    return;
   }
-  respPayload += "\r\n";
-  respPayload += std::move(response.body);
-  respPayload += "\r\n";
-  sender.Send(std::move(respPayload));
+  sender.Send(SerializeMixedReplacePart(mixedReplaceBoundary, std::move(response)));
+}
+
+void ConcreteHttpSender::Send(SharedMixedReplaceDataHttpResponse&& response) const {
+  if (mixedReplaceHeadOnly.load(std::memory_order_relaxed)) {
+    return;
+  }
+  sender.SendLatest(std::move(response.part));
 }
 
 void ConcreteHttpSender::Send(ChunkedHeaderHttpResponse&& response) const {
+  chunkedDeflater = SendChunkedHead(std::move(response.headers));
+}
+
+std::unique_ptr<HttpResponseWriter> ConcreteHttpSender::Stream(StreamingHttpResponse&& response) const {
+  auto deflater = SendChunkedHead(std::move(response.headers));
+  if (not writerToken) {
+    writerToken = std::make_shared<HttpWriterToken>();
+    writerToken->sender = &sender;
+  }
+  return std::make_unique<ConcreteHttpResponseWriter>(
+      writerToken, std::move(deflater), response.lowWatermark, request.headOnly);
+}
+
+std::unique_ptr<Deflater> ConcreteHttpSender::SendChunkedHead(HttpHeaders&& headers) const {
   std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::OK) +
                             "\r\n"
                             "Transfer-Encoding: chunked\r\n";
-  for (const auto& [k, v] : response.headers) {
+  std::unique_ptr<Deflater> deflater;
+  if (auto coding = NegotiateCoding(headers)) {
+    deflater = std::make_unique<Deflater>(*coding, request.compression.level);
+    headers.emplace("Content-Encoding", ContentEncodingOf(*coding));
+    headers.emplace("Vary", "Accept-Encoding");
+  }
+  for (const auto& [k, v] : headers) {
     respPayload += k + ": " + v + "\r\n";
   }
   respPayload += "\r\n";
   sender.Send(std::move(respPayload));
+  return deflater;
 }
 
 void ConcreteHttpSender::Send(ChunkedDataHttpResponse&& response) const {
+  if (request.headOnly) {
+    return;
+  }
+  if (chunkedDeflater) {
+    return SendCompressedChunk(response.body);
+  }
   std::stringstream ss;
   ss << std::hex << response.body.size();
   ss << "\r\n" << response.body << "\r\n";
   sender.Send(ss.str());
 }
 
+void ConcreteHttpSender::SendCompressedChunk(std::string_view body) const {
+  const bool last = body.empty();
+  auto compressed = chunkedDeflater->Compress(body, last);
+  std::stringstream ss;
+  if (not compressed.empty()) {
+    ss << std::hex << compressed.size() << "\r\n" << compressed << "\r\n";
+  }
+  if (last) {
+    chunkedDeflater.reset();
+    ss << "0\r\n\r\n";
+  }
+  auto payload = ss.str();
+  if (not payload.empty()) {
+    sender.Send(std::move(payload));
+  }
+}
+
+std::optional<HttpContentCoding> ConcreteHttpSender::NegotiateCoding(const HttpHeaders& headers) const {
+  if (not request.compression.enabled or FindHeader(headers, "Content-Encoding")) {
+    return std::nullopt;
+  }
+  if (AcceptsEncoding(request.acceptEncoding, "gzip")) {
+    return HttpContentCoding::Gzip;
+  }
+  if (AcceptsEncoding(request.acceptEncoding, "deflate")) {
+    return HttpContentCoding::Deflate;
+  }
+  return std::nullopt;
+}
+
+void ConcreteHttpSender::Configure(const HttpRouteOptions& options) {
+  request.compression = options.compression;
+}
+
+void ConcreteHttpSender::Prepare(const HttpRequest& req) {
+  request = {};
+  request.headOnly = req.method == HttpMethod::HEAD;
+  if (auto it = req.headers.find("accept-encoding"); it != req.headers.end()) {
+    request.acceptEncoding = it->second;
+  }
+  if (req.method != HttpMethod::GET and req.method != HttpMethod::HEAD) {
+    return;
+  }
+  if (auto it = req.headers.find("if-none-match"); it != req.headers.end()) {
+    request.ifNoneMatch = it->second;
+  }
+  if (auto it = req.headers.find("if-modified-since"); it != req.headers.end()) {
+    request.ifModifiedSince = it->second;
+  }
+  if (req.method != HttpMethod::GET) {
+    return;
+  }
+  if (auto it = req.headers.find("range"); it != req.headers.end()) {
+    request.range = it->second;
+  }
+  if (auto it = req.headers.find("if-range"); it != req.headers.end()) {
+    request.ifRange = it->second;
+  }
+}
+
+std::string SerializeMixedReplacePart(std::string_view boundary, MixedReplaceDataHttpResponse&& response) {
+  std::string part = "--";
+  part += boundary;
+  part += "\r\n";
+  response.headers.emplace("Content-Length", std::to_string(response.body.size()));
+  for (const auto& [k, v] : response.headers) {
+    part += k + ": " + v + "\r\n";
+  }
+  part += "\r\n";
+  part += response.body;
+  part += "\r\n";
+  return part;
+}
+
 void ConcreteHttpSender::Close() const {
+  closing = true;
   sender.Close();
 }
 
-HttpLayer::HttpLayer(HttpParser& parser, HttpSender& sender_, HttpProcessor& processor)
-    : parser{parser}, sender{sender_}, processor{processor} {
+bool ConcreteHttpSender::Closing() const {
+  return closing;
+}
+
+ConcreteHttpResponseWriter::ConcreteHttpResponseWriter(std::shared_ptr<HttpWriterToken> token,
+    std::unique_ptr<Deflater> deflater, std::size_t lowWatermark, bool headOnly)
+    : token{std::move(token)}, deflater{std::move(deflater)}, lowWatermark{lowWatermark}, headOnly{headOnly} {
+}
+
+bool ConcreteHttpResponseWriter::Write(std::string_view data) {
+  std::lock_guard lock{token->tokenMut};
+  if (not token->sender or token->sender->Closed()) {
+    return false;
+  }
+  if (finished or headOnly) {
+    return true;
+  }
+  pending += data;
+  if (pending.size() >= writerChunkLength) {
+    FlushImpl();
+  }
+  return token->sender->BufferedBytes() <= lowWatermark;
+}
+
+void ConcreteHttpResponseWriter::Flush() {
+  std::lock_guard lock{token->tokenMut};
+  if (token->sender) {
+    FlushImpl();
+  }
+}
+
+void ConcreteHttpResponseWriter::FlushImpl() {
+  if (finished or headOnly or pending.empty()) {
+    return;
+  }
+  std::string payload;
+  AppendChunk(payload, deflater ? deflater->Compress(pending, false) : pending);
+  pending.clear();
+  if (not payload.empty()) {
+    token->sender->Send(std::move(payload));
+  }
+}
+
+void ConcreteHttpResponseWriter::Finish(HttpHeaders&& trailers) {
+  std::lock_guard lock{token->tokenMut};
+  if (finished) {
+    return;
+  }
+  finished = true;
+  if (headOnly or not token->sender) {
+    return;
+  }
+  std::string payload;
+  AppendChunk(payload, deflater ? deflater->Compress(pending, true) : pending);
+  pending.clear();
+  payload += "0\r\n";
+  for (const auto& [k, v] : trailers) {
+    payload += k + ": " + v + "\r\n";
+  }
+  payload += "\r\n";
+  token->sender->Send(std::move(payload));
+}
+
+void ConcreteHttpResponseWriter::OnWritable(std::function<void()> callback) {
+  {
+    std::lock_guard lock{token->tokenMut};
+    if (token->sender and not token->sender->Closed()) {
+      token->sender->OnDrain(lowWatermark, std::move(callback));
+      return;
+    }
+  }
+  callback();
+}
+
+bool ConcreteHttpResponseWriter::Closed() {
+  std::lock_guard lock{token->tokenMut};
+  return not token->sender or token->sender->Closed();
+}
+
+HttpStatus CountRejection(HttpRequestError error, HttpRejections& rejections) {
+  switch (error) {
+    case HttpRequestError::Malformed:
+      rejections.malformed++;
+      return HttpStatus::BadRequest;
+    case HttpRequestError::RequestLineTooLong:
+      rejections.requestLineTooLong++;
+      return HttpStatus::UriTooLong;
+    case HttpRequestError::TooManyHeaders:
+      rejections.tooManyHeaders++;
+      return HttpStatus::RequestHeaderFieldsTooLarge;
+    case HttpRequestError::HeadersTooLarge:
+      rejections.headersTooLarge++;
+      return HttpStatus::RequestHeaderFieldsTooLarge;
+    case HttpRequestError::BodyTooLarge:
+      rejections.bodyTooLarge++;
+      return HttpStatus::PayloadTooLarge;
+  }
+  return HttpStatus::BadRequest;
+}
+
+HttpLayer::HttpLayer(
+    HttpParser& parser, HttpSender& sender_, HttpStreamProcessor& processor, HttpRejections& rejections)
+    : parser{parser}, sender{sender_}, processor{processor}, rejections{rejections} {
 }
 
 bool HttpLayer::TryProcess(std::string& payload) {
-  auto request = parser.Parse(payload);
-  if (not request) {
+  if (rejected or sender.Closing()) {
+    payload.clear();
     return false;
   }
-  spdlog::debug("http layer received request: method = {}, uri = {}", ToString(request->method), request->uri);
-  processor.Process(std::move(*request));
+  if (not bodyDecoder) {
+    auto head = parser.ParseHead(payload);
+    if (const auto* error = std::get_if<HttpRequestError>(&head)) {
+      Reject(*error);
+      payload.clear();
+      return false;
+    }
+    auto* request = std::get_if<HttpRequest>(&head);
+    if (not request) {
+      return false;
+    }
+    spdlog::debug("http layer received request: method = {}, uri = {}", ToString(request->method), request->uri.Raw());
+    // Only frames the body, the dispatcher applies the body limit once it knows whether the route buffers it.
+    bodyDecoder.emplace(request->headers, std::numeric_limits<size_t>::max());
+    if (bodyDecoder->Failed()) {
+      Reject(bodyDecoder->Error());
+      payload.clear();
+      return false;
+    }
+    processor.Process(std::move(*request));
+  }
+  HttpRequestBody body;
+  if (not bodyDecoder->Decode(payload, body.data)) {
+    Reject(bodyDecoder->Error());
+    payload.clear();
+    return false;
+  }
+  body.last = bodyDecoder->Done();
+  if (body.data.empty() and not body.last) {
+    return false;
+  }
+  if (body.last) {
+    bodyDecoder.reset();
+  }
+  processor.Process(std::move(body));
+  return true;
+}
+
+void HttpLayer::Reject(HttpRequestError error) {
+  HttpResponse resp;
+  resp.status = CountRejection(error, rejections);
+  spdlog::debug("http layer rejected request: {}", ToString(resp.status));
+  resp.headers.emplace("Connection", "close");
+  sender.Send(std::move(resp));
+  sender.Close();
+  bodyDecoder.reset();
+  rejected = true;
+}
+
+bool HttpLayer::TryProcess(TcpReceiver& receiver) {
+  if (rejected or sender.Closing() or not bodyDecoder or bodyDecoder->Raw() == 0) {
+    return false;
+  }
+  const size_t n = processor.Process(receiver, bodyDecoder->Raw());
+  if (n == 0) {
+    return false;
+  }
+  bodyDecoder->Skip(n);
+  if (bodyDecoder->Done()) {
+    bodyDecoder.reset();
+    processor.Process(HttpRequestBody{{}, true});
+  }
   return true;
 }
 
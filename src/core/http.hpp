@@ -1,5 +1,11 @@
 #pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <vector>
+#include "cache.hpp"
+#include "compression.hpp"
 #include "network.hpp"
 
 namespace network {
@@ -7,6 +13,7 @@ namespace network {
 class ConcreteHttpParser final : public HttpParser {
 public:
   ConcreteHttpParser() = default;
+  explicit ConcreteHttpParser(const HttpLimits&);
   ConcreteHttpParser(const ConcreteHttpParser&) = delete;
   ConcreteHttpParser(ConcreteHttpParser&&) = delete;
   ConcreteHttpParser& operator=(const ConcreteHttpParser&) = delete;
@@ -14,9 +21,10 @@ public:
   ~ConcreteHttpParser() override = default;
 
   std::optional<HttpRequest> Parse(std::string&) const override;
+  std::variant<std::monostate, HttpRequest, HttpRequestError> ParseHead(std::string&) const override;
 
 private:
-  void Reset();
+  std::optional<HttpRequest> ParseRequest(std::string&) const;
   void SkipWhiteSpaces(std::string&) const;
   bool Consume(std::string&, std::string_view) const;
   std::optional<std::string> ParseToken(std::string&) const;
@@ -24,31 +32,147 @@ private:
   std::optional<HttpHeader> ParseHeader(std::string&) const;
   std::optional<std::string> ParseHeaderField(std::string&) const;
   std::optional<std::string> ParseLine(std::string&) const;
-  size_t FindContentLength(const HttpHeaders&) const;
-  std::string ParseUriBase(std::string&) const;
-  std::string ParseQueryKey(std::string&) const;
-  std::string ParseQueryValue(std::string&) const;
-  HttpQuery ParseQueryString(std::string&) const;
+
+  HttpLimits limits;
+};
+
+class HttpBodyDecoder {
+public:
+  HttpBodyDecoder(const HttpHeaders&, size_t);
+  bool Decode(std::string&, std::string&);
+  size_t Raw() const;
+  void Skip(size_t);
+  bool Done() const;
+  bool Failed() const;
+  HttpRequestError Error() const;
+
+private:
+  enum class State { Length, ChunkSize, ChunkData, ChunkDataEnding, Trailer, Done, Failed };
+
+  bool DecodeChunkSize(std::string&);
+  bool DecodeTrailer(std::string&);
+  bool Fail(HttpRequestError);
+
+  State state{State::Done};
+  size_t remaining{0};
+  size_t length{0};
+  size_t maxLength;
+  HttpRequestError error{HttpRequestError::Malformed};
+};
+
+struct HttpRange {
+  size_t first;
+  size_t last;
+};
+
+std::optional<std::vector<HttpRange>> ParseHttpRanges(std::string_view, size_t);
+
+// True when the Accept-Encoding header allows the content coding, an entry naming it overrides the wildcard.
+bool AcceptsEncoding(std::string_view, std::string_view);
+
+// Guesses the media type from the file extension, text/plain when unknown.
+std::string_view MimeTypeOf(std::string_view);
+
+std::string SerializeMixedReplacePart(std::string_view, MixedReplaceDataHttpResponse&&);
+
+// Shared between a sender and the writers it hands out, the sender clears it when the connection goes away.
+struct HttpWriterToken {
+  std::mutex tokenMut;
+  TcpSender* sender;
+};
+
+class ConcreteHttpResponseWriter final : public HttpResponseWriter {
+public:
+  ConcreteHttpResponseWriter(std::shared_ptr<HttpWriterToken>, std::unique_ptr<Deflater>, std::size_t, bool);
+  ConcreteHttpResponseWriter(const ConcreteHttpResponseWriter&) = delete;
+  ConcreteHttpResponseWriter(ConcreteHttpResponseWriter&&) = delete;
+  ConcreteHttpResponseWriter& operator=(const ConcreteHttpResponseWriter&) = delete;
+  ConcreteHttpResponseWriter& operator=(ConcreteHttpResponseWriter&&) = delete;
+  ~ConcreteHttpResponseWriter() override = default;
+
+  bool Write(std::string_view) override;
+  void Flush() override;
+  void Finish(HttpHeaders&&) override;
+  void OnWritable(std::function<void()>) override;
+  bool Closed() override;
+
+private:
+  void FlushImpl();
+
+  std::shared_ptr<HttpWriterToken> token;
+  std::unique_ptr<Deflater> deflater;
+  std::string pending;
+  std::size_t lowWatermark;
+  bool headOnly;
+  bool finished{false};
+};
+
+struct HttpCaches {
+  FileCache& fileCache;
+  ResponseCache* responseCache;
+  CompressionCache* compressionCache;
 };
 
 class ConcreteHttpSender final : public HttpSender {
 public:
-  explicit ConcreteHttpSender(TcpSender&);
+  ConcreteHttpSender(TcpSender&, const HttpCaches&);
+  ConcreteHttpSender(const ConcreteHttpSender&) = delete;
+  ConcreteHttpSender(ConcreteHttpSender&&) = delete;
+  ConcreteHttpSender& operator=(const ConcreteHttpSender&) = delete;
+  ConcreteHttpSender& operator=(ConcreteHttpSender&&) = delete;
+  ~ConcreteHttpSender() override;
+
   void Send(HttpResponse&&) const override;
   void Send(FileHttpResponse&&) const override;
   void Send(MixedReplaceHeaderHttpResponse&&) const override;
   void Send(MixedReplaceDataHttpResponse&&) const override;
+  void Send(SharedMixedReplaceDataHttpResponse&&) const override;
   void Send(ChunkedHeaderHttpResponse&&) const override;
   void Send(ChunkedDataHttpResponse&&) const override;
+  std::unique_ptr<HttpResponseWriter> Stream(StreamingHttpResponse&&) const override;
   void Close() const override;
+  bool Closing() const override;
+  void Prepare(const HttpRequest&);
+  void Configure(const HttpRouteOptions&);
 
 private:
+  struct RequestConditions {
+    bool headOnly{false};
+    std::string range;
+    std::string ifRange;
+    std::string ifNoneMatch;
+    std::string ifModifiedSince;
+    std::string acceptEncoding;
+    HttpCompressionOptions compression;
+  };
+
+  void SendRanges(FileHttpResponse&&, const CachedFile&, const std::vector<HttpRange>&) const;
+  void SelectEncoding(FileHttpResponse&) const;
+  std::optional<HttpContentCoding> NegotiateCoding(const HttpHeaders&) const;
+  std::unique_ptr<Deflater> SendChunkedHead(HttpHeaders&&) const;
+  void SendCompressedChunk(std::string_view) const;
+  bool RangeApplies(const CachedFile&) const;
+  bool NotModified(const CachedFile&) const;
+
   TcpSender& sender;
+  FileCache& fileCache;
+  ResponseCache* responseCache;
+  CompressionCache* compressionCache;
+  RequestConditions request;
+  mutable std::unique_ptr<Deflater> chunkedDeflater;
+  mutable std::shared_ptr<HttpWriterToken> writerToken;
+  mutable std::string mixedReplaceBoundary{"BND"};
+  // Taken from the request that attached the viewer, parts are published from another thread than the event loop.
+  mutable std::atomic<bool> mixedReplaceHeadOnly{false};
+  mutable bool closing{false};
 };
 
+// Counts the rejection and returns the status the request is answered with.
+HttpStatus CountRejection(HttpRequestError, HttpRejections&);
+
 class HttpLayer final : public ProtocolProcessor {
 public:
-  HttpLayer(HttpParser&, HttpSender&, HttpProcessor&);
+  HttpLayer(HttpParser&, HttpSender&, HttpStreamProcessor&, HttpRejections&);
   HttpLayer(const HttpLayer&) = delete;
   HttpLayer(HttpLayer&&) = delete;
   HttpLayer& operator=(const HttpLayer&) = delete;
@@ -56,11 +180,17 @@ public:
   ~HttpLayer() override = default;
 
   bool TryProcess(std::string&) override;
+  bool TryProcess(TcpReceiver&) override;
 
 private:
+  void Reject(HttpRequestError);
+
   HttpParser& parser;
   HttpSender& sender;
-  HttpProcessor& processor;
+  HttpStreamProcessor& processor;
+  HttpRejections& rejections;
+  std::optional<HttpBodyDecoder> bodyDecoder{std::nullopt};
+  bool rejected{false};
 };
 
 }  // namespace network
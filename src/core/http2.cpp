@@ -0,0 +1,1257 @@
+#include "http2.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <tuple>
+#include "common.hpp"
+#include "router.hpp"
+
+namespace {
+
+constexpr std::uint8_t dataFrame = 0x0;
+constexpr std::uint8_t headersFrame = 0x1;
+constexpr std::uint8_t priorityFrame = 0x2;
+constexpr std::uint8_t resetStreamFrame = 0x3;
+constexpr std::uint8_t settingsFrame = 0x4;
+constexpr std::uint8_t pushPromiseFrame = 0x5;
+constexpr std::uint8_t pingFrame = 0x6;
+constexpr std::uint8_t goAwayFrame = 0x7;
+constexpr std::uint8_t windowUpdateFrame = 0x8;
+constexpr std::uint8_t continuationFrame = 0x9;
+constexpr std::uint8_t priorityUpdateFrame = 0x10;
+
+constexpr std::uint8_t endStreamFlag = 0x1;
+constexpr std::uint8_t ackFlag = 0x1;
+constexpr std::uint8_t endHeadersFlag = 0x4;
+constexpr std::uint8_t paddedFlag = 0x8;
+constexpr std::uint8_t priorityFlag = 0x20;
+
+constexpr std::uint32_t noError = 0x0;
+constexpr std::uint32_t protocolError = 0x1;
+constexpr std::uint32_t internalError = 0x2;
+constexpr std::uint32_t flowControlError = 0x3;
+constexpr std::uint32_t streamClosedError = 0x5;
+constexpr std::uint32_t frameSizeError = 0x6;
+constexpr std::uint32_t refusedStreamError = 0x7;
+constexpr std::uint32_t cancelError = 0x8;
+constexpr std::uint32_t compressionError = 0x9;
+constexpr std::uint32_t enhanceYourCalmError = 0xb;
+constexpr std::uint32_t http11RequiredError = 0xd;
+
+constexpr std::uint16_t headerTableSizeSetting = 0x1;
+constexpr std::uint16_t enablePushSetting = 0x2;
+constexpr std::uint16_t maxConcurrentStreamsSetting = 0x3;
+constexpr std::uint16_t initialWindowSizeSetting = 0x4;
+constexpr std::uint16_t maxFrameSizeSetting = 0x5;
+constexpr std::uint16_t maxHeaderListSizeSetting = 0x6;
+
+constexpr std::size_t frameHeaderLength = 9;
+constexpr std::size_t settingLength = 6;
+constexpr std::size_t defaultFrameSize = 16384;
+constexpr std::size_t maxFrameSizeLimit = (1 << 24) - 1;
+constexpr std::int64_t defaultWindow = 65535;
+constexpr std::int64_t maxWindow = 0x7fffffff;
+constexpr std::size_t maxConcurrentStreams = 100;
+// Streams the client may reset before resets have to stay under half of the opened streams, see "rapid reset".
+constexpr std::uint64_t freeClientResets = maxConcurrentStreams;
+// Bounds the CONTINUATION frames of one header block, empty ones would otherwise never hit the size limit.
+constexpr std::size_t maxHeaderBlockFrames = 32;
+constexpr std::int64_t streamReceiveWindow = 1 << 20;
+constexpr std::int64_t connectionReceiveWindow = 4 << 20;
+// Frames are only handed to the socket while less than this is queued there, so that priorities still apply.
+constexpr std::size_t sendHighWatermark = 256 << 10;
+constexpr std::size_t sendLowWatermark = 64 << 10;
+
+std::uint32_t ReadUint32(std::string_view s) {
+  return static_cast<std::uint32_t>(static_cast<std::uint8_t>(s[0])) << 24 |
+         static_cast<std::uint32_t>(static_cast<std::uint8_t>(s[1])) << 16 |
+         static_cast<std::uint32_t>(static_cast<std::uint8_t>(s[2])) << 8 | static_cast<std::uint8_t>(s[3]);
+}
+
+void AppendUint32(std::string& out, std::uint32_t value) {
+  out += static_cast<char>(value >> 24);
+  out += static_cast<char>(value >> 16);
+  out += static_cast<char>(value >> 8);
+  out += static_cast<char>(value);
+}
+
+void AppendSetting(std::string& out, std::uint16_t id, std::uint32_t value) {
+  out += static_cast<char>(id >> 8);
+  out += static_cast<char>(id);
+  AppendUint32(out, value);
+}
+
+void EncodeFrameHeader(char (&header)[frameHeaderLength], std::size_t length, std::uint8_t type, std::uint8_t flags,
+    std::uint32_t id) {
+  header[0] = static_cast<char>(length >> 16);
+  header[1] = static_cast<char>(length >> 8);
+  header[2] = static_cast<char>(length);
+  header[3] = static_cast<char>(type);
+  header[4] = static_cast<char>(flags);
+  header[5] = static_cast<char>(id >> 24);
+  header[6] = static_cast<char>(id >> 16);
+  header[7] = static_cast<char>(id >> 8);
+  header[8] = static_cast<char>(id);
+}
+
+bool StripPadding(std::uint8_t flags, std::string_view& payload) {
+  if (not(flags & paddedFlag)) {
+    return true;
+  }
+  if (payload.empty()) {
+    return false;
+  }
+  const auto padding = static_cast<std::uint8_t>(payload.front());
+  payload.remove_prefix(1);
+  if (padding > payload.size()) {
+    return false;
+  }
+  payload.remove_suffix(padding);
+  return true;
+}
+
+std::optional<network::HttpMethod> MethodOf(std::string_view method) {
+  if (method == "GET") {
+    return network::HttpMethod::GET;
+  }
+  if (method == "HEAD") {
+    return network::HttpMethod::HEAD;
+  }
+  if (method == "PUT") {
+    return network::HttpMethod::PUT;
+  }
+  if (method == "POST") {
+    return network::HttpMethod::POST;
+  }
+  if (method == "DELETE") {
+    return network::HttpMethod::DELETE;
+  }
+  return std::nullopt;
+}
+
+bool IsConnectionHeader(std::string_view name) {
+  return name == "connection" or name == "keep-alive" or name == "proxy-connection" or name == "transfer-encoding" or
+         name == "upgrade";
+}
+
+// Reads the RFC 9218 urgency and incremental parameters, leaving them untouched when absent.
+void ParsePriority(std::string_view value, std::uint8_t& urgency, bool& incremental) {
+  while (not value.empty()) {
+    auto comma = value.find(',');
+    auto item = common::Trim(value.substr(0, comma));
+    value = comma == value.npos ? std::string_view{} : value.substr(comma + 1);
+    if (item.size() == 3 and item.starts_with("u=") and item[2] >= '0' and item[2] <= '7') {
+      urgency = item[2] - '0';
+    } else if (item == "i" or item == "i=?1") {
+      incremental = true;
+    } else if (item == "i=?0") {
+      incremental = false;
+    }
+  }
+}
+
+std::size_t LengthOf(const network::Http2HeadersOutput&) {
+  return 0;
+}
+
+std::size_t LengthOf(const network::Http2DataOutput& data) {
+  return data.length;
+}
+
+std::size_t LengthOf(const network::Http2FileOutput& file) {
+  return file.length;
+}
+
+std::size_t LengthOf(const network::Http2Output& output) {
+  return std::visit([](const auto& o) { return LengthOf(o); }, output);
+}
+
+}  // namespace
+
+namespace network {
+
+std::optional<std::string> DecodeHttp2Settings(std::string_view value) {
+  std::string padded{value};
+  for (auto& c : padded) {
+    if (c == '-') {
+      c = '+';
+    } else if (c == '_') {
+      c = '/';
+    }
+  }
+  padded.resize((padded.size() + 3) / 4 * 4, '=');
+  std::string settings(padded.size() / 4 * 3, '\0');
+  auto length = common::Base64Decode(padded, settings.data());
+  if (not length or *length % settingLength != 0) {
+    return std::nullopt;
+  }
+  settings.resize(*length);
+  return settings;
+}
+
+Http2StreamSender::Http2StreamSender(Http2Layer& layer, std::uint32_t id) : layer{layer}, id{id} {
+}
+
+void Http2StreamSender::Send(std::string_view buffer) {
+  layer.Write(id, std::make_shared<const std::string>(buffer), 0, buffer.size(), false);
+}
+
+void Http2StreamSender::Send(std::string_view head, std::string_view body) {
+  std::string buffer;
+  buffer.reserve(head.size() + body.size());
+  buffer += head;
+  buffer += body;
+  Send(buffer);
+}
+
+void Http2StreamSender::Send(os::File file) {
+  Send(std::make_shared<const os::File>(std::move(file)));
+}
+
+void Http2StreamSender::Send(std::shared_ptr<const os::File> file) {
+  const size_t size = file->Size();
+  layer.Write(id, std::move(file), 0, size);
+}
+
+void Http2StreamSender::Send(std::shared_ptr<const os::File> file, size_t offset, size_t size) {
+  layer.Write(id, std::move(file), offset, size);
+}
+
+void Http2StreamSender::Send(std::shared_ptr<const std::string> buffer) {
+  const size_t size = buffer->size();
+  layer.Write(id, std::move(buffer), 0, size, false);
+}
+
+void Http2StreamSender::SendLatest(std::shared_ptr<const std::string> buffer) {
+  const size_t size = buffer->size();
+  layer.Write(id, std::move(buffer), 0, size, true);
+}
+
+void Http2StreamSender::SendBuffered() {
+}
+
+void Http2StreamSender::Shape(const BandwidthLimit& limit) {
+  if (limit.bytesPerSecond > 0) {
+    layer.Reset(id, http11RequiredError);
+  }
+}
+
+void Http2StreamSender::Coalesce(std::chrono::nanoseconds) {
+}
+
+void Http2StreamSender::Cork() {
+}
+
+void Http2StreamSender::Uncork() {
+}
+
+std::size_t Http2StreamSender::Backlog() {
+  return layer.Backlog(id);
+}
+
+std::size_t Http2StreamSender::BufferedBytes() {
+  return layer.BufferedBytes(id);
+}
+
+void Http2StreamSender::OnDrain(std::size_t threshold, std::function<void()> callback) {
+  layer.OnDrain(id, threshold, std::move(callback));
+}
+
+bool Http2StreamSender::Closed() {
+  return layer.Closed(id);
+}
+
+void Http2StreamSender::Close() {
+  layer.Close(id);
+}
+
+void Http2StreamSender::Abort() {
+  layer.Reset(id, cancelError);
+}
+
+std::uint32_t Http2StreamSender::Id() const {
+  return id;
+}
+
+Http2Layer::Stream::Stream(Http2Layer& layer, std::uint32_t id, std::int64_t sendWindow, const HttpCaches& caches)
+    : tcpSender{layer, id}, httpSender{tcpSender, caches}, sendWindow{sendWindow}, receiveWindow{streamReceiveWindow} {
+}
+
+Http2Layer::Http2Layer(TcpSender& sender, HttpRouteMapping& mapping, const HttpLimits& limits,
+    HttpRejections& rejections, const HttpCaches& caches)
+    : sender{sender},
+      mapping{mapping},
+      limits{limits},
+      rejections{rejections},
+      caches{caches},
+      sendWindow{defaultWindow},
+      receiveWindow{connectionReceiveWindow},
+      initialSendWindow{defaultWindow},
+      maxFrameSize{defaultFrameSize} {
+  std::string settings;
+  AppendSetting(settings, maxConcurrentStreamsSetting, maxConcurrentStreams);
+  AppendSetting(settings, initialWindowSizeSetting, streamReceiveWindow);
+  AppendSetting(settings, maxHeaderListSizeSetting, HeaderListLimit());
+  std::lock_guard lock{connectionMut};
+  SendFrame(settingsFrame, 0, 0, settings);
+  SendWindowUpdate(0, connectionReceiveWindow - defaultWindow);
+}
+
+Http2Layer::~Http2Layer() {
+  sender.OnDrain(0, nullptr);
+  std::map<std::uint32_t, std::unique_ptr<Stream>> finished;
+  std::lock_guard lock{connectionMut};
+  finished.swap(streams);
+}
+
+void Http2Layer::Upgrade(HttpRequest&& req, std::string_view settings) {
+  std::uint32_t error;
+  {
+    std::lock_guard lock{connectionMut};
+    error = ApplySettings(settings);
+  }
+  if (error != noError) {
+    Fail(error);
+    return;
+  }
+  lastStreamId = 1;
+  auto& stream = Open(1);
+  stream.requestEnded = true;
+  Dispatch(stream, std::move(req));
+}
+
+bool Http2Layer::TryProcess(std::string& buffer) {
+  if (closed) {
+    buffer.clear();
+    return false;
+  }
+  if (not prefaceReceived) {
+    if (buffer.size() < http2Preface.size()) {
+      return false;
+    }
+    if (not buffer.starts_with(http2Preface)) {
+      Fail(protocolError);
+      buffer.clear();
+      return false;
+    }
+    buffer.erase(0, http2Preface.size());
+    prefaceReceived = true;
+  }
+  if (buffer.size() < frameHeaderLength) {
+    return false;
+  }
+  const std::size_t length = ReadUint32(buffer) >> 8;
+  if (length > defaultFrameSize) {
+    Fail(frameSizeError);
+    buffer.clear();
+    return false;
+  }
+  if (buffer.size() < frameHeaderLength + length) {
+    return false;
+  }
+  const auto type = static_cast<std::uint8_t>(buffer[3]);
+  const auto flags = static_cast<std::uint8_t>(buffer[4]);
+  const auto id = ReadUint32(std::string_view{buffer}.substr(5)) & 0x7fffffff;
+  if (not ProcessFrame(type, flags, id, std::string_view{buffer}.substr(frameHeaderLength, length))) {
+    buffer.clear();
+    return false;
+  }
+  buffer.erase(0, frameHeaderLength + length);
+  RunDrained();
+  Reap();
+  return not closed;
+}
+
+bool Http2Layer::TryProcess(TcpReceiver&) {
+  return false;
+}
+
+bool Http2Layer::ProcessFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t id, std::string_view payload) {
+  if (continuationStreamId != 0 and (type != continuationFrame or id != continuationStreamId)) {
+    return Fail(protocolError);
+  }
+  switch (type) {
+    case dataFrame:
+      return ProcessData(flags, id, payload);
+    case headersFrame:
+      return ProcessHeaders(flags, id, payload);
+    case priorityFrame:
+      if (id == 0) {
+        return Fail(protocolError);
+      }
+      if (payload.size() != 5) {
+        Reset(id, frameSizeError);
+      }
+      return true;
+    case resetStreamFrame:
+      return ProcessResetStream(id, payload);
+    case settingsFrame:
+      return ProcessSettings(flags, id, payload);
+    case pushPromiseFrame:
+      return Fail(protocolError);
+    case pingFrame: {
+      if (id != 0) {
+        return Fail(protocolError);
+      }
+      if (payload.size() != 8) {
+        return Fail(frameSizeError);
+      }
+      if (not(flags & ackFlag)) {
+        std::lock_guard lock{connectionMut};
+        SendFrame(pingFrame, ackFlag, 0, payload);
+      }
+      return true;
+    }
+    case goAwayFrame:
+      if (id != 0) {
+        return Fail(protocolError);
+      }
+      goingAway = true;
+      return true;
+    case windowUpdateFrame:
+      return ProcessWindowUpdate(id, payload);
+    case continuationFrame:
+      if (continuationStreamId == 0) {
+        return Fail(protocolError);
+      }
+      headerBlock += payload;
+      if (headerBlock.size() > HeaderListLimit() or ++headerBlockFrames > maxHeaderBlockFrames) {
+        return Fail(enhanceYourCalmError);
+      }
+      if (not(flags & endHeadersFlag)) {
+        return true;
+      }
+      continuationStreamId = 0;
+      return ProcessHeaderBlock(id, continuationFlags & endStreamFlag);
+    case priorityUpdateFrame:
+      return ProcessPriorityUpdate(id, payload);
+  }
+  return true;
+}
+
+bool Http2Layer::ProcessHeaders(std::uint8_t flags, std::uint32_t id, std::string_view payload) {
+  if (id == 0 or id % 2 == 0) {
+    return Fail(protocolError);
+  }
+  if (not StripPadding(flags, payload)) {
+    return Fail(protocolError);
+  }
+  if (flags & priorityFlag) {
+    if (payload.size() < 5) {
+      return Fail(frameSizeError);
+    }
+    payload.remove_prefix(5);
+  }
+  if (payload.size() > HeaderListLimit()) {
+    return Fail(enhanceYourCalmError);
+  }
+  headerBlock = payload;
+  if (not(flags & endHeadersFlag)) {
+    continuationStreamId = id;
+    continuationFlags = flags;
+    headerBlockFrames = 1;
+    return true;
+  }
+  return ProcessHeaderBlock(id, flags & endStreamFlag);
+}
+
+bool Http2Layer::ProcessHeaderBlock(std::uint32_t id, bool endStream) {
+  auto decoded = decoder.Decode(headerBlock, HeaderListLimit());
+  headerBlock.clear();
+  auto* fields = std::get_if<std::vector<HttpHeader>>(&decoded);
+  if (not fields and std::get<HttpRequestError>(decoded) == HttpRequestError::Malformed) {
+    return Fail(compressionError);
+  }
+  if (auto* stream = Find(id)) {
+    if (stream->requestEnded) {
+      Reset(id, streamClosedError);
+    } else if (not endStream) {
+      Reset(id, protocolError);
+    } else {
+      Deliver(*stream, HttpRequestBody{{}, true});
+    }
+    return true;
+  }
+  if (id <= lastStreamId) {
+    return Fail(streamClosedError);
+  }
+  lastStreamId = id;
+  const auto open = std::count_if(streams.begin(), streams.end(), [](const auto& entry) {
+    return not entry.second->reset and not(entry.second->requestEnded and entry.second->responseEnded);
+  });
+  if (static_cast<std::size_t>(open) >= maxConcurrentStreams) {
+    Reset(id, refusedStreamError);
+    return true;
+  }
+  auto& stream = Open(id);
+  streamsOpened++;
+  stream.requestEnded = endStream;
+  if (not fields) {
+    Reject(stream, std::get<HttpRequestError>(decoded));
+    return true;
+  }
+  HttpRequest req;
+  req.version = "HTTP/2";
+  std::optional<HttpMethod> method;
+  std::string path;
+  std::string authority;
+  std::size_t count = 0;
+  bool malformed = false;
+  for (auto& [name, value] : *fields) {
+    if (name.starts_with(':')) {
+      if (count > 0) {
+        malformed = true;
+      } else if (name == ":method") {
+        method = MethodOf(value);
+      } else if (name == ":path") {
+        path = std::move(value);
+      } else if (name == ":authority") {
+        authority = std::move(value);
+      } else if (name != ":scheme") {
+        malformed = true;
+      }
+      continue;
+    }
+    count++;
+    const bool upper = std::any_of(name.begin(), name.end(), [](unsigned char c) { return std::isupper(c); });
+    if (IsConnectionHeader(name) or upper) {
+      malformed = true;
+    }
+    auto [it, inserted] = req.headers.try_emplace(name, value);
+    if (not inserted) {
+      it->second += name == "cookie" ? "; " : ", ";
+      it->second += value;
+    }
+  }
+  if (malformed or not method or path.empty()) {
+    Reject(stream, HttpRequestError::Malformed);
+    return true;
+  }
+  if (path.size() > limits.maxRequestLineLength) {
+    Reject(stream, HttpRequestError::RequestLineTooLong);
+    return true;
+  }
+  if (count > limits.maxHeaderCount) {
+    Reject(stream, HttpRequestError::TooManyHeaders);
+    return true;
+  }
+  if (auto it = req.headers.find("content-length"); it != req.headers.end()) {
+    std::size_t length = 0;
+    auto [p, ec] = std::from_chars(it->second.data(), it->second.data() + it->second.size(), length);
+    if (ec != std::errc{} or p != it->second.data() + it->second.size()) {
+      Reject(stream,
+          ec == std::errc::result_out_of_range ? HttpRequestError::BodyTooLarge : HttpRequestError::Malformed);
+      return true;
+    }
+  }
+  if (not authority.empty()) {
+    req.headers.try_emplace("host", std::move(authority));
+  }
+  req.method = *method;
+  req.uri = Uri{std::move(path)};
+  Dispatch(stream, std::move(req));
+  return true;
+}
+
+void Http2Layer::Dispatch(Stream& stream, HttpRequest&& req) {
+  {
+    std::lock_guard lock{connectionMut};
+    stream.headOnly = req.method == HttpMethod::HEAD;
+    if (auto it = req.headers.find("priority"); it != req.headers.end()) {
+      ParsePriority(it->second, stream.urgency, stream.incremental);
+    }
+  }
+  spdlog::debug("http2 layer received request: stream = {}, uri = {}", lastStreamId, req.uri.Raw());
+  stream.processor = std::make_unique<HttpDispatcher>(mapping, limits, rejections, stream.httpSender, stream.tcpSender);
+  stream.processor->Process(std::move(req));
+  if (stream.requestEnded) {
+    stream.processor->Process(HttpRequestBody{{}, true});
+  }
+  Abandon(stream);
+}
+
+void Http2Layer::Reject(Stream& stream, HttpRequestError error) {
+  HttpResponse resp;
+  resp.status = CountRejection(error, rejections);
+  spdlog::debug("http2 layer rejected request: stream = {}", lastStreamId);
+  stream.rejected = true;
+  stream.httpSender.Send(std::move(resp));
+}
+
+void Http2Layer::Deliver(Stream& stream, HttpRequestBody&& body) {
+  stream.requestEnded = body.last;
+  if (stream.rejected or not stream.processor) {
+    return;
+  }
+  stream.processor->Process(std::move(body));
+  Abandon(stream);
+}
+
+void Http2Layer::Abandon(Stream& stream) {
+  // The dispatcher closes the sender when it refuses a request, the rest of the body is then dropped.
+  if (stream.rejected or not stream.httpSender.Closing()) {
+    return;
+  }
+  std::lock_guard lock{connectionMut};
+  stream.rejected = true;
+  if (stream.responseEnded and not stream.requestEnded) {
+    ResetLocked(stream, stream.tcpSender.Id(), noError);
+  }
+}
+
+bool Http2Layer::ProcessData(std::uint8_t flags, std::uint32_t id, std::string_view payload) {
+  if (id == 0) {
+    return Fail(protocolError);
+  }
+  const auto length = static_cast<std::int64_t>(payload.size());
+  if (not StripPadding(flags, payload)) {
+    return Fail(protocolError);
+  }
+  if (length > receiveWindow) {
+    return Fail(flowControlError);
+  }
+  receiveWindow -= length;
+  received += length;
+  if (received >= connectionReceiveWindow / 2) {
+    std::lock_guard lock{connectionMut};
+    SendWindowUpdate(0, received);
+    receiveWindow += received;
+    received = 0;
+  }
+  auto* stream = Find(id);
+  if (not stream or stream->requestEnded) {
+    if (id > lastStreamId) {
+      return Fail(protocolError);
+    }
+    Reset(id, streamClosedError);
+    return true;
+  }
+  if (length > stream->receiveWindow) {
+    Reset(id, flowControlError);
+    return true;
+  }
+  const bool end = flags & endStreamFlag;
+  stream->receiveWindow -= length;
+  stream->received += length;
+  if (not end and stream->received >= streamReceiveWindow / 2) {
+    std::lock_guard lock{connectionMut};
+    SendWindowUpdate(id, stream->received);
+    stream->receiveWindow += stream->received;
+    stream->received = 0;
+  }
+  Deliver(*stream, HttpRequestBody{std::string{payload}, end});
+  return true;
+}
+
+bool Http2Layer::ProcessSettings(std::uint8_t flags, std::uint32_t id, std::string_view payload) {
+  if (id != 0) {
+    return Fail(protocolError);
+  }
+  if (flags & ackFlag) {
+    return payload.empty() or Fail(frameSizeError);
+  }
+  if (payload.size() % settingLength != 0) {
+    return Fail(frameSizeError);
+  }
+  std::uint32_t error;
+  {
+    std::lock_guard lock{connectionMut};
+    error = ApplySettings(payload);
+    if (error == noError) {
+      SendFrame(settingsFrame, ackFlag, 0);
+      Flush();
+    }
+  }
+  return error == noError or Fail(error);
+}
+
+std::uint32_t Http2Layer::ApplySettings(std::string_view payload) {
+  for (; payload.size() >= settingLength; payload.remove_prefix(settingLength)) {
+    const auto setting = static_cast<std::uint16_t>(static_cast<std::uint8_t>(payload[0]) << 8 |
+                                                    static_cast<std::uint8_t>(payload[1]));
+    const auto value = ReadUint32(payload.substr(2));
+    switch (setting) {
+      case headerTableSizeSetting:
+        encoder.Resize(value);
+        break;
+      case enablePushSetting:
+        if (value > 1) {
+          return protocolError;
+        }
+        break;
+      case initialWindowSizeSetting: {
+        if (value > maxWindow) {
+          return flowControlError;
+        }
+        const std::int64_t delta = static_cast<std::int64_t>(value) - initialSendWindow;
+        for (auto& [_, stream] : streams) {
+          stream->sendWindow += delta;
+          if (stream->sendWindow > maxWindow) {
+            return flowControlError;
+          }
+        }
+        initialSendWindow = value;
+        break;
+      }
+      case maxFrameSizeSetting:
+        if (value < defaultFrameSize or value > maxFrameSizeLimit) {
+          return protocolError;
+        }
+        maxFrameSize = value;
+        break;
+    }
+  }
+  return noError;
+}
+
+bool Http2Layer::ProcessWindowUpdate(std::uint32_t id, std::string_view payload) {
+  if (payload.size() != 4) {
+    return Fail(frameSizeError);
+  }
+  const std::int64_t increment = ReadUint32(payload) & 0x7fffffff;
+  std::uint32_t error = noError;
+  {
+    std::lock_guard lock{connectionMut};
+    if (id == 0) {
+      sendWindow += increment;
+      error = increment == 0 ? protocolError : sendWindow > maxWindow ? flowControlError : noError;
+    } else if (auto* stream = Find(id)) {
+      stream->sendWindow += increment;
+      if (increment == 0 or stream->sendWindow > maxWindow) {
+        ResetLocked(*stream, id, increment == 0 ? protocolError : flowControlError);
+      }
+    }
+    if (error == noError) {
+      Flush();
+    }
+  }
+  return error == noError or Fail(error);
+}
+
+bool Http2Layer::ProcessResetStream(std::uint32_t id, std::string_view payload) {
+  if (id == 0) {
+    return Fail(protocolError);
+  }
+  if (payload.size() != 4) {
+    return Fail(frameSizeError);
+  }
+  if (id > lastStreamId) {
+    return Fail(protocolError);
+  }
+  if (++clientResets > freeClientResets and clientResets * 2 > streamsOpened) {
+    return Fail(enhanceYourCalmError);
+  }
+  std::lock_guard lock{connectionMut};
+  if (auto* stream = Find(id)) {
+    stream->reset = true;
+    stream->outbound.clear();
+    stream->outboundBytes = 0;
+    stream->onDrain = nullptr;
+  }
+  return true;
+}
+
+bool Http2Layer::ProcessPriorityUpdate(std::uint32_t id, std::string_view payload) {
+  if (id != 0) {
+    return Fail(protocolError);
+  }
+  if (payload.size() < 4) {
+    return Fail(frameSizeError);
+  }
+  std::lock_guard lock{connectionMut};
+  if (auto* stream = Find(ReadUint32(payload) & 0x7fffffff)) {
+    ParsePriority(payload.substr(4), stream->urgency, stream->incremental);
+  }
+  return true;
+}
+
+bool Http2Layer::Fail(std::uint32_t error) {
+  spdlog::debug("http2 layer connection error: {}", error);
+  {
+    std::lock_guard lock{connectionMut};
+    std::string payload;
+    AppendUint32(payload, lastStreamId);
+    AppendUint32(payload, error);
+    SendFrame(goAwayFrame, 0, 0, payload);
+    closed = true;
+  }
+  sender.Close();
+  return false;
+}
+
+std::size_t Http2Layer::HeaderListLimit() const {
+  return limits.maxRequestLineLength + limits.maxHeaderLength;
+}
+
+Http2Layer::Stream& Http2Layer::Open(std::uint32_t id) {
+  std::lock_guard lock{connectionMut};
+  auto stream = std::make_unique<Stream>(*this, id, initialSendWindow, caches);
+  return *streams.emplace(id, std::move(stream)).first->second;
+}
+
+Http2Layer::Stream* Http2Layer::Find(std::uint32_t id) {
+  auto it = streams.find(id);
+  return it == streams.end() ? nullptr : it->second.get();
+}
+
+void Http2Layer::Write(std::uint32_t id, std::shared_ptr<const std::string> buffer, std::size_t offset,
+    std::size_t length, bool latest) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  if (closed or not stream or stream->reset) {
+    return;
+  }
+  if (latest and stream->framing == Framing::UntilClose and not stream->outbound.empty()) {
+    auto* last = std::get_if<Http2DataOutput>(&stream->outbound.back());
+    if (last and last->latest) {
+      stream->outboundBytes = stream->outboundBytes - last->length + length;
+      *last = Http2DataOutput{std::move(buffer), offset, length, false, true};
+      return;
+    }
+  }
+  Translate(*stream, std::move(buffer), offset, length, latest);
+  Flush();
+}
+
+void Http2Layer::Write(
+    std::uint32_t id, std::shared_ptr<const os::File> file, std::size_t offset, std::size_t length) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  if (closed or not stream or stream->reset or stream->framing != Framing::Length) {
+    return;
+  }
+  length = std::min(length, stream->remaining);
+  stream->remaining -= length;
+  if (stream->remaining == 0) {
+    stream->framing = Framing::Done;
+  }
+  Enqueue(*stream, Http2FileOutput{std::move(file), offset, length, stream->remaining == 0});
+  Flush();
+}
+
+void Http2Layer::Translate(Stream& stream, std::shared_ptr<const std::string> buffer, std::size_t offset,
+    std::size_t length, bool latest) {
+  if (not stream.pending.empty()) {
+    stream.pending.append(*buffer, offset, length);
+    buffer = std::make_shared<const std::string>(std::move(stream.pending));
+    stream.pending.clear();
+    offset = 0;
+    length = buffer->size();
+  }
+  const std::string_view view{buffer->data() + offset, length};
+  std::size_t pos = 0;
+  auto data = [&](std::size_t n, bool end) {
+    Enqueue(stream, Http2DataOutput{buffer, offset + pos, n, end, latest});
+    pos += n;
+  };
+  while (pos < view.size()) {
+    switch (stream.framing) {
+      case Framing::Head: {
+        const auto end = view.find("\r\n\r\n", pos);
+        if (end == view.npos) {
+          stream.pending = view.substr(pos);
+          return;
+        }
+        if (not TranslateHead(stream, view.substr(pos, end - pos))) {
+          return;
+        }
+        pos = end + 4;
+        break;
+      }
+      case Framing::Length: {
+        const std::size_t n = std::min(stream.remaining, view.size() - pos);
+        stream.remaining -= n;
+        if (stream.remaining == 0) {
+          stream.framing = Framing::Done;
+        }
+        data(n, stream.remaining == 0);
+        break;
+      }
+      case Framing::UntilClose:
+        data(view.size() - pos, false);
+        break;
+      case Framing::ChunkSize: {
+        const auto eol = view.find("\r\n", pos);
+        if (eol == view.npos) {
+          stream.pending = view.substr(pos);
+          return;
+        }
+        stream.remaining = 0;
+        const auto [p, ec] = std::from_chars(view.data() + pos, view.data() + eol, stream.remaining, 16);
+        if (ec != std::errc{} or (p != view.data() + eol and *p != ';')) {
+          spdlog::error("http2 layer cannot frame response: stream = {}, bad chunk size", stream.tcpSender.Id());
+          ResetLocked(stream, stream.tcpSender.Id(), internalError);
+          return;
+        }
+        stream.framing = stream.remaining > 0 ? Framing::ChunkData : Framing::Trailers;
+        pos = eol + 2;
+        break;
+      }
+      case Framing::ChunkData: {
+        const std::size_t n = std::min(stream.remaining, view.size() - pos);
+        stream.remaining -= n;
+        if (stream.remaining == 0) {
+          stream.framing = Framing::ChunkDataEnding;
+        }
+        data(n, false);
+        break;
+      }
+      case Framing::ChunkDataEnding:
+        if (view.size() - pos < 2) {
+          stream.pending = view.substr(pos);
+          return;
+        }
+        stream.framing = Framing::ChunkSize;
+        pos += 2;
+        break;
+      case Framing::Trailers: {
+        const auto eol = view.find("\r\n", pos);
+        if (eol == view.npos) {
+          stream.pending = view.substr(pos);
+          return;
+        }
+        const auto line = view.substr(pos, eol - pos);
+        pos = eol + 2;
+        if (not line.empty()) {
+          const auto colon = line.find(':');
+          std::string name{common::Trim(line.substr(0, colon))};
+          common::ToLower(name);
+          if (colon != line.npos and not IsConnectionHeader(name)) {
+            stream.trailers.emplace_back(std::move(name), std::string{common::Trim(line.substr(colon + 1))});
+          }
+          break;
+        }
+        stream.framing = Framing::Done;
+        if (stream.trailers.empty()) {
+          Enqueue(stream, Http2DataOutput{nullptr, 0, 0, true});
+        } else {
+          Enqueue(stream, Http2HeadersOutput{std::move(stream.trailers), true});
+        }
+        break;
+      }
+      case Framing::Done:
+        return;
+    }
+  }
+}
+
+bool Http2Layer::TranslateHead(Stream& stream, std::string_view head) {
+  const auto eol = head.find("\r\n");
+  const auto statusLine = head.substr(0, eol);
+  const auto space = statusLine.find(' ');
+  const auto status = space == statusLine.npos ? std::string_view{} : statusLine.substr(space + 1, 3);
+  std::vector<HttpHeader> headers{{":status", std::string{status}}};
+  std::optional<std::size_t> contentLength;
+  bool chunked = false;
+  auto rest = eol == head.npos ? std::string_view{} : head.substr(eol + 2);
+  while (not rest.empty()) {
+    const auto lineEnd = rest.find("\r\n");
+    const auto line = rest.substr(0, lineEnd);
+    rest = lineEnd == rest.npos ? std::string_view{} : rest.substr(lineEnd + 2);
+    const auto colon = line.find(':');
+    if (colon == line.npos) {
+      continue;
+    }
+    std::string name{common::Trim(line.substr(0, colon))};
+    common::ToLower(name);
+    const auto value = common::Trim(line.substr(colon + 1));
+    chunked = chunked or name == "transfer-encoding";
+    if (IsConnectionHeader(name)) {
+      continue;
+    }
+    if (name == "content-length") {
+      std::size_t length = 0;
+      const auto [p, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+      if (ec != std::errc{} or p != value.data() + value.size()) {
+        spdlog::error("http2 layer cannot frame response: stream = {}, bad length", stream.tcpSender.Id());
+        ResetLocked(stream, stream.tcpSender.Id(), internalError);
+        return false;
+      }
+      contentLength = length;
+    }
+    headers.emplace_back(std::move(name), std::string{value});
+  }
+  if (status.starts_with('1')) {
+    Enqueue(stream, Http2HeadersOutput{std::move(headers), false});
+    return true;
+  }
+  if (stream.headOnly or status == "204" or status == "304" or (not chunked and contentLength == 0)) {
+    stream.framing = Framing::Done;
+    Enqueue(stream, Http2HeadersOutput{std::move(headers), true});
+    return true;
+  }
+  Enqueue(stream, Http2HeadersOutput{std::move(headers), false});
+  if (chunked) {
+    stream.framing = Framing::ChunkSize;
+  } else if (contentLength) {
+    stream.framing = Framing::Length;
+    stream.remaining = *contentLength;
+  } else {
+    stream.framing = Framing::UntilClose;
+  }
+  return true;
+}
+
+void Http2Layer::Enqueue(Stream& stream, Http2Output&& output) {
+  stream.outboundBytes += LengthOf(output);
+  stream.outbound.emplace_back(std::move(output));
+}
+
+void Http2Layer::Close(std::uint32_t id) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  if (closed or not stream or stream->reset or stream->framing == Framing::Done) {
+    return;
+  }
+  if (stream->framing != Framing::UntilClose) {
+    ResetLocked(*stream, id, internalError);
+    return;
+  }
+  stream->framing = Framing::Done;
+  Enqueue(*stream, Http2DataOutput{nullptr, 0, 0, true});
+  Flush();
+}
+
+void Http2Layer::Reset(std::uint32_t id, std::uint32_t error) {
+  std::lock_guard lock{connectionMut};
+  if (auto* stream = Find(id)) {
+    ResetLocked(*stream, id, error);
+    return;
+  }
+  std::string payload;
+  AppendUint32(payload, error);
+  SendFrame(resetStreamFrame, 0, id, payload);
+}
+
+void Http2Layer::ResetLocked(Stream& stream, std::uint32_t id, std::uint32_t error) {
+  if (stream.reset or closed) {
+    return;
+  }
+  std::string payload;
+  AppendUint32(payload, error);
+  SendFrame(resetStreamFrame, 0, id, payload);
+  stream.reset = true;
+  stream.outbound.clear();
+  stream.outboundBytes = 0;
+  if (stream.onDrain) {
+    drained.emplace_back(id, std::exchange(stream.onDrain, nullptr));
+  }
+  sender.OnDrain(sendLowWatermark, [this] { OnWritable(); });
+}
+
+std::size_t Http2Layer::Backlog(std::uint32_t id) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  return stream ? stream->outbound.size() : 0;
+}
+
+std::size_t Http2Layer::BufferedBytes(std::uint32_t id) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  return stream ? stream->outboundBytes : 0;
+}
+
+void Http2Layer::OnDrain(std::uint32_t id, std::size_t threshold, std::function<void()> callback) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  if (closed or not stream or stream->reset) {
+    return;
+  }
+  stream->drainThreshold = threshold;
+  stream->onDrain = std::move(callback);
+  if (stream->onDrain and stream->outboundBytes <= threshold) {
+    drained.emplace_back(id, std::exchange(stream->onDrain, nullptr));
+    sender.OnDrain(sendLowWatermark, [this] { OnWritable(); });
+  }
+}
+
+bool Http2Layer::Closed(std::uint32_t id) {
+  std::lock_guard lock{connectionMut};
+  auto* stream = Find(id);
+  return closed or not stream or stream->reset or sender.Closed();
+}
+
+void Http2Layer::Flush() {
+  if (closed) {
+    return;
+  }
+  bool blocked = false;
+  bool ended = false;
+  while (auto* stream = Next()) {
+    if (sender.BufferedBytes() >= sendHighWatermark) {
+      blocked = true;
+      break;
+    }
+    ended = SendFrom(*stream) or ended;
+  }
+  for (auto& [id, stream] : streams) {
+    if (stream->onDrain and stream->outboundBytes <= stream->drainThreshold) {
+      drained.emplace_back(id, std::exchange(stream->onDrain, nullptr));
+    }
+  }
+  if (blocked or ended or not drained.empty()) {
+    sender.OnDrain(sendLowWatermark, [this] { OnWritable(); });
+  }
+}
+
+bool Http2Layer::Sendable(const Stream& stream) const {
+  if (stream.reset or stream.outbound.empty()) {
+    return false;
+  }
+  const auto& front = stream.outbound.front();
+  return std::holds_alternative<Http2HeadersOutput>(front) or LengthOf(front) == 0 or
+         std::min(sendWindow, stream.sendWindow) > 0;
+}
+
+Http2Layer::Stream* Http2Layer::Next() {
+  // Lower urgency first, then sequential streams in id order, then incremental streams round-robin.
+  using Rank = std::tuple<std::uint8_t, bool, std::uint64_t>;
+  Stream* next = nullptr;
+  Rank nextRank;
+  for (auto& [id, stream] : streams) {
+    if (not Sendable(*stream)) {
+      continue;
+    }
+    const std::uint64_t turn = stream->incremental and id <= lastIncremental ? id + (std::uint64_t{1} << 32) : id;
+    const Rank rank{stream->urgency, stream->incremental, turn};
+    if (not next or rank < nextRank) {
+      next = stream.get();
+      nextRank = rank;
+    }
+  }
+  return next;
+}
+
+bool Http2Layer::SendFrom(Stream& stream) {
+  const auto id = stream.tcpSender.Id();
+  if (stream.incremental) {
+    lastIncremental = id;
+  }
+  auto& front = stream.outbound.front();
+  bool end = false;
+  if (auto* headers = std::get_if<Http2HeadersOutput>(&front)) {
+    end = headers->end;
+    SendHeaders(id, std::move(headers->headers), end);
+    stream.outbound.pop_front();
+  } else {
+    const auto window = static_cast<std::size_t>(std::max<std::int64_t>(0, std::min(sendWindow, stream.sendWindow)));
+    const std::size_t length = LengthOf(front);
+    const std::size_t n = std::min({length, maxFrameSize, window});
+    const bool last = n == length;
+    char header[frameHeaderLength];
+    if (auto* data = std::get_if<Http2DataOutput>(&front)) {
+      EncodeFrameHeader(header, n, dataFrame, last and data->end ? endStreamFlag : 0, id);
+      const auto payload = n == 0 ? std::string_view{} : std::string_view{*data->buffer}.substr(data->offset, n);
+      sender.Send(std::string_view{header, frameHeaderLength}, payload);
+      data->offset += n;
+      data->length -= n;
+      data->latest = false;
+      end = last and data->end;
+    } else {
+      auto& file = std::get<Http2FileOutput>(front);
+      EncodeFrameHeader(header, n, dataFrame, last and file.end ? endStreamFlag : 0, id);
+      sender.Send(std::string_view{header, frameHeaderLength});
+      if (n > 0) {
+        sender.Send(file.file, file.offset, n);
+      }
+      file.offset += n;
+      file.length -= n;
+      end = last and file.end;
+    }
+    sendWindow -= n;
+    stream.sendWindow -= n;
+    stream.outboundBytes -= n;
+    if (last) {
+      stream.outbound.pop_front();
+    }
+  }
+  if (end) {
+    stream.responseEnded = true;
+    if (stream.rejected and not stream.requestEnded) {
+      ResetLocked(stream, id, noError);
+    }
+  }
+  return end;
+}
+
+void Http2Layer::SendHeaders(std::uint32_t id, std::vector<HttpHeader>&& headers, bool end) {
+  std::string block;
+  encoder.Encode(headers, block);
+  std::size_t offset = 0;
+  std::uint8_t type = headersFrame;
+  do {
+    const std::size_t n = std::min(block.size() - offset, maxFrameSize);
+    offset += n;
+    std::uint8_t flags = offset == block.size() ? endHeadersFlag : 0;
+    if (type == headersFrame and end) {
+      flags |= endStreamFlag;
+    }
+    SendFrame(type, flags, id, std::string_view{block}.substr(offset - n, n));
+    type = continuationFrame;
+  } while (offset < block.size());
+}
+
+void Http2Layer::SendFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t id, std::string_view payload) {
+  char header[frameHeaderLength];
+  EncodeFrameHeader(header, payload.size(), type, flags, id);
+  sender.Send(std::string_view{header, frameHeaderLength}, payload);
+}
+
+void Http2Layer::SendWindowUpdate(std::uint32_t id, std::size_t increment) {
+  std::string payload;
+  AppendUint32(payload, increment);
+  SendFrame(windowUpdateFrame, 0, id, payload);
+}
+
+void Http2Layer::OnWritable() {
+  {
+    std::lock_guard lock{connectionMut};
+    if (closed or sender.Closed()) {
+      for (auto& [id, stream] : streams) {
+        if (stream->onDrain) {
+          drained.emplace_back(id, std::exchange(stream->onDrain, nullptr));
+        }
+      }
+    } else {
+      Flush();
+    }
+  }
+  RunDrained();
+  Reap();
+}
+
+void Http2Layer::RunDrained() {
+  std::vector<std::pair<std::uint32_t, std::function<void()>>> callbacks;
+  {
+    std::lock_guard lock{connectionMut};
+    callbacks.swap(drained);
+  }
+  for (auto& [id, callback] : callbacks) {
+    if (Find(id)) {
+      callback();
+    }
+  }
+}
+
+void Http2Layer::Reap() {
+  std::vector<std::unique_ptr<Stream>> finished;
+  {
+    std::lock_guard lock{connectionMut};
+    for (auto it = streams.begin(); it != streams.end();) {
+      const auto& stream = *it->second;
+      if (stream.reset or (stream.requestEnded and stream.responseEnded)) {
+        finished.emplace_back(std::move(it->second));
+        it = streams.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  if (goingAway and streams.empty()) {
+    sender.Close();
+    closed = true;
+  }
+}
+
+}  // namespace network
@@ -0,0 +1,202 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+#include "hpack.hpp"
+#include "http.hpp"
+#include "network.hpp"
+
+namespace network {
+
+class HttpRouteMapping;
+class Http2Layer;
+
+constexpr std::string_view http2Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// Decodes the base64url HTTP2-Settings header of an h2c upgrade into a SETTINGS payload.
+std::optional<std::string> DecodeHttp2Settings(std::string_view);
+
+// Lets a ConcreteHttpSender answer on one HTTP/2 stream, the HTTP/1.1 responses it writes are reframed by the layer.
+// Bandwidth limits apply to a whole connection, so a stream refuses a shaped route with HTTP_1_1_REQUIRED and the
+// client retries over HTTP/1.1. Coalescing, corking and flushing are left to the layer, which batches frames itself.
+class Http2StreamSender final : public TcpSender {
+public:
+  Http2StreamSender(Http2Layer&, std::uint32_t);
+  Http2StreamSender(const Http2StreamSender&) = delete;
+  Http2StreamSender(Http2StreamSender&&) = delete;
+  Http2StreamSender& operator=(const Http2StreamSender&) = delete;
+  Http2StreamSender& operator=(Http2StreamSender&&) = delete;
+  ~Http2StreamSender() override = default;
+
+  void Send(std::string_view) override;
+  void Send(std::string_view, std::string_view) override;
+  void Send(os::File) override;
+  void Send(std::shared_ptr<const os::File>) override;
+  void Send(std::shared_ptr<const os::File>, size_t, size_t) override;
+  void Send(std::shared_ptr<const std::string>) override;
+  void SendLatest(std::shared_ptr<const std::string>) override;
+  void SendBuffered() override;
+  void Shape(const BandwidthLimit&) override;
+  void Coalesce(std::chrono::nanoseconds) override;
+  void Cork() override;
+  void Uncork() override;
+  std::size_t Backlog() override;
+  std::size_t BufferedBytes() override;
+  void OnDrain(std::size_t, std::function<void()>) override;
+  bool Closed() override;
+  void Close() override;
+  void Abort() override;
+
+  std::uint32_t Id() const;
+
+private:
+  Http2Layer& layer;
+  const std::uint32_t id;
+};
+
+struct Http2HeadersOutput {
+  std::vector<HttpHeader> headers;
+  bool end{false};
+};
+
+struct Http2DataOutput {
+  std::shared_ptr<const std::string> buffer;
+  std::size_t offset;
+  std::size_t length;
+  bool end{false};
+  bool latest{false};
+};
+
+struct Http2FileOutput {
+  std::shared_ptr<const os::File> file;
+  std::size_t offset;
+  std::size_t length;
+  bool end{false};
+};
+
+using Http2Output = std::variant<Http2HeadersOutput, Http2DataOutput, Http2FileOutput>;
+
+class Http2Layer final : public ProtocolProcessor {
+public:
+  Http2Layer(TcpSender&, HttpRouteMapping&, const HttpLimits&, HttpRejections&, const HttpCaches&);
+  Http2Layer(const Http2Layer&) = delete;
+  Http2Layer(Http2Layer&&) = delete;
+  Http2Layer& operator=(const Http2Layer&) = delete;
+  Http2Layer& operator=(Http2Layer&&) = delete;
+  ~Http2Layer() override;
+
+  bool TryProcess(std::string&) override;
+  bool TryProcess(TcpReceiver&) override;
+  // Serves a request that upgraded from HTTP/1.1 as stream 1, given the payload of its HTTP2-Settings header.
+  void Upgrade(HttpRequest&&, std::string_view);
+
+private:
+  friend class Http2StreamSender;
+
+  enum class Framing { Head, Length, ChunkSize, ChunkData, ChunkDataEnding, Trailers, UntilClose, Done };
+
+  struct Stream {
+    Stream(Http2Layer&, std::uint32_t, std::int64_t, const HttpCaches&);
+    Http2StreamSender tcpSender;
+    ConcreteHttpSender httpSender;
+    std::deque<Http2Output> outbound;
+    std::size_t outboundBytes{0};
+    std::int64_t sendWindow;
+    std::int64_t receiveWindow;
+    std::int64_t received{0};
+    std::size_t drainThreshold{0};
+    std::function<void()> onDrain;
+    Framing framing{Framing::Head};
+    std::size_t remaining{0};
+    std::string pending;
+    std::vector<HttpHeader> trailers;
+    std::uint8_t urgency{3};
+    bool incremental{false};
+    bool headOnly{false};
+    bool requestEnded{false};
+    bool responseEnded{false};
+    bool rejected{false};
+    bool reset{false};
+    std::unique_ptr<HttpStreamProcessor> processor;
+  };
+
+  bool ProcessFrame(std::uint8_t, std::uint8_t, std::uint32_t, std::string_view);
+  bool ProcessHeaders(std::uint8_t, std::uint32_t, std::string_view);
+  bool ProcessHeaderBlock(std::uint32_t, bool);
+  bool ProcessData(std::uint8_t, std::uint32_t, std::string_view);
+  bool ProcessSettings(std::uint8_t, std::uint32_t, std::string_view);
+  bool ProcessWindowUpdate(std::uint32_t, std::string_view);
+  bool ProcessResetStream(std::uint32_t, std::string_view);
+  bool ProcessPriorityUpdate(std::uint32_t, std::string_view);
+  void Dispatch(Stream&, HttpRequest&&);
+  void Reject(Stream&, HttpRequestError);
+  void Deliver(Stream&, HttpRequestBody&&);
+  void Abandon(Stream&);
+  bool Fail(std::uint32_t);
+  std::size_t HeaderListLimit() const;
+  Stream& Open(std::uint32_t);
+  Stream* Find(std::uint32_t);
+  void OnWritable();
+  void RunDrained();
+  void Reap();
+
+  void Write(std::uint32_t, std::shared_ptr<const std::string>, std::size_t, std::size_t, bool);
+  void Write(std::uint32_t, std::shared_ptr<const os::File>, std::size_t, std::size_t);
+  void Close(std::uint32_t);
+  void Reset(std::uint32_t, std::uint32_t);
+  std::size_t Backlog(std::uint32_t);
+  std::size_t BufferedBytes(std::uint32_t);
+  void OnDrain(std::uint32_t, std::size_t, std::function<void()>);
+  bool Closed(std::uint32_t);
+
+  // The following expect connectionMut to be held.
+  std::uint32_t ApplySettings(std::string_view);
+  void Translate(Stream&, std::shared_ptr<const std::string>, std::size_t, std::size_t, bool);
+  bool TranslateHead(Stream&, std::string_view);
+  void Enqueue(Stream&, Http2Output&&);
+  void ResetLocked(Stream&, std::uint32_t, std::uint32_t);
+  void Flush();
+  bool Sendable(const Stream&) const;
+  Stream* Next();
+  bool SendFrom(Stream&);
+  void SendHeaders(std::uint32_t, std::vector<HttpHeader>&&, bool);
+  void SendFrame(std::uint8_t, std::uint8_t, std::uint32_t, std::string_view = {});
+  void SendWindowUpdate(std::uint32_t, std::size_t);
+
+  TcpSender& sender;
+  HttpRouteMapping& mapping;
+  const HttpLimits& limits;
+  HttpRejections& rejections;
+  const HttpCaches caches;
+  HpackDecoder decoder;
+  HpackEncoder encoder;
+  std::int64_t sendWindow;
+  std::int64_t receiveWindow;
+  std::int64_t received{0};
+  std::int64_t initialSendWindow;
+  std::size_t maxFrameSize;
+  std::uint32_t lastStreamId{0};
+  std::uint32_t lastIncremental{0};
+  std::uint32_t continuationStreamId{0};
+  std::uint8_t continuationFlags{0};
+  std::size_t headerBlockFrames{0};
+  std::uint64_t streamsOpened{0};
+  std::uint64_t clientResets{0};
+  std::string headerBlock;
+  std::vector<std::pair<std::uint32_t, std::function<void()>>> drained;
+  bool prefaceReceived{false};
+  bool goingAway{false};
+  bool closed{false};
+  std::mutex connectionMut;
+  std::map<std::uint32_t, std::unique_ptr<Stream>> streams;
+};
+
+}  // namespace network
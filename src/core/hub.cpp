@@ -0,0 +1,115 @@
+#include "hub.hpp"
+#include <spdlog/spdlog.h>
+#include <vector>
+#include "websocket.hpp"
+
+namespace network {
+
+WebsocketHub::WebsocketHub(const WebsocketHubOptions& options) : options{options} {
+}
+
+void WebsocketHub::Publish(std::string_view topic, WebsocketFrame&& frame) {
+  std::lock_guard lock{hubMut};
+  auto it = topics.find(std::string{topic});
+  if (it == topics.end()) {
+    return;
+  }
+  frame.compressed = false;
+  auto encoded = std::make_shared<const std::string>(EncodeWebsocketFrame(frame));
+  for (auto* endpoint : it->second) {
+    endpoint->Post(topic, encoded);
+  }
+}
+
+void WebsocketHub::Subscribe(std::string_view topic, WebsocketHubEndpoint& endpoint) {
+  std::lock_guard lock{hubMut};
+  topics[std::string{topic}].insert(&endpoint);
+}
+
+void WebsocketHub::Unsubscribe(std::string_view topic, WebsocketHubEndpoint& endpoint) {
+  std::lock_guard lock{hubMut};
+  auto it = topics.find(std::string{topic});
+  if (it == topics.end()) {
+    return;
+  }
+  it->second.erase(&endpoint);
+  if (it->second.empty()) {
+    topics.erase(it);
+  }
+}
+
+WebsocketHubEndpoint::WebsocketHubEndpoint(WebsocketHub& hub, TcpExecutor& executor) : hub{hub}, executor{executor} {
+}
+
+WebsocketHubEndpoint::~WebsocketHubEndpoint() {
+  for (const auto& [topic, _] : subscribers) {
+    hub.Unsubscribe(topic, *this);
+  }
+}
+
+void WebsocketHubEndpoint::Subscribe(std::string_view topic, const ConcreteWebsocketSender& sender) {
+  auto& local = subscribers[std::string{topic}];
+  if (local.empty()) {
+    hub.Subscribe(topic, *this);
+  }
+  local.insert(&sender);
+  subscriptions[&sender].emplace(topic);
+}
+
+void WebsocketHubEndpoint::Unsubscribe(std::string_view topic, const ConcreteWebsocketSender& sender) {
+  auto it = subscribers.find(std::string{topic});
+  if (it == subscribers.end()) {
+    return;
+  }
+  it->second.erase(&sender);
+  if (it->second.empty()) {
+    subscribers.erase(it);
+    hub.Unsubscribe(topic, *this);
+  }
+  if (auto sub = subscriptions.find(&sender); sub != subscriptions.end()) {
+    sub->second.erase(std::string{topic});
+    if (sub->second.empty()) {
+      subscriptions.erase(sub);
+    }
+  }
+}
+
+void WebsocketHubEndpoint::Unsubscribe(const ConcreteWebsocketSender& sender) {
+  auto it = subscriptions.find(&sender);
+  if (it == subscriptions.end()) {
+    return;
+  }
+  auto topics = std::move(it->second);
+  for (const auto& topic : topics) {
+    Unsubscribe(topic, sender);
+  }
+}
+
+void WebsocketHubEndpoint::Post(std::string_view topic, std::shared_ptr<const std::string> encoded) {
+  executor.Post([this, topic = std::string{topic}, encoded = std::move(encoded)] { Deliver(topic, encoded); });
+}
+
+void WebsocketHubEndpoint::Deliver(const std::string& topic, const std::shared_ptr<const std::string>& encoded) {
+  auto it = subscribers.find(topic);
+  if (it == subscribers.end()) {
+    return;
+  }
+  std::vector<const ConcreteWebsocketSender*> slow;
+  for (const auto* sender : it->second) {
+    if (sender->Backlog() >= hub.options.maxBacklog) {
+      slow.push_back(sender);
+      continue;
+    }
+    sender->Send(encoded);
+  }
+  if (not slow.empty()) {
+    spdlog::debug("websocket hub {} slow subscribers on {}", slow.size(), topic);
+  }
+  if (hub.options.disconnectSlow) {
+    for (const auto* sender : slow) {
+      sender->Abort();
+    }
+  }
+}
+
+}  // namespace network
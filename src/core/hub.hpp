@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include "network.hpp"
+
+namespace network {
+
+class ConcreteWebsocketSender;
+class WebsocketHubEndpoint;
+
+struct WebsocketHubOptions {
+  std::size_t maxBacklog{64};
+  bool disconnectSlow{false};
+};
+
+class WebsocketHub {
+public:
+  WebsocketHub() = default;
+  explicit WebsocketHub(const WebsocketHubOptions&);
+  WebsocketHub(const WebsocketHub&) = delete;
+  WebsocketHub(WebsocketHub&&) = delete;
+  WebsocketHub& operator=(const WebsocketHub&) = delete;
+  WebsocketHub& operator=(WebsocketHub&&) = delete;
+  ~WebsocketHub() = default;
+
+  void Publish(std::string_view, WebsocketFrame&&);
+
+private:
+  friend class WebsocketHubEndpoint;
+
+  void Subscribe(std::string_view, WebsocketHubEndpoint&);
+  void Unsubscribe(std::string_view, WebsocketHubEndpoint&);
+
+  const WebsocketHubOptions options;
+  std::unordered_map<std::string, std::unordered_set<WebsocketHubEndpoint*>> topics;
+  std::mutex hubMut;
+};
+
+class WebsocketHubEndpoint {
+public:
+  WebsocketHubEndpoint(WebsocketHub&, TcpExecutor&);
+  WebsocketHubEndpoint(const WebsocketHubEndpoint&) = delete;
+  WebsocketHubEndpoint(WebsocketHubEndpoint&&) = delete;
+  WebsocketHubEndpoint& operator=(const WebsocketHubEndpoint&) = delete;
+  WebsocketHubEndpoint& operator=(WebsocketHubEndpoint&&) = delete;
+  ~WebsocketHubEndpoint();
+
+  void Subscribe(std::string_view, const ConcreteWebsocketSender&);
+  void Unsubscribe(std::string_view, const ConcreteWebsocketSender&);
+  void Unsubscribe(const ConcreteWebsocketSender&);
+  void Post(std::string_view, std::shared_ptr<const std::string>);
+
+private:
+  void Deliver(const std::string&, const std::shared_ptr<const std::string>&);
+
+  WebsocketHub& hub;
+  TcpExecutor& executor;
+  std::unordered_map<std::string, std::unordered_set<const ConcreteWebsocketSender*>> subscribers;
+  std::unordered_map<const ConcreteWebsocketSender*, std::unordered_set<std::string>> subscriptions;
+};
+
+}  // namespace network
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The kernels behind the common functions, one per instruction set. The public functions pick one at startup,
+// tests run each of them against the same vectors.
+namespace common::kernels {
+
+constexpr std::size_t maskPatternLength = 32;
+
+// Rotates the mask key by offset and repeats it, so byte i of the payload unmasks with pattern[i % 4] and wider
+// words unmask with a plain load of the pattern.
+void MaskPattern(const std::uint8_t (&)[4], std::size_t, std::uint8_t (&)[maskPatternLength]);
+
+void UnmaskWords(std::uint8_t*, std::size_t, const std::uint8_t*);
+
+#if defined(__x86_64__)
+void UnmaskSse2(std::uint8_t*, std::size_t, const std::uint8_t*);
+
+// Requires AVX2, check with __builtin_cpu_supports before calling.
+__attribute__((target("avx2"))) void UnmaskAvx2(std::uint8_t*, std::size_t, const std::uint8_t*);
+#endif
+
+// Runs the SHA-1 compression function over whole 64 byte blocks.
+void Sha1Scalar(std::uint32_t*, const std::uint8_t*, std::size_t);
+
+// Encoders and decoders handle as much of the input as they can and return how many bytes they consumed, the
+// decoders stop before the first group holding a character outside the alphabet.
+std::size_t Base64EncodeScalar(const std::uint8_t*, std::size_t, char*);
+std::size_t Base64DecodeScalar(const char*, std::size_t, std::uint8_t*);
+
+#if defined(__x86_64__)
+// Requires the SHA extensions and SSE4.1.
+void Sha1Ni(std::uint32_t*, const std::uint8_t*, std::size_t);
+
+__attribute__((target("ssse3"))) std::size_t Base64EncodeSsse3(const std::uint8_t*, std::size_t, char*);
+__attribute__((target("ssse3"))) std::size_t Base64DecodeSsse3(const char*, std::size_t, std::uint8_t*);
+#endif
+
+}  // namespace common::kernels
@@ -1,34 +1,109 @@
 #pragma once
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string_view>
 #include <unordered_map>
 #include <variant>
 #include "file.hpp"
+#include "uri.hpp"
 
 namespace network {
 
+struct BandwidthLimit {
+  std::size_t bytesPerSecond{0};
+  std::size_t burst{256 << 10};
+  bool kernelPacing{false};
+};
+
+struct TcpStatistics {
+  std::atomic<std::uint64_t> interactiveBytes{0};
+  std::atomic<std::uint64_t> bulkBytes{0};
+  std::atomic<std::uint64_t> throttled{0};
+  std::atomic<std::uint64_t> kernelTlsSessions{0};
+  std::atomic<std::uint64_t> userTlsSessions{0};
+};
+
 class TcpSenderSupervisor {
 public:
   virtual ~TcpSenderSupervisor() = default;
   virtual void MarkSenderPending(int) const = 0;
   virtual void UnmarkSenderPending(int) const = 0;
+  virtual void ResumeSenderAfter(int, std::chrono::nanoseconds) const = 0;
+};
+
+class TcpExecutor {
+public:
+  virtual ~TcpExecutor() = default;
+  virtual void Post(std::function<void()>) = 0;
+};
+
+enum class TlsHandshake { WantRead, WantWrite, Done, Failed };
+
+class TlsSession {
+public:
+  virtual ~TlsSession() = default;
+  virtual TlsHandshake Handshake() = 0;
+  // True when the kernel encrypts writes to the socket, so that send(), writev() and sendfile() can be used as is.
+  virtual bool KernelSend() const = 0;
+  // Behaves like recv(), failing with EAGAIN while no application data is available.
+  virtual ssize_t Read(char*, std::size_t) = 0;
+  virtual void Write(std::string_view) = 0;
+  // Returns false while encrypted records are still waiting for room in the socket.
+  virtual bool Flush() = 0;
+  virtual void Shutdown() = 0;
+};
+
+class TlsSessionFactory {
+public:
+  virtual ~TlsSessionFactory() = default;
+  virtual std::unique_ptr<TlsSession> Create(int) const = 0;
 };
 
 class TcpSender {
 public:
   virtual ~TcpSender() = default;
   virtual void Send(std::string_view) = 0;
+  virtual void Send(std::string_view, std::string_view) = 0;
   virtual void Send(os::File) = 0;
+  virtual void Send(std::shared_ptr<const os::File>) = 0;
+  virtual void Send(std::shared_ptr<const os::File>, size_t, size_t) = 0;
+  virtual void Send(std::shared_ptr<const std::string>) = 0;
+  virtual void SendLatest(std::shared_ptr<const std::string>) = 0;
   virtual void SendBuffered() = 0;
+  virtual void Shape(const BandwidthLimit&) = 0;
+  // Holds freshly queued writes for up to the given delay so that more of them leave in one system call.
+  virtual void Coalesce(std::chrono::nanoseconds) = 0;
+  virtual void Cork() = 0;
+  virtual void Uncork() = 0;
+  virtual std::size_t Backlog() = 0;
+  virtual std::size_t BufferedBytes() = 0;
+  // Calls back once from the event loop when no more than the given number of bytes remain queued, or when the
+  // connection goes away.
+  virtual void OnDrain(std::size_t, std::function<void()>) = 0;
+  // True once the connection is shut down, anything sent afterwards is dropped.
+  virtual bool Closed() = 0;
   virtual void Close() = 0;
+  virtual void Abort() = 0;
+};
+
+class TcpReceiver {
+public:
+  virtual ~TcpReceiver() = default;
+  virtual std::string_view Peek() = 0;
+  // Returns nullopt when the target did not take the data, whatever was moved off the socket is then lost.
+  virtual std::optional<size_t> Splice(int, size_t) = 0;
 };
 
 class TcpProcessor {
 public:
   virtual ~TcpProcessor() = default;
   virtual void Process(std::string_view) = 0;
+  virtual bool Process(TcpReceiver&) = 0;
 };
 
 class TcpProcessorFactory {
@@ -41,11 +116,10 @@ class ProtocolProcessor {
 public:
   virtual ~ProtocolProcessor() = default;
   virtual bool TryProcess(std::string&) = 0;
+  virtual bool TryProcess(TcpReceiver&) = 0;
 };
 
-enum class HttpMethod { PUT, GET, POST, DELETE };
-
-using HttpQuery = std::unordered_map<std::string, std::string>;
+enum class HttpMethod { PUT, GET, HEAD, POST, DELETE };
 
 struct HttpHeader {
   std::string field;
@@ -56,14 +130,61 @@ using HttpHeaders = std::unordered_map<std::string, std::string>;
 
 struct HttpRequest {
   HttpMethod method;
-  std::string uri;
+  Uri uri;
   std::string version;
   HttpHeaders headers;
-  HttpQuery query;
   std::string body;
 };
 
-enum class HttpStatus { SwitchingProtocols, OK, BadRequest, NotFound };
+struct HttpRequestBody {
+  std::string data;
+  bool last;
+};
+
+enum class HttpStatus {
+  Continue,
+  SwitchingProtocols,
+  OK,
+  PartialContent,
+  NotModified,
+  BadRequest,
+  NotFound,
+  PayloadTooLarge,
+  UriTooLong,
+  RangeNotSatisfiable,
+  RequestHeaderFieldsTooLarge,
+  InternalServerError
+};
+
+enum class HttpRequestError { Malformed, RequestLineTooLong, TooManyHeaders, HeadersTooLarge, BodyTooLarge };
+
+struct HttpLimits {
+  size_t maxRequestLineLength{8192};
+  size_t maxHeaderCount{100};
+  size_t maxHeaderLength{16384};
+  size_t maxBodyLength{8 << 20};
+};
+
+struct HttpCompressionOptions {
+  bool enabled{false};
+  int level{6};
+  std::size_t minLength{1024};
+  // Keeps compressed bodies in the shared compression cache, for routes that answer with the same bodies repeatedly.
+  bool cacheable{false};
+};
+
+struct HttpRouteOptions {
+  HttpCompressionOptions compression;
+  BandwidthLimit bandwidth;
+};
+
+struct HttpRejections {
+  std::atomic<std::uint64_t> malformed{0};
+  std::atomic<std::uint64_t> requestLineTooLong{0};
+  std::atomic<std::uint64_t> tooManyHeaders{0};
+  std::atomic<std::uint64_t> headersTooLarge{0};
+  std::atomic<std::uint64_t> bodyTooLarge{0};
+};
 
 struct HttpResponse {
   HttpStatus status;
@@ -78,15 +199,23 @@ struct RawHttpResponse {
 struct FileHttpResponse {
   HttpHeaders headers;
   std::string path;
+  int root{-1};
+  bool precompressed{false};
 };
 
-struct MixedReplaceHeaderHttpResponse {};
+struct MixedReplaceHeaderHttpResponse {
+  std::string boundary{"BND"};
+};
 
 struct MixedReplaceDataHttpResponse {
   HttpHeaders headers;
   std::string body;
 };
 
+struct SharedMixedReplaceDataHttpResponse {
+  std::shared_ptr<const std::string> part;
+};
+
 struct ChunkedHeaderHttpResponse {
   HttpHeaders headers;
 };
@@ -95,10 +224,29 @@ struct ChunkedDataHttpResponse {
   std::string body;
 };
 
+struct StreamingHttpResponse {
+  HttpHeaders headers;
+  std::size_t lowWatermark{64 << 10};
+};
+
+class HttpResponseWriter {
+public:
+  virtual ~HttpResponseWriter() = default;
+  // Returns false while more than the low watermark is queued, the producer should then wait for OnWritable.
+  virtual bool Write(std::string_view) = 0;
+  virtual void Flush() = 0;
+  virtual void Finish(HttpHeaders&&) = 0;
+  // Calls back once the queue drains or the connection closes, right away when it is closed already.
+  virtual void OnWritable(std::function<void()>) = 0;
+  // True once the connection is gone, the producer should then stop. The writer may outlive the connection.
+  virtual bool Closed() = 0;
+};
+
 class HttpParser {
 public:
   virtual ~HttpParser() = default;
   virtual std::optional<HttpRequest> Parse(std::string&) const = 0;
+  virtual std::variant<std::monostate, HttpRequest, HttpRequestError> ParseHead(std::string&) const = 0;
 };
 
 class HttpSender {
@@ -108,9 +256,15 @@ public:
   virtual void Send(FileHttpResponse&&) const = 0;
   virtual void Send(MixedReplaceHeaderHttpResponse&&) const = 0;
   virtual void Send(MixedReplaceDataHttpResponse&&) const = 0;
+  virtual void Send(SharedMixedReplaceDataHttpResponse&&) const = 0;
   virtual void Send(ChunkedHeaderHttpResponse&&) const = 0;
   virtual void Send(ChunkedDataHttpResponse&&) const = 0;
+  virtual std::unique_ptr<HttpResponseWriter> Stream(StreamingHttpResponse&&) const = 0;
   virtual void Close() const = 0;
+  // True once Close was requested, requests pipelined after that point must not be processed.
+  virtual bool Closing() const {
+    return false;
+  }
 };
 
 class HttpProcessor {
@@ -125,22 +279,76 @@ public:
   virtual std::unique_ptr<HttpProcessor> Create(HttpSender&) const = 0;
 };
 
+class HttpStreamProcessor {
+public:
+  virtual ~HttpStreamProcessor() = default;
+  virtual void Process(HttpRequest&&) = 0;
+  virtual void Process(HttpRequestBody&&) = 0;
+  // Lets the processor move up to the given number of body bytes straight off the socket, returns how many it took.
+  virtual size_t Process(TcpReceiver&, size_t) {
+    return 0;
+  }
+};
+
+class HttpStreamProcessorFactory {
+public:
+  virtual ~HttpStreamProcessorFactory() = default;
+  virtual std::unique_ptr<HttpStreamProcessor> Create(HttpSender&) const = 0;
+};
+
+struct HttpUploadPart {
+  HttpHeaders headers;
+};
+
+class HttpUploadProcessor {
+public:
+  virtual ~HttpUploadProcessor() = default;
+  virtual int Open(const HttpRequest&, const HttpUploadPart&) = 0;
+  virtual void Process(HttpRequest&&) = 0;
+};
+
+class HttpUploadProcessorFactory {
+public:
+  virtual ~HttpUploadProcessorFactory() = default;
+  virtual std::unique_ptr<HttpUploadProcessor> Create(HttpSender&) const = 0;
+};
+
 struct WebsocketFrame {
   bool fin;
   std::uint8_t opcode;
   std::string payload;
+  bool compressed{false};
+};
+
+enum class WebsocketError { ProtocolError, InvalidPayload, MessageTooBig };
+
+struct WebsocketCompressionOptions {
+  bool enabled{false};
+  int level{6};
+  int windowBits{15};
+  bool contextTakeover{true};
+  std::size_t minLength{256};
+};
+
+struct WebsocketOptions {
+  std::size_t maxMessageLength{16 << 20};
+  bool streaming{false};
+  std::chrono::microseconds flushDelay{0};
+  WebsocketCompressionOptions compression;
 };
 
 class WebsocketParser {
 public:
   virtual ~WebsocketParser() = default;
-  virtual std::optional<WebsocketFrame> Parse(std::string&) const = 0;
+  virtual std::variant<std::monostate, WebsocketFrame, WebsocketError> Parse(std::string&) = 0;
 };
 
 class WebsocketSender {
 public:
   virtual ~WebsocketSender() = default;
   virtual void Send(WebsocketFrame&&) const = 0;
+  virtual void Subscribe(std::string_view) const = 0;
+  virtual void Unsubscribe(std::string_view) const = 0;
   virtual void Close() const = 0;
 };
 
@@ -156,7 +364,7 @@ public:
   virtual std::unique_ptr<WebsocketProcessor> Create(WebsocketSender&) const = 0;
 };
 
-class Router : public ProtocolProcessor, public HttpProcessor, public WebsocketProcessor {
+class Router : public ProtocolProcessor, public HttpStreamProcessor, public WebsocketProcessor {
 public:
   ~Router() override = default;
 };
@@ -6,7 +6,8 @@ namespace network {
 
 class ProtocolLayer final : public TcpProcessor {
 public:
-  ProtocolLayer(TcpSender& sender, RouterFactory& routerFactory) : router{routerFactory.Create(sender)} {
+  ProtocolLayer(TcpSender& sender, RouterFactory& routerFactory)
+      : sender{sender}, router{routerFactory.Create(sender)} {
   }
   ProtocolLayer(const ProtocolLayer&) = delete;
   ProtocolLayer(ProtocolLayer&&) = delete;
@@ -15,12 +16,22 @@ public:
   ~ProtocolLayer() override = default;
 
   void Process(std::string_view payload) override {
+    sender.Cork();
     buffer += payload;
     while (router->TryProcess(buffer)) {
     }
+    sender.Uncork();
+  }
+
+  bool Process(TcpReceiver& receiver) override {
+    if (not buffer.empty()) {
+      return false;
+    }
+    return router->TryProcess(receiver);
   }
 
 private:
+  TcpSender& sender;
   std::string buffer;
   std::unique_ptr<Router> router;
 };
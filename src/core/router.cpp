@@ -1,39 +1,215 @@
 #include "router.hpp"
+#include "common.hpp"
+
+namespace {
+
+bool HasToken(std::string value, std::string_view token) {
+  common::ToLower(value);
+  std::string_view list{value};
+  while (not list.empty()) {
+    auto comma = list.find(',');
+    if (common::Trim(list.substr(0, comma)) == token) {
+      return true;
+    }
+    list = comma == list.npos ? std::string_view{} : list.substr(comma + 1);
+  }
+  return false;
+}
+
+}  // namespace
 
 namespace network {
 
+HttpDispatcher::HttpDispatcher(HttpRouteMapping& httpMapping, const HttpLimits& httpLimits,
+    HttpRejections& httpRejections, ConcreteHttpSender& httpSender, TcpSender& tcpSender)
+    : httpMapping{httpMapping},
+      httpLimits{httpLimits},
+      httpRejections{httpRejections},
+      httpSender{httpSender},
+      tcpSender{tcpSender} {
+}
+
+bool HttpDispatcher::ExpectsContinue(const HttpRequest& req) const {
+  auto it = req.headers.find("expect");
+  if (it == req.headers.end()) {
+    return false;
+  }
+  auto expect = it->second;
+  common::ToLower(expect);
+  return expect == "100-continue";
+}
+
+void HttpDispatcher::Process(HttpRequest&& req) {
+  httpSender.Prepare(req);
+  const bool expectsContinue = ExpectsContinue(req);
+  auto streamEntry = httpMapping.GetStream(req.method, req.uri.Path());
+  auto entry = streamEntry ? nullptr : httpMapping.Get(req.method, req.uri.Path());
+  if (not streamEntry and not entry and req.method == HttpMethod::HEAD) {
+    streamEntry = httpMapping.GetStream(HttpMethod::GET, req.uri.Path());
+    entry = streamEntry ? nullptr : httpMapping.Get(HttpMethod::GET, req.uri.Path());
+  }
+  if (not streamEntry and not entry) {
+    HttpResponse resp;
+    resp.status = HttpStatus::NotFound;
+    httpSender.Send(std::move(resp));
+    if (expectsContinue) {
+      httpSender.Close();
+    }
+    return;
+  }
+  // Only buffered routes are bound by the body limit, stream routes see the body piece by piece.
+  if (entry and HttpBodyDecoder{req.headers, httpLimits.maxBodyLength}.Failed()) {
+    RejectBody();
+    return;
+  }
+  if (expectsContinue) {
+    HttpResponse resp;
+    resp.status = HttpStatus::Continue;
+    httpSender.Send(std::move(resp));
+  }
+  if (streamEntry) {
+    httpSender.Configure(streamEntry->options);
+    // An HTTP/2 stream refuses a shaped route by resetting itself.
+    tcpSender.Shape(streamEntry->options.bandwidth);
+    if (tcpSender.Closed()) {
+      return;
+    }
+    httpStreamProcessor = streamEntry->factory->Create(httpSender);
+    streaming = true;
+    httpStreamProcessor->Process(std::move(req));
+    return;
+  }
+  httpSender.Configure(entry->options);
+  tcpSender.Shape(entry->options.bandwidth);
+  if (tcpSender.Closed()) {
+    return;
+  }
+  pendingProcessorFactory = entry->factory.get();
+  pendingRequest.emplace(std::move(req));
+  pendingLength = 0;
+}
+
+void HttpDispatcher::Process(HttpRequestBody&& body) {
+  if (streaming) {
+    streaming = not body.last;
+    httpStreamProcessor->Process(std::move(body));
+    return;
+  }
+  if (not pendingRequest) {
+    return;
+  }
+  pendingLength += body.data.size();
+  if (pendingLength > httpLimits.maxBodyLength) {
+    RejectBody();
+    return;
+  }
+  if (pendingRequest->body.empty()) {
+    pendingRequest->body = std::move(body.data);
+  } else {
+    pendingRequest->body += body.data;
+  }
+  if (not body.last) {
+    return;
+  }
+  auto req = std::move(*pendingRequest);
+  pendingRequest.reset();
+  httpProcessor = pendingProcessorFactory->Create(httpSender);
+  httpProcessor->Process(std::move(req));
+}
+
+size_t HttpDispatcher::Process(TcpReceiver& receiver, size_t size) {
+  if (not streaming) {
+    return 0;
+  }
+  return httpStreamProcessor->Process(receiver, size);
+}
+
+void HttpDispatcher::Reset() {
+  httpProcessor.reset();
+}
+
+void HttpDispatcher::RejectBody() {
+  HttpResponse resp;
+  resp.status = CountRejection(HttpRequestError::BodyTooLarge, httpRejections);
+  resp.headers.emplace("Connection", "close");
+  httpSender.Send(std::move(resp));
+  httpSender.Close();
+  pendingRequest.reset();
+}
+
+bool ConcreteRouter::TryProcess(std::string& buffer) {
+  if (not prefaceChecked) {
+    const auto received = std::string_view{buffer}.substr(0, http2Preface.size());
+    if (http2Preface.starts_with(received)) {
+      if (received.size() < http2Preface.size()) {
+        return false;
+      }
+      http2Layer.emplace(tcpSender, httpMapping, httpLimits, httpRejections, httpCaches);
+      protocolProcessorDelegate = &*http2Layer;
+    }
+    prefaceChecked = true;
+  }
+  return protocolProcessorDelegate->TryProcess(buffer);
+}
+
 bool ConcreteRouter::TryUpgradeToWebsocket(const HttpRequest& req) {
-  auto* entry = websocketMapping.Get(req.uri);
+  auto* entry = websocketMapping.Get(req.uri.Path());
   if (not entry) {
     return false;
   }
-  WebsocketHandshakeBuilder handshake{req};
+  WebsocketHandshakeBuilder handshake{req, entry->options.compression};
   auto resp = handshake.Build();
   if (not resp) {
     return false;
   }
   httpAggregation.httpSender.Send(std::move(*resp));
-  httpAggregation.httpProcessor.reset();
-  websocketAggregation.emplace(tcpSender, *this);
-  websocketAggregation->websocketProcessor = entry->Create(websocketAggregation->websocketSender);
+  httpAggregation.httpDispatcher.Reset();
+  websocketAggregation.emplace(tcpSender, *this, entry->options, handshake.Deflate(), websocketHub);
+  websocketAggregation->websocketProcessor = entry->factory->Create(websocketAggregation->websocketSender);
   protocolProcessorDelegate = &websocketAggregation->websocketLayer;
   return true;
 }
 
-void ConcreteRouter::Process(HttpRequest&& req) {
-  if (TryUpgradeToWebsocket(req)) {
-    return;
+bool ConcreteRouter::TryUpgradeToHttp2(HttpRequest& req) {
+  auto upgrade = req.headers.find("upgrade");
+  auto settings = req.headers.find("http2-settings");
+  if (upgrade == req.headers.end() or settings == req.headers.end() or not HasToken(upgrade->second, "h2c")) {
+    return false;
   }
-  auto entry = httpMapping.Get(req.method, req.uri);
-  if (entry) {
-    websocketAggregation.reset();
-    httpAggregation.httpProcessor = entry->Create(httpAggregation.httpSender);
-    httpAggregation.httpProcessor->Process(std::move(req));
-    return;
+  if (req.headers.contains("transfer-encoding") or
+      (req.headers.contains("content-length") and req.headers.at("content-length") != "0")) {
+    return false;
+  }
+  auto payload = DecodeHttp2Settings(settings->second);
+  if (not payload) {
+    return false;
   }
   HttpResponse resp;
-  resp.status = HttpStatus::NotFound;
+  resp.status = HttpStatus::SwitchingProtocols;
+  resp.headers.emplace("Connection", "Upgrade");
+  resp.headers.emplace("Upgrade", "h2c");
   httpAggregation.httpSender.Send(std::move(resp));
+  httpAggregation.httpDispatcher.Reset();
+  http2Layer.emplace(tcpSender, httpMapping, httpLimits, httpRejections, httpCaches);
+  protocolProcessorDelegate = &*http2Layer;
+  http2Layer->Upgrade(std::move(req), *payload);
+  return true;
+}
+
+void ConcreteRouter::Process(HttpRequest&& req) {
+  if (TryUpgradeToWebsocket(req) or TryUpgradeToHttp2(req)) {
+    return;
+  }
+  websocketAggregation.reset();
+  httpAggregation.httpDispatcher.Process(std::move(req));
+}
+
+void ConcreteRouter::Process(HttpRequestBody&& body) {
+  httpAggregation.httpDispatcher.Process(std::move(body));
+}
+
+size_t ConcreteRouter::Process(TcpReceiver& receiver, size_t size) {
+  return httpAggregation.httpDispatcher.Process(receiver, size);
 }
 
 void ConcreteRouter::Process(WebsocketFrame&& req) {
@@ -4,81 +4,162 @@
 #include <string>
 #include <vector>
 #include "http.hpp"
+#include "http2.hpp"
+#include "hub.hpp"
 #include "websocket.hpp"
 
 namespace network {
 
+template <typename FactoryT>
+struct HttpRoute {
+  HttpMethod method;
+  std::regex uri;
+  std::unique_ptr<FactoryT> factory;
+  HttpRouteOptions options;
+};
+
 class HttpRouteMapping {
 public:
-  void Add(HttpMethod method, const std::string& uri, std::unique_ptr<HttpProcessorFactory> processorFactory) {
-    mapping.emplace_back(std::make_tuple<HttpMethod, std::regex, std::unique_ptr<HttpProcessorFactory>>(
-        std::move(method), std::regex{uri}, std::move(processorFactory)));
+  void Add(HttpMethod method, const std::string& uri, std::unique_ptr<HttpProcessorFactory> processorFactory,
+      const HttpRouteOptions& options = {}) {
+    mapping.emplace_back(method, std::regex{uri}, std::move(processorFactory), options);
+  }
+
+  void Add(HttpMethod method, const std::string& uri, std::unique_ptr<HttpStreamProcessorFactory> processorFactory,
+      const HttpRouteOptions& options = {}) {
+    streamMapping.emplace_back(method, std::regex{uri}, std::move(processorFactory), options);
   }
 
-  HttpProcessorFactory* Get(HttpMethod method, const std::string& uri) const {
-    for (const auto& [m, k, v] : mapping) {
-      if (m == method and std::regex_match(uri, k)) {
-        return v.get();
+  const HttpRoute<HttpProcessorFactory>* Get(HttpMethod method, std::string_view uri) const {
+    return Find(mapping, method, uri);
+  }
+
+  const HttpRoute<HttpStreamProcessorFactory>* GetStream(HttpMethod method, std::string_view uri) const {
+    return Find(streamMapping, method, uri);
+  }
+
+private:
+  template <typename FactoryT>
+  static const HttpRoute<FactoryT>* Find(
+      const std::vector<HttpRoute<FactoryT>>& routes, HttpMethod method, std::string_view uri) {
+    for (const auto& route : routes) {
+      if (route.method == method and std::regex_match(uri.begin(), uri.end(), route.uri)) {
+        return &route;
       }
     }
     return nullptr;
   }
 
-private:
-  std::vector<std::tuple<HttpMethod, std::regex, std::unique_ptr<HttpProcessorFactory>>> mapping;
+  std::vector<HttpRoute<HttpProcessorFactory>> mapping;
+  std::vector<HttpRoute<HttpStreamProcessorFactory>> streamMapping;
+};
+
+struct WebsocketRoute {
+  std::regex uri;
+  std::unique_ptr<WebsocketProcessorFactory> factory;
+  WebsocketOptions options;
 };
 
 class WebsocketRouteMapping {
 public:
-  void Add(const std::string& uri, std::unique_ptr<WebsocketProcessorFactory> processorFactory) {
-    mapping.emplace_back(std::make_tuple<std::regex, std::unique_ptr<WebsocketProcessorFactory>>(
-        std::regex{uri}, std::move(processorFactory)));
+  void Add(const std::string& uri, std::unique_ptr<WebsocketProcessorFactory> processorFactory,
+      const WebsocketOptions& options = {}) {
+    mapping.emplace_back(std::regex{uri}, std::move(processorFactory), options);
   }
 
-  WebsocketProcessorFactory* Get(const std::string& uri) const {
-    for (const auto& [k, v] : mapping) {
-      if (std::regex_match(uri, k)) {
-        return v.get();
+  const WebsocketRoute* Get(std::string_view uri) const {
+    for (const auto& route : mapping) {
+      if (std::regex_match(uri.begin(), uri.end(), route.uri)) {
+        return &route;
       }
     }
     return nullptr;
   }
 
 private:
-  std::vector<std::tuple<std::regex, std::unique_ptr<WebsocketProcessorFactory>>> mapping;
+  std::vector<WebsocketRoute> mapping;
+};
+
+class HttpDispatcher final : public HttpStreamProcessor {
+public:
+  HttpDispatcher(HttpRouteMapping&, const HttpLimits&, HttpRejections&, ConcreteHttpSender&, TcpSender&);
+  HttpDispatcher(const HttpDispatcher&) = delete;
+  HttpDispatcher(HttpDispatcher&&) = delete;
+  HttpDispatcher& operator=(const HttpDispatcher&) = delete;
+  HttpDispatcher& operator=(HttpDispatcher&&) = delete;
+  ~HttpDispatcher() override = default;
+
+  void Process(HttpRequest&&) override;
+  void Process(HttpRequestBody&&) override;
+  size_t Process(TcpReceiver&, size_t) override;
+  void Reset();
+
+private:
+  bool ExpectsContinue(const HttpRequest& req) const;
+  void RejectBody();
+
+  HttpRouteMapping& httpMapping;
+  const HttpLimits& httpLimits;
+  HttpRejections& httpRejections;
+  ConcreteHttpSender& httpSender;
+  TcpSender& tcpSender;
+  std::unique_ptr<HttpProcessor> httpProcessor{nullptr};
+  std::unique_ptr<HttpStreamProcessor> httpStreamProcessor{nullptr};
+  const HttpProcessorFactory* pendingProcessorFactory{nullptr};
+  std::optional<HttpRequest> pendingRequest{std::nullopt};
+  size_t pendingLength{0};
+  bool streaming{false};
 };
 
 class ConcreteRouter final : public Router {
 public:
-  ConcreteRouter(HttpRouteMapping& httpMapping, WebsocketRouteMapping& websocketMapping, TcpSender& tcpSender)
+  ConcreteRouter(HttpRouteMapping& httpMapping, WebsocketRouteMapping& websocketMapping, const HttpLimits& httpLimits,
+      HttpRejections& httpRejections, const HttpCaches& httpCaches, WebsocketHubEndpoint* websocketHub,
+      TcpSender& tcpSender)
       : tcpSender{tcpSender},
         httpMapping{httpMapping},
         websocketMapping{websocketMapping},
-        httpAggregation{tcpSender, *this},
+        httpLimits{httpLimits},
+        httpRejections{httpRejections},
+        httpCaches{httpCaches},
+        websocketHub{websocketHub},
+        httpAggregation{tcpSender, *this, httpMapping, httpLimits, httpRejections, httpCaches},
         protocolProcessorDelegate{&httpAggregation.httpLayer} {
   }
 
-  bool TryProcess(std::string& buffer) override {
-    return protocolProcessorDelegate->TryProcess(buffer);
+  bool TryProcess(std::string& buffer) override;
+
+  bool TryProcess(TcpReceiver& receiver) override {
+    return protocolProcessorDelegate->TryProcess(receiver);
   }
 
   void Process(HttpRequest&&) override;
+  void Process(HttpRequestBody&&) override;
+  size_t Process(TcpReceiver&, size_t) override;
   void Process(WebsocketFrame&&) override;
 
 private:
   struct HttpAggregation {
-    HttpAggregation(TcpSender& tcpSender, HttpProcessor& httpProcessor)
-        : httpSender{tcpSender}, httpLayer{httpParser, httpSender, httpProcessor} {
+    HttpAggregation(TcpSender& tcpSender, HttpStreamProcessor& httpProcessor, HttpRouteMapping& httpMapping,
+        const HttpLimits& httpLimits, HttpRejections& httpRejections, const HttpCaches& httpCaches)
+        : httpSender{tcpSender, httpCaches},
+          httpParser{httpLimits},
+          httpLayer{httpParser, httpSender, httpProcessor, httpRejections},
+          httpDispatcher{httpMapping, httpLimits, httpRejections, httpSender, tcpSender} {
     }
     ConcreteHttpSender httpSender;
     ConcreteHttpParser httpParser;
     HttpLayer httpLayer;
-    std::unique_ptr<HttpProcessor> httpProcessor{nullptr};
+    HttpDispatcher httpDispatcher;
   };
 
   struct WebsocketAggregation {
-    WebsocketAggregation(TcpSender& tcpSender, WebsocketProcessor& websocketProcessor)
-        : websocketSender{tcpSender}, websocketLayer{websocketParser, websocketSender, websocketProcessor} {
+    WebsocketAggregation(TcpSender& tcpSender, WebsocketProcessor& websocketProcessor,
+        const WebsocketOptions& websocketOptions, const std::optional<WebsocketDeflateParameters>& deflate,
+        WebsocketHubEndpoint* websocketHub)
+        : websocketSender{tcpSender, websocketOptions, deflate, websocketHub},
+          websocketParser{websocketOptions, deflate},
+          websocketLayer{websocketParser, websocketSender, websocketProcessor, websocketOptions, deflate} {
     }
     ConcreteWebsocketSender websocketSender;
     ConcreteWebsocketParser websocketParser;
@@ -87,28 +168,49 @@ private:
   };
 
   bool TryUpgradeToWebsocket(const HttpRequest& req);
+  bool TryUpgradeToHttp2(HttpRequest& req);
 
   TcpSender& tcpSender;
   HttpRouteMapping& httpMapping;
   WebsocketRouteMapping& websocketMapping;
+  const HttpLimits& httpLimits;
+  HttpRejections& httpRejections;
+  const HttpCaches httpCaches;
+  WebsocketHubEndpoint* websocketHub;
   HttpAggregation httpAggregation;
   std::optional<WebsocketAggregation> websocketAggregation{std::nullopt};
+  std::optional<Http2Layer> http2Layer{std::nullopt};
   ProtocolProcessor* protocolProcessorDelegate;
+  bool prefaceChecked{false};
 };
 
 class ConcreteRouterFactory final : public RouterFactory {
 public:
-  ConcreteRouterFactory(HttpRouteMapping& httpMapping, WebsocketRouteMapping& websocketMapping)
-      : httpMapping{httpMapping}, websocketMapping{websocketMapping} {
+  ConcreteRouterFactory(HttpRouteMapping& httpMapping, WebsocketRouteMapping& websocketMapping,
+      const HttpLimits& httpLimits, HttpRejections& httpRejections, const HttpCaches& httpCaches)
+      : httpMapping{httpMapping},
+        websocketMapping{websocketMapping},
+        httpLimits{httpLimits},
+        httpRejections{httpRejections},
+        httpCaches{httpCaches} {
   }
 
   std::unique_ptr<Router> Create(TcpSender& sender) const override {
-    return std::make_unique<ConcreteRouter>(httpMapping, websocketMapping, sender);
+    return std::make_unique<ConcreteRouter>(
+        httpMapping, websocketMapping, httpLimits, httpRejections, httpCaches, websocketHub, sender);
+  }
+
+  void Attach(WebsocketHubEndpoint& endpoint) {
+    websocketHub = &endpoint;
   }
 
 private:
   HttpRouteMapping& httpMapping;
   WebsocketRouteMapping& websocketMapping;
+  const HttpLimits& httpLimits;
+  HttpRejections& httpRejections;
+  HttpCaches httpCaches;
+  WebsocketHubEndpoint* websocketHub{nullptr};
 };
 
 }  // namespace network
@@ -1,8 +1,10 @@
 #include "server.hpp"
 #include <functional>
+#include <optional>
 #include "network.hpp"
 #include "protocol.hpp"
 #include "tcp.hpp"
+#include "upload.hpp"
 
 namespace {
 
@@ -38,28 +40,92 @@ private:
 namespace network {
 
 void Server::Start(std::string_view host, std::uint16_t port) {
-  auto routerFactory = std::make_unique<ConcreteRouterFactory>(httpMapping, websocketMapping);
+  FileCache fileCache{fileCacheOptions};
+  HttpCaches httpCaches{fileCache, responseCache, compressionCache};
+  auto routerFactory =
+      std::make_unique<ConcreteRouterFactory>(httpMapping, websocketMapping, httpLimits, httpRejections, httpCaches);
   auto protocolLayerFactory = std::make_unique<ProtocolLayerFactory>(*routerFactory);
-  Tcp4Layer tcp{host, port, *protocolLayerFactory};
+  std::optional<WebsocketHubEndpoint> websocketHubEndpoint;
+  Tcp4Layer tcp{host, port, *protocolLayerFactory, bandwidthLimit, tcpStatistics};
+  if (websocketHub) {
+    websocketHubEndpoint.emplace(*websocketHub, tcp);
+    routerFactory->Attach(*websocketHubEndpoint);
+  }
+  if (tlsSessionFactory) {
+    tcp.Secure(*tlsSessionFactory);
+  }
   tcp.Start();
 }
 
-void Server::Add(HttpMethod method, const std::string& uri, std::unique_ptr<HttpProcessorFactory> processorFactory) {
-  httpMapping.Add(method, uri, std::move(processorFactory));
+void Server::Limit(const HttpLimits& limits) {
+  httpLimits = limits;
+}
+
+void Server::Cache(const FileCacheOptions& options) {
+  fileCacheOptions = options;
+}
+
+void Server::Cache(CompressionCache& cache) {
+  compressionCache = &cache;
+}
+
+void Server::Cache(ResponseCache& cache) {
+  responseCache = &cache;
+}
+
+void Server::Hub(WebsocketHub& hub) {
+  websocketHub = &hub;
+}
+
+void Server::Secure(const TlsSessionFactory& factory) {
+  tlsSessionFactory = &factory;
 }
 
-void Server::Add(HttpMethod method, const std::string& uri, std::function<void(HttpRequest&&, HttpSender&)> f) {
+void Server::Limit(const BandwidthLimit& limit) {
+  bandwidthLimit = limit;
+}
+
+const TcpStatistics& Server::Statistics() const {
+  return tcpStatistics;
+}
+
+const HttpRejections& Server::Rejections() const {
+  return httpRejections;
+}
+
+void Server::Add(HttpMethod method, const std::string& uri, std::unique_ptr<HttpProcessorFactory> processorFactory,
+    const HttpRouteOptions& options) {
+  httpMapping.Add(method, uri, std::move(processorFactory), options);
+}
+
+void Server::Add(HttpMethod method, const std::string& uri, std::function<void(HttpRequest&&, HttpSender&)> f,
+    const HttpRouteOptions& options) {
   httpMapping.Add(method, uri,
-      std::make_unique<LambdaProcessorFactoryWrapper<HttpProcessorFactory, HttpProcessor, HttpRequest, HttpSender>>(f));
+      std::make_unique<LambdaProcessorFactoryWrapper<HttpProcessorFactory, HttpProcessor, HttpRequest, HttpSender>>(f),
+      options);
+}
+
+void Server::Add(HttpMethod method, const std::string& uri,
+    std::unique_ptr<HttpStreamProcessorFactory> processorFactory, const HttpRouteOptions& options) {
+  httpMapping.Add(method, uri, std::move(processorFactory), options);
+}
+
+void Server::Add(
+    HttpMethod method, const std::string& uri, std::unique_ptr<HttpUploadProcessorFactory> processorFactory) {
+  httpMapping.Add(method, uri, std::make_unique<HttpUploadLayerFactory>(std::move(processorFactory)));
 }
 
-void Server::Add(const std::string& uri, std::unique_ptr<WebsocketProcessorFactory> processorFactory) {
-  websocketMapping.Add(uri, std::move(processorFactory));
+void Server::Add(const std::string& uri, std::unique_ptr<WebsocketProcessorFactory> processorFactory,
+    const WebsocketOptions& options) {
+  websocketMapping.Add(uri, std::move(processorFactory), options);
 }
 
-void Server::Add(const std::string& uri, std::function<void(WebsocketFrame&&, WebsocketSender&)> f) {
-  websocketMapping.Add(uri, std::make_unique<LambdaProcessorFactoryWrapper<WebsocketProcessorFactory,
-                                WebsocketProcessor, WebsocketFrame, WebsocketSender>>(f));
+void Server::Add(const std::string& uri, std::function<void(WebsocketFrame&&, WebsocketSender&)> f,
+    const WebsocketOptions& options) {
+  websocketMapping.Add(uri,
+      std::make_unique<LambdaProcessorFactoryWrapper<WebsocketProcessorFactory, WebsocketProcessor, WebsocketFrame,
+          WebsocketSender>>(f),
+      options);
 }
 
 }  // namespace network
@@ -8,14 +8,35 @@ namespace network {
 class Server {
 public:
   void Start(std::string_view, std::uint16_t);
-  void Add(HttpMethod, const std::string&, std::unique_ptr<HttpProcessorFactory>);
-  void Add(HttpMethod, const std::string&, std::function<void(HttpRequest&&, HttpSender&)>);
-  void Add(const std::string&, std::unique_ptr<WebsocketProcessorFactory>);
-  void Add(const std::string&, std::function<void(WebsocketFrame&&, WebsocketSender&)>);
+  void Limit(const HttpLimits&);
+  void Limit(const BandwidthLimit&);
+  void Cache(const FileCacheOptions&);
+  void Cache(CompressionCache&);
+  void Cache(ResponseCache&);
+  void Hub(WebsocketHub&);
+  void Secure(const TlsSessionFactory&);
+  const HttpRejections& Rejections() const;
+  const TcpStatistics& Statistics() const;
+  void Add(HttpMethod, const std::string&, std::unique_ptr<HttpProcessorFactory>, const HttpRouteOptions& = {});
+  void Add(HttpMethod, const std::string&, std::function<void(HttpRequest&&, HttpSender&)>,
+      const HttpRouteOptions& = {});
+  void Add(HttpMethod, const std::string&, std::unique_ptr<HttpStreamProcessorFactory>, const HttpRouteOptions& = {});
+  void Add(HttpMethod, const std::string&, std::unique_ptr<HttpUploadProcessorFactory>);
+  void Add(const std::string&, std::unique_ptr<WebsocketProcessorFactory>, const WebsocketOptions& = {});
+  void Add(const std::string&, std::function<void(WebsocketFrame&&, WebsocketSender&)>, const WebsocketOptions& = {});
 
 private:
   HttpRouteMapping httpMapping;
   WebsocketRouteMapping websocketMapping;
+  HttpLimits httpLimits;
+  HttpRejections httpRejections;
+  BandwidthLimit bandwidthLimit;
+  TcpStatistics tcpStatistics;
+  FileCacheOptions fileCacheOptions;
+  ResponseCache* responseCache{nullptr};
+  CompressionCache* compressionCache{nullptr};
+  WebsocketHub* websocketHub{nullptr};
+  const TlsSessionFactory* tlsSessionFactory{nullptr};
 };
 
 }  // namespace network
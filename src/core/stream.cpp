@@ -0,0 +1,41 @@
+#include "stream.hpp"
+#include "http.hpp"
+
+namespace network {
+
+MixedReplaceStream::MixedReplaceStream(std::string boundary) : boundary{std::move(boundary)} {
+}
+
+void MixedReplaceStream::Publish(MixedReplaceDataHttpResponse&& response) {
+  auto part = std::make_shared<const std::string>(SerializeMixedReplacePart(boundary, std::move(response)));
+  std::lock_guard lock{streamMut};
+  latest = part;
+  for (const auto* viewer : viewers) {
+    viewer->Send(SharedMixedReplaceDataHttpResponse{part});
+  }
+}
+
+void MixedReplaceStream::Attach(const HttpSender& sender) {
+  sender.Send(MixedReplaceHeaderHttpResponse{boundary});
+  std::lock_guard lock{streamMut};
+  viewers.insert(&sender);
+  if (latest) {
+    sender.Send(SharedMixedReplaceDataHttpResponse{latest});
+  }
+}
+
+void MixedReplaceStream::Detach(const HttpSender& sender) {
+  std::lock_guard lock{streamMut};
+  viewers.erase(&sender);
+}
+
+MixedReplaceViewer::MixedReplaceViewer(MixedReplaceStream& stream, const HttpSender& sender)
+    : stream{stream}, sender{sender} {
+  stream.Attach(sender);
+}
+
+MixedReplaceViewer::~MixedReplaceViewer() {
+  stream.Detach(sender);
+}
+
+}  // namespace network
@@ -0,0 +1,44 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include "network.hpp"
+
+namespace network {
+
+class MixedReplaceStream {
+public:
+  explicit MixedReplaceStream(std::string = "BND");
+  MixedReplaceStream(const MixedReplaceStream&) = delete;
+  MixedReplaceStream(MixedReplaceStream&&) = delete;
+  MixedReplaceStream& operator=(const MixedReplaceStream&) = delete;
+  MixedReplaceStream& operator=(MixedReplaceStream&&) = delete;
+  ~MixedReplaceStream() = default;
+
+  void Publish(MixedReplaceDataHttpResponse&&);
+  void Attach(const HttpSender&);
+  void Detach(const HttpSender&);
+
+private:
+  const std::string boundary;
+  std::shared_ptr<const std::string> latest;
+  std::unordered_set<const HttpSender*> viewers;
+  std::mutex streamMut;
+};
+
+class MixedReplaceViewer {
+public:
+  MixedReplaceViewer(MixedReplaceStream&, const HttpSender&);
+  MixedReplaceViewer(const MixedReplaceViewer&) = delete;
+  MixedReplaceViewer(MixedReplaceViewer&&) = delete;
+  MixedReplaceViewer& operator=(const MixedReplaceViewer&) = delete;
+  MixedReplaceViewer& operator=(MixedReplaceViewer&&) = delete;
+  ~MixedReplaceViewer();
+
+private:
+  MixedReplaceStream& stream;
+  const HttpSender& sender;
+};
+
+}  // namespace network
@@ -5,82 +5,351 @@
 #include <spdlog/spdlog.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 namespace {
 
 struct TrySendOperation {
   auto operator()(auto& op) {
-    op.Send();
+    budget -= std::min(budget, op.Send(budget));
     return op.Done();
   }
+  size_t& budget;
 };
 
+constexpr size_t prefetchWindow = 1 << 20;
+constexpr size_t sendBudget = 256 << 10;
+constexpr size_t shapingQuantum = 16 << 10;
+constexpr size_t maxGatheredOps = 64;
+constexpr int maxDeferredBatches = 4;
+
+std::string_view UnsentOf(const network::TcpSendOperation& op) {
+  if (auto* buffer = std::get_if<network::TcpSendBuffer>(&op)) {
+    return buffer->Unsent();
+  }
+  if (auto* shared = std::get_if<network::TcpSendSharedBuffer>(&op)) {
+    return shared->Unsent();
+  }
+  return {};
+}
+
+void ConsumeOf(network::TcpSendOperation& op, size_t n) {
+  if (auto* buffer = std::get_if<network::TcpSendBuffer>(&op)) {
+    buffer->Consume(n);
+  } else if (auto* shared = std::get_if<network::TcpSendSharedBuffer>(&op)) {
+    shared->Consume(n);
+  }
+}
+
 }  // namespace
 
 namespace network {
 
-TcpSendBuffer::TcpSendBuffer(int fd, std::string_view buffer) : fd{fd}, buffer{buffer}, size{buffer.size()} {
+TcpSendBuffer::TcpSendBuffer(int fd, std::string buffer_) : fd{fd}, buffer{std::move(buffer_)}, size{buffer.size()} {
 }
 
-void TcpSendBuffer::Send() {
-  while (size > 0) {
-    ssize_t n = send(fd, buffer.c_str(), size, 0);
+size_t TcpSendBuffer::Send(size_t budget) {
+  size_t sent = 0;
+  while (size > 0 and sent < budget) {
+    ssize_t n = send(fd, buffer.c_str() + offset, std::min(size, budget - sent), 0);
     if (n == -1) {
       if (errno == EAGAIN or errno == EWOULDBLOCK) {
-        return;
+        return sent;
       }
       spdlog::error("tcp send(): {}", strerror(errno));
-      return;
+      return sent;
     }
     if (n == 0) {
-      return;
+      return sent;
     }
     size -= n;
-    buffer.erase(0, n);
+    offset += n;
+    sent += n;
   }
+  return sent;
 }
 
 bool TcpSendBuffer::Done() const {
   return size == 0;
 }
 
-std::string&& TcpSendBuffer::TakeBuffer() {
-  return std::move(buffer);
+size_t TcpSendBuffer::Remaining() const {
+  return size;
+}
+
+std::string_view TcpSendBuffer::Unsent() const {
+  return {buffer.data() + offset, size};
+}
+
+void TcpSendBuffer::Consume(size_t n) {
+  offset += n;
+  size -= n;
+}
+
+void TcpSendBuffer::Append(std::string_view data) {
+  if (offset > 0 and offset >= size) {
+    buffer.erase(0, offset);
+    offset = 0;
+  }
+  buffer += data;
+  size += data.size();
+}
+
+TcpSendSharedBuffer::TcpSendSharedBuffer(int fd, std::shared_ptr<const std::string> buffer_, bool replaceable)
+    : fd{fd}, buffer{std::move(buffer_)}, replaceable{replaceable} {
+}
+
+size_t TcpSendSharedBuffer::Send(size_t budget) {
+  size_t sent = 0;
+  while (offset < buffer->size() and sent < budget) {
+    ssize_t n = send(fd, buffer->data() + offset, std::min(buffer->size() - offset, budget - sent), 0);
+    if (n == -1) {
+      if (errno == EAGAIN or errno == EWOULDBLOCK) {
+        return sent;
+      }
+      spdlog::error("tcp send(): {}", strerror(errno));
+      return sent;
+    }
+    if (n == 0) {
+      return sent;
+    }
+    offset += n;
+    sent += n;
+  }
+  return sent;
+}
+
+bool TcpSendSharedBuffer::Done() const {
+  return offset == buffer->size();
+}
+
+size_t TcpSendSharedBuffer::Remaining() const {
+  return buffer->size() - offset;
 }
 
-TcpSendFile::TcpSendFile(int fd, os::File file_) : fd{fd}, file{std::move(file_)} {
-  if (not file.Ok()) {
+std::string_view TcpSendSharedBuffer::Unsent() const {
+  return std::string_view{*buffer}.substr(offset);
+}
+
+void TcpSendSharedBuffer::Consume(size_t n) {
+  offset += n;
+}
+
+bool TcpSendSharedBuffer::Replace(std::shared_ptr<const std::string>& latest) {
+  if (not replaceable or offset > 0) {
+    return false;
+  }
+  buffer = std::move(latest);
+  return true;
+}
+
+TcpSendFile::TcpSendFile(int fd, std::shared_ptr<const os::File> file_) : fd{fd}, file{std::move(file_)} {
+  if (not file or not file->Ok()) {
     size = 0;
     return;
   }
-  size = file.Size();
+  size = file->Size();
 }
 
-void TcpSendFile::Send() {
-  while (size > 0) {
-    ssize_t n = sendfile(fd, file.Fd(), nullptr, size);
+TcpSendFile::TcpSendFile(int fd, std::shared_ptr<const os::File> file_, size_t offset_, size_t size_)
+    : fd{fd}, file{std::move(file_)} {
+  if (not file or not file->Ok() or offset_ >= file->Size()) {
+    size = 0;
+    return;
+  }
+  offset = offset_;
+  size = std::min(size_, file->Size() - offset_);
+}
+
+size_t TcpSendFile::Send(size_t budget) {
+  size_t sent = 0;
+  while (size > 0 and sent < budget) {
+    if (offset >= residentUntil and not Probe(budget - sent)) {
+      cold = true;
+      return sent;
+    }
+    size_t count = std::min({size, budget - sent, static_cast<size_t>(residentUntil - offset)});
+    ssize_t n = sendfile(fd, file->Fd(), &offset, count);
     if (n < 0) {
       if (errno == EAGAIN or errno == EWOULDBLOCK) {
-        return;
+        return sent;
       }
       spdlog::error("tcp sendfile(): {}", strerror(errno));
-      return;
+      Fail();
+      return sent;
     }
     if (n == 0) {
-      return;
+      spdlog::error("tcp sendfile(): file ended {} bytes early", size);
+      Fail();
+      return sent;
     }
     size -= n;
+    sent += n;
   }
+  return sent;
 }
 
 bool TcpSendFile::Done() const {
   return size == 0;
 }
 
-ConcreteTcpSender::ConcreteTcpSender(int fd, TcpSenderSupervisor& supervisor) : fd{fd}, supervisor{supervisor} {
+size_t TcpSendFile::Remaining() const {
+  return size;
+}
+
+bool TcpSendFile::Cold() const {
+  return cold;
+}
+
+bool TcpSendFile::Failed() const {
+  return failed;
+}
+
+void TcpSendFile::Fail() {
+  failed = true;
+  size = 0;
+}
+
+void TcpSendFile::Prefetched() {
+  cold = false;
+  residentUntil = offset + Window();
+}
+
+const std::shared_ptr<const os::File>& TcpSendFile::File() const {
+  return file;
+}
+
+off_t TcpSendFile::Offset() const {
+  return offset;
+}
+
+size_t TcpSendFile::Window() const {
+  return std::min(size, prefetchWindow);
+}
+
+size_t TcpSendFile::Read(char* buffer, size_t budget) {
+  // RWF_NOWAIT fails on pages missing from the cache instead of blocking the event loop, those are prefetched.
+  iovec iov{buffer, std::min(size, budget)};
+  ssize_t n = preadv2(file->Fd(), &iov, 1, offset, RWF_NOWAIT);
+  if (n < 0 and errno == EOPNOTSUPP) {
+    if (offset >= residentUntil and not Probe(iov.iov_len)) {
+      cold = true;
+      return 0;
+    }
+    n = pread(file->Fd(), buffer, std::min(iov.iov_len, static_cast<size_t>(residentUntil - offset)), offset);
+  }
+  if (n < 0 and errno == EAGAIN) {
+    cold = true;
+    return 0;
+  }
+  if (n <= 0) {
+    if (n < 0) {
+      spdlog::error("tcp pread(): {}", strerror(errno));
+    } else {
+      spdlog::error("tcp pread(): file ended {} bytes early", size);
+    }
+    Fail();
+    return 0;
+  }
+  offset += n;
+  size -= n;
+  return n;
+}
+
+bool TcpSendFile::Probe(size_t wanted) {
+  // A single byte RWF_NOWAIT read per page tells whether it is cached, without mapping the file into the process.
+  // Only the pages about to be sent are probed and only the resident prefix is trusted.
+  static const off_t pageSize = sysconf(_SC_PAGESIZE);
+  const off_t end = offset + std::min(wanted, Window());
+  off_t page = offset - offset % pageSize;
+  char byte;
+  iovec iov{&byte, 1};
+  while (page < end) {
+    ssize_t n = preadv2(file->Fd(), &iov, 1, page, RWF_NOWAIT);
+    if (n < 0 and errno == EOPNOTSUPP) {
+      residentUntil = offset + size;
+      return true;
+    }
+    if (n != 1) {
+      break;
+    }
+    page += pageSize;
+  }
+  if (page <= offset) {
+    return false;
+  }
+  residentUntil = std::min(page, end);
+  return true;
+}
+
+TcpPrefetcher::TcpPrefetcher() : worker{[this] { Run(); }} {
+}
+
+TcpPrefetcher::~TcpPrefetcher() {
+  {
+    std::lock_guard lock{prefetcherMut};
+    stopping = true;
+  }
+  prefetcherCv.notify_one();
+  worker.join();
+}
+
+void TcpPrefetcher::Prefetch(
+    std::shared_ptr<const os::File> file, off_t offset, size_t size, std::weak_ptr<TcpResumeToken> token) {
+  {
+    std::lock_guard lock{prefetcherMut};
+    jobs.push_back({std::move(file), offset, size, std::move(token)});
+  }
+  prefetcherCv.notify_one();
+}
+
+void TcpPrefetcher::Run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock lock{prefetcherMut};
+      prefetcherCv.wait(lock, [this] { return stopping or not jobs.empty(); });
+      if (stopping) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    if (job.token.expired()) {
+      continue;
+    }
+    if (readahead(job.file->Fd(), job.offset, job.size) < 0) {
+      spdlog::error("tcp readahead(): {}", strerror(errno));
+    }
+    auto token = job.token.lock();
+    if (not token) {
+      continue;
+    }
+    std::lock_guard lock{token->tokenMut};
+    if (token->sender) {
+      token->sender->Resume();
+    }
+  }
+}
+
+ConcreteTcpSender::ConcreteTcpSender(int fd, TcpSenderSupervisor& supervisor, TcpPrefetcher& prefetcher,
+    const BandwidthLimit& defaultLimit, TcpStatistics& statistics, TlsSession* tls)
+    : fd{fd},
+      supervisor{supervisor},
+      prefetcher{prefetcher},
+      statistics{statistics},
+      tls{tls},
+      defaultLimit{defaultLimit},
+      refilled{std::chrono::steady_clock::now()} {
+  Shape(defaultLimit);
   int flag = 0;
   int r = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
   if (r < 0) {
@@ -89,49 +358,386 @@ ConcreteTcpSender::ConcreteTcpSender(int fd, TcpSenderSupervisor& supervisor) :
 }
 
 ConcreteTcpSender::~ConcreteTcpSender() {
-  ConcreteTcpSender::Close();
+  if (resumeToken) {
+    std::lock_guard lock{resumeToken->tokenMut};
+    resumeToken->sender = nullptr;
+  }
+  std::lock_guard lock{senderMut};
+  CloseImpl();
 }
 
 void ConcreteTcpSender::SendBuffered() {
+  std::function<void()> drained;
+  {
+    std::lock_guard lock{senderMut};
+    if (not waiting and SendBufferedImpl()) {
+      UnmarkPending();
+      if (closing) {
+        Finish();
+      }
+    }
+    drained = TakeDrainCallback();
+  }
+  if (drained) {
+    drained();
+  }
+}
+
+void ConcreteTcpSender::Shape(const BandwidthLimit& routeLimit) {
   std::lock_guard lock{senderMut};
+  const auto& next = routeLimit.bytesPerSecond > 0 ? routeLimit : defaultLimit;
+  unsigned int rate = next.kernelPacing ? std::min<size_t>(next.bytesPerSecond, ~0U - 1) : ~0U;
+  if (rate != pacingRate) {
+    pacingRate = rate;
+    if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof rate) < 0) {
+      spdlog::error("tcp setsockopt(SO_MAX_PACING_RATE): {}", strerror(errno));
+    }
+  }
+  const bool changed = next.bytesPerSecond != limit.bytesPerSecond;
+  limit = next;
+  if (changed) {
+    tokens = limit.burst;
+    refilled = std::chrono::steady_clock::now();
+  }
+}
+
+bool ConcreteTcpSender::Bulk() {
+  std::lock_guard lock{senderMut};
+  return not buffered.empty() and std::holds_alternative<TcpSendFile>(buffered.front());
+}
+
+void ConcreteTcpSender::Coalesce(std::chrono::nanoseconds delay) {
+  std::lock_guard lock{senderMut};
+  flushDelay = delay;
+}
+
+void ConcreteTcpSender::Cork() {
+  std::lock_guard lock{senderMut};
+  corked = true;
+}
+
+void ConcreteTcpSender::Uncork() {
+  std::lock_guard lock{senderMut};
+  corked = false;
+  if (pending or waiting or fd == -1) {
+    return;
+  }
+  if (not SendBufferedImpl()) {
+    MarkPending();
+    return;
+  }
+  if (closing) {
+    Finish();
+    return;
+  }
+  if (onDrain) {
+    MarkPending();
+  }
+}
+
+bool ConcreteTcpSender::SendBufferedImpl() {
+  size_t budget = sendBudget;
+  if (limit.bytesPerSecond > 0 and not buffered.empty()) {
+    Refill();
+    const size_t quantum = std::min(limit.burst, shapingQuantum);
+    if (tokens < quantum) {
+      Throttle(quantum);
+      return false;
+    }
+    budget = std::min(budget, static_cast<size_t>(tokens));
+  }
+  if (tls and not tls->KernelSend()) {
+    return SendEncrypted(budget);
+  }
   while (not buffered.empty()) {
+    if (budget > 0 and buffered.size() > 1 and not UnsentOf(buffered[0]).empty() and
+        not UnsentOf(buffered[1]).empty()) {
+      if (not SendGathered(budget)) {
+        return false;
+      }
+      continue;
+    }
     auto& op = buffered.front();
-    if (not std::visit(TrySendOperation{}, op)) {
-      return;
+    const size_t before = budget;
+    const bool done = budget > 0 and std::visit(TrySendOperation{budget}, op);
+    const size_t sent = before - budget;
+    auto& counter = std::holds_alternative<TcpSendFile>(op) ? statistics.bulkBytes : statistics.interactiveBytes;
+    counter.fetch_add(sent, std::memory_order_relaxed);
+    tokens -= sent;
+    bufferedBytes -= sent;
+    if (auto* file = std::get_if<TcpSendFile>(&op); file and file->Failed()) {
+      AbortImpl();
+      return false;
+    }
+    if (not done) {
+      if (auto* file = std::get_if<TcpSendFile>(&op); file and file->Cold()) {
+        Prefetch(*file);
+      }
+      return false;
     }
     buffered.pop_front();
   }
-  UnmarkPending();
+  return true;
 }
 
-void ConcreteTcpSender::Send(std::string_view buf) {
-  std::lock_guard lock{senderMut};
-  std::string accumulated{buf};
-  while (not buffered.empty()) {
-    auto& lastOp = buffered.back();
-    if (not std::holds_alternative<TcpSendBuffer>(lastOp)) {
+bool ConcreteTcpSender::SendGathered(size_t& budget) {
+  iovec iov[maxGatheredOps];
+  size_t count = 0;
+  size_t total = 0;
+  for (const auto& op : buffered) {
+    auto unsent = UnsentOf(op);
+    if (unsent.empty() or count == maxGatheredOps or total == budget) {
       break;
     }
-    auto& lastWriteBuffer = std::get<TcpSendBuffer>(lastOp);
-    std::string s = lastWriteBuffer.TakeBuffer();
-    s += accumulated;
-    accumulated = std::move(s);
-    buffered.pop_back();
+    const size_t length = std::min(unsent.size(), budget - total);
+    iov[count++] = {const_cast<char*>(unsent.data()), length};
+    total += length;
+  }
+  ssize_t n = writev(fd, iov, count);
+  if (n < 0) {
+    if (errno != EAGAIN and errno != EWOULDBLOCK) {
+      spdlog::error("tcp writev(): {}", strerror(errno));
+    }
+    return false;
+  }
+  size_t sent = n;
+  budget -= sent;
+  tokens -= sent;
+  bufferedBytes -= sent;
+  statistics.interactiveBytes.fetch_add(sent, std::memory_order_relaxed);
+  while (sent > 0) {
+    auto& op = buffered.front();
+    const size_t length = std::min(sent, UnsentOf(op).size());
+    ConsumeOf(op, length);
+    sent -= length;
+    if (UnsentOf(op).empty()) {
+      buffered.pop_front();
+    }
+  }
+  return static_cast<size_t>(n) == total;
+}
+
+bool ConcreteTcpSender::SendEncrypted(size_t budget) {
+  char chunk[shapingQuantum];
+  while (tls->Flush()) {
+    if (buffered.empty()) {
+      return true;
+    }
+    if (budget == 0) {
+      return false;
+    }
+    auto& op = buffered.front();
+    auto remaining = [&op] { return std::visit([](const auto& queued) { return queued.Remaining(); }, op); };
+    const size_t before = remaining();
+    size_t length = 0;
+    if (auto* file = std::get_if<TcpSendFile>(&op)) {
+      length = file->Read(chunk, std::min(budget, sizeof chunk));
+      if (file->Failed()) {
+        AbortImpl();
+        return false;
+      }
+      if (file->Cold()) {
+        Prefetch(*file);
+        return false;
+      }
+      tls->Write({chunk, length});
+      statistics.bulkBytes.fetch_add(length, std::memory_order_relaxed);
+    } else {
+      const auto unsent = UnsentOf(op).substr(0, std::min(budget, sizeof chunk));
+      length = unsent.size();
+      tls->Write(unsent);
+      ConsumeOf(op, length);
+      statistics.interactiveBytes.fetch_add(length, std::memory_order_relaxed);
+    }
+    budget -= length;
+    tokens -= length;
+    bufferedBytes -= before - remaining();
+    if (std::visit([](const auto& queued) { return queued.Done(); }, op)) {
+      buffered.pop_front();
+    }
+  }
+  return false;
+}
+
+void ConcreteTcpSender::Refill() {
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = now - refilled;
+  refilled = now;
+  tokens = std::min<double>(limit.burst, tokens + elapsed.count() * limit.bytesPerSecond);
+}
+
+void ConcreteTcpSender::Throttle(size_t quantum) {
+  UnmarkPending();
+  waiting = true;
+  statistics.throttled.fetch_add(1, std::memory_order_relaxed);
+  const std::chrono::duration<double> delay{(quantum - tokens) / limit.bytesPerSecond};
+  supervisor.ResumeSenderAfter(fd, std::chrono::duration_cast<std::chrono::nanoseconds>(delay));
+}
+
+void ConcreteTcpSender::Prefetch(TcpSendFile& file) {
+  if (not resumeToken) {
+    resumeToken = std::make_shared<TcpResumeToken>();
+    resumeToken->sender = this;
+  }
+  UnmarkPending();
+  waiting = true;
+  file.Prefetched();
+  prefetcher.Prefetch(file.File(), file.Offset(), file.Window(), resumeToken);
+}
+
+void ConcreteTcpSender::Resume() {
+  std::lock_guard lock{senderMut};
+  waiting = false;
+  if (fd == -1 or (buffered.empty() and not onDrain)) {
+    return;
   }
-  TcpSendBuffer op{fd, std::move(accumulated)};
-  buffered.emplace_back(std::move(op));
   MarkPending();
 }
 
+void ConcreteTcpSender::Send(std::string_view buf) {
+  std::lock_guard lock{senderMut};
+  Append(buf, {});
+}
+
+void ConcreteTcpSender::Send(std::string_view head, std::string_view body) {
+  std::lock_guard lock{senderMut};
+  Append(head, body);
+}
+
 void ConcreteTcpSender::Send(os::File file) {
+  Send(std::make_shared<const os::File>(std::move(file)));
+}
+
+void ConcreteTcpSender::Send(std::shared_ptr<const os::File> file) {
   std::lock_guard lock{senderMut};
-  TcpSendFile op{fd, std::move(file)};
-  buffered.emplace_back(std::move(op));
-  MarkPending();
+  Enqueue(TcpSendFile{fd, std::move(file)});
+}
+
+void ConcreteTcpSender::Send(std::shared_ptr<const os::File> file, size_t offset, size_t size) {
+  std::lock_guard lock{senderMut};
+  Enqueue(TcpSendFile{fd, std::move(file), offset, size});
+}
+
+void ConcreteTcpSender::Send(std::shared_ptr<const std::string> buffer) {
+  std::lock_guard lock{senderMut};
+  Enqueue(TcpSendSharedBuffer{fd, std::move(buffer)});
+}
+
+std::size_t ConcreteTcpSender::Backlog() {
+  std::lock_guard lock{senderMut};
+  return buffered.size();
+}
+
+std::size_t ConcreteTcpSender::BufferedBytes() {
+  std::lock_guard lock{senderMut};
+  return bufferedBytes;
+}
+
+void ConcreteTcpSender::OnDrain(std::size_t threshold, std::function<void()> callback) {
+  std::lock_guard lock{senderMut};
+  drainThreshold = threshold;
+  onDrain = std::move(callback);
+  if (onDrain and bufferedBytes <= drainThreshold) {
+    MarkPending();
+  }
+}
+
+std::function<void()> ConcreteTcpSender::TakeDrainCallback() {
+  if (not onDrain or (bufferedBytes > drainThreshold and fd != -1)) {
+    return nullptr;
+  }
+  return std::exchange(onDrain, nullptr);
+}
+
+void ConcreteTcpSender::Abort() {
+  std::lock_guard lock{senderMut};
+  AbortImpl();
+}
+
+void ConcreteTcpSender::Disconnect() {
+  std::function<void()> drained;
+  {
+    std::lock_guard lock{senderMut};
+    AbortImpl();
+    drained = TakeDrainCallback();
+  }
+  if (drained) {
+    drained();
+  }
+}
+
+bool ConcreteTcpSender::Closed() {
+  std::lock_guard lock{senderMut};
+  return fd == -1;
+}
+
+void ConcreteTcpSender::AbortImpl() {
+  buffered.clear();
+  bufferedBytes = 0;
+  closing = false;
+  UnmarkPending();
+  CloseImpl();
+}
+
+void ConcreteTcpSender::SendLatest(std::shared_ptr<const std::string> buffer) {
+  std::lock_guard lock{senderMut};
+  if (not buffered.empty()) {
+    auto* last = std::get_if<TcpSendSharedBuffer>(&buffered.back());
+    const size_t replaced = last ? last->Remaining() : 0;
+    if (last and last->Replace(buffer)) {
+      bufferedBytes += last->Remaining() - replaced;
+      return;
+    }
+  }
+  Enqueue(TcpSendSharedBuffer{fd, std::move(buffer), true});
 }
 
 void ConcreteTcpSender::Close() {
   std::lock_guard lock{senderMut};
+  if (buffered.empty() and not tls) {
+    CloseImpl();
+    return;
+  }
+  closing = true;
+  MarkPending();
+}
+
+void ConcreteTcpSender::Enqueue(TcpSendOperation&& op) {
+  bufferedBytes += std::visit([](const auto& queued) { return queued.Remaining(); }, op);
+  buffered.emplace_back(std::move(op));
+  Schedule();
+}
+
+void ConcreteTcpSender::Append(std::string_view head, std::string_view body) {
+  if (not buffered.empty()) {
+    if (auto* last = std::get_if<TcpSendBuffer>(&buffered.back())) {
+      bufferedBytes += head.size() + body.size();
+      last->Append(head);
+      last->Append(body);
+      Schedule();
+      return;
+    }
+  }
+  std::string buf;
+  buf.reserve(head.size() + body.size());
+  buf += head;
+  buf += body;
+  Enqueue(TcpSendBuffer{fd, std::move(buf)});
+}
+
+void ConcreteTcpSender::Schedule() {
+  if (flushDelay.count() == 0 or pending or corked or waiting or fd == -1) {
+    MarkPending();
+    return;
+  }
+  waiting = true;
+  supervisor.ResumeSenderAfter(fd, flushDelay);
+}
+
+void ConcreteTcpSender::Finish() {
+  if (tls and fd != -1) {
+    tls->Shutdown();
+  }
   CloseImpl();
 }
 
@@ -143,7 +749,7 @@ void ConcreteTcpSender::CloseImpl() {
 }
 
 void ConcreteTcpSender::MarkPending() {
-  if (pending) {
+  if (pending or corked or waiting or fd == -1) {
     return;
   }
   pending = true;
@@ -158,10 +764,110 @@ void ConcreteTcpSender::UnmarkPending() {
   supervisor.UnmarkSenderPending(fd);
 }
 
-TcpLayer::TcpLayer(TcpProcessorFactory& processorFactory) : processorFactory{processorFactory} {
+ConcreteTcpReceiver::ConcreteTcpReceiver(int fd, const int (&pipeFds)[2], std::string& peekBuffer)
+    : fd{fd}, pipeFds{pipeFds}, peekBuffer{peekBuffer} {
+}
+
+std::string_view ConcreteTcpReceiver::Peek() {
+  constexpr size_t peekSize = 65536;
+  peekBuffer.resize(peekSize);
+  ssize_t r = recv(fd, peekBuffer.data(), peekSize, MSG_PEEK);
+  if (r < 0) {
+    if (errno != EAGAIN and errno != EWOULDBLOCK) {
+      closed = true;
+    }
+    return {};
+  }
+  if (r == 0) {
+    closed = true;
+  }
+  return {peekBuffer.data(), static_cast<size_t>(r)};
+}
+
+std::optional<size_t> ConcreteTcpReceiver::Splice(int target, size_t size) {
+  constexpr size_t maxSpliceSize = 1 << 20;
+  if (pipeFds[0] == -1) {
+    return 0;
+  }
+  size = std::min(size, maxSpliceSize);
+  size_t spliced = 0;
+  while (spliced < size) {
+    ssize_t r = splice(fd, nullptr, pipeFds[1], nullptr, size - spliced, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (r < 0) {
+      if (errno != EAGAIN and errno != EWOULDBLOCK) {
+        spdlog::error("tcp splice(): {}", strerror(errno));
+        closed = true;
+      }
+      break;
+    }
+    if (r == 0) {
+      closed = true;
+      break;
+    }
+    if (not Drain(target, r)) {
+      return std::nullopt;
+    }
+    spliced += r;
+  }
+  return spliced;
+}
+
+bool ConcreteTcpReceiver::Drain(int target, size_t size) {
+  while (size > 0) {
+    ssize_t r = splice(pipeFds[0], nullptr, target, nullptr, size, SPLICE_F_MOVE);
+    if (r <= 0) {
+      spdlog::error("tcp splice(): {}", strerror(errno));
+      break;
+    }
+    size -= r;
+  }
+  if (size == 0) {
+    return true;
+  }
+  // The pipe is shared by every connection of the worker, so what the target did not take has to be dropped.
+  char discarded[4096];
+  while (size > 0) {
+    ssize_t r = read(pipeFds[0], discarded, std::min(size, sizeof discarded));
+    if (r <= 0) {
+      break;
+    }
+    size -= r;
+  }
+  return false;
+}
+
+bool ConcreteTcpReceiver::Closed() const {
+  return closed;
+}
+
+TcpLayer::TcpLayer(
+    TcpProcessorFactory& processorFactory, const BandwidthLimit& bandwidthLimit, TcpStatistics& statistics)
+    : processorFactory{processorFactory}, bandwidthLimit{bandwidthLimit}, statistics{statistics} {
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd < 0) {
+    spdlog::error("tcp eventfd(): {}", strerror(errno));
+  }
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFd < 0) {
+    spdlog::error("tcp timerfd_create(): {}", strerror(errno));
+  }
 }
 
 TcpLayer::~TcpLayer() {
+  std::vector<int> peers;
+  for (const auto& [peer, _] : connections) {
+    peers.push_back(peer);
+  }
+  connections.clear();
+  for (int peer : peers) {
+    close(peer);
+  }
+  for (int& fd : spliceFds) {
+    if (fd != -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
   if (localFd != -1) {
     close(localFd);
     localFd = -1;
@@ -170,6 +876,22 @@ TcpLayer::~TcpLayer() {
     close(epollFd);
     epollFd = -1;
   }
+  if (eventFd != -1) {
+    close(eventFd);
+    eventFd = -1;
+  }
+  if (timerFd != -1) {
+    close(timerFd);
+    timerFd = -1;
+  }
+}
+
+void TcpLayer::Stop() {
+  Post([this] { stopping = true; });
+}
+
+void TcpLayer::Secure(const TlsSessionFactory& factory) {
+  tlsSessionFactory = &factory;
 }
 
 void TcpLayer::Start() {
@@ -182,7 +904,17 @@ void TcpLayer::Start() {
   if (localFd < 0) {
     return;
   }
+  if (pipe2(spliceFds, O_NONBLOCK) < 0) {
+    spdlog::error("tcp pipe2(): {}", strerror(errno));
+    spliceFds[0] = spliceFds[1] = -1;
+  }
   MarkReceiverPending(localFd);
+  if (eventFd != -1) {
+    MarkReceiverPending(eventFd);
+  }
+  if (timerFd != -1) {
+    MarkReceiverPending(timerFd);
+  }
   StartLoop();
 }
 
@@ -221,6 +953,76 @@ void TcpLayer::UnmarkSenderPending(int peer) const {
   }
 }
 
+void TcpLayer::ResumeSenderAfter(int peer, std::chrono::nanoseconds delay) const {
+  std::lock_guard lock{timersMut};
+  auto it = timers.emplace(std::chrono::steady_clock::now() + delay, peer);
+  if (it == timers.begin()) {
+    ArmTimer(it->first);
+  }
+}
+
+void TcpLayer::ArmTimer(std::chrono::steady_clock::time_point deadline) const {
+  const auto since = deadline.time_since_epoch();
+  const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since);
+  itimerspec spec{};
+  spec.it_value.tv_sec = seconds.count();
+  spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(since - seconds).count();
+  if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+    spdlog::error("tcp timerfd_settime(): {}", strerror(errno));
+  }
+}
+
+void TcpLayer::Post(std::function<void()> task) {
+  {
+    std::lock_guard lock{postedMut};
+    posted.emplace_back(std::move(task));
+  }
+  const std::uint64_t one = 1;
+  if (write(eventFd, &one, sizeof one) < 0 and errno != EAGAIN) {
+    spdlog::error("tcp write(eventfd): {}", strerror(errno));
+  }
+}
+
+void TcpLayer::RunPosted() {
+  std::uint64_t count;
+  if (read(eventFd, &count, sizeof count) < 0 and errno != EAGAIN) {
+    spdlog::error("tcp read(eventfd): {}", strerror(errno));
+  }
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard lock{postedMut};
+    tasks.swap(posted);
+  }
+  for (auto& task : tasks) {
+    task();
+  }
+}
+
+void TcpLayer::ResumeDueSenders() {
+  std::uint64_t expirations;
+  if (read(timerFd, &expirations, sizeof expirations) < 0 and errno != EAGAIN) {
+    spdlog::error("tcp read(timerfd): {}", strerror(errno));
+  }
+  std::vector<int> due;
+  {
+    std::lock_guard lock{timersMut};
+    const auto now = std::chrono::steady_clock::now();
+    while (not timers.empty() and timers.begin()->first <= now) {
+      due.push_back(timers.begin()->second);
+      timers.erase(timers.begin());
+    }
+    if (not timers.empty()) {
+      ArmTimer(timers.begin()->first);
+    }
+  }
+  for (int peer : due) {
+    auto it = connections.find(peer);
+    if (it != connections.end() and std::get<TcpConnectionContext>(*it).sender) {
+      std::get<TcpConnectionContext>(*it).sender->Resume();
+    }
+  }
+}
+
 void TcpLayer::SetNonBlocking(int peer) const {
   int flags = fcntl(peer, F_GETFL);
   if (flags < 0) {
@@ -237,13 +1039,23 @@ void TcpLayer::SetNonBlocking(int peer) const {
 void TcpLayer::StartLoop() {
   constexpr int maxEvents = 32;
   epoll_event events[maxEvents];
-  while (true) {
-    int n = epoll_wait(epollFd, events, maxEvents, -1);
+  std::vector<int> bulkPeers;
+  int deferredBatches = 0;
+  while (not stopping) {
+    int n = epoll_wait(epollFd, events, maxEvents, bulkPeers.empty() ? -1 : 0);
     for (int i = 0; i < n; i++) {
       if (events[i].data.fd == localFd) {
         SetupPeer();
         continue;
       }
+      if (events[i].data.fd == eventFd) {
+        RunPosted();
+        continue;
+      }
+      if (events[i].data.fd == timerFd) {
+        ResumeDueSenders();
+        continue;
+      }
       if (events[i].events & EPOLLERR) {
         ClosePeer(events[i].data.fd);
         continue;
@@ -253,10 +1065,27 @@ void TcpLayer::StartLoop() {
         continue;
       }
       if (events[i].events & EPOLLOUT) {
+        if (SendsBulk(events[i].data.fd)) {
+          if (std::find(bulkPeers.begin(), bulkPeers.end(), events[i].data.fd) == bulkPeers.end()) {
+            bulkPeers.push_back(events[i].data.fd);
+          }
+          continue;
+        }
         SendToPeer(events[i].data.fd);
         continue;
       }
     }
+    // A full batch means more peers are ready, bulk senders wait for them for a few batches.
+    if (n == maxEvents and not bulkPeers.empty() and ++deferredBatches < maxDeferredBatches) {
+      continue;
+    }
+    for (int peer : bulkPeers) {
+      if (connections.contains(peer)) {
+        SendToPeer(peer);
+      }
+    }
+    bulkPeers.clear();
+    deferredBatches = 0;
   }
 }
 
@@ -266,14 +1095,52 @@ void TcpLayer::SetupPeer() {
     return;
   }
   MarkReceiverPending(s);
+  auto& context = connections[s];
+  if (not tlsSessionFactory) {
+    Establish(s, context);
+    return;
+  }
+  context.tls = tlsSessionFactory->Create(s);
+  if (not context.tls) {
+    ClosePeer(s);
+  }
+}
 
-  auto sender = std::make_unique<ConcreteTcpSender>(s, *this);
-  auto processor = processorFactory.Create(*sender);
-  connections.try_emplace(s, std::move(processor), std::move(sender));
+void TcpLayer::Establish(int peer, TcpConnectionContext& context) {
+  context.sender =
+      std::make_unique<ConcreteTcpSender>(peer, *this, prefetcher, bandwidthLimit, statistics, context.tls.get());
+  context.processor = processorFactory.Create(*context.sender);
+}
+
+void TcpLayer::Handshake(int peer, TcpConnectionContext& context) {
+  switch (context.tls->Handshake()) {
+    case TlsHandshake::WantRead:
+      UnmarkSenderPending(peer);
+      return;
+    case TlsHandshake::WantWrite:
+      MarkSenderPending(peer);
+      return;
+    case TlsHandshake::Failed:
+      ClosePeer(peer);
+      return;
+    case TlsHandshake::Done:
+      UnmarkSenderPending(peer);
+      auto& counter = context.tls->KernelSend() ? statistics.kernelTlsSessions : statistics.userTlsSessions;
+      counter.fetch_add(1, std::memory_order_relaxed);
+      Establish(peer, context);
+      return;
+  }
 }
 
 void TcpLayer::ClosePeer(int peer) {
+  if (auto it = connections.find(peer); it != connections.end() and std::get<TcpConnectionContext>(*it).sender) {
+    std::get<TcpConnectionContext>(*it).sender->Disconnect();
+  }
   connections.erase(peer);
+  {
+    std::lock_guard lock{timersMut};
+    std::erase_if(timers, [peer](const auto& timer) { return timer.second == peer; });
+  }
   epoll_ctl(epollFd, EPOLL_CTL_DEL, peer, nullptr);
   close(peer);
 }
@@ -284,7 +1151,19 @@ void TcpLayer::ReadFromPeer(int peer) {
     spdlog::error("tcp read from unexpected peer: {}", peer);
     return;
   }
-  char buf[512];
+  auto& context = std::get<TcpConnectionContext>(*it);
+  if (context.tls) {
+    ReadFromSecurePeer(peer, context);
+    return;
+  }
+  ConcreteTcpReceiver receiver{peer, spliceFds, peekBuffer};
+  if (context.processor->Process(receiver)) {
+    if (receiver.Closed()) {
+      ClosePeer(peer);
+    }
+    return;
+  }
+  char buf[16384];
   size_t size = sizeof buf;
   ssize_t r = recv(peer, buf, size, 0);
   if (r < 0) {
@@ -298,23 +1177,54 @@ void TcpLayer::ReadFromPeer(int peer) {
     ClosePeer(peer);
     return;
   }
-  auto& context = std::get<TcpConnectionContext>(*it);
   context.processor->Process({buf, buf + r});
 }
 
-void TcpLayer::SendToPeer(int peer) const {
+// Records are decrypted before they reach the processor, so the splice path is never offered.
+void TcpLayer::ReadFromSecurePeer(int peer, TcpConnectionContext& context) {
+  if (not context.processor) {
+    Handshake(peer, context);
+    return;
+  }
+  char buf[16384];
+  ssize_t r = context.tls->Read(buf, sizeof buf);
+  if (r < 0 and errno == EAGAIN) {
+    return;
+  }
+  if (r <= 0) {
+    ClosePeer(peer);
+    return;
+  }
+  context.processor->Process({buf, buf + r});
+}
+
+void TcpLayer::SendToPeer(int peer) {
   auto it = connections.find(peer);
   if (it == connections.end()) {
     spdlog::error("tcp send to unexpected peer: {}", peer);
     return;
   }
 
-  const auto& context = std::get<TcpConnectionContext>(*it);
+  auto& context = std::get<TcpConnectionContext>(*it);
+  if (not context.sender) {
+    Handshake(peer, context);
+    return;
+  }
   context.sender->SendBuffered();
 }
 
-Tcp4Layer::Tcp4Layer(std::string_view host, std::uint16_t port, TcpProcessorFactory& processorFactory)
-    : TcpLayer{processorFactory}, host{host}, port{port} {
+bool TcpLayer::SendsBulk(int peer) const {
+  auto it = connections.find(peer);
+  if (it == connections.end()) {
+    return false;
+  }
+  const auto& sender = std::get<TcpConnectionContext>(*it).sender;
+  return sender and sender->Bulk();
+}
+
+Tcp4Layer::Tcp4Layer(std::string_view host, std::uint16_t port, TcpProcessorFactory& processorFactory,
+    const BandwidthLimit& bandwidthLimit, TcpStatistics& statistics)
+    : TcpLayer{processorFactory, bandwidthLimit, statistics}, host{host}, port{port} {
 }
 
 int Tcp4Layer::CreateSocket() const {
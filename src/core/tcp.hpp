@@ -1,53 +1,139 @@
 #pragma once
+#include <condition_variable>
 #include <cstdint>
 #include <deque>
+#include <map>
+#include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 #include "network.hpp"
 
 namespace network {
 
 class TcpSendBuffer {
 public:
-  TcpSendBuffer(int, std::string_view);
+  TcpSendBuffer(int, std::string);
   TcpSendBuffer(TcpSendBuffer&) = delete;
   TcpSendBuffer(TcpSendBuffer&&) = default;
   TcpSendBuffer& operator=(TcpSendBuffer&) = delete;
   TcpSendBuffer& operator=(TcpSendBuffer&&) = default;
   ~TcpSendBuffer() = default;
-  void Send();
+  size_t Send(size_t);
   bool Done() const;
-  std::string&& TakeBuffer();
+  size_t Remaining() const;
+  std::string_view Unsent() const;
+  void Consume(size_t);
+  void Append(std::string_view);
 
 private:
   int fd;
   std::string buffer;
+  size_t offset{0};
   size_t size{0};
 };
 
+class TcpSendSharedBuffer {
+public:
+  TcpSendSharedBuffer(int, std::shared_ptr<const std::string>, bool = false);
+  TcpSendSharedBuffer(TcpSendSharedBuffer&) = delete;
+  TcpSendSharedBuffer(TcpSendSharedBuffer&&) = default;
+  TcpSendSharedBuffer& operator=(TcpSendSharedBuffer&) = delete;
+  TcpSendSharedBuffer& operator=(TcpSendSharedBuffer&&) = default;
+  ~TcpSendSharedBuffer() = default;
+  size_t Send(size_t);
+  bool Done() const;
+  size_t Remaining() const;
+  std::string_view Unsent() const;
+  void Consume(size_t);
+  bool Replace(std::shared_ptr<const std::string>&);
+
+private:
+  int fd;
+  std::shared_ptr<const std::string> buffer;
+  size_t offset{0};
+  bool replaceable;
+};
+
 class TcpSendFile {
 public:
-  TcpSendFile(int, os::File);
+  TcpSendFile(int, std::shared_ptr<const os::File>);
+  TcpSendFile(int, std::shared_ptr<const os::File>, size_t, size_t);
   TcpSendFile(TcpSendFile&) = delete;
   TcpSendFile(TcpSendFile&&) = default;
   TcpSendFile& operator=(TcpSendFile&) = delete;
   TcpSendFile& operator=(TcpSendFile&&) = default;
   ~TcpSendFile() = default;
-  void Send();
+  size_t Send(size_t);
   bool Done() const;
+  size_t Remaining() const;
+  bool Cold() const;
+  // True once the file ended or failed before the whole range was sent, the response is then cut short.
+  bool Failed() const;
+  void Prefetched();
+  const std::shared_ptr<const os::File>& File() const;
+  off_t Offset() const;
+  size_t Window() const;
+  // Copies the next bytes for encryption in user space, used instead of Send when the kernel cannot encrypt.
+  // Reads nothing and turns cold when the bytes are not cached yet.
+  size_t Read(char*, size_t);
 
 private:
+  bool Probe(size_t);
+  void Fail();
+
   int fd;
-  os::File file;
+  std::shared_ptr<const os::File> file;
+  off_t offset{0};
   size_t size{0};
+  off_t residentUntil{0};
+  bool cold{false};
+  bool failed{false};
 };
 
-using TcpSendOperation = std::variant<TcpSendBuffer, TcpSendFile>;
+using TcpSendOperation = std::variant<TcpSendBuffer, TcpSendSharedBuffer, TcpSendFile>;
+
+class ConcreteTcpSender;
+
+struct TcpResumeToken {
+  std::mutex tokenMut;
+  ConcreteTcpSender* sender;
+};
+
+class TcpPrefetcher {
+public:
+  TcpPrefetcher();
+  TcpPrefetcher(const TcpPrefetcher&) = delete;
+  TcpPrefetcher(TcpPrefetcher&&) = delete;
+  TcpPrefetcher& operator=(const TcpPrefetcher&) = delete;
+  TcpPrefetcher& operator=(TcpPrefetcher&&) = delete;
+  ~TcpPrefetcher();
+
+  void Prefetch(std::shared_ptr<const os::File>, off_t, size_t, std::weak_ptr<TcpResumeToken>);
+
+private:
+  struct Job {
+    std::shared_ptr<const os::File> file;
+    off_t offset;
+    size_t size;
+    std::weak_ptr<TcpResumeToken> token;
+  };
+
+  void Run();
+
+  std::deque<Job> jobs;
+  bool stopping{false};
+  std::mutex prefetcherMut;
+  std::condition_variable prefetcherCv;
+  std::thread worker;
+};
 
 class ConcreteTcpSender final : public TcpSender {
 public:
-  ConcreteTcpSender(int, TcpSenderSupervisor&);
+  ConcreteTcpSender(
+      int, TcpSenderSupervisor&, TcpPrefetcher&, const BandwidthLimit&, TcpStatistics&, TlsSession* = nullptr);
   ConcreteTcpSender(const ConcreteTcpSender&) = delete;
   ConcreteTcpSender(ConcreteTcpSender&&) = delete;
   ConcreteTcpSender& operator=(const ConcreteTcpSender&) = delete;
@@ -55,34 +141,107 @@ public:
   ~ConcreteTcpSender() override;
 
   void Send(std::string_view) override;
+  void Send(std::string_view, std::string_view) override;
   void Send(os::File) override;
+  void Send(std::shared_ptr<const os::File>) override;
+  void Send(std::shared_ptr<const os::File>, size_t, size_t) override;
+  void Send(std::shared_ptr<const std::string>) override;
+  void SendLatest(std::shared_ptr<const std::string>) override;
   void SendBuffered() override;
+  void Shape(const BandwidthLimit&) override;
+  void Coalesce(std::chrono::nanoseconds) override;
+  void Cork() override;
+  void Uncork() override;
+  std::size_t Backlog() override;
+  std::size_t BufferedBytes() override;
+  void OnDrain(std::size_t, std::function<void()>) override;
+  bool Closed() override;
   void Close() override;
+  void Abort() override;
+  void Resume();
+  // Drops the queue once the peer is gone and runs the drain callback so that a waiting producer learns of it.
+  void Disconnect();
 
 private:
+  friend class TcpLayer;
+
+  // True while a file leads the queue, the event loop then serves interactive senders first.
+  bool Bulk();
+  bool SendBufferedImpl();
+  bool SendGathered(size_t&);
+  bool SendEncrypted(size_t);
+  void Prefetch(TcpSendFile&);
+  void Refill();
+  void Throttle(size_t);
+  void Enqueue(TcpSendOperation&&);
+  void Append(std::string_view, std::string_view);
+  void Schedule();
+  std::function<void()> TakeDrainCallback();
+  void Finish();
+  void AbortImpl();
   void CloseImpl();
   void MarkPending();
   void UnmarkPending();
 
   int fd;
   TcpSenderSupervisor& supervisor;
+  TcpPrefetcher& prefetcher;
+  TcpStatistics& statistics;
+  TlsSession* tls;
+  const BandwidthLimit defaultLimit;
+  BandwidthLimit limit;
+  double tokens{0};
+  unsigned int pacingRate{~0U};
+  std::chrono::steady_clock::time_point refilled;
+  std::chrono::nanoseconds flushDelay{0};
+  std::shared_ptr<TcpResumeToken> resumeToken;
   std::deque<TcpSendOperation> buffered;
+  std::size_t bufferedBytes{0};
+  std::size_t drainThreshold{0};
+  std::function<void()> onDrain;
   bool pending{false};
+  bool corked{false};
+  bool closing{false};
+  bool waiting{false};
   std::mutex senderMut;
 };
 
+class ConcreteTcpReceiver final : public TcpReceiver {
+public:
+  ConcreteTcpReceiver(int, const int (&)[2], std::string&);
+  ConcreteTcpReceiver(const ConcreteTcpReceiver&) = delete;
+  ConcreteTcpReceiver(ConcreteTcpReceiver&&) = delete;
+  ConcreteTcpReceiver& operator=(const ConcreteTcpReceiver&) = delete;
+  ConcreteTcpReceiver& operator=(ConcreteTcpReceiver&&) = delete;
+  ~ConcreteTcpReceiver() override = default;
+
+  std::string_view Peek() override;
+  std::optional<size_t> Splice(int, size_t) override;
+  bool Closed() const;
+
+private:
+  bool Drain(int, size_t);
+
+  int fd;
+  const int (&pipeFds)[2];
+  std::string& peekBuffer;
+  bool closed{false};
+};
+
 struct TcpConnectionContext {
   ~TcpConnectionContext() {
     processor.reset();
     sender.reset();
+    tls.reset();
   }
   std::unique_ptr<TcpProcessor> processor;
-  std::unique_ptr<TcpSender> sender;
+  std::unique_ptr<ConcreteTcpSender> sender;
+  std::unique_ptr<TlsSession> tls;
 };
 
-class TcpLayer : public TcpSenderSupervisor {
+class TcpLayer : public TcpSenderSupervisor, public TcpExecutor {
 public:
-  explicit TcpLayer(TcpProcessorFactory&);
+  TcpLayer(TcpProcessorFactory&, const BandwidthLimit&, TcpStatistics&);
   TcpLayer(const TcpLayer&) = delete;
   TcpLayer(TcpLayer&&) = delete;
   TcpLayer& operator=(const TcpLayer&) = delete;
@@ -90,8 +249,14 @@ public:
   ~TcpLayer() override;
 
   void Start();
+  // Makes Start return once the event loop wakes up, callable from any thread.
+  void Stop();
+  // Terminates TLS on every accepted connection, must be called before Start.
+  void Secure(const TlsSessionFactory&);
   void MarkSenderPending(int) const override;
   void UnmarkSenderPending(int) const override;
+  void ResumeSenderAfter(int, std::chrono::nanoseconds) const override;
+  void Post(std::function<void()>) override;
 
 protected:
   virtual int CreateSocket() const = 0;
@@ -101,20 +266,40 @@ protected:
 private:
   void StartLoop();
   void SetupPeer();
+  void Establish(int, TcpConnectionContext&);
+  void Handshake(int, TcpConnectionContext&);
   void ClosePeer(int);
   void ReadFromPeer(int);
-  void SendToPeer(int) const;
+  void ReadFromSecurePeer(int, TcpConnectionContext&);
+  void SendToPeer(int);
+  bool SendsBulk(int) const;
   void MarkReceiverPending(int) const;
+  void ArmTimer(std::chrono::steady_clock::time_point) const;
+  void ResumeDueSenders();
+  void RunPosted();
 
   TcpProcessorFactory& processorFactory;
+  const BandwidthLimit bandwidthLimit;
+  TcpStatistics& statistics;
+  const TlsSessionFactory* tlsSessionFactory{nullptr};
+  mutable std::multimap<std::chrono::steady_clock::time_point, int> timers;
+  mutable std::mutex timersMut;
   int localFd{-1};
   int epollFd{-1};
+  int eventFd{-1};
+  int timerFd{-1};
+  int spliceFds[2]{-1, -1};
+  std::string peekBuffer;
+  TcpPrefetcher prefetcher;
+  std::vector<std::function<void()>> posted;
+  std::mutex postedMut;
   std::unordered_map<int, TcpConnectionContext> connections;
+  bool stopping{false};
 };
 
 class Tcp4Layer final : public TcpLayer {
 public:
-  Tcp4Layer(std::string_view, std::uint16_t, TcpProcessorFactory&);
+  Tcp4Layer(std::string_view, std::uint16_t, TcpProcessorFactory&, const BandwidthLimit&, TcpStatistics&);
 
 protected:
   int CreateSocket() const override;
@@ -0,0 +1,179 @@
+#include "tls.hpp"
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <spdlog/spdlog.h>
+#include <string.h>
+#include <sys/socket.h>
+
+namespace {
+
+std::string LastError() {
+  char error[256];
+  ERR_error_string_n(ERR_get_error(), error, sizeof error);
+  return error;
+}
+
+// Prefers h2 when the client offers it, the router recognises the connection preface either way.
+int SelectProtocol(SSL*, const unsigned char** out, unsigned char* outLength, const unsigned char* in,
+    unsigned int inLength, void*) {
+  static constexpr unsigned char supported[] = "\x02h2\x08http/1.1";
+  unsigned char* selected = nullptr;
+  if (SSL_select_next_proto(&selected, outLength, supported, sizeof supported - 1, in, inLength) !=
+      OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+}  // namespace
+
+namespace network {
+
+ConcreteTlsSession::ConcreteTlsSession(SSL* ssl, int fd) : ssl{ssl}, fd{fd} {
+}
+
+ConcreteTlsSession::~ConcreteTlsSession() {
+  SSL_free(ssl);
+}
+
+TlsHandshake ConcreteTlsSession::Handshake() {
+  const int r = SSL_do_handshake(ssl);
+  if (r != 1) {
+    switch (SSL_get_error(ssl, r)) {
+      case SSL_ERROR_WANT_READ:
+        return TlsHandshake::WantRead;
+      case SSL_ERROR_WANT_WRITE:
+        return TlsHandshake::WantWrite;
+      default:
+        spdlog::debug("tls handshake failed: {}", LastError());
+        return TlsHandshake::Failed;
+    }
+  }
+  kernelSend = BIO_get_ktls_send(SSL_get_wbio(ssl));
+  if (not kernelSend) {
+    // Records are encrypted into memory and written out by Flush, so a full socket never leaves a record half sent.
+    records = BIO_new(BIO_s_mem());
+    SSL_set0_wbio(ssl, records);
+  }
+  spdlog::debug("tls session established: fd = {}, kernel = {}", fd, kernelSend);
+  return TlsHandshake::Done;
+}
+
+bool ConcreteTlsSession::KernelSend() const {
+  return kernelSend;
+}
+
+ssize_t ConcreteTlsSession::Read(char* buffer, std::size_t size) {
+  std::size_t n = 0;
+  const int r = SSL_read_ex(ssl, buffer, size, &n);
+  const int error = r == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl, r);
+  Flush();
+  switch (error) {
+    case SSL_ERROR_NONE:
+      return n;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      errno = EAGAIN;
+      return -1;
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    default:
+      spdlog::debug("tls SSL_read_ex(): {}", LastError());
+      errno = ECONNRESET;
+      return -1;
+  }
+}
+
+void ConcreteTlsSession::Write(std::string_view data) {
+  std::size_t written = 0;
+  if (not data.empty() and SSL_write_ex(ssl, data.data(), data.size(), &written) != 1) {
+    spdlog::error("tls SSL_write_ex(): {}", LastError());
+  }
+}
+
+bool ConcreteTlsSession::Flush() {
+  if (not records) {
+    return true;
+  }
+  if (not pending.empty()) {
+    pending.erase(0, Send(pending));
+    if (not pending.empty()) {
+      return false;
+    }
+  }
+  char* data = nullptr;
+  const long length = BIO_get_mem_data(records, &data);
+  if (length <= 0) {
+    return true;
+  }
+  const std::string_view encrypted{data, static_cast<std::size_t>(length)};
+  pending = encrypted.substr(Send(encrypted));
+  (void)BIO_reset(records);
+  return pending.empty();
+}
+
+void ConcreteTlsSession::Shutdown() {
+  if (SSL_is_init_finished(ssl)) {
+    SSL_shutdown(ssl);
+    Flush();
+  }
+}
+
+std::size_t ConcreteTlsSession::Send(std::string_view data) {
+  std::size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN and errno != EWOULDBLOCK) {
+        spdlog::error("tls send(): {}", strerror(errno));
+      }
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+TlsContext::TlsContext(const TlsOptions& options) : ctx{SSL_CTX_new(TLS_server_method())} {
+  if (not ctx) {
+    spdlog::error("tls SSL_CTX_new(): {}", LastError());
+    return;
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  if (options.kernelOffload) {
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+  }
+  SSL_CTX_set_alpn_select_cb(ctx, SelectProtocol, nullptr);
+  if (SSL_CTX_use_certificate_chain_file(ctx, options.certificateFile.c_str()) != 1 or
+      SSL_CTX_use_PrivateKey_file(ctx, options.privateKeyFile.c_str(), SSL_FILETYPE_PEM) != 1 or
+      SSL_CTX_check_private_key(ctx) != 1) {
+    spdlog::error("tls load certificate: {}", LastError());
+    SSL_CTX_free(ctx);
+    ctx = nullptr;
+  }
+}
+
+TlsContext::~TlsContext() {
+  SSL_CTX_free(ctx);
+}
+
+bool TlsContext::Ok() const {
+  return ctx != nullptr;
+}
+
+std::unique_ptr<TlsSession> TlsContext::Create(int fd) const {
+  if (not ctx) {
+    return nullptr;
+  }
+  SSL* ssl = SSL_new(ctx);
+  if (not ssl or SSL_set_fd(ssl, fd) != 1) {
+    spdlog::error("tls SSL_new(): {}", LastError());
+    SSL_free(ssl);
+    return nullptr;
+  }
+  SSL_set_accept_state(ssl);
+  return std::make_unique<ConcreteTlsSession>(ssl, fd);
+}
+
+}  // namespace network
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include "network.hpp"
+
+struct ssl_st;
+struct ssl_ctx_st;
+struct bio_st;
+
+namespace network {
+
+struct TlsOptions {
+  std::string certificateFile;
+  std::string privateKeyFile;
+  // Hands the record layer to the kernel after the handshake, user space keeps encrypting when kTLS is unavailable.
+  bool kernelOffload{true};
+};
+
+class ConcreteTlsSession final : public TlsSession {
+public:
+  ConcreteTlsSession(ssl_st*, int);
+  ConcreteTlsSession(const ConcreteTlsSession&) = delete;
+  ConcreteTlsSession(ConcreteTlsSession&&) = delete;
+  ConcreteTlsSession& operator=(const ConcreteTlsSession&) = delete;
+  ConcreteTlsSession& operator=(ConcreteTlsSession&&) = delete;
+  ~ConcreteTlsSession() override;
+
+  TlsHandshake Handshake() override;
+  bool KernelSend() const override;
+  ssize_t Read(char*, std::size_t) override;
+  void Write(std::string_view) override;
+  bool Flush() override;
+  void Shutdown() override;
+
+private:
+  std::size_t Send(std::string_view);
+
+  ssl_st* ssl;
+  int fd;
+  bio_st* records{nullptr};
+  std::string pending;
+  bool kernelSend{false};
+};
+
+class TlsContext final : public TlsSessionFactory {
+public:
+  explicit TlsContext(const TlsOptions&);
+  TlsContext(const TlsContext&) = delete;
+  TlsContext(TlsContext&&) = delete;
+  TlsContext& operator=(const TlsContext&) = delete;
+  TlsContext& operator=(TlsContext&&) = delete;
+  ~TlsContext() override;
+
+  bool Ok() const;
+  std::unique_ptr<TlsSession> Create(int) const override;
+
+private:
+  ssl_ctx_st* ctx;
+};
+
+}  // namespace network
@@ -0,0 +1,265 @@
+#include "upload.hpp"
+#include <spdlog/spdlog.h>
+#include <string.h>
+#include <unistd.h>
+#include "common.hpp"
+
+namespace {
+
+constexpr size_t maxPendingLength = 16384;
+
+}  // namespace
+
+namespace network {
+
+MultipartSplitter::MultipartSplitter(std::string_view boundary) : delimiter{"\r\n--"} {
+  delimiter += boundary;
+}
+
+bool MultipartSplitter::Split(std::string_view data, MultipartProcessor& processor) {
+  std::string_view view = data;
+  if (not pending.empty()) {
+    pending += data;
+    view = pending;
+  }
+  size_t consumed = 0;
+  while (size_t n = Step(view.substr(consumed), processor)) {
+    consumed += n;
+  }
+  std::string remaining{view.substr(consumed)};
+  pending = std::move(remaining);
+  if (state == State::Failed) {
+    return false;
+  }
+  if (pending.size() > maxPendingLength) {
+    state = State::Failed;
+    return false;
+  }
+  return true;
+}
+
+size_t MultipartSplitter::Passable(std::string_view data) const {
+  if (state != State::Data or not pending.empty()) {
+    return 0;
+  }
+  const auto n = data.find(delimiter);
+  if (n != data.npos) {
+    return n;
+  }
+  return data.size() - PartialDelimiterLength(data);
+}
+
+size_t MultipartSplitter::Step(std::string_view data, MultipartProcessor& processor) {
+  switch (state) {
+    case State::Preamble: {
+      const auto n = data.find(delimiter);
+      if (n == data.npos) {
+        return data.size() - PartialDelimiterLength(data);
+      }
+      state = State::Delimiter;
+      return n + delimiter.size();
+    }
+    case State::Delimiter: {
+      if (data.size() < 2) {
+        return 0;
+      }
+      if (data.starts_with("--")) {
+        state = State::Epilogue;
+        return data.size();
+      }
+      const auto n = data.find("\r\n");
+      if (n == data.npos) {
+        return 0;
+      }
+      state = State::Headers;
+      return n + 2;
+    }
+    case State::Headers: {
+      const auto n = data.starts_with("\r\n") ? 0 : data.find("\r\n\r\n");
+      if (n == data.npos) {
+        return 0;
+      }
+      const auto headersLength = n == 0 ? 0 : n + 2;
+      HttpHeaders headers;
+      if (not ParseHeaders(data.substr(0, headersLength), headers)) {
+        state = State::Failed;
+        return 0;
+      }
+      processor.Process(std::move(headers));
+      state = State::Data;
+      return headersLength + 2;
+    }
+    case State::Data: {
+      const auto n = data.find(delimiter);
+      if (n == data.npos) {
+        const auto passable = data.size() - PartialDelimiterLength(data);
+        if (passable > 0) {
+          processor.Process(data.substr(0, passable));
+        }
+        return passable;
+      }
+      if (n > 0) {
+        processor.Process(data.substr(0, n));
+      }
+      state = State::Delimiter;
+      return n + delimiter.size();
+    }
+    case State::Epilogue:
+      return data.size();
+    case State::Failed:
+      return 0;
+  }
+  return 0;
+}
+
+size_t MultipartSplitter::PartialDelimiterLength(std::string_view data) const {
+  for (size_t n = std::min(delimiter.size() - 1, data.size()); n > 0; n--) {
+    if (data.ends_with(std::string_view{delimiter}.substr(0, n))) {
+      return n;
+    }
+  }
+  return 0;
+}
+
+bool MultipartSplitter::ParseHeaders(std::string_view data, HttpHeaders& headers) const {
+  while (not data.empty()) {
+    const auto lineEnd = data.find("\r\n");
+    const auto line = data.substr(0, lineEnd);
+    data.remove_prefix(std::min(data.size(), lineEnd + 2));
+    const auto colon = line.find(':');
+    if (colon == line.npos) {
+      return false;
+    }
+    std::string field{line.substr(0, colon)};
+    common::ToLower(field);
+    auto value = line.substr(colon + 1);
+    const auto valueBegin = value.find_first_not_of(" \t");
+    value.remove_prefix(std::min(value.size(), valueBegin));
+    headers.emplace(std::move(field), std::string{value});
+  }
+  return true;
+}
+
+HttpUploadLayer::HttpUploadLayer(HttpSender& sender, std::unique_ptr<HttpUploadProcessor> processor)
+    : sender{sender}, processor{std::move(processor)} {
+}
+
+void HttpUploadLayer::Process(HttpRequest&& req) {
+  request = std::move(req);
+  auto boundary = FindBoundary();
+  if (boundary) {
+    splitter.emplace(*boundary);
+    return;
+  }
+  fd = processor->Open(request, HttpUploadPart{});
+}
+
+void HttpUploadLayer::Process(HttpRequestBody&& body) {
+  if (failed) {
+    return;
+  }
+  if (not splitter) {
+    Write(body.data);
+  } else if (not splitter->Split(body.data, *this)) {
+    spdlog::error("upload received malformed multipart body");
+    Fail(HttpStatus::BadRequest);
+  }
+  if (body.last and not failed) {
+    processor->Process(std::move(request));
+  }
+}
+
+size_t HttpUploadLayer::Process(TcpReceiver& receiver, size_t size) {
+  if (fd == -1) {
+    return 0;
+  }
+  if (splitter) {
+    auto peeked = receiver.Peek();
+    size = splitter->Passable(peeked.substr(0, std::min(size, peeked.size())));
+    if (size == 0) {
+      return 0;
+    }
+  }
+  auto spliced = receiver.Splice(fd, size);
+  if (not spliced) {
+    Fail(HttpStatus::InternalServerError);
+    return 0;
+  }
+  return *spliced;
+}
+
+void HttpUploadLayer::Process(HttpHeaders&& headers) {
+  if (failed) {
+    return;
+  }
+  fd = processor->Open(request, HttpUploadPart{std::move(headers)});
+}
+
+void HttpUploadLayer::Process(std::string_view data) {
+  Write(data);
+}
+
+void HttpUploadLayer::Write(std::string_view data) {
+  while (fd != -1 and not data.empty()) {
+    ssize_t n = write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      spdlog::error("upload write(): {}", strerror(errno));
+      Fail(HttpStatus::InternalServerError);
+      return;
+    }
+    data.remove_prefix(n);
+  }
+}
+
+// Part of the body is already lost, so the connection cannot be kept in sync and is closed after the answer.
+void HttpUploadLayer::Fail(HttpStatus status) {
+  fd = -1;
+  if (failed) {
+    return;
+  }
+  failed = true;
+  HttpResponse resp;
+  resp.status = status;
+  resp.headers.emplace("Connection", "close");
+  sender.Send(std::move(resp));
+  sender.Close();
+}
+
+std::optional<std::string> HttpUploadLayer::FindBoundary() const {
+  const auto it = request.headers.find("content-type");
+  if (it == request.headers.end()) {
+    return std::nullopt;
+  }
+  const auto& contentType = it->second;
+  auto lowered = contentType;
+  common::ToLower(lowered);
+  if (not lowered.starts_with("multipart/")) {
+    return std::nullopt;
+  }
+  const auto n = lowered.find("boundary=");
+  if (n == lowered.npos) {
+    return std::nullopt;
+  }
+  auto boundary = contentType.substr(n + 9);
+  boundary.erase(std::min(boundary.size(), boundary.find(';')));
+  if (boundary.size() >= 2 and boundary.starts_with('"') and boundary.ends_with('"')) {
+    boundary = boundary.substr(1, boundary.size() - 2);
+  }
+  if (boundary.empty()) {
+    return std::nullopt;
+  }
+  return boundary;
+}
+
+HttpUploadLayerFactory::HttpUploadLayerFactory(std::unique_ptr<HttpUploadProcessorFactory> processorFactory)
+    : processorFactory{std::move(processorFactory)} {
+}
+
+std::unique_ptr<HttpStreamProcessor> HttpUploadLayerFactory::Create(HttpSender& sender) const {
+  return std::make_unique<HttpUploadLayer>(sender, processorFactory->Create(sender));
+}
+
+}  // namespace network
@@ -0,0 +1,77 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include "network.hpp"
+
+namespace network {
+
+class MultipartProcessor {
+public:
+  virtual ~MultipartProcessor() = default;
+  virtual void Process(HttpHeaders&&) = 0;
+  virtual void Process(std::string_view) = 0;
+};
+
+class MultipartSplitter {
+public:
+  explicit MultipartSplitter(std::string_view);
+  bool Split(std::string_view, MultipartProcessor&);
+  size_t Passable(std::string_view) const;
+
+private:
+  enum class State { Preamble, Delimiter, Headers, Data, Epilogue, Failed };
+
+  size_t Step(std::string_view, MultipartProcessor&);
+  size_t PartialDelimiterLength(std::string_view) const;
+  bool ParseHeaders(std::string_view, HttpHeaders&) const;
+
+  std::string delimiter;
+  std::string pending{"\r\n"};
+  State state{State::Preamble};
+};
+
+class HttpUploadLayer final : public HttpStreamProcessor, private MultipartProcessor {
+public:
+  HttpUploadLayer(HttpSender&, std::unique_ptr<HttpUploadProcessor>);
+  HttpUploadLayer(const HttpUploadLayer&) = delete;
+  HttpUploadLayer(HttpUploadLayer&&) = delete;
+  HttpUploadLayer& operator=(const HttpUploadLayer&) = delete;
+  HttpUploadLayer& operator=(HttpUploadLayer&&) = delete;
+  ~HttpUploadLayer() override = default;
+
+  void Process(HttpRequest&&) override;
+  void Process(HttpRequestBody&&) override;
+  size_t Process(TcpReceiver&, size_t) override;
+
+private:
+  void Process(HttpHeaders&&) override;
+  void Process(std::string_view) override;
+  void Write(std::string_view);
+  void Fail(HttpStatus);
+  std::optional<std::string> FindBoundary() const;
+
+  HttpSender& sender;
+  std::unique_ptr<HttpUploadProcessor> processor;
+  HttpRequest request;
+  std::optional<MultipartSplitter> splitter{std::nullopt};
+  int fd{-1};
+  bool failed{false};
+};
+
+class HttpUploadLayerFactory final : public HttpStreamProcessorFactory {
+public:
+  explicit HttpUploadLayerFactory(std::unique_ptr<HttpUploadProcessorFactory>);
+  HttpUploadLayerFactory(const HttpUploadLayerFactory&) = delete;
+  HttpUploadLayerFactory(HttpUploadLayerFactory&&) = delete;
+  HttpUploadLayerFactory& operator=(const HttpUploadLayerFactory&) = delete;
+  HttpUploadLayerFactory& operator=(HttpUploadLayerFactory&&) = delete;
+  ~HttpUploadLayerFactory() override = default;
+
+  std::unique_ptr<HttpStreamProcessor> Create(HttpSender&) const override;
+
+private:
+  std::unique_ptr<HttpUploadProcessorFactory> processorFactory;
+};
+
+}  // namespace network
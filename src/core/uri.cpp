@@ -0,0 +1,154 @@
+#include "uri.hpp"
+#include <algorithm>
+#include <vector>
+#include "common.hpp"
+
+namespace network {
+
+QueryParameterIterator::QueryParameterIterator(std::string_view query) : remaining{query}, end{false} {
+  Load();
+}
+
+const QueryParameter& QueryParameterIterator::operator*() const {
+  return current;
+}
+
+const QueryParameter* QueryParameterIterator::operator->() const {
+  return &current;
+}
+
+QueryParameterIterator& QueryParameterIterator::operator++() {
+  Load();
+  return *this;
+}
+
+bool QueryParameterIterator::operator==(const QueryParameterIterator& other) const {
+  if (end or other.end) {
+    return end == other.end;
+  }
+  return remaining.data() == other.remaining.data() and current.key.data() == other.current.key.data();
+}
+
+void QueryParameterIterator::Load() {
+  while (not remaining.empty()) {
+    const auto n = std::min(remaining.find('&'), remaining.size());
+    const auto pair = remaining.substr(0, n);
+    remaining.remove_prefix(std::min(n + 1, remaining.size()));
+    if (pair.empty()) {
+      continue;
+    }
+    const auto eq = std::min(pair.find('='), pair.size());
+    current.key = pair.substr(0, eq);
+    current.value = pair.substr(std::min(eq + 1, pair.size()));
+    return;
+  }
+  end = true;
+}
+
+QueryParameters::QueryParameters(std::string_view query) : query{query} {
+}
+
+QueryParameterIterator QueryParameters::begin() const {
+  return QueryParameterIterator{query};
+}
+
+QueryParameterIterator QueryParameters::end() const {
+  return QueryParameterIterator{};
+}
+
+Uri::Uri(std::string raw) : raw{std::move(raw)} {
+}
+
+const std::string& Uri::Raw() const {
+  return raw;
+}
+
+std::string_view Uri::Path() const {
+  Split();
+  return std::string_view{raw}.substr(0, pathEnd);
+}
+
+std::string_view Uri::Query() const {
+  Split();
+  if (pathEnd == queryEnd) {
+    return {};
+  }
+  return std::string_view{raw}.substr(pathEnd + 1, queryEnd - pathEnd - 1);
+}
+
+std::string_view Uri::Fragment() const {
+  Split();
+  if (queryEnd == raw.size()) {
+    return {};
+  }
+  return std::string_view{raw}.substr(queryEnd + 1);
+}
+
+QueryParameters Uri::Parameters() const {
+  return QueryParameters{Query()};
+}
+
+std::optional<std::string> Uri::Parameter(std::string_view key) const {
+  for (const auto& parameter : Parameters()) {
+    if (parameter.key != key) {
+      continue;
+    }
+    std::string value{parameter.value};
+    std::replace(value.begin(), value.end(), '+', ' ');
+    return common::PercentDecode(value);
+  }
+  return std::nullopt;
+}
+
+const std::string& Uri::NormalizedPath() const {
+  if (normalizedPath) {
+    return *normalizedPath;
+  }
+  const auto decoded = common::PercentDecode(Path());
+  std::vector<std::string_view> segments;
+  std::string_view remaining{decoded};
+  bool directory = true;
+  while (not remaining.empty()) {
+    const auto n = std::min(remaining.find('/'), remaining.size());
+    const auto segment = remaining.substr(0, n);
+    remaining.remove_prefix(std::min(n + 1, remaining.size()));
+    if (segment.empty() or segment == ".") {
+      directory = true;
+      continue;
+    }
+    if (segment == "..") {
+      if (not segments.empty()) {
+        segments.pop_back();
+      }
+      directory = true;
+      continue;
+    }
+    segments.emplace_back(segment);
+    directory = false;
+  }
+  if (decoded.ends_with('/')) {
+    directory = true;
+  }
+  std::string result;
+  result.reserve(decoded.size() + 1);
+  for (const auto& segment : segments) {
+    result += '/';
+    result += segment;
+  }
+  if (directory or result.empty()) {
+    result += '/';
+  }
+  normalizedPath = std::move(result);
+  return *normalizedPath;
+}
+
+void Uri::Split() const {
+  if (split) {
+    return;
+  }
+  queryEnd = std::min(raw.find('#'), raw.size());
+  pathEnd = std::min(raw.find('?'), queryEnd);
+  split = true;
+}
+
+}  // namespace network
@@ -0,0 +1,63 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace network {
+
+struct QueryParameter {
+  std::string_view key;
+  std::string_view value;
+};
+
+class QueryParameterIterator {
+public:
+  QueryParameterIterator() = default;
+  explicit QueryParameterIterator(std::string_view);
+  const QueryParameter& operator*() const;
+  const QueryParameter* operator->() const;
+  QueryParameterIterator& operator++();
+  bool operator==(const QueryParameterIterator&) const;
+
+private:
+  void Load();
+
+  std::string_view remaining;
+  QueryParameter current;
+  bool end{true};
+};
+
+class QueryParameters {
+public:
+  explicit QueryParameters(std::string_view);
+  QueryParameterIterator begin() const;
+  QueryParameterIterator end() const;
+
+private:
+  std::string_view query;
+};
+
+class Uri {
+public:
+  Uri() = default;
+  explicit Uri(std::string);
+
+  const std::string& Raw() const;
+  std::string_view Path() const;
+  std::string_view Query() const;
+  std::string_view Fragment() const;
+  QueryParameters Parameters() const;
+  std::optional<std::string> Parameter(std::string_view) const;
+  const std::string& NormalizedPath() const;
+
+private:
+  void Split() const;
+
+  std::string raw;
+  mutable bool split{false};
+  mutable size_t pathEnd{0};
+  mutable size_t queryEnd{0};
+  mutable std::optional<std::string> normalizedPath{std::nullopt};
+};
+
+}  // namespace network
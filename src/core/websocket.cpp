@@ -1,21 +1,103 @@
 #include "websocket.hpp"
 #include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cctype>
 #include "common.hpp"
+#include "hub.hpp"
+
+namespace {
+
+constexpr std::uint8_t opContinuation{0};
+constexpr std::uint8_t opText{1};
+constexpr std::uint8_t opBinary{2};
+constexpr std::uint8_t opClose{8};
+constexpr std::uint8_t opPing{9};
+constexpr std::uint8_t opPong{10};
+
+constexpr std::uint16_t closeNormal{1000};
+constexpr std::uint16_t closeProtocolError{1002};
+constexpr std::uint16_t closeInvalidPayload{1007};
+constexpr std::uint16_t closeMessageTooBig{1009};
+
+constexpr std::size_t maxHeaderLen{10};
+constexpr std::string_view deflateTail{"\x00\x00\xff\xff", 4};
+constexpr std::string_view websocketGuid{"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"};
+
+std::string ClosePayload(std::uint16_t code) {
+  return {common::ToChar(code >> 8), common::ToChar(code)};
+}
+
+// Codes reserved for local use such as 1005, 1006 and 1015 must never appear on the wire.
+bool ValidCloseCode(std::uint16_t code) {
+  return (code >= 1000 and code <= 1003) or (code >= 1007 and code <= 1014) or (code >= 3000 and code <= 4999);
+}
+
+std::size_t EncodeHeader(char (&header)[maxHeaderLen], const network::WebsocketFrame& frame) {
+  std::uint64_t payloadLen = frame.payload.length();
+  std::size_t length = 0;
+  header[length++] = common::ToChar((frame.fin << 7) | (frame.compressed << 6) | (frame.opcode));
+  if (payloadLen < 126) {
+    header[length++] = common::ToChar(payloadLen);
+  } else if (payloadLen < (1 << 16)) {
+    header[length++] = common::ToChar(126);
+    header[length++] = common::ToChar(payloadLen >> 8);
+    header[length++] = common::ToChar(payloadLen);
+  } else {
+    header[length++] = common::ToChar(127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      header[length++] = common::ToChar(payloadLen >> shift);
+    }
+  }
+  return length;
+}
+
+std::optional<int> ParseWindowBits(std::string_view value) {
+  if (value.length() >= 2 and value.front() == '"' and value.back() == '"') {
+    value = value.substr(1, value.length() - 2);
+  }
+  if (value.length() == 1 and value[0] >= '8' and value[0] <= '9') {
+    return value[0] - '0';
+  }
+  if (value.length() == 2 and value[0] == '1' and value[1] >= '0' and value[1] <= '5') {
+    return 10 + value[1] - '0';
+  }
+  return std::nullopt;
+}
+
+}  // namespace
 
 namespace network {
 
-std::optional<WebsocketFrame> ConcreteWebsocketParser::Parse(std::string& payload) const {
+ConcreteWebsocketParser::ConcreteWebsocketParser(
+    const WebsocketOptions& options, const std::optional<WebsocketDeflateParameters>& deflate)
+    : options{options}, deflate{deflate.has_value()} {
+}
+
+std::variant<std::monostate, WebsocketFrame, WebsocketError> ConcreteWebsocketParser::Parse(std::string& payload) {
+  if (fragmentRemaining > 0) {
+    return ParseFragment(payload);
+  }
   std::uint64_t payloadLen = payload.length();
   std::uint64_t requiredLen = headerLen;
   if (payloadLen < requiredLen) {
-    return std::nullopt;
+    return std::monostate{};
   }
   WebsocketFrame frame;
   const auto* p = reinterpret_cast<const std::uint8_t*>(payload.data());
   frame.fin = (p[0] >> 7) & 0b1;
   frame.opcode = p[0] & 0b1111;
+  frame.compressed = (p[0] >> 6) & 0b1;
+  bool reserved = (p[0] >> 4) & 0b11;
   bool mask = (p[1] >> 7) & 0b1;
   std::uint64_t len = p[1] & 0b1111111;
+  const bool control = frame.opcode >= opClose;
+  const bool known = frame.opcode <= opBinary or (control and frame.opcode <= opPong);
+  if (reserved or not mask or not known or (control and (not frame.fin or len > 125))) {
+    return WebsocketError::ProtocolError;
+  }
+  if (frame.compressed and (not deflate or control or frame.opcode == opContinuation)) {
+    return WebsocketError::ProtocolError;
+  }
   p += headerLen;
   int payloadExtLen = 0;
   if (len == 126) {
@@ -26,68 +108,271 @@ std::optional<WebsocketFrame> ConcreteWebsocketParser::Parse(std::string& payloa
   }
   requiredLen += payloadExtLen;
   if (payloadLen < requiredLen) {
-    return std::nullopt;
+    return std::monostate{};
   }
   if (payloadExtLen > 0) {
     len = 0;
     for (int i = 0; i < payloadExtLen; i++) {
-      len |= p[i] << (8 * (payloadExtLen - i - 1));
+      len |= static_cast<std::uint64_t>(p[i]) << (8 * (payloadExtLen - i - 1));
+    }
+    if (len >> 63) {
+      return WebsocketError::ProtocolError;
     }
     p += payloadExtLen;
   }
+  if (not control and not options.streaming and len > options.maxMessageLength) {
+    return WebsocketError::MessageTooBig;
+  }
   std::uint8_t maskKey[maskLen] = {0};
-  if (mask) {
-    requiredLen += maskLen;
-    if (payloadLen < requiredLen) {
-      return std::nullopt;
-    }
-    for (int i = 0; i < maskLen; i++) {
-      maskKey[i] = p[i];
-    }
-    p += maskLen;
+  requiredLen += maskLen;
+  if (payloadLen < requiredLen) {
+    return std::monostate{};
+  }
+  for (int i = 0; i < maskLen; i++) {
+    maskKey[i] = p[i];
+  }
+  if (not control and options.streaming) {
+    std::copy(std::begin(maskKey), std::end(maskKey), std::begin(fragmentKey));
+    fragmentOpcode = frame.opcode;
+    fragmentFin = frame.fin;
+    fragmentCompressed = frame.compressed;
+    fragmentRemaining = len;
+    fragmentOffset = 0;
+    payload.erase(0, requiredLen);
+    return ParseFragment(payload);
   }
   requiredLen += len;
   if (payloadLen < requiredLen) {
-    return std::nullopt;
+    return std::monostate{};
   }
-  std::string data{p, p + len};
-  for (std::uint64_t i = 0; i < len; i++) {
-    reinterpret_cast<std::uint8_t&>(data[i]) ^= maskKey[i % maskLen];
+  const std::uint64_t dataOffset = requiredLen - len;
+  common::Unmask(payload.data() + dataOffset, len, maskKey);
+  if (requiredLen == payloadLen) {
+    payload.erase(0, dataOffset);
+    frame.payload = std::move(payload);
+    payload.clear();
+    return frame;
   }
-  frame.payload = std::move(data);
+  frame.payload.assign(payload, dataOffset, len);
   payload.erase(0, requiredLen);
   return frame;
 }
 
-ConcreteWebsocketSender::ConcreteWebsocketSender(TcpSender& sender) : sender{sender} {
+std::variant<std::monostate, WebsocketFrame, WebsocketError> ConcreteWebsocketParser::ParseFragment(
+    std::string& payload) {
+  const std::uint64_t len = std::min<std::uint64_t>(fragmentRemaining, payload.length());
+  if (len == 0 and fragmentRemaining > 0) {
+    return std::monostate{};
+  }
+  WebsocketFrame frame;
+  common::Unmask(payload.data(), len, fragmentKey, fragmentOffset);
+  if (len == payload.length()) {
+    frame.payload = std::move(payload);
+    payload.clear();
+  } else {
+    frame.payload.assign(payload, 0, len);
+    payload.erase(0, len);
+  }
+  fragmentRemaining -= len;
+  fragmentOffset = (fragmentOffset + len) % maskLen;
+  frame.fin = fragmentFin and fragmentRemaining == 0;
+  frame.opcode = fragmentOpcode;
+  frame.compressed = fragmentCompressed;
+  fragmentOpcode = opContinuation;
+  fragmentCompressed = false;
+  return frame;
+}
+
+ConcreteWebsocketSender::ConcreteWebsocketSender(TcpSender& sender, const WebsocketOptions& options,
+    const std::optional<WebsocketDeflateParameters>& deflate, WebsocketHubEndpoint* hub)
+    : sender{sender}, compression{options.compression}, deflate{deflate}, hub{hub} {
+  if (options.flushDelay.count() > 0) {
+    sender.Coalesce(options.flushDelay);
+  }
+}
+
+ConcreteWebsocketSender::~ConcreteWebsocketSender() {
+  if (hub) {
+    hub->Unsubscribe(*this);
+  }
 }
 
 void ConcreteWebsocketSender::Send(WebsocketFrame&& frame) const {
-  std::string payload;
-  payload += common::ToChar((frame.fin << 7) | (frame.opcode));
-  std::uint64_t payloadLen = frame.payload.length();
-  if (payloadLen < 126) {
-    payload += common::ToChar(payloadLen);
-  } else if (payloadLen < (1 << 16)) {
-    payload += common::ToChar(126);
-    payload += common::ToChar(payloadLen >> 8);
-    payload += common::ToChar(payloadLen);
-  } else {
-    payload += common::ToChar(127);
-    payload += common::ToChar(payloadLen >> 24);
-    payload += common::ToChar(payloadLen >> 16);
-    payload += common::ToChar(payloadLen >> 8);
-    payload += common::ToChar(payloadLen);
+  if (frame.opcode == opClose ? closeSent.exchange(true) : closeSent.load()) {
+    return;
   }
-  payload += frame.payload;
-  sender.Send(payload);
+  frame.compressed = false;
+  const bool data = frame.opcode == opText or frame.opcode == opBinary;
+  if (deflate and data and frame.fin and frame.payload.length() >= compression.minLength) {
+    std::lock_guard lock{deflaterMut};
+    Compress(frame);
+    SendFrame(frame);
+    return;
+  }
+  SendFrame(frame);
+}
+
+void ConcreteWebsocketSender::Compress(WebsocketFrame& frame) const {
+  if (not deflater) {
+    deflater = std::make_unique<Deflater>(deflate->serverMaxWindowBits, compression.level);
+  }
+  auto compressed = deflater->Compress(frame.payload, false);
+  if (not deflater->Ok() or not compressed.ends_with(deflateTail)) {
+    deflater.reset();
+    return;
+  }
+  compressed.resize(compressed.length() - deflateTail.length());
+  frame.payload = std::move(compressed);
+  frame.compressed = true;
+  if (deflate->serverNoContextTakeover) {
+    deflater.reset();
+  }
+}
+
+void ConcreteWebsocketSender::SendFrame(const WebsocketFrame& frame) const {
+  char header[maxHeaderLen];
+  const auto length = EncodeHeader(header, frame);
+  sender.Send(std::string_view{header, length}, frame.payload);
+}
+
+void ConcreteWebsocketSender::Send(const std::shared_ptr<const std::string>& encoded) const {
+  if (closeSent) {
+    return;
+  }
+  sender.Send(encoded);
+}
+
+void ConcreteWebsocketSender::Subscribe(std::string_view topic) const {
+  if (not hub) {
+    spdlog::error("websocket subscribe(\"{}\"): no hub configured", topic);
+    return;
+  }
+  hub->Subscribe(topic, *this);
+}
+
+void ConcreteWebsocketSender::Unsubscribe(std::string_view topic) const {
+  if (hub) {
+    hub->Unsubscribe(topic, *this);
+  }
+}
+
+std::size_t ConcreteWebsocketSender::Backlog() const {
+  return sender.Backlog();
+}
+
+void ConcreteWebsocketSender::Abort() const {
+  sender.Abort();
 }
 
 void ConcreteWebsocketSender::Close() const {
+  if (not closeSent) {
+    Send(WebsocketFrame{true, opClose, ClosePayload(closeNormal)});
+    return;
+  }
   sender.Close();
 }
 
-WebsocketHandshakeBuilder::WebsocketHandshakeBuilder(const HttpRequest& request) : request{request} {
+std::string EncodeWebsocketFrame(const WebsocketFrame& frame) {
+  char header[maxHeaderLen];
+  const auto length = EncodeHeader(header, frame);
+  std::string payload;
+  payload.reserve(length + frame.payload.length());
+  payload.append(header, length);
+  payload += frame.payload;
+  return payload;
+}
+
+bool ComputeWebsocketAccept(std::string_view key, char (&accept)[websocketAcceptLength]) {
+  constexpr std::size_t keyLength = 24;
+  char nonce[keyLength / 4 * 3];
+  if (key.length() != keyLength or common::Base64Decode(key, nonce) != 16) {
+    return false;
+  }
+  char digest[common::sha1DigestLength];
+  common::SHA1Hasher hasher;
+  hasher.Update(key);
+  hasher.Update(websocketGuid);
+  hasher.Final(digest);
+  common::Base64({digest, sizeof digest}, accept);
+  return true;
+}
+
+WebsocketHandshakeBuilder::WebsocketHandshakeBuilder(
+    const HttpRequest& request, const WebsocketCompressionOptions& compression)
+    : request{request} {
+  auto it = request.headers.find("sec-websocket-extensions");
+  if (compression.enabled and it != request.headers.end()) {
+    Negotiate(it->second, compression);
+  }
+}
+
+void WebsocketHandshakeBuilder::Negotiate(std::string_view offers, const WebsocketCompressionOptions& compression) {
+  while (not offers.empty()) {
+    auto comma = offers.find(',');
+    auto offer = offers.substr(0, comma);
+    offers = comma == offers.npos ? std::string_view{} : offers.substr(comma + 1);
+    auto semicolon = offer.find(';');
+    if (common::Trim(offer.substr(0, semicolon)) != "permessage-deflate") {
+      continue;
+    }
+    WebsocketDeflateParameters params;
+    params.serverNoContextTakeover = not compression.contextTakeover;
+    params.clientNoContextTakeover = not compression.contextTakeover;
+    params.serverMaxWindowBits = std::max(compression.windowBits, 9);
+    std::optional<int> serverWindowBits;
+    std::optional<int> clientWindowBits;
+    bool valid = true;
+    while (valid and semicolon != offer.npos) {
+      offer = offer.substr(semicolon + 1);
+      semicolon = offer.find(';');
+      auto param = common::Trim(offer.substr(0, semicolon));
+      auto equals = param.find('=');
+      auto name = common::Trim(param.substr(0, equals));
+      auto value = equals == param.npos ? std::string_view{} : common::Trim(param.substr(equals + 1));
+      if (name == "server_no_context_takeover") {
+        params.serverNoContextTakeover = true;
+        valid = equals == param.npos;
+      } else if (name == "client_no_context_takeover") {
+        valid = equals == param.npos;
+      } else if (name == "server_max_window_bits" and (serverWindowBits = ParseWindowBits(value))) {
+        // zlib cannot produce a raw deflate stream with a 256 byte window.
+        valid = *serverWindowBits > 8;
+      } else if (name == "client_max_window_bits" and equals == param.npos) {
+        clientWindowBits = 15;
+      } else if (name == "client_max_window_bits") {
+        clientWindowBits = ParseWindowBits(value);
+        valid = clientWindowBits.has_value();
+      } else {
+        valid = false;
+      }
+    }
+    if (not valid) {
+      continue;
+    }
+    extensions = "permessage-deflate";
+    if (params.serverNoContextTakeover) {
+      extensions += "; server_no_context_takeover";
+    }
+    if (params.clientNoContextTakeover) {
+      extensions += "; client_no_context_takeover";
+    }
+    if (serverWindowBits) {
+      params.serverMaxWindowBits = std::min(params.serverMaxWindowBits, *serverWindowBits);
+      extensions += "; server_max_window_bits=" + std::to_string(params.serverMaxWindowBits);
+    }
+    if (clientWindowBits) {
+      params.clientMaxWindowBits = std::min(*clientWindowBits, std::max(compression.windowBits, 8));
+      if (params.clientMaxWindowBits < 15) {
+        extensions += "; client_max_window_bits=" + std::to_string(params.clientMaxWindowBits);
+      }
+    }
+    deflate = params;
+    return;
+  }
+}
+
+const std::optional<WebsocketDeflateParameters>& WebsocketHandshakeBuilder::Deflate() const {
+  return deflate;
 }
 
 std::optional<HttpResponse> WebsocketHandshakeBuilder::Build() const {
@@ -95,42 +380,159 @@ std::optional<HttpResponse> WebsocketHandshakeBuilder::Build() const {
   if (upgradeIt == request.headers.end()) {
     return std::nullopt;
   }
-  auto upgrade = upgradeIt->second;
-  common::ToLower(upgrade);
-  if (upgrade != "websocket") {
+  constexpr std::string_view websocket{"websocket"};
+  const auto& upgrade = upgradeIt->second;
+  if (not std::equal(upgrade.begin(), upgrade.end(), websocket.begin(), websocket.end(),
+          [](unsigned char a, char b) { return std::tolower(a) == b; })) {
     return std::nullopt;
   }
   auto keyIt = request.headers.find("sec-websocket-key");
   if (keyIt == request.headers.end()) {
     return std::nullopt;
   }
-  auto accept = common::Base64(common::SHA1(keyIt->second + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+  char accept[websocketAcceptLength];
+  if (not ComputeWebsocketAccept(keyIt->second, accept)) {
+    return std::nullopt;
+  }
   HttpResponse resp;
   resp.status = HttpStatus::SwitchingProtocols;
   resp.headers.emplace("Upgrade", "websocket");
   resp.headers.emplace("Connection", "Upgrade");
-  resp.headers.emplace("Sec-WebSocket-Accept", std::move(accept));
+  resp.headers.emplace("Sec-WebSocket-Accept", std::string{accept, sizeof accept});
+  if (deflate) {
+    resp.headers.emplace("Sec-WebSocket-Extensions", extensions);
+  }
   return resp;
 }
 
-WebsocketLayer::WebsocketLayer(WebsocketParser& parser, WebsocketSender& sender, WebsocketProcessor& processor)
-    : parser{parser}, sender{sender}, processor{processor} {
+WebsocketLayer::WebsocketLayer(WebsocketParser& parser, WebsocketSender& sender, WebsocketProcessor& processor,
+    const WebsocketOptions& options, const std::optional<WebsocketDeflateParameters>& deflate)
+    : parser{parser}, sender{sender}, processor{processor}, options{options}, deflate{deflate} {
 }
 
 bool WebsocketLayer::TryProcess(std::string& payload) {
-  auto frame = parser.Parse(payload);
+  if (closed) {
+    payload.clear();
+    return false;
+  }
+  auto parsed = parser.Parse(payload);
+  if (const auto* error = std::get_if<WebsocketError>(&parsed)) {
+    Fail(*error);
+    payload.clear();
+    return false;
+  }
+  auto* frame = std::get_if<WebsocketFrame>(&parsed);
   if (not frame) {
     return false;
   }
   spdlog::debug("websocket received frame: fin = {}, opcode = {}", frame->fin, frame->opcode);
-  spdlog::debug("websocket received message: {}", frame->payload);
-  constexpr int opClose{8};
-  if (frame->opcode == opClose) {
-    sender.Close();
-    return true;
+  switch (frame->opcode) {
+    case opClose: {
+      if (frame->payload.length() == 1) {
+        Fail(WebsocketError::ProtocolError);
+        return false;
+      }
+      const auto* p = reinterpret_cast<const std::uint8_t*>(frame->payload.data());
+      if (frame->payload.length() >= 2 and not ValidCloseCode(p[0] << 8 | p[1])) {
+        Fail(WebsocketError::ProtocolError);
+        return false;
+      }
+      common::Utf8Validator reason;
+      if (frame->payload.length() > 2 and
+          not(reason.Update(std::string_view{frame->payload}.substr(2)) and reason.Complete())) {
+        Fail(WebsocketError::InvalidPayload);
+        return false;
+      }
+      closed = true;
+      frame->payload.resize(std::min<std::size_t>(frame->payload.length(), 2));
+      sender.Send(std::move(*frame));
+      sender.Close();
+      return false;
+    }
+    case opPing:
+      frame->opcode = opPong;
+      sender.Send(std::move(*frame));
+      return true;
+    case opPong:
+      return true;
+    default:
+      Process(std::move(*frame));
+      return true;
+  }
+}
+
+void WebsocketLayer::Process(WebsocketFrame&& frame) {
+  if ((frame.opcode == opContinuation) != fragmented) {
+    Fail(WebsocketError::ProtocolError);
+    return;
+  }
+  if (frame.opcode != opContinuation) {
+    messageCompressed = frame.compressed;
+    messageText = frame.opcode == opText;
+    utf8 = {};
+  }
+  fragmented = not frame.fin;
+  if (messageCompressed and not Inflate(frame)) {
+    return;
+  }
+  if (messageText and not(utf8.Update(frame.payload) and (not frame.fin or utf8.Complete()))) {
+    Fail(WebsocketError::InvalidPayload);
+    return;
+  }
+  if (options.streaming) {
+    processor.Process(std::move(frame));
+    return;
+  }
+  if (not message) {
+    message.emplace(std::move(frame));
+  } else if (message->payload.length() + frame.payload.length() > options.maxMessageLength) {
+    Fail(WebsocketError::MessageTooBig);
+    return;
+  } else {
+    message->payload += frame.payload;
+    message->fin = frame.fin;
+  }
+  if (message->fin) {
+    processor.Process(std::move(*message));
+    message.reset();
+  }
+}
+
+bool WebsocketLayer::Inflate(WebsocketFrame& frame) {
+  if (not inflater) {
+    inflater = std::make_unique<Inflater>(deflate->clientMaxWindowBits);
+  }
+  const std::size_t buffered = message ? message->payload.length() : 0;
+  const std::size_t limit = options.streaming ? SIZE_MAX : options.maxMessageLength - buffered;
+  auto data = inflater->Decompress(frame.payload, limit);
+  if (data and frame.fin) {
+    auto tail = inflater->Decompress(deflateTail, limit - data->length());
+    data = tail ? std::optional{*data + *tail} : std::nullopt;
+  }
+  if (not data) {
+    Fail(inflater->Ok() ? WebsocketError::MessageTooBig : WebsocketError::ProtocolError);
+    return false;
+  }
+  frame.payload = std::move(*data);
+  if (frame.fin and deflate->clientNoContextTakeover) {
+    inflater.reset();
   }
-  processor.Process(std::move(*frame));
   return true;
 }
 
+void WebsocketLayer::Fail(WebsocketError error) {
+  spdlog::debug("websocket layer failed connection: {}", static_cast<int>(error));
+  closed = true;
+  message.reset();
+  const auto code = error == WebsocketError::MessageTooBig    ? closeMessageTooBig
+                    : error == WebsocketError::InvalidPayload ? closeInvalidPayload
+                                                              : closeProtocolError;
+  sender.Send(WebsocketFrame{true, opClose, ClosePayload(code)});
+  sender.Close();
+}
+
+bool WebsocketLayer::TryProcess(TcpReceiver&) {
+  return false;
+}
+
 }  // namespace network
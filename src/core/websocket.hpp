@@ -1,56 +1,110 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include "common.hpp"
+#include "compression.hpp"
 #include "network.hpp"
 
 namespace network {
 
+class WebsocketHubEndpoint;
+
+struct WebsocketDeflateParameters {
+  bool serverNoContextTakeover{false};
+  bool clientNoContextTakeover{false};
+  int serverMaxWindowBits{15};
+  int clientMaxWindowBits{15};
+};
+
 class ConcreteWebsocketParser final : public WebsocketParser {
 public:
-  ConcreteWebsocketParser() = default;
+  explicit ConcreteWebsocketParser(
+      const WebsocketOptions& = {}, const std::optional<WebsocketDeflateParameters>& = std::nullopt);
   ConcreteWebsocketParser(const ConcreteWebsocketParser&) = delete;
   ConcreteWebsocketParser(ConcreteWebsocketParser&&) = delete;
   ConcreteWebsocketParser& operator=(const ConcreteWebsocketParser&) = delete;
   ConcreteWebsocketParser& operator=(ConcreteWebsocketParser&&) = delete;
   ~ConcreteWebsocketParser() override = default;
 
-  std::optional<WebsocketFrame> Parse(std::string&) const override;
+  std::variant<std::monostate, WebsocketFrame, WebsocketError> Parse(std::string&) override;
 
 private:
+  std::variant<std::monostate, WebsocketFrame, WebsocketError> ParseFragment(std::string&);
+
   static constexpr std::uint8_t headerLen = 2;
   static constexpr std::uint8_t maskLen = 4;
   static constexpr std::uint8_t ext1Len = 2;
   static constexpr std::uint8_t ext2Len = 8;
+
+  const WebsocketOptions options;
+  const bool deflate;
+  std::uint8_t fragmentKey[maskLen]{};
+  std::uint8_t fragmentOpcode{0};
+  bool fragmentFin{false};
+  bool fragmentCompressed{false};
+  std::uint64_t fragmentRemaining{0};
+  std::size_t fragmentOffset{0};
 };
 
 class ConcreteWebsocketSender final : public WebsocketSender {
 public:
-  explicit ConcreteWebsocketSender(TcpSender&);
+  explicit ConcreteWebsocketSender(TcpSender&, const WebsocketOptions& = {},
+      const std::optional<WebsocketDeflateParameters>& = std::nullopt, WebsocketHubEndpoint* = nullptr);
   ConcreteWebsocketSender(const ConcreteWebsocketSender&) = delete;
   ConcreteWebsocketSender(ConcreteWebsocketSender&&) = delete;
   ConcreteWebsocketSender& operator=(const ConcreteWebsocketSender&) = delete;
   ConcreteWebsocketSender& operator=(ConcreteWebsocketSender&&) = delete;
-  ~ConcreteWebsocketSender() override = default;
+  ~ConcreteWebsocketSender() override;
 
   void Send(WebsocketFrame&&) const override;
+  void Subscribe(std::string_view) const override;
+  void Unsubscribe(std::string_view) const override;
   void Close() const override;
+  void Send(const std::shared_ptr<const std::string>&) const;
+  std::size_t Backlog() const;
+  void Abort() const;
 
 private:
+  void Compress(WebsocketFrame&) const;
+  void SendFrame(const WebsocketFrame&) const;
+
   TcpSender& sender;
+  const WebsocketCompressionOptions compression;
+  const std::optional<WebsocketDeflateParameters> deflate;
+  WebsocketHubEndpoint* hub;
+  mutable std::unique_ptr<Deflater> deflater;
+  mutable std::mutex deflaterMut;
+  mutable std::atomic<bool> closeSent{false};
 };
 
+std::string EncodeWebsocketFrame(const WebsocketFrame&);
+
+constexpr std::size_t websocketAcceptLength = 28;
+
+// Derives Sec-WebSocket-Accept from a client key, fails unless the key is the base64 of 16 bytes.
+bool ComputeWebsocketAccept(std::string_view, char (&)[websocketAcceptLength]);
+
 class WebsocketHandshakeBuilder {
 public:
-  explicit WebsocketHandshakeBuilder(const HttpRequest&);
+  explicit WebsocketHandshakeBuilder(const HttpRequest&, const WebsocketCompressionOptions& = {});
   std::optional<HttpResponse> Build() const;
+  const std::optional<WebsocketDeflateParameters>& Deflate() const;
 
 private:
+  void Negotiate(std::string_view, const WebsocketCompressionOptions&);
+
   const HttpRequest& request;
+  std::optional<WebsocketDeflateParameters> deflate;
+  std::string extensions;
 };
 
 class WebsocketLayer final : public ProtocolProcessor {
 public:
-  WebsocketLayer(WebsocketParser&, WebsocketSender&, WebsocketProcessor&);
+  WebsocketLayer(WebsocketParser&, WebsocketSender&, WebsocketProcessor&, const WebsocketOptions& = {},
+      const std::optional<WebsocketDeflateParameters>& = std::nullopt);
   WebsocketLayer(const WebsocketLayer&) = delete;
   WebsocketLayer(WebsocketLayer&&) = delete;
   WebsocketLayer& operator=(const WebsocketLayer&) = delete;
@@ -58,11 +112,25 @@ public:
   ~WebsocketLayer() override = default;
 
   bool TryProcess(std::string&) override;
+  bool TryProcess(TcpReceiver&) override;
 
 private:
+  void Process(WebsocketFrame&&);
+  bool Inflate(WebsocketFrame&);
+  void Fail(WebsocketError);
+
   WebsocketParser& parser;
   WebsocketSender& sender;
   WebsocketProcessor& processor;
+  const WebsocketOptions options;
+  const std::optional<WebsocketDeflateParameters> deflate;
+  std::unique_ptr<Inflater> inflater;
+  std::optional<WebsocketFrame> message;
+  common::Utf8Validator utf8;
+  bool fragmented{false};
+  bool messageCompressed{false};
+  bool messageText{false};
+  bool closed{false};
 };
 
 }  // namespace network
@@ -1,44 +1,39 @@
 #include "app.hpp"
 #include <spdlog/spdlog.h>
-#include <filesystem>
+#include <cstring>
+#include "http.hpp"
 
 namespace application {
 
-AppLayer::AppLayer(const AppOptions& options) : options{options} {
+AppLayer::AppLayer(const AppOptions& options) : options{options}, root{options.wwwRoot} {
+  if (not root.Ok()) {
+    spdlog::error("app open(\"{}\"): {}", options.wwwRoot, strerror(errno));
+  }
 }
 
 void AppLayer::Process(network::HttpRequest&& req, network::HttpSender& sender) {
-  std::string uri = req.uri;
+  std::string uri = req.uri.NormalizedPath();
   if (uri.ends_with("/")) {
     uri += "index.html";
   }
-  if (uri.starts_with("/")) {
-    uri.erase(0, 1);
-  }
-  const auto path = std::filesystem::path{options.wwwRoot} / std::filesystem::path{uri};
-  const auto pathStr = path.string();
-  spdlog::debug("request local path is {}", pathStr);
-  if (not pathStr.starts_with(options.wwwRoot)) {
+  if (uri.find('\0') != uri.npos) {
     network::HttpResponse resp;
     resp.status = network::HttpStatus::NotFound;
     resp.headers.emplace("Content-Type", "text/plain");
     resp.body = "No such file";
     return sender.Send(std::move(resp));
   }
-  std::string mimeType = MimeTypeOf(pathStr);
+  uri.erase(0, 1);
+  spdlog::debug("request local path is {}", uri);
+  std::string mimeType{network::MimeTypeOf(uri)};
   network::FileHttpResponse resp;
-  resp.path = std::move(pathStr);
+  resp.path = std::move(uri);
+  resp.root = root.Fd();
   resp.headers.emplace("Content-type", std::move(mimeType));
+  resp.precompressed = true;
   return sender.Send(std::move(resp));
 }
 
-std::string AppLayer::MimeTypeOf(std::string_view path) const {
-  if (path.ends_with(".html")) {
-    return "text/html";
-  }
-  return "text/plain";
-}
-
 void AppLayer::Process(network::WebsocketFrame&& frame, network::WebsocketSender& sender) {
   sender.Send(std::move(frame));
 }
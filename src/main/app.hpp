@@ -1,5 +1,6 @@
 #pragma once
 #include <optional>
+#include "file.hpp"
 #include "network.hpp"
 
 namespace application {
@@ -15,9 +16,8 @@ public:
   void Process(network::WebsocketFrame&&, network::WebsocketSender&);
 
 private:
-  std::string MimeTypeOf(std::string_view) const;
-
   const AppOptions options;
+  os::Directory root;
 };
 
 }  // namespace application
@@ -15,21 +15,30 @@ int main(int argc, char* argv[]) {
   application::AppOptions appOptions;
   appOptions.wwwRoot = argv[3];
   application::AppLayer appLayer{appOptions};
+  network::ResponseCache responseCache;
+  network::CompressionCache compressionCache;
 
   std::vector<std::thread> workers;
   const std::size_t nWorkers = std::thread::hardware_concurrency();
   for (std::size_t i = 0; i < nWorkers; i++) {
-    workers.emplace_back(std::thread([&host, &port, &appLayer] {
+    workers.emplace_back(std::thread([&host, &port, &appLayer, &responseCache, &compressionCache] {
       network::Server server;
+      server.Cache(responseCache);
+      server.Cache(compressionCache);
       server.Add(network::HttpMethod::GET, "^/$", [&appLayer](network::HttpRequest&& req, network::HttpSender& sender) {
         appLayer.Process(std::move(req), sender);
       });
       server.Add(network::HttpMethod::GET, "^/static/.*$",
           [&appLayer](
               network::HttpRequest&& req, network::HttpSender& sender) { appLayer.Process(std::move(req), sender); });
-      server.Add("^/ws$", [&appLayer](network::WebsocketFrame&& req, network::WebsocketSender& sender) {
-        appLayer.Process(std::move(req), sender);
-      });
+      network::WebsocketOptions websocketOptions;
+      websocketOptions.compression.enabled = true;
+      server.Add(
+          "^/ws$",
+          [&appLayer](network::WebsocketFrame&& req, network::WebsocketSender& sender) {
+            appLayer.Process(std::move(req), sender);
+          },
+          websocketOptions);
       server.Start(host, port);
     }));
   }
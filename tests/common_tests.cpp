@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
 #include "common.hpp"
+#include "kernels.hpp"
 
 using namespace testing;
 
@@ -15,4 +19,182 @@ TEST(CommonFunctionTest, whenEncodingSHA1_itShouldProduceCorrectResult) {
   ASSERT_EQ(SHA1("abc"), "\xa9\x99\x3e\x36\x47\x06\x81\x6a\xba\x3e\x25\x71\x78\x50\xc2\x6c\x9c\xd0\xd8\x9d");
 }
 
+TEST(CommonFunctionTest, whenHashingInPieces_itShouldMatchOneShotSHA1AcrossBlockBoundaries) {
+  const std::string input(1000, 'a');
+  ASSERT_EQ(Base64(SHA1(input)), "KR6abGaZSUm1e6XmUDYemPw2sbo=");
+  for (std::size_t cut : {0, 1, 55, 56, 63, 64, 65, 128, 999}) {
+    SHA1Hasher hasher;
+    hasher.Update(std::string_view{input}.substr(0, cut));
+    hasher.Update(std::string_view{input}.substr(cut));
+    char digest[sha1DigestLength];
+    hasher.Final(digest);
+    ASSERT_EQ(std::string(digest, sizeof digest), SHA1(input));
+  }
+}
+
+TEST(CommonFunctionTest, whenBase64Decoding_itShouldRoundTripAndRejectMalformedInput) {
+  for (std::size_t len = 0; len < 100; len++) {
+    std::string data;
+    for (std::size_t i = 0; i < len; i++) {
+      data += static_cast<char>(i * 37 + 11);
+    }
+    auto encoded = Base64(data);
+    ASSERT_EQ(encoded.size(), (len + 2) / 3 * 4);
+    std::string decoded(encoded.size(), '\0');
+    auto decodedLength = Base64Decode(encoded, decoded.data());
+    ASSERT_EQ(decodedLength, len);
+    ASSERT_EQ(decoded.substr(0, len), data);
+  }
+  char out[64];
+  ASSERT_EQ(Base64Decode("Zm9vYmFy", out), 6);
+  ASSERT_EQ(Base64Decode("Zm9vYg==", out), 4);
+  ASSERT_FALSE(Base64Decode("Zm9vYmF", out).has_value());
+  ASSERT_FALSE(Base64Decode("Zm9v=mFy", out).has_value());
+  ASSERT_FALSE(Base64Decode("QUJDREVGR0hJSktMTU5PUFFSU1RV-1dYWVo=", out).has_value());
+}
+
+TEST(CommonFunctionTest, whenPercentDecoding_itShouldDecodeValidEscapesOnly) {
+  ASSERT_EQ(PercentDecode("a%20b%2Fc%zz%4"), "a b/c%zz%4");
+  ASSERT_EQ(PercentDecode("plain"), "plain");
+}
+
+TEST(CommonFunctionTest, whenFormattingHttpDate_itShouldRoundTrip) {
+  ASSERT_EQ(HttpDate(784111777), "Sun, 06 Nov 1994 08:49:37 GMT");
+  ASSERT_EQ(ParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT"), 784111777);
+  ASSERT_FALSE(ParseHttpDate("yesterday").has_value());
+}
+
+TEST(CommonFunctionTest, whenUnmasking_itShouldMatchBytewiseXorForAllLengthsAndOffsets) {
+  const std::uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  for (std::size_t len : {0, 1, 3, 7, 8, 15, 16, 31, 32, 33, 63, 64, 100, 1000}) {
+    for (std::size_t offset = 0; offset < 4; offset++) {
+      std::string data;
+      for (std::size_t i = 0; i < len + 1; i++) {
+        data += static_cast<char>(i * 7);
+      }
+      std::string expected = data;
+      for (std::size_t i = 0; i < len; i++) {
+        expected[i + 1] = static_cast<char>(expected[i + 1] ^ key[(offset + i) % 4]);
+      }
+      Unmask(data.data() + 1, len, key, offset);
+      ASSERT_EQ(data, expected) << "len " << len << " offset " << offset;
+    }
+  }
+}
+
+TEST(CommonFunctionTest, whenUnmaskingWithEachKernel_itShouldMatchTheBytewiseReference) {
+  using UnmaskKernel = void (*)(std::uint8_t*, std::size_t, const std::uint8_t*);
+  std::vector<std::pair<const char*, UnmaskKernel>> unmaskKernels{{"words", kernels::UnmaskWords}};
+#if defined(__x86_64__)
+  unmaskKernels.emplace_back("sse2", kernels::UnmaskSse2);
+  if (__builtin_cpu_supports("avx2")) {
+    unmaskKernels.emplace_back("avx2", kernels::UnmaskAvx2);
+  }
+#endif
+  const std::uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  for (const auto& [name, unmask] : unmaskKernels) {
+    for (std::size_t len : {0, 1, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 100, 1000}) {
+      for (std::size_t offset = 0; offset < 4; offset++) {
+        std::vector<std::uint8_t> data(len + 1);
+        for (std::size_t i = 0; i < data.size(); i++) {
+          data[i] = static_cast<std::uint8_t>(i * 7);
+        }
+        auto expected = data;
+        for (std::size_t i = 0; i < len; i++) {
+          expected[i + 1] ^= key[(offset + i) % 4];
+        }
+        std::uint8_t pattern[kernels::maskPatternLength];
+        kernels::MaskPattern(key, offset, pattern);
+        unmask(data.data() + 1, len, pattern);
+        ASSERT_EQ(data, expected) << name << " len " << len << " offset " << offset;
+      }
+    }
+  }
+}
+
+TEST(CommonFunctionTest, whenHashingWithEachKernel_itShouldMatchTheScalarReference) {
+  using Sha1Kernel = void (*)(std::uint32_t*, const std::uint8_t*, std::size_t);
+  std::vector<std::pair<const char*, Sha1Kernel>> sha1Kernels{{"scalar", kernels::Sha1Scalar}};
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sha") and __builtin_cpu_supports("sse4.1")) {
+    sha1Kernels.emplace_back("sha-ni", kernels::Sha1Ni);
+  }
+#endif
+  constexpr std::uint32_t initial[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  std::vector<std::uint8_t> abc(64);
+  abc[0] = 'a';
+  abc[1] = 'b';
+  abc[2] = 'c';
+  abc[3] = 0x80;
+  abc[63] = 24;
+  std::vector<std::uint8_t> data(8 * 64);
+  for (std::size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<std::uint8_t>(i * 131 + 7);
+  }
+  for (const auto& [name, sha1] : sha1Kernels) {
+    std::vector<std::uint32_t> state(initial, initial + 5);
+    sha1(state.data(), abc.data(), 1);
+    ASSERT_EQ(state, (std::vector<std::uint32_t>{0xa9993e36, 0x4706816a, 0xba3e2571, 0x7850c26c, 0x9cd0d89d}))
+        << name;
+    for (std::size_t blocks = 1; blocks <= 8; blocks++) {
+      std::vector<std::uint32_t> expected(initial, initial + 5);
+      kernels::Sha1Scalar(expected.data(), data.data(), blocks);
+      state.assign(initial, initial + 5);
+      sha1(state.data(), data.data(), blocks);
+      ASSERT_EQ(state, expected) << name << " blocks " << blocks;
+    }
+  }
+}
+
+TEST(CommonFunctionTest, whenCodingBase64WithEachKernel_itShouldMatchTheScalarReference) {
+  using EncodeKernel = std::size_t (*)(const std::uint8_t*, std::size_t, char*);
+  using DecodeKernel = std::size_t (*)(const char*, std::size_t, std::uint8_t*);
+  std::vector<std::pair<const char*, EncodeKernel>> encodeKernels{{"scalar", kernels::Base64EncodeScalar}};
+  std::vector<std::pair<const char*, DecodeKernel>> decodeKernels{{"scalar", kernels::Base64DecodeScalar}};
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("ssse3")) {
+    encodeKernels.emplace_back("ssse3", kernels::Base64EncodeSsse3);
+    decodeKernels.emplace_back("ssse3", kernels::Base64DecodeSsse3);
+  }
+#endif
+  for (std::size_t len = 0; len <= 120; len++) {
+    std::vector<std::uint8_t> data(len);
+    for (std::size_t i = 0; i < len; i++) {
+      data[i] = static_cast<std::uint8_t>(i * 37 + 11);
+    }
+    std::string expected(len / 3 * 4, '\0');
+    ASSERT_EQ(kernels::Base64EncodeScalar(data.data(), len, expected.data()), len / 3 * 3);
+    for (const auto& [name, encode] : encodeKernels) {
+      std::string encoded(expected.size(), '\0');
+      std::size_t done = encode(data.data(), len, encoded.data());
+      ASSERT_EQ(done % 3, 0) << name << " len " << len;
+      done += kernels::Base64EncodeScalar(data.data() + done, len - done, encoded.data() + done / 3 * 4);
+      ASSERT_EQ(done, len / 3 * 3) << name << " len " << len;
+      ASSERT_EQ(encoded, expected) << name << " len " << len;
+    }
+    for (const auto& [name, decode] : decodeKernels) {
+      std::vector<std::uint8_t> decoded(len / 3 * 3);
+      std::size_t done = decode(expected.data(), expected.size(), decoded.data());
+      ASSERT_EQ(done % 4, 0) << name << " len " << len;
+      done += kernels::Base64DecodeScalar(
+          expected.data() + done, expected.size() - done, decoded.data() + done / 4 * 3);
+      ASSERT_EQ(done, expected.size()) << name << " len " << len;
+      ASSERT_TRUE(std::equal(decoded.begin(), decoded.end(), data.begin())) << name << " len " << len;
+      for (std::size_t bad = 0; bad < expected.size(); bad += 5) {
+        std::string corrupted = expected;
+        corrupted[bad] = '-';
+        ASSERT_LE(decode(corrupted.data(), corrupted.size(), decoded.data()), bad / 4 * 4) << name << " bad " << bad;
+      }
+    }
+  }
+  char out[8];
+  for (const auto& [name, encode] : encodeKernels) {
+    const std::string_view foobar{"foobar"};
+    const std::size_t done = encode(reinterpret_cast<const std::uint8_t*>(foobar.data()), foobar.size(), out);
+    kernels::Base64EncodeScalar(reinterpret_cast<const std::uint8_t*>(foobar.data()) + done, foobar.size() - done,
+        out + done / 3 * 4);
+    ASSERT_EQ(std::string_view(out, 8), "Zm9vYmFy") << name;
+  }
+}
+
 }  // namespace common
@@ -1,25 +1,153 @@
 #pragma once
+#include <arpa/inet.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
 #include "network.hpp"
+#include "tcp.hpp"
+#include "upload.hpp"
 
 namespace network {
 
+class TcpSenderMock : public TcpSender {
+public:
+  MOCK_METHOD(void, Send, (std::string_view), (override));
+  MOCK_METHOD(void, Send, (std::string_view, std::string_view), (override));
+  MOCK_METHOD(void, Send, (os::File), (override));
+  MOCK_METHOD(void, Send, (std::shared_ptr<const os::File>), (override));
+  MOCK_METHOD(void, Send, (std::shared_ptr<const os::File>, size_t, size_t), (override));
+  MOCK_METHOD(void, Send, (std::shared_ptr<const std::string>), (override));
+  MOCK_METHOD(void, SendLatest, (std::shared_ptr<const std::string>), (override));
+  MOCK_METHOD(void, SendBuffered, (), (override));
+  MOCK_METHOD(void, Shape, (const BandwidthLimit &), (override));
+  MOCK_METHOD(void, Coalesce, (std::chrono::nanoseconds), (override));
+  MOCK_METHOD(void, Cork, (), (override));
+  MOCK_METHOD(void, Uncork, (), (override));
+  MOCK_METHOD(std::size_t, Backlog, (), (override));
+  MOCK_METHOD(std::size_t, BufferedBytes, (), (override));
+  MOCK_METHOD(void, OnDrain, (std::size_t, std::function<void()>), (override));
+  MOCK_METHOD(bool, Closed, (), (override));
+  MOCK_METHOD(void, Close, (), (override));
+  MOCK_METHOD(void, Abort, (), (override));
+};
+
+class TlsSessionMock : public TlsSession {
+public:
+  MOCK_METHOD(TlsHandshake, Handshake, (), (override));
+  MOCK_METHOD(bool, KernelSend, (), (const, override));
+  MOCK_METHOD(ssize_t, Read, (char *, std::size_t), (override));
+  MOCK_METHOD(void, Write, (std::string_view), (override));
+  MOCK_METHOD(bool, Flush, (), (override));
+  MOCK_METHOD(void, Shutdown, (), (override));
+};
+
+class TcpReceiverMock : public TcpReceiver {
+public:
+  MOCK_METHOD(std::string_view, Peek, (), (override));
+  MOCK_METHOD(std::optional<size_t>, Splice, (int, size_t), (override));
+};
+
+class TcpSenderSupervisorMock : public TcpSenderSupervisor {
+public:
+  MOCK_METHOD(void, MarkSenderPending, (int), (const, override));
+  MOCK_METHOD(void, UnmarkSenderPending, (int), (const, override));
+  MOCK_METHOD(void, ResumeSenderAfter, (int, std::chrono::nanoseconds), (const, override));
+};
+
+class TcpExecutorMock : public TcpExecutor {
+public:
+  MOCK_METHOD(void, Post, (std::function<void()>), (override));
+};
+
 class HttpSenderMock : public HttpSender {
 public:
   MOCK_METHOD(void, Send, (HttpResponse &&), (const, override));
   MOCK_METHOD(void, Send, (FileHttpResponse &&), (const, override));
   MOCK_METHOD(void, Send, (MixedReplaceHeaderHttpResponse &&), (const, override));
   MOCK_METHOD(void, Send, (MixedReplaceDataHttpResponse &&), (const, override));
+  MOCK_METHOD(void, Send, (SharedMixedReplaceDataHttpResponse &&), (const, override));
   MOCK_METHOD(void, Send, (ChunkedHeaderHttpResponse &&), (const, override));
   MOCK_METHOD(void, Send, (ChunkedDataHttpResponse &&), (const, override));
+  MOCK_METHOD(std::unique_ptr<HttpResponseWriter>, Stream, (StreamingHttpResponse &&), (const, override));
   MOCK_METHOD(void, Close, (), (const, override));
 };
 
 class WebsocketSenderMock : public WebsocketSender {
 public:
   MOCK_METHOD(void, Send, (WebsocketFrame &&), (const, override));
+  MOCK_METHOD(void, Subscribe, (std::string_view), (const, override));
+  MOCK_METHOD(void, Unsubscribe, (std::string_view), (const, override));
   MOCK_METHOD(void, Close, (), (const, override));
 };
 
+class WebsocketProcessorMock : public WebsocketProcessor {
+public:
+  MOCK_METHOD(void, Process, (WebsocketFrame &&), (override));
+};
+
+class HttpUploadProcessorMock : public HttpUploadProcessor {
+public:
+  MOCK_METHOD(int, Open, (const HttpRequest &, const HttpUploadPart &), (override));
+  MOCK_METHOD(void, Process, (HttpRequest &&), (override));
+};
+
+class MultipartProcessorMock : public MultipartProcessor {
+public:
+  MOCK_METHOD(void, Process, (HttpHeaders &&), (override));
+  MOCK_METHOD(void, Process, (std::string_view), (override));
+};
+
+// Listens on an ephemeral loopback port so that tests can drive the event loop through real sockets.
+class LoopbackTcpLayer final : public TcpLayer {
+public:
+  using TcpLayer::TcpLayer;
+
+  std::uint16_t Port() const {
+    return port;
+  }
+
+  int Connect() const {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+      close(s);
+      return -1;
+    }
+    return s;
+  }
+
+protected:
+  int CreateSocket() const override {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof addr;
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 or listen(s, 8) < 0 or
+        getsockname(s, reinterpret_cast<sockaddr*>(&addr), &length) < 0) {
+      close(s);
+      return -1;
+    }
+    SetNonBlocking(s);
+    port = ntohs(addr.sin_port);
+    return s;
+  }
+
+  int Accept(int fd) const override {
+    int s = accept(fd, nullptr, nullptr);
+    if (s >= 0) {
+      SetNonBlocking(s);
+    }
+    return s;
+  }
+
+private:
+  mutable std::atomic<std::uint16_t> port{0};
+};
+
 }  // namespace network
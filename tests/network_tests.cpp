@@ -1,8 +1,29 @@
+#include <fcntl.h>
 #include <gtest/gtest.h>
 #include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "cache.hpp"
+#include "common.hpp"
+#include "compression.hpp"
 #include "http.hpp"
+#include "hpack.hpp"
+#include "http2.hpp"
+#include "hub.hpp"
 #include "network.hpp"
 #include "network_mocks.hpp"
+#include "protocol.hpp"
+#include "router.hpp"
+#include "stream.hpp"
+#include "tcp.hpp"
+#include "upload.hpp"
 #include "websocket.hpp"
 
 using namespace testing;
@@ -31,12 +52,12 @@ TEST(HttpParserTest, whenReceivedValidHttpRequest_itShouldParseTheRequest) {
   const auto req2 = sut->Parse(p1);
   ASSERT_TRUE(req2);
   ASSERT_EQ(req2->method, HttpMethod::GET);
-  ASSERT_EQ(req2->uri, "/request");
+  ASSERT_EQ(req2->uri.Path(), "/request");
   ASSERT_EQ(req2->version, "HTTP/1.1");
   ASSERT_EQ(req2->headers.at("accept-encoding"), "gzip, deflate, br");
   ASSERT_EQ(req2->headers.at("accept-language"), "en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7");
-  ASSERT_EQ(req2->query.at("key"), "value");
-  ASSERT_EQ(req2->query.at("key2"), "value2");
+  ASSERT_EQ(req2->uri.Parameter("key"), "value");
+  ASSERT_EQ(req2->uri.Parameter("key2"), "value2");
 }
 
 TEST(HttpParserTest, whenReceivedValidSwitchingProtocolRequest_itShouldParseTheRequestCorrectly) {
@@ -52,7 +73,7 @@ TEST(HttpParserTest, whenReceivedValidSwitchingProtocolRequest_itShouldParseTheR
   const auto req1 = sut->Parse(p1);
   ASSERT_TRUE(req1);
   ASSERT_EQ(req1->method, HttpMethod::GET);
-  ASSERT_EQ(req1->uri, "/websocket");
+  ASSERT_EQ(req1->uri.Path(), "/websocket");
   ASSERT_EQ(req1->version, "HTTP/1.1");
   ASSERT_EQ(req1->headers.at("upgrade"), "Websocket");
   ASSERT_EQ(req1->headers.at("connection"), "Upgrade, keep-alive");
@@ -61,10 +82,551 @@ TEST(HttpParserTest, whenReceivedValidSwitchingProtocolRequest_itShouldParseTheR
   ASSERT_FALSE(req2);
 }
 
+TEST(HttpParserTest, whenReceivedChunkedRequest_itShouldDecodeTheBody) {
+  auto sut = std::make_unique<ConcreteHttpParser>();
+  std::string p1{
+      "POST /upload HTTP/1.1\r\n"
+      "Host: localhost\r\n"
+      "Transfer-Encoding: chunked\r\n\r\n"
+      "5\r\nhello\r\n"
+      "7;ext=1\r\n, world\r\n"};
+  const auto req1 = sut->Parse(p1);
+  ASSERT_FALSE(req1);
+  p1 += "0\r\nChecksum: none\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+  const auto req2 = sut->Parse(p1);
+  ASSERT_TRUE(req2);
+  ASSERT_EQ(req2->method, HttpMethod::POST);
+  ASSERT_EQ(req2->body, "hello, world");
+  ASSERT_EQ(p1, "GET / HTTP/1.1\r\n\r\n");
+}
+
+TEST(HttpParserTest, whenRequestExceedsLimits_itShouldReportTheViolatedLimit) {
+  HttpLimits limits;
+  limits.maxRequestLineLength = 32;
+  limits.maxHeaderCount = 2;
+  limits.maxHeaderLength = 64;
+  auto sut = std::make_unique<ConcreteHttpParser>(limits);
+  std::string p1{"GET /" + std::string(40, 'a')};
+  ASSERT_EQ(std::get<HttpRequestError>(sut->ParseHead(p1)), HttpRequestError::RequestLineTooLong);
+  std::string p2{"GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n"};
+  ASSERT_EQ(std::get<HttpRequestError>(sut->ParseHead(p2)), HttpRequestError::TooManyHeaders);
+  std::string p3{"GET / HTTP/1.1\r\nA: " + std::string(80, 'a')};
+  ASSERT_EQ(std::get<HttpRequestError>(sut->ParseHead(p3)), HttpRequestError::HeadersTooLarge);
+  std::string p4{"GET / HTTP/1.1\r\nA"};
+  ASSERT_TRUE(std::holds_alternative<std::monostate>(sut->ParseHead(p4)));
+  std::string p5{"GET / HTTP/1.1\r\nA\r\n\r\n"};
+  ASSERT_EQ(std::get<HttpRequestError>(sut->ParseHead(p5)), HttpRequestError::Malformed);
+}
+
+TEST(UriTest, whenRequestTargetHasQueryAndFragment_itShouldSplitThem) {
+  Uri sut{"/a/b?x=1&&y=%41+b&z#frag"};
+  ASSERT_EQ(sut.Path(), "/a/b");
+  ASSERT_EQ(sut.Query(), "x=1&&y=%41+b&z");
+  ASSERT_EQ(sut.Fragment(), "frag");
+  std::vector<std::pair<std::string_view, std::string_view>> parameters;
+  for (const auto& parameter : sut.Parameters()) {
+    parameters.emplace_back(parameter.key, parameter.value);
+  }
+  ASSERT_THAT(parameters, ElementsAre(Pair("x", "1"), Pair("y", "%41+b"), Pair("z", "")));
+  ASSERT_EQ(sut.Parameter("y"), "A b");
+  ASSERT_FALSE(sut.Parameter("w"));
+}
+
+TEST(UriTest, whenPathHasEncodedAndDotSegments_itShouldNormalizeThePath) {
+  ASSERT_EQ(Uri{"/static/%2e%2e/%2E%2e/etc/passwd"}.NormalizedPath(), "/etc/passwd");
+  ASSERT_EQ(Uri{"/a/./b/../c/"}.NormalizedPath(), "/a/c/");
+  ASSERT_EQ(Uri{"/a/b/.."}.NormalizedPath(), "/a/");
+  ASSERT_EQ(Uri{"//a%20b%zz"}.NormalizedPath(), "/a b%zz");
+  ASSERT_EQ(Uri{"/../../"}.NormalizedPath(), "/");
+}
+
+TEST(HttpBodyDecoderTest, whenContentLengthIsInvalidOrTooLarge_itShouldFail) {
+  HttpHeaders headers;
+  headers.emplace("content-length", "12x");
+  ASSERT_EQ(HttpBodyDecoder(headers, 1024).Error(), HttpRequestError::Malformed);
+  ASSERT_TRUE(HttpBodyDecoder(headers, 1024).Failed());
+  headers["content-length"] = "2048";
+  ASSERT_EQ(HttpBodyDecoder(headers, 1024).Error(), HttpRequestError::BodyTooLarge);
+  headers["content-length"] = "99999999999999999999999";
+  ASSERT_EQ(HttpBodyDecoder(headers, 1024).Error(), HttpRequestError::BodyTooLarge);
+}
+
+TEST(HttpBodyDecoderTest, whenChunkedBodyExceedsLimit_itShouldFail) {
+  HttpHeaders headers;
+  headers.emplace("transfer-encoding", "chunked");
+  HttpBodyDecoder sut{headers, 16};
+  std::string payload{"a\r\n0123456789\r\n7\r\n"};
+  std::string data;
+  ASSERT_FALSE(sut.Decode(payload, data));
+  ASSERT_EQ(sut.Error(), HttpRequestError::BodyTooLarge);
+}
+
+TEST(HttpBodyDecoderTest, whenReceivedPartialChunks_itShouldDecodeAvailableData) {
+  HttpHeaders headers;
+  headers.emplace("transfer-encoding", "chunked");
+  HttpBodyDecoder sut{headers, 1024};
+  std::string payload{"a\r\n0123"};
+  std::string data;
+  ASSERT_TRUE(sut.Decode(payload, data));
+  ASSERT_FALSE(sut.Done());
+  ASSERT_EQ(data, "0123");
+  ASSERT_TRUE(payload.empty());
+  payload = "456789\r\n0\r\n\r\n";
+  ASSERT_TRUE(sut.Decode(payload, data));
+  ASSERT_TRUE(sut.Done());
+  ASSERT_EQ(data, "0123456789");
+}
+
+TEST(HttpBodyDecoderTest, whenReceivedMalformedChunkSize_itShouldFail) {
+  HttpHeaders headers;
+  headers.emplace("transfer-encoding", "chunked");
+  for (const auto* chunkSize : {"zz\r\n", "1Z\r\n", "a0zz;ext\r\n", "1 2\r\n", "-1\r\n"}) {
+    HttpBodyDecoder sut{headers, 1024};
+    std::string payload{chunkSize};
+    std::string data;
+    ASSERT_FALSE(sut.Decode(payload, data)) << chunkSize;
+    ASSERT_EQ(sut.Error(), HttpRequestError::Malformed);
+  }
+  HttpBodyDecoder sut{headers, 1024};
+  std::string payload{"a ;ext=1\r\n"};
+  std::string data;
+  ASSERT_TRUE(sut.Decode(payload, data));
+}
+
+TEST(HttpBodyDecoderTest, whenTheFinalTransferCodingIsNotChunked_itShouldFail) {
+  HttpHeaders headers;
+  for (const auto* transferEncoding : {"gzip", "xchunked", "chunked, gzip", "chunked;q=1", ""}) {
+    headers["transfer-encoding"] = transferEncoding;
+    headers["content-length"] = "4";
+    HttpBodyDecoder sut{headers, 1024};
+    ASSERT_TRUE(sut.Failed()) << transferEncoding;
+    ASSERT_EQ(sut.Error(), HttpRequestError::Malformed);
+  }
+  headers["transfer-encoding"] = "gzip, Chunked";
+  ASSERT_FALSE(HttpBodyDecoder(headers, 1024).Failed());
+}
+
+TEST(MultipartSplitterTest, whenReceivedMultipartBodyInPieces_itShouldSplitParts) {
+  MultipartSplitter sut{"XyZ"};
+  MultipartProcessorMock processor;
+  std::string data;
+  EXPECT_CALL(processor, Process(An<HttpHeaders&&>()))
+      .Times(2)
+      .WillRepeatedly([&data](HttpHeaders&& headers) { data += "[" + headers.at("content-disposition") + "]"; });
+  EXPECT_CALL(processor, Process(An<std::string_view>())).WillRepeatedly([&data](std::string_view d) { data += d; });
+  ASSERT_TRUE(sut.Split("preamble\r\n--XyZ\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nfirst\r", processor));
+  ASSERT_EQ(sut.Passable("\n--X"), 0);
+  ASSERT_TRUE(sut.Split("\n--X", processor));
+  ASSERT_TRUE(sut.Split("yZ\r\nContent-Disposition: file\r\n\r\nsec\r\n--Xy", processor));
+  ASSERT_EQ(sut.Passable("ond part\r\n--X"), 0);
+  ASSERT_TRUE(sut.Split("ond part\r\n--XyZ--\r\nepilogue", processor));
+  ASSERT_EQ(data, "[form-data; name=\"a\"]first[file]sec\r\n--Xyond part");
+}
+
+TEST(MultipartSplitterTest, whenInsidePartData_itShouldReportBytesBeforeDelimiterAsPassable) {
+  MultipartSplitter sut{"XyZ"};
+  NiceMock<MultipartProcessorMock> processor;
+  ASSERT_TRUE(sut.Split("--XyZ\r\n\r\n", processor));
+  ASSERT_EQ(sut.Passable("0123456789"), 10);
+  ASSERT_EQ(sut.Passable("01234\r\n--X"), 5);
+  ASSERT_EQ(sut.Passable("01234\r\n--XyZ--"), 5);
+}
+
+TEST(HttpUploadLayerTest, whenTheBodyCannotBeStored_itShouldAnswerWithAnErrorInsteadOfCompleting) {
+  const int readOnly = open("/dev/null", O_RDONLY);
+  ASSERT_NE(readOnly, -1);
+  auto fail = [readOnly](std::string contentType, std::string body, HttpStatus expected) {
+    StrictMock<HttpSenderMock> sender;
+    auto processor = std::make_unique<StrictMock<HttpUploadProcessorMock>>();
+    EXPECT_CALL(*processor, Open(_, _)).WillRepeatedly(Return(readOnly));
+    EXPECT_CALL(sender, Send(An<HttpResponse&&>())).WillOnce([expected](HttpResponse&& resp) {
+      ASSERT_EQ(resp.status, expected);
+      ASSERT_EQ(resp.headers.at("Connection"), "close");
+    });
+    EXPECT_CALL(sender, Close());
+    HttpUploadLayer sut{sender, std::move(processor)};
+    HttpRequest req;
+    req.method = HttpMethod::POST;
+    req.headers.emplace("content-type", std::move(contentType));
+    sut.Process(std::move(req));
+    sut.Process(HttpRequestBody{std::move(body), false});
+    sut.Process(HttpRequestBody{"more", true});
+  };
+  fail("application/octet-stream", "data", HttpStatus::InternalServerError);
+  fail("multipart/form-data; boundary=XyZ", "--XyZ\r\nno colon\r\n\r\ndata", HttpStatus::BadRequest);
+
+  StrictMock<HttpSenderMock> sender;
+  auto processor = std::make_unique<StrictMock<HttpUploadProcessorMock>>();
+  EXPECT_CALL(*processor, Open(_, _)).WillOnce(Return(readOnly));
+  HttpUploadLayer sut{sender, std::move(processor)};
+  sut.Process(HttpRequest{});
+  StrictMock<TcpReceiverMock> receiver;
+  EXPECT_CALL(receiver, Splice(readOnly, 4)).WillOnce(Return(std::nullopt));
+  EXPECT_CALL(sender, Send(An<HttpResponse&&>())).WillOnce([](HttpResponse&& resp) {
+    ASSERT_EQ(resp.status, HttpStatus::InternalServerError);
+  });
+  EXPECT_CALL(sender, Close());
+  ASSERT_EQ(sut.Process(receiver, 4), 0);
+  ASSERT_EQ(sut.Process(receiver, 4), 0);
+  sut.Process(HttpRequestBody{{}, true});
+  close(readOnly);
+}
+
+TEST(TcpReceiverTest, whenTheSpliceTargetFails_itShouldReportTheFailureAndEmptyThePipe) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  int pipeFds[2];
+  ASSERT_EQ(pipe2(pipeFds, O_NONBLOCK), 0);
+  int target[2];
+  ASSERT_EQ(pipe2(target, O_NONBLOCK), 0);
+  const int readOnly = open("/dev/null", O_RDONLY);
+  std::string peekBuffer;
+  ConcreteTcpReceiver sut{fds[0], pipeFds, peekBuffer};
+  ASSERT_EQ(write(fds[1], "datadata", 8), 8);
+  ASSERT_EQ(sut.Splice(target[1], 4), 4);
+  ASSERT_EQ(sut.Splice(readOnly, 4), std::nullopt);
+  char buf[8];
+  ASSERT_EQ(read(pipeFds[0], buf, sizeof buf), -1);
+  ASSERT_EQ(read(target[0], buf, sizeof buf), 4);
+  ASSERT_FALSE(sut.Closed());
+  for (int fd : {fds[0], fds[1], pipeFds[0], pipeFds[1], target[0], target[1], readOnly}) {
+    close(fd);
+  }
+}
+
+TEST(HttpRangeTest, whenParsingRangeHeader_itShouldClampSatisfiableRangesAndIgnoreInvalidOnes) {
+  auto ranges = ParseHttpRanges("bytes=0-4, 10-, -3, 200-300", 100);
+  ASSERT_TRUE(ranges.has_value());
+  ASSERT_EQ(ranges->size(), 3);
+  ASSERT_EQ((*ranges)[0].first, 0);
+  ASSERT_EQ((*ranges)[0].last, 4);
+  ASSERT_EQ((*ranges)[1].first, 10);
+  ASSERT_EQ((*ranges)[1].last, 99);
+  ASSERT_EQ((*ranges)[2].first, 97);
+  ASSERT_EQ((*ranges)[2].last, 99);
+  ASSERT_TRUE(ParseHttpRanges("bytes=100-", 100)->empty());
+  ASSERT_FALSE(ParseHttpRanges("bytes=5-1", 100).has_value());
+  ASSERT_FALSE(ParseHttpRanges("items=0-1", 100).has_value());
+  ASSERT_FALSE(ParseHttpRanges("bytes=a-b", 100).has_value());
+}
+
+TEST(FileCacheTest, whenFileChangesAfterValidity_itShouldReopenTheFile) {
+  const std::string path = testing::TempDir() + "file_cache_test";
+  std::ofstream{path} << "cached";
+  FileCache sut{FileCacheOptions{.capacity = 4, .validity = std::chrono::milliseconds{0}}};
+  auto first = sut.Get(path);
+  ASSERT_NE(first, nullptr);
+  ASSERT_THAT(first->headers, HasSubstr("Content-Length: 6\r\n"));
+  ASSERT_THAT(first->headers, HasSubstr("ETag: " + first->etag + "\r\n"));
+  ASSERT_EQ(sut.Get(path), first);
+  std::ofstream{path} << "changed content";
+  auto second = sut.Get(path);
+  ASSERT_NE(second, nullptr);
+  ASSERT_THAT(second->headers, HasSubstr("Content-Length: 15\r\n"));
+  ASSERT_NE(second->etag, first->etag);
+  std::remove(path.c_str());
+  ASSERT_EQ(sut.Get(path), nullptr);
+  ASSERT_EQ(sut.Get(testing::TempDir()), nullptr);
+}
+
+TEST(FileTest, whenOpeningBeneathDirectory_itShouldRejectEscapes) {
+  const std::filesystem::path root = testing::TempDir() + "file_beneath_test";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "sub");
+  std::ofstream{root / "sub" / "inner"} << "inner";
+  std::ofstream{testing::TempDir() + "file_beneath_outer"} << "outer";
+  std::filesystem::create_symlink(testing::TempDir() + "file_beneath_outer", root / "escape");
+  os::Directory sut{root.string()};
+  ASSERT_TRUE(sut.Ok());
+  ASSERT_TRUE(os::File(sut.Fd(), "sub/inner").Ok());
+  ASSERT_FALSE(os::File(sut.Fd(), "../file_beneath_outer").Ok());
+  ASSERT_FALSE(os::File(sut.Fd(), "sub/../../file_beneath_outer").Ok());
+  ASSERT_FALSE(os::File(sut.Fd(), "escape").Ok());
+  ASSERT_FALSE(os::File(sut.Fd(), "/etc/passwd").Ok());
+  std::filesystem::remove_all(root);
+}
+
+TEST(ResponseCacheTest, whenBudgetIsExceeded_itShouldEvictLeastRecentlyUsedEntries) {
+  ResponseCache sut{ResponseCacheOptions{.capacity = 8, .maxEntrySize = 8}};
+  os::FileStatus status{.size = 4, .regular = true};
+  HttpHeaders headers{{"Content-Type", "text/html"}};
+  sut.Put(-1, "/a", "", status, headers, std::make_shared<const std::string>("aaaa"));
+  sut.Put(-1, "/b", "", status, headers, std::make_shared<const std::string>("bbbb"));
+  ASSERT_NE(sut.Get(-1, "/a", "", status, headers), nullptr);
+  sut.Put(-1, "/c", "", status, headers, std::make_shared<const std::string>("cccc"));
+  ASSERT_EQ(sut.Get(-1, "/b", "", status, headers), nullptr);
+  ASSERT_EQ(*sut.Get(-1, "/a", "", status, headers), "aaaa");
+  ASSERT_EQ(sut.Get(-1, "/a", "", status, HttpHeaders{}), nullptr);
+  ASSERT_EQ(sut.Size(), 4);
+}
+
+TEST(ResponseCacheTest, whenRepresentationsShareAPath_itShouldKeepEachOne) {
+  ResponseCache sut{ResponseCacheOptions{.capacity = 64, .maxEntrySize = 8}};
+  os::FileStatus status{.size = 4, .inode = 7, .device = 1, .regular = true};
+  HttpHeaders headers{{"Content-Type", "text/html"}};
+  sut.Put(3, "a", "", status, headers, std::make_shared<const std::string>("root"));
+  sut.Put(4, "a", "", status, headers, std::make_shared<const std::string>("other"));
+  sut.Put(3, "a", "br", status, headers, std::make_shared<const std::string>("brotli"));
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(*sut.Get(3, "a", "", status, headers), "root");
+    ASSERT_EQ(*sut.Get(4, "a", "", status, headers), "other");
+    ASSERT_EQ(*sut.Get(3, "a", "br", status, headers), "brotli");
+  }
+  auto moved = status;
+  moved.device = 2;
+  ASSERT_EQ(sut.Get(3, "a", "", moved, headers), nullptr);
+  ASSERT_EQ(sut.Size(), 11);
+}
+
+TEST(CompressionCacheTest, whenCompressingRepeatedContent_itShouldReuseTheCompressedResult) {
+  CompressionCache sut{CompressionCacheOptions{.capacity = 1 << 20, .maxEntrySize = 1 << 16}};
+  const std::string content(4096, 'a');
+  auto first = sut.Compress(content, HttpContentCoding::Gzip, 6);
+  ASSERT_TRUE(first.has_value());
+  ASSERT_LT(first->size(), content.size());
+  ASSERT_EQ(first->substr(0, 2), "\x1f\x8b");
+  ASSERT_EQ(sut.Compress(content, HttpContentCoding::Gzip, 6), first);
+  ASSERT_NE(sut.Compress(content, HttpContentCoding::Deflate, 6), first);
+}
+
+std::string MaskedWebsocketFrame(bool fin, std::uint8_t opcode, std::string payload) {
+  const std::uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  std::string frame{static_cast<char>((fin << 7) | opcode)};
+  if (payload.length() < 126) {
+    frame += static_cast<char>(0x80 | payload.length());
+  } else {
+    frame += static_cast<char>(0x80 | 127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      frame += static_cast<char>(payload.length() >> shift);
+    }
+  }
+  frame.append(reinterpret_cast<const char*>(key), 4);
+  common::Unmask(payload.data(), payload.length(), key);
+  return frame + payload;
+}
+
+TEST(HttpResponseWriterTest, whenStreaming_itShouldCoalesceWritesAndReportBackpressure) {
+  StrictMock<TcpSenderMock> tcpSender;
+  FileCache fileCache;
+  ConcreteHttpSender sender{tcpSender, HttpCaches{fileCache, nullptr, nullptr}};
+  HttpRequest req;
+  req.method = HttpMethod::GET;
+  sender.Prepare(req);
+  EXPECT_CALL(tcpSender, Send(An<std::string_view>()))
+      .WillOnce([](std::string_view head) { ASSERT_TRUE(head.starts_with("HTTP/1.1 200 OK\r\n")); });
+  auto sut = sender.Stream(StreamingHttpResponse{{{"Trailer", "X-Checksum"}}, 10});
+  Mock::VerifyAndClearExpectations(&tcpSender);
+  EXPECT_CALL(tcpSender, Closed()).WillRepeatedly(Return(false));
+  EXPECT_CALL(tcpSender, BufferedBytes()).WillOnce(Return(0)).WillOnce(Return(0)).WillOnce(Return(100));
+  EXPECT_CALL(tcpSender, Send(std::string_view{"5\r\nhello\r\n"}));
+  EXPECT_CALL(tcpSender, OnDrain(10, _));
+  EXPECT_CALL(tcpSender, Send(std::string_view{"1\r\n!\r\n0\r\nX-Checksum: 1\r\n\r\n"}));
+  ASSERT_TRUE(sut->Write("hel"));
+  sut->Write("lo");
+  sut->Flush();
+  ASSERT_FALSE(sut->Write("!"));
+  sut->OnWritable([] {});
+  sut->Finish({{"X-Checksum", "1"}});
+  sut->Finish({});
+}
+
+TEST(HttpResponseWriterTest, whenTheConnectionGoesAway_itShouldReportItAndStopWaiting) {
+  NiceMock<TcpSenderMock> tcpSender;
+  FileCache fileCache;
+  auto sender = std::make_unique<ConcreteHttpSender>(tcpSender, HttpCaches{fileCache, nullptr, nullptr});
+  sender->Prepare(HttpRequest{});
+  auto sut = sender->Stream(StreamingHttpResponse{{}, 10});
+  int woken = 0;
+  EXPECT_CALL(tcpSender, Closed()).WillOnce(Return(false)).WillRepeatedly(Return(true));
+  EXPECT_CALL(tcpSender, OnDrain(10, _)).WillOnce([](std::size_t, std::function<void()> callback) { callback(); });
+  sut->OnWritable([&woken] { woken++; });
+  ASSERT_EQ(woken, 1);
+  ASSERT_TRUE(sut->Closed());
+  ASSERT_FALSE(sut->Write("data"));
+  sut->OnWritable([&woken] { woken++; });
+  ASSERT_EQ(woken, 2);
+  sender.reset();
+  Mock::VerifyAndClearExpectations(&tcpSender);
+  EXPECT_CALL(tcpSender, Send(An<std::string_view>())).Times(0);
+  EXPECT_CALL(tcpSender, Closed()).Times(0);
+  ASSERT_TRUE(sut->Closed());
+  ASSERT_FALSE(sut->Write("data"));
+  sut->Flush();
+  sut->Finish({});
+  sut->OnWritable([&woken] { woken++; });
+  ASSERT_EQ(woken, 3);
+}
+
+TEST(TcpSenderTest, whenThePeerDisconnectsWhileAProducerWaits_itShouldRunTheDrainCallback) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  NiceMock<TcpSenderSupervisorMock> supervisor;
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Send(std::string(1024, 'd'));
+  int woken = 0;
+  sut.OnDrain(0, [&woken] { woken++; });
+  ASSERT_FALSE(sut.Closed());
+  sut.Disconnect();
+  ASSERT_EQ(woken, 1);
+  ASSERT_TRUE(sut.Closed());
+  ASSERT_EQ(sut.BufferedBytes(), 0);
+  close(fds[1]);
+}
+
+TEST(TcpSenderTest, whenCoalescing_itShouldDeferAndGatherQueuedWritesIntoOneSend) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  StrictMock<TcpSenderSupervisorMock> supervisor;
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Coalesce(std::chrono::microseconds{200});
+  EXPECT_CALL(supervisor, ResumeSenderAfter(fds[0], std::chrono::nanoseconds{200'000}));
+  sut.Send("ab", "c");
+  sut.Send(std::make_shared<const std::string>("de"));
+  sut.Send("f");
+  sut.Send(std::make_shared<const std::string>("gh"));
+  Mock::VerifyAndClearExpectations(&supervisor);
+  EXPECT_CALL(supervisor, MarkSenderPending(fds[0]));
+  EXPECT_CALL(supervisor, UnmarkSenderPending(fds[0]));
+  sut.Resume();
+  sut.SendBuffered();
+  char received[16];
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), 8);
+  ASSERT_EQ(std::string_view(received, 8), "abcdefgh");
+  ASSERT_EQ(sut.BufferedBytes(), 0);
+  close(fds[1]);
+}
+
+TEST(WebsocketParserTest, whenReceivedMaskedFrames_itShouldUnmaskEachPayload) {
+  ConcreteWebsocketParser sut;
+  std::string masked{"\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58", 11};
+  std::string payload = masked + masked.substr(0, 4);
+  auto frame = std::get<WebsocketFrame>(sut.Parse(payload));
+  ASSERT_TRUE(frame.fin);
+  ASSERT_EQ(frame.opcode, 1);
+  ASSERT_EQ(frame.payload, "Hello");
+  ASSERT_TRUE(std::holds_alternative<std::monostate>(sut.Parse(payload)));
+  payload += masked.substr(4);
+  ASSERT_EQ(std::get<WebsocketFrame>(sut.Parse(payload)).payload, "Hello");
+  ASSERT_TRUE(payload.empty());
+  std::string unmasked{"\x81\x01x", 3};
+  ASSERT_EQ(std::get<WebsocketError>(sut.Parse(unmasked)), WebsocketError::ProtocolError);
+}
+
+TEST(WebsocketParserTest, whenReceivedOversizedFrame_itShouldRejectOrStreamIt) {
+  const std::string data(70000, 'd');
+  WebsocketOptions options;
+  options.maxMessageLength = 1024;
+  ConcreteWebsocketParser limited{options};
+  std::string header = MaskedWebsocketFrame(true, 2, data).substr(0, 14);
+  ASSERT_EQ(std::get<WebsocketError>(limited.Parse(header)), WebsocketError::MessageTooBig);
+  options.streaming = true;
+  ConcreteWebsocketParser sut{options};
+  std::string encoded = MaskedWebsocketFrame(true, 2, data);
+  std::string payload = encoded.substr(0, 1000);
+  auto first = std::get<WebsocketFrame>(sut.Parse(payload));
+  ASSERT_FALSE(first.fin);
+  ASSERT_EQ(first.opcode, 2);
+  payload = encoded.substr(1000);
+  auto rest = std::get<WebsocketFrame>(sut.Parse(payload));
+  ASSERT_TRUE(rest.fin);
+  ASSERT_EQ(rest.opcode, 0);
+  ASSERT_EQ(first.payload + rest.payload, data);
+}
+
+TEST(WebsocketLayerTest, whenReceivedFragmentsAndControlFrames_itShouldReassembleAndReply) {
+  ConcreteWebsocketParser parser;
+  StrictMock<WebsocketSenderMock> sender;
+  StrictMock<WebsocketProcessorMock> processor;
+  WebsocketLayer sut{parser, sender, processor};
+  std::string message;
+  std::string pong;
+  std::string close;
+  EXPECT_CALL(processor, Process(_)).WillOnce([&message](WebsocketFrame&& frame) { message = frame.payload; });
+  EXPECT_CALL(sender, Send(_))
+      .WillOnce([&pong](WebsocketFrame&& frame) { pong = std::to_string(frame.opcode) + frame.payload; })
+      .WillOnce([&close](WebsocketFrame&& frame) { close = std::to_string(frame.opcode) + frame.payload; });
+  EXPECT_CALL(sender, Close());
+  std::string payload = MaskedWebsocketFrame(false, 1, "Hel") + MaskedWebsocketFrame(true, 9, "p") +
+                        MaskedWebsocketFrame(true, 0, "lo") + MaskedWebsocketFrame(true, 8, "\x03\xe8" "bye");
+  while (sut.TryProcess(payload)) {
+  }
+  ASSERT_EQ(message, "Hello");
+  ASSERT_EQ(pong, "10p");
+  ASSERT_EQ(close, "8\x03\xe8");
+}
+
+std::string RunWebsocketLayer(std::string payload, const WebsocketOptions& options = {}) {
+  ConcreteWebsocketParser parser{options};
+  NiceMock<WebsocketSenderMock> sender;
+  NiceMock<WebsocketProcessorMock> processor;
+  WebsocketLayer sut{parser, sender, processor, options};
+  std::string events;
+  ON_CALL(processor, Process(_)).WillByDefault([&events](WebsocketFrame&& frame) {
+    events += "[" + frame.payload + "]";
+  });
+  ON_CALL(sender, Send(_)).WillByDefault([&events](WebsocketFrame&& frame) {
+    const auto* p = reinterpret_cast<const std::uint8_t*>(frame.payload.data());
+    events += std::to_string(frame.opcode) + ":" + (frame.payload.size() >= 2 ? std::to_string(p[0] << 8 | p[1]) : "");
+  });
+  while (sut.TryProcess(payload)) {
+  }
+  return events;
+}
+
+std::string CloseFrame(std::uint16_t code, std::string_view reason = {}) {
+  const std::string payload{common::ToChar(code >> 8), common::ToChar(code)};
+  return MaskedWebsocketFrame(true, 8, payload + std::string{reason});
+}
+
+TEST(WebsocketParserTest, whenAControlFrameIsFragmentedOrTooLong_itShouldFail) {
+  ConcreteWebsocketParser sut;
+  std::string fragmented = MaskedWebsocketFrame(false, 9, "p");
+  ASSERT_EQ(std::get<WebsocketError>(sut.Parse(fragmented)), WebsocketError::ProtocolError);
+  std::string tooLong = MaskedWebsocketFrame(true, 9, std::string(126, 'p'));
+  ASSERT_EQ(std::get<WebsocketError>(sut.Parse(tooLong)), WebsocketError::ProtocolError);
+  std::string longest = MaskedWebsocketFrame(true, 9, std::string(125, 'p'));
+  ASSERT_EQ(std::get<WebsocketFrame>(sut.Parse(longest)).payload.size(), 125);
+}
+
+TEST(WebsocketLayerTest, whenTheCloseCodeMustNotBeSent_itShouldFailWithProtocolError) {
+  for (std::uint16_t code : {0, 999, 1004, 1005, 1006, 1015, 1016, 2999, 5000}) {
+    ASSERT_EQ(RunWebsocketLayer(CloseFrame(code)), "8:1002") << code;
+  }
+  for (std::uint16_t code : {1000, 1003, 1007, 1014, 3000, 4999}) {
+    ASSERT_EQ(RunWebsocketLayer(CloseFrame(code, "bye")), "8:" + std::to_string(code)) << code;
+  }
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(true, 8, "")), "8:");
+}
+
+TEST(WebsocketLayerTest, whenACloseReasonIsNotUtf8_itShouldFailWithInvalidPayload) {
+  ASSERT_EQ(RunWebsocketLayer(CloseFrame(1000, "\xce\xba\xe1\xbd\xb9")), "8:1000");
+  ASSERT_EQ(RunWebsocketLayer(CloseFrame(1000, "\xce")), "8:1007");
+  ASSERT_EQ(RunWebsocketLayer(CloseFrame(1000, "\xed\xa0\x80")), "8:1007");
+}
+
+TEST(WebsocketLayerTest, whenATextMessageIsNotUtf8_itShouldFailWithInvalidPayload) {
+  const std::string kosme{"\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5"};
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(false, 1, kosme.substr(0, 3)) +
+                              MaskedWebsocketFrame(true, 0, kosme.substr(3))),
+      "[" + kosme + "]");
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(true, 1, "plain ascii text \xc0\xaf")), "8:1007");
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(true, 1, "\xf4\x90\x80\x80")), "8:1007");
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(false, 1, "ok") + MaskedWebsocketFrame(true, 0, "\xe1\xbd")),
+      "8:1007");
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(true, 2, "\xc0\xaf")), "[\xc0\xaf]");
+  WebsocketOptions streaming;
+  streaming.streaming = true;
+  ASSERT_EQ(RunWebsocketLayer(MaskedWebsocketFrame(true, 1, "ok\xff"), streaming), "8:1007");
+}
+
 TEST(WebsocketHandshakeBuilderTest, whenReceivedValidUpgradeRequest_itShouldProduceUpgradeResponse) {
   HttpRequest req;
   req.method = HttpMethod::GET;
-  req.uri = "/websocket";
+  req.uri = Uri{"/websocket"};
   req.version = "HTTP/1.1";
   req.headers.emplace("connection", "Upgrade, keep-alive");
   req.headers.emplace("upgrade", "Websocket");
@@ -77,4 +639,1251 @@ TEST(WebsocketHandshakeBuilderTest, whenReceivedValidUpgradeRequest_itShouldProd
   ASSERT_EQ(resp->headers.at("Sec-WebSocket-Accept"), "HSmrc0sMlYUkAGmm5OPpG2HaGWk=");
 }
 
+TEST(WebsocketHandshakeBuilderTest, whenKeyIsNotASixteenByteNonce_itShouldRejectTheUpgrade) {
+  char accept[websocketAcceptLength];
+  ASSERT_TRUE(ComputeWebsocketAccept("dGhlIHNhbXBsZSBub25jZQ==", accept));
+  ASSERT_EQ(std::string_view(accept, sizeof accept), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+  ASSERT_FALSE(ComputeWebsocketAccept("dGhlIHNhbXBsZSBub25jZQ", accept));
+  ASSERT_FALSE(ComputeWebsocketAccept("dGhlIHNhbXBsZSBub25jZQ!!", accept));
+  HttpRequest req;
+  req.headers.emplace("upgrade", "WebSocket");
+  req.headers.emplace("sec-websocket-key", "not a key");
+  ASSERT_FALSE(WebsocketHandshakeBuilder{req}.Build().has_value());
+}
+
+TEST(WebsocketHandshakeBuilderTest, whenClientOffersPermessageDeflate_itShouldNegotiateWindowAndTakeover) {
+  HttpRequest req;
+  req.headers.emplace("upgrade", "websocket");
+  req.headers.emplace("sec-websocket-key", "x3JJHMbDL1EzLkh9GBhXDw==");
+  req.headers.emplace("sec-websocket-extensions",
+      "permessage-deflate; server_max_window_bits=8, permessage-deflate; client_max_window_bits; "
+      "server_max_window_bits=12, permessage-deflate");
+  WebsocketCompressionOptions options;
+  ASSERT_FALSE(WebsocketHandshakeBuilder(req, options).Deflate());
+  options.enabled = true;
+  options.windowBits = 10;
+  options.contextTakeover = false;
+  WebsocketHandshakeBuilder sut{req, options};
+  auto resp = sut.Build();
+  ASSERT_TRUE(resp);
+  ASSERT_EQ(resp->headers.at("Sec-WebSocket-Extensions"),
+      "permessage-deflate; server_no_context_takeover; client_no_context_takeover; server_max_window_bits=10; "
+      "client_max_window_bits=10");
+  ASSERT_EQ(sut.Deflate()->serverMaxWindowBits, 10);
+  ASSERT_EQ(sut.Deflate()->clientMaxWindowBits, 10);
+}
+
+TEST(WebsocketLayerTest, whenDeflateNegotiated_itShouldInflateFragmentedMessages) {
+  WebsocketOptions options;
+  options.compression.minLength = 16;
+  std::optional<WebsocketDeflateParameters> deflate{std::in_place};
+  const std::string text(1000, 'a');
+  Deflater client{15, 6};
+  auto compressed = client.Compress(text, false);
+  compressed.resize(compressed.length() - 4);
+  std::string payload = MaskedWebsocketFrame(false, 1, compressed.substr(0, 5)) +
+                        MaskedWebsocketFrame(true, 0, compressed.substr(5));
+  payload[0] = static_cast<char>(payload[0] | 0x40);
+  ConcreteWebsocketParser parser{options, deflate};
+  NiceMock<WebsocketSenderMock> sender;
+  StrictMock<WebsocketProcessorMock> processor;
+  WebsocketLayer sut{parser, sender, processor, options, deflate};
+  std::string message;
+  EXPECT_CALL(processor, Process(_)).WillOnce([&message](WebsocketFrame&& frame) { message = frame.payload; });
+  while (sut.TryProcess(payload)) {
+  }
+  ASSERT_EQ(message, text);
+}
+
+TEST(WebsocketHubTest, whenPublishing_itShouldShareOneEncodedFrameAndDisconnectSlowSubscribers) {
+  WebsocketHubOptions options;
+  options.maxBacklog = 4;
+  options.disconnectSlow = true;
+  WebsocketHub sut{options};
+  TcpExecutorMock executor;
+  EXPECT_CALL(executor, Post(_)).WillRepeatedly([](std::function<void()> task) { task(); });
+  WebsocketHubEndpoint endpoint{sut, executor};
+  StrictMock<TcpSenderMock> fast;
+  StrictMock<TcpSenderMock> slow;
+  StrictMock<TcpSenderMock> idle;
+  ConcreteWebsocketSender fastSender{fast, {}, std::nullopt, &endpoint};
+  ConcreteWebsocketSender slowSender{slow, {}, std::nullopt, &endpoint};
+  ConcreteWebsocketSender idleSender{idle, {}, std::nullopt, &endpoint};
+  fastSender.Subscribe("prices");
+  slowSender.Subscribe("prices");
+  idleSender.Subscribe("news");
+  std::shared_ptr<const std::string> delivered;
+  EXPECT_CALL(fast, Backlog()).WillOnce(Return(0));
+  EXPECT_CALL(fast, Send(An<std::shared_ptr<const std::string>>())).WillOnce(SaveArg<0>(&delivered));
+  EXPECT_CALL(slow, Backlog()).WillOnce(Return(4));
+  EXPECT_CALL(slow, Abort());
+  sut.Publish("prices", WebsocketFrame{true, 1, "tick"});
+  sut.Publish("weather", WebsocketFrame{true, 1, "rain"});
+  ASSERT_TRUE(delivered);
+  ASSERT_EQ(*delivered, std::string("\x81\x04tick"));
+  idleSender.Unsubscribe("news");
+  sut.Publish("news", WebsocketFrame{true, 1, "none"});
+}
+
+TEST(MixedReplaceStreamTest, whenPublishingFrames_itShouldShareThePartAndReplayTheLatestToNewViewers) {
+  MixedReplaceStream sut{"frame"};
+  StrictMock<HttpSenderMock> first;
+  StrictMock<HttpSenderMock> second;
+  std::string boundary;
+  std::vector<std::shared_ptr<const std::string>> parts;
+  auto header = [&boundary](MixedReplaceHeaderHttpResponse&& resp) { boundary = resp.boundary; };
+  auto part = [&parts](SharedMixedReplaceDataHttpResponse&& resp) { parts.push_back(resp.part); };
+  EXPECT_CALL(first, Send(An<MixedReplaceHeaderHttpResponse&&>())).WillOnce(header);
+  EXPECT_CALL(first, Send(An<SharedMixedReplaceDataHttpResponse&&>())).Times(2).WillRepeatedly(part);
+  EXPECT_CALL(second, Send(An<MixedReplaceHeaderHttpResponse&&>())).WillOnce(header);
+  EXPECT_CALL(second, Send(An<SharedMixedReplaceDataHttpResponse&&>())).Times(2).WillRepeatedly(part);
+  {
+    MixedReplaceViewer viewer{sut, first};
+    sut.Publish(MixedReplaceDataHttpResponse{{{"Content-Type", "image/jpeg"}}, "one"});
+    MixedReplaceViewer late{sut, second};
+    sut.Publish(MixedReplaceDataHttpResponse{{}, "two"});
+  }
+  sut.Publish(MixedReplaceDataHttpResponse{{}, "three"});
+  ASSERT_EQ(boundary, "frame");
+  ASSERT_EQ(parts.size(), 4);
+  ASSERT_EQ(*parts[0], "--frame\r\nContent-Length: 3\r\nContent-Type: image/jpeg\r\n\r\none\r\n");
+  ASSERT_EQ(parts[1], parts[0]);
+  ASSERT_EQ(*parts[2], "--frame\r\nContent-Length: 3\r\n\r\ntwo\r\n");
+  ASSERT_EQ(parts[3], parts[2]);
+}
+
+TEST(MixedReplaceStreamTest, whenALaterRequestIsPrepared_itShouldKeepTheMethodTheViewerAttachedWith) {
+  MixedReplaceStream sut;
+  NiceMock<TcpSenderMock> headTcpSender;
+  NiceMock<TcpSenderMock> getTcpSender;
+  FileCache fileCache;
+  ConcreteHttpSender headSender{headTcpSender, HttpCaches{fileCache, nullptr, nullptr}};
+  ConcreteHttpSender getSender{getTcpSender, HttpCaches{fileCache, nullptr, nullptr}};
+  HttpRequest head;
+  head.method = HttpMethod::HEAD;
+  HttpRequest get;
+  get.method = HttpMethod::GET;
+  headSender.Prepare(head);
+  getSender.Prepare(get);
+  EXPECT_CALL(headTcpSender, SendLatest(_)).Times(0);
+  EXPECT_CALL(getTcpSender, SendLatest(_)).Times(1);
+  MixedReplaceViewer headViewer{sut, headSender};
+  MixedReplaceViewer getViewer{sut, getSender};
+  headSender.Prepare(get);
+  getSender.Prepare(head);
+  sut.Publish(MixedReplaceDataHttpResponse{{}, "frame"});
+}
+
+std::string JoinHeaders(const std::vector<HttpHeader>& headers) {
+  std::string joined;
+  for (const auto& [field, value] : headers) {
+    joined += field + ": " + value + "\n";
+  }
+  return joined;
+}
+
+TEST(HpackTest, whenDecodingRfcExamples_itShouldMaintainTheDynamicTable) {
+  HpackDecoder sut;
+  auto decode = [&sut](std::string_view hex) {
+    std::string block;
+    for (std::size_t i = 0; i < hex.size(); i += 2) {
+      block += static_cast<char>(std::stoi(std::string{hex.substr(i, 2)}, nullptr, 16));
+    }
+    auto headers = sut.Decode(block, 4096);
+    return std::holds_alternative<std::vector<HttpHeader>>(headers)
+               ? JoinHeaders(std::get<std::vector<HttpHeader>>(headers))
+               : "error";
+  };
+  ASSERT_EQ(decode("828684418cf1e3c2e5f23a6ba0ab90f4ff"),
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+  ASSERT_EQ(decode("828684be5886a8eb10649cbf"),
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+  ASSERT_EQ(decode("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"),
+      ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+  ASSERT_EQ(decode("82c1"), "error");
+}
+
+TEST(HpackTest, whenEncoding_itShouldRoundTripAcrossTableResizes) {
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+  const std::vector<HttpHeader> headers{
+      {":status", "200"}, {"content-type", "text/html"}, {"x-trace", "abc"}, {"date", "Mon, 19 Oct 2026"}};
+  std::string first;
+  encoder.Encode(headers, first);
+  std::string second;
+  encoder.Encode(headers, second);
+  ASSERT_LT(second.size(), first.size());
+  encoder.Resize(0);
+  std::string third;
+  encoder.Encode(headers, third);
+  for (const auto* block : {&first, &second, &third}) {
+    auto decoded = decoder.Decode(*block, 4096);
+    ASSERT_TRUE(std::holds_alternative<std::vector<HttpHeader>>(decoded));
+    ASSERT_EQ(JoinHeaders(std::get<std::vector<HttpHeader>>(decoded)), JoinHeaders(headers));
+  }
+}
+
+std::string Http2Frame(std::uint8_t type, std::uint8_t flags, std::uint32_t id, std::string_view payload) {
+  std::string frame;
+  for (int shift = 16; shift >= 0; shift -= 8) {
+    frame += static_cast<char>(payload.size() >> shift);
+  }
+  frame += static_cast<char>(type);
+  frame += static_cast<char>(flags);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    frame += static_cast<char>(id >> shift);
+  }
+  return frame.append(payload);
+}
+
+// Renders each frame as type:flags:id followed by its decoded headers, data or error code.
+std::vector<std::string> ParseHttp2Frames(std::string_view rest, HpackDecoder& decoder) {
+  auto readUint32 = [](std::string_view s) {
+    return static_cast<std::uint32_t>(static_cast<std::uint8_t>(s[0])) << 24 |
+           static_cast<std::uint32_t>(static_cast<std::uint8_t>(s[1])) << 16 |
+           static_cast<std::uint32_t>(static_cast<std::uint8_t>(s[2])) << 8 | static_cast<std::uint8_t>(s[3]);
+  };
+  std::vector<std::string> frames;
+  while (rest.size() >= 9) {
+    const std::size_t length = static_cast<std::uint8_t>(rest[0]) << 16 | static_cast<std::uint8_t>(rest[1]) << 8 |
+                               static_cast<std::uint8_t>(rest[2]);
+    const auto type = static_cast<int>(rest[3]);
+    auto frame = std::to_string(type) + ":" + std::to_string(rest[4]) + ":" + std::to_string(rest[8]);
+    const auto body = rest.substr(9, length);
+    if (type == 1) {
+      frame += ":" + JoinHeaders(std::get<std::vector<HttpHeader>>(decoder.Decode(body, 4096)));
+    } else if (type == 0 or type == 6) {
+      frame += ":" + std::string{body};
+    } else if (type == 3 or type == 8) {
+      frame += ":" + std::to_string(readUint32(body));
+    } else if (type == 7) {
+      frame += ":" + std::to_string(readUint32(body)) + ":" + std::to_string(readUint32(body.substr(4)));
+    }
+    frames.push_back(frame);
+    rest.remove_prefix(9 + length);
+  }
+  return frames;
+}
+
+class HelloProcessor : public HttpProcessor {
+public:
+  explicit HelloProcessor(HttpSender& sender) : sender{sender} {
+  }
+
+  void Process(HttpRequest&& req) override {
+    HttpResponse resp;
+    resp.status = HttpStatus::OK;
+    resp.body = "hello " + req.headers.at("host");
+    sender.Send(std::move(resp));
+  }
+
+private:
+  HttpSender& sender;
+};
+
+class HelloProcessorFactory : public HttpProcessorFactory {
+public:
+  std::unique_ptr<HttpProcessor> Create(HttpSender& sender) const override {
+    return std::make_unique<HelloProcessor>(sender);
+  }
+};
+
+TEST(Http2LayerTest, whenReceivedRequestsOnStreams_itShouldAnswerEachWithHeadersAndData) {
+  NiceMock<TcpSenderMock> tcpSender;
+  std::string output;
+  ON_CALL(tcpSender, Send(An<std::string_view>(), An<std::string_view>()))
+      .WillByDefault([&output](std::string_view header, std::string_view payload) {
+        output.append(header).append(payload);
+      });
+  HttpRouteMapping mapping;
+  mapping.Add(HttpMethod::GET, "^/hello$", std::make_unique<HelloProcessorFactory>());
+  HttpLimits limits;
+  HttpRejections rejections;
+  FileCache fileCache;
+  Http2Layer sut{tcpSender, mapping, limits, rejections, HttpCaches{fileCache, nullptr, nullptr}};
+  HpackEncoder encoder;
+  std::string request;
+  encoder.Encode({{":method", "GET"}, {":scheme", "http"}, {":path", "/hello"}, {":authority", "h2"}}, request);
+  std::string missing;
+  encoder.Encode({{":method", "GET"}, {":scheme", "http"}, {":path", "/missing"}, {":authority", "h2"}}, missing);
+  std::string payload = std::string{http2Preface} + Http2Frame(4, 0, 0, "") + Http2Frame(1, 5, 1, request) +
+                        Http2Frame(1, 5, 3, missing) + Http2Frame(6, 0, 0, "pingpong");
+  while (sut.TryProcess(payload)) {
+  }
+  ASSERT_TRUE(payload.empty());
+
+  HpackDecoder decoder;
+  ASSERT_EQ(ParseHttp2Frames(output, decoder), (std::vector<std::string>{"4:0:0", "8:0:0:4128769", "4:1:0",
+                        "1:4:1::status: 200\ncontent-length: 8\n", "0:1:1:hello h2",
+                        "1:5:3::status: 404\ncontent-length: 0\n", "6:1:0:pingpong"}));
+}
+
+TEST(ProtocolLayerTest, whenReceivedPipelinedRequests_itShouldCorkAllResponsesIntoOneWrite) {
+  StrictMock<TcpSenderMock> tcpSender;
+  HttpRouteMapping httpMapping;
+  httpMapping.Add(HttpMethod::GET, "^/hello$", std::make_unique<HelloProcessorFactory>());
+  WebsocketRouteMapping websocketMapping;
+  HttpLimits limits;
+  HttpRejections rejections;
+  FileCache fileCache;
+  ConcreteRouterFactory routerFactory{
+      httpMapping, websocketMapping, limits, rejections, HttpCaches{fileCache, nullptr, nullptr}};
+  ProtocolLayer sut{tcpSender, routerFactory};
+  EXPECT_CALL(tcpSender, Shape(_)).Times(2);
+  EXPECT_CALL(tcpSender, Closed()).WillRepeatedly(Return(false));
+  {
+    InSequence sequence;
+    EXPECT_CALL(tcpSender, Cork());
+    EXPECT_CALL(tcpSender, Send(An<std::string_view>()))
+        .WillOnce([](std::string_view resp) { ASSERT_TRUE(resp.ends_with("hello a")); })
+        .WillOnce([](std::string_view resp) { ASSERT_TRUE(resp.ends_with("hello b")); });
+    EXPECT_CALL(tcpSender, Uncork());
+  }
+  sut.Process("GET /hello HTTP/1.1\r\nHost: a\r\n\r\nGET /hello HTTP/1.1\r\nHost: b\r\n\r\n");
+}
+
+class RecordingStreamProcessor : public HttpStreamProcessor {
+public:
+  RecordingStreamProcessor(HttpSender& sender, std::string& events) : sender{sender}, events{events} {
+  }
+
+  void Process(HttpRequest&& req) override {
+    events += "[" + std::string{req.uri.Path()} + "]";
+  }
+
+  void Process(HttpRequestBody&& body) override {
+    events += body.data;
+    if (body.last) {
+      events += "[last]";
+      HttpResponse resp;
+      resp.status = HttpStatus::OK;
+      sender.Send(std::move(resp));
+    }
+  }
+
+private:
+  HttpSender& sender;
+  std::string& events;
+};
+
+class RecordingStreamProcessorFactory : public HttpStreamProcessorFactory {
+public:
+  explicit RecordingStreamProcessorFactory(std::string& events) : events{events} {
+  }
+
+  std::unique_ptr<HttpStreamProcessor> Create(HttpSender& sender) const override {
+    return std::make_unique<RecordingStreamProcessor>(sender, events);
+  }
+
+private:
+  std::string& events;
+};
+
+class RouterTest : public Test {
+protected:
+  RouterTest() {
+    ON_CALL(tcpSender, Send(An<std::string_view>())).WillByDefault([this](std::string_view data) {
+      output += data;
+    });
+    ON_CALL(tcpSender, Send(An<std::string_view>(), An<std::string_view>()))
+        .WillByDefault([this](std::string_view header, std::string_view payload) {
+          output.append(header).append(payload);
+        });
+    httpMapping.Add(HttpMethod::GET, "^/hello$", std::make_unique<HelloProcessorFactory>());
+    httpMapping.Add(HttpMethod::POST, "^/stream$", std::make_unique<RecordingStreamProcessorFactory>(events));
+    httpMapping.Add(HttpMethod::POST, "^/buffered$", std::make_unique<HelloProcessorFactory>());
+  }
+
+  void Receive(std::string payload) {
+    while (sut->TryProcess(payload)) {
+    }
+  }
+
+  NiceMock<TcpSenderMock> tcpSender;
+  HttpRouteMapping httpMapping;
+  WebsocketRouteMapping websocketMapping;
+  HttpLimits limits;
+  HttpRejections rejections;
+  FileCache fileCache;
+  ConcreteRouterFactory routerFactory{
+      httpMapping, websocketMapping, limits, rejections, HttpCaches{fileCache, nullptr, nullptr}};
+  std::unique_ptr<Router> sut{routerFactory.Create(tcpSender)};
+  std::string output;
+  std::string events;
+};
+
+TEST_F(RouterTest, whenStreamRouteReceivesChunkedBody_itShouldPassEachPieceAsItArrives) {
+  Receive("POST /stream HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel");
+  ASSERT_EQ(events, "[/stream]hel");
+  Receive("lo\r\n6\r\n world\r\n0\r\n\r\nGET /hello HTTP/1.1\r\nHost: next\r\n\r\n");
+  ASSERT_EQ(events, "[/stream]hello world[last]");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_THAT(output, EndsWith("hello next"));
+}
+
+TEST_F(RouterTest, whenRequestExpectsContinue_itShouldAnswerContinueBeforeTheBody) {
+  Receive("POST /stream HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 4\r\n\r\n");
+  ASSERT_EQ(output, "HTTP/1.1 100 Continue\r\n\r\n");
+  ASSERT_EQ(events, "[/stream]");
+  Receive("body");
+  ASSERT_EQ(events, "[/stream]body[last]");
+  ASSERT_THAT(output, HasSubstr("\r\n\r\nHTTP/1.1 200 OK\r\n"));
+}
+
+TEST_F(RouterTest, whenUnroutedRequestExpectsContinue_itShouldCloseAndIgnorePipelinedRequests) {
+  EXPECT_CALL(tcpSender, Close());
+  Receive(
+      "POST /missing HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 4\r\n\r\nbody"
+      "GET /hello HTTP/1.1\r\nHost: late\r\n\r\n");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 404 Not Found\r\n"));
+  ASSERT_THAT(output, Not(HasSubstr("hello late")));
+  Receive("GET /hello HTTP/1.1\r\nHost: later\r\n\r\n");
+  ASSERT_THAT(output, Not(HasSubstr("hello later")));
+}
+
+
+TEST_F(RouterTest, whenTheTransferCodingCannotFrameTheBody_itShouldRejectAndClose) {
+  EXPECT_CALL(tcpSender, Close());
+  Receive(
+      "POST /stream HTTP/1.1\r\nTransfer-Encoding: gzip\r\nContent-Length: 4\r\n\r\nbody"
+      "GET /hello HTTP/1.1\r\nHost: smuggled\r\n\r\n");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 400 Bad Request\r\n"));
+  ASSERT_THAT(output, HasSubstr("Connection: close\r\n"));
+  ASSERT_THAT(output, Not(HasSubstr("hello smuggled")));
+  ASSERT_EQ(events, "");
+  ASSERT_EQ(rejections.malformed, 1);
+}
+
+TEST_F(RouterTest, whenStreamRouteReceivesMoreThanTheBodyLimit_itShouldPassTheWholeBody) {
+  limits.maxBodyLength = 4;
+  Receive("POST /stream HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world");
+  Receive("POST /stream HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+  ASSERT_EQ(events, "[/stream]hello world[last][/stream]hello[last]");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(rejections.bodyTooLarge, 0);
+}
+
+TEST_F(RouterTest, whenBufferedRouteExpectsMoreThanTheBodyLimit_itShouldRejectWithoutContinue) {
+  limits.maxBodyLength = 4;
+  EXPECT_CALL(tcpSender, Close());
+  Receive(
+      "POST /buffered HTTP/1.1\r\nHost: a\r\nExpect: 100-continue\r\nContent-Length: 11\r\n\r\n"
+      "GET /hello HTTP/1.1\r\nHost: late\r\n\r\n");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 413 Payload Too Large\r\n"));
+  ASSERT_THAT(output, Not(HasSubstr("100 Continue")));
+  ASSERT_THAT(output, Not(HasSubstr("hello")));
+  ASSERT_EQ(rejections.bodyTooLarge, 1);
+}
+
+TEST_F(RouterTest, whenBufferedRouteReceivesAChunkedBodyOverTheLimit_itShouldReject) {
+  limits.maxBodyLength = 4;
+  EXPECT_CALL(tcpSender, Close());
+  Receive("POST /buffered HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n");
+  ASSERT_EQ(output, "");
+  Receive("3\r\ndef\r\n0\r\n\r\n");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 413 Payload Too Large\r\n"));
+  ASSERT_THAT(output, Not(HasSubstr("hello")));
+  ASSERT_EQ(rejections.bodyTooLarge, 1);
+}
+
+
+class ScriptedProcessor : public HttpProcessor {
+public:
+  ScriptedProcessor(HttpSender& sender, const std::function<void(HttpSender&)>& script)
+      : sender{sender}, script{script} {
+  }
+
+  void Process(HttpRequest&&) override {
+    script(sender);
+  }
+
+private:
+  HttpSender& sender;
+  const std::function<void(HttpSender&)>& script;
+};
+
+class ScriptedProcessorFactory : public HttpProcessorFactory {
+public:
+  explicit ScriptedProcessorFactory(std::function<void(HttpSender&)> script) : script{std::move(script)} {
+  }
+
+  std::unique_ptr<HttpProcessor> Create(HttpSender& sender) const override {
+    return std::make_unique<ScriptedProcessor>(sender, script);
+  }
+
+private:
+  std::function<void(HttpSender&)> script;
+};
+
+class Http2ConnectionTest : public Test {
+protected:
+  Http2ConnectionTest() {
+    std::filesystem::create_directories(dir);
+    std::ofstream{dir / "file.txt"} << "0123456789";
+    root = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    ON_CALL(tcpSender, Send(An<std::string_view>())).WillByDefault([this](std::string_view data) {
+      output += data;
+    });
+    ON_CALL(tcpSender, Send(An<std::string_view>(), An<std::string_view>()))
+        .WillByDefault([this](std::string_view header, std::string_view payload) {
+          output.append(header).append(payload);
+        });
+    ON_CALL(tcpSender, Send(An<std::shared_ptr<const os::File>>(), _, _))
+        .WillByDefault([this](auto file, size_t offset, size_t size) {
+          output += file->Read().value_or("").substr(offset, size);
+        });
+    mapping.Add(HttpMethod::GET, "^/hello$", std::make_unique<HelloProcessorFactory>());
+    mapping.Add(HttpMethod::GET, "^/chunked$", std::make_unique<ScriptedProcessorFactory>([](HttpSender& sender) {
+      sender.Send(ChunkedHeaderHttpResponse{});
+      sender.Send(ChunkedDataHttpResponse{"hel"});
+      sender.Send(ChunkedDataHttpResponse{"lo"});
+      sender.Send(ChunkedDataHttpResponse{});
+    }));
+    mapping.Add(HttpMethod::GET, "^/file$", std::make_unique<ScriptedProcessorFactory>([this](HttpSender& sender) {
+      FileHttpResponse resp;
+      resp.path = "file.txt";
+      resp.root = root;
+      sender.Send(std::move(resp));
+    }));
+    mapping.Add(HttpMethod::GET, "^/bogus$", std::make_unique<ScriptedProcessorFactory>([](HttpSender& sender) {
+      HttpResponse resp;
+      resp.status = HttpStatus::OK;
+      resp.headers.emplace("Content-Length", "4x");
+      resp.body = "body";
+      sender.Send(std::move(resp));
+    }));
+    HttpRouteOptions shaped;
+    shaped.bandwidth.bytesPerSecond = 1024;
+    mapping.Add(HttpMethod::GET, "^/shaped$", std::make_unique<HelloProcessorFactory>(), shaped);
+    mapping.Add(HttpMethod::POST, "^/stream$", std::make_unique<RecordingStreamProcessorFactory>(events));
+    mapping.Add(HttpMethod::POST, "^/buffered$", std::make_unique<HelloProcessorFactory>());
+  }
+
+  ~Http2ConnectionTest() override {
+    close(root);
+    std::filesystem::remove_all(dir);
+  }
+
+  // Sends the preface with the given settings and drops the handshake frames.
+  void Start(std::string_view settings = {}) {
+    Receive(std::string{http2Preface} + Http2Frame(4, 0, 0, settings));
+    Frames();
+  }
+
+  void Receive(std::string payload) {
+    while (sut.TryProcess(payload)) {
+    }
+  }
+
+  std::string Request(std::uint32_t id, std::string_view method, std::string_view path, std::uint8_t flags = 5,
+      std::vector<HttpHeader> headers = {}) {
+    headers.insert(headers.begin(),
+        {{":method", std::string{method}}, {":scheme", "http"}, {":path", std::string{path}}, {":authority", "h2"}});
+    std::string block;
+    encoder.Encode(headers, block);
+    return Http2Frame(1, flags, id, block);
+  }
+
+  std::vector<std::string> Frames() {
+    auto frames = ParseHttp2Frames(output, decoder);
+    output.clear();
+    return frames;
+  }
+
+  static std::string Uint32(std::uint32_t value) {
+    return {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8),
+        static_cast<char>(value)};
+  }
+
+  static std::string Setting(std::uint16_t id, std::uint32_t value) {
+    return std::string{static_cast<char>(id >> 8), static_cast<char>(id)} + Uint32(value);
+  }
+
+  const std::filesystem::path dir{std::filesystem::temp_directory_path() / "net_http2_connection_test"};
+  int root{-1};
+  NiceMock<TcpSenderMock> tcpSender;
+  HttpRouteMapping mapping;
+  HttpLimits limits;
+  HttpRejections rejections;
+  FileCache fileCache;
+  Http2Layer sut{tcpSender, mapping, limits, rejections, HttpCaches{fileCache, nullptr, nullptr}};
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+  std::string output;
+  std::string events;
+};
+
+TEST_F(Http2ConnectionTest, whenTheStreamWindowIsExhausted_itShouldHoldDataUntilWindowUpdate) {
+  Start(Setting(4, 4));
+  Receive(Request(1, "GET", "/hello"));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"1:4:1::status: 200\ncontent-length: 8\n", "0:0:1:hell"}));
+  Receive(Http2Frame(8, 0, 1, Uint32(2)));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"0:0:1:o "}));
+  Receive(Http2Frame(8, 0, 1, Uint32(100)));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"0:1:1:h2"}));
+}
+
+TEST_F(Http2ConnectionTest, whenReceivingHalfTheStreamWindow_itShouldReplenishIt) {
+  Start();
+  Receive(Request(1, "POST", "/stream", 4));
+  const std::string chunk(16384, 'd');
+  for (int i = 0; i < 32; i++) {
+    Receive(Http2Frame(0, 0, 1, chunk));
+  }
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"8:0:1:524288"}));
+  ASSERT_EQ(events.size(), std::string{"[/stream]"}.size() + 32 * chunk.size());
+}
+
+TEST_F(Http2ConnectionTest, whenSeveralStreamsBecomeSendable_itShouldServeTheMostUrgentFirst) {
+  Start(Setting(4, 0));
+  Receive(Request(1, "GET", "/hello", 5, {{"priority", "u=5"}}));
+  Receive(Request(3, "GET", "/hello", 5, {{"priority", "u=1"}}));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"1:4:1::status: 200\ncontent-length: 8\n",
+                          "1:4:3::status: 200\ncontent-length: 8\n"}));
+  Receive(Http2Frame(4, 0, 0, Setting(4, 100)));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"4:1:0", "0:1:3:hello h2", "0:1:1:hello h2"}));
+}
+
+TEST_F(Http2ConnectionTest, whenTheClientResetsAStream_itShouldDropItsQueuedData) {
+  Start(Setting(4, 0));
+  Receive(Request(1, "GET", "/hello"));
+  Frames();
+  Receive(Http2Frame(3, 0, 1, Uint32(8)) + Http2Frame(8, 0, 1, Uint32(100)) + Http2Frame(4, 0, 0, Setting(4, 100)));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"4:1:0"}));
+}
+
+TEST_F(Http2ConnectionTest, whenTheClientGoesAway_itShouldCloseOnceTheOpenStreamsFinish) {
+  Start(Setting(4, 0));
+  Receive(Request(1, "GET", "/hello"));
+  EXPECT_CALL(tcpSender, Close()).Times(0);
+  Receive(Http2Frame(7, 0, 0, Uint32(0) + Uint32(0)));
+  Mock::VerifyAndClearExpectations(&tcpSender);
+  EXPECT_CALL(tcpSender, Close());
+  Receive(Http2Frame(8, 0, 1, Uint32(100)));
+  ASSERT_THAT(Frames(), Contains("0:1:1:hello h2"));
+}
+
+TEST_F(Http2ConnectionTest, whenTheClientBreaksTheProtocol_itShouldGoAway) {
+  Start();
+  Receive(Request(1, "GET", "/hello"));
+  Frames();
+  EXPECT_CALL(tcpSender, Close());
+  Receive(Http2Frame(8, 0, 0, Uint32(0)) + Request(3, "GET", "/hello"));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"7:0:0:1:1"}));
+}
+
+TEST_F(Http2ConnectionTest, whenTheClientKeepsResettingStreams_itShouldGoAwayWithEnhanceYourCalm) {
+  Start();
+  EXPECT_CALL(tcpSender, Close()).Times(0);
+  std::uint32_t id = 1;
+  for (int i = 0; i < 100; i++, id += 2) {
+    Receive(Request(id, "POST", "/stream", 4) + Http2Frame(3, 0, id, Uint32(8)));
+  }
+  ASSERT_THAT(Frames(), Not(Contains(StartsWith("7:"))));
+  Mock::VerifyAndClearExpectations(&tcpSender);
+  EXPECT_CALL(tcpSender, Close());
+  Receive(Request(id, "POST", "/stream", 4) + Http2Frame(3, 0, id, Uint32(8)));
+  ASSERT_THAT(Frames(), Contains("7:0:0:" + std::to_string(id) + ":11"));
+}
+
+TEST_F(Http2ConnectionTest, whenAHeaderBlockSpansTooManyFrames_itShouldGoAwayWithEnhanceYourCalm) {
+  Start();
+  std::string split = Request(1, "GET", "/hello", 1);
+  std::string flood = Request(3, "GET", "/hello", 1);
+  for (int i = 0; i < 32; i++) {
+    split += i < 30 ? Http2Frame(9, 0, 1, "") : "";
+    flood += Http2Frame(9, 0, 3, "");
+  }
+  Receive(split + Http2Frame(9, 4, 1, ""));
+  ASSERT_THAT(Frames(), Contains("0:1:1:hello h2"));
+  EXPECT_CALL(tcpSender, Close());
+  Receive(flood);
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"7:0:0:1:11"}));
+}
+
+TEST_F(Http2ConnectionTest, whenTheBodyExceedsTheLimit_itShouldOnlyRejectBufferedRoutes) {
+  limits.maxBodyLength = 4;
+  Start();
+  Receive(Request(1, "POST", "/stream", 4) + Http2Frame(0, 1, 1, "hello world"));
+  ASSERT_EQ(events, "[/stream]hello world[last]");
+  ASSERT_THAT(Frames(), Contains("1:5:1::status: 200\ncontent-length: 0\n"));
+  Receive(Request(3, "POST", "/buffered", 4, {{"content-length", "11"}}) + Http2Frame(0, 1, 3, "hello world"));
+  ASSERT_THAT(Frames(), Contains(StartsWith("1:5:3::status: 413\n")));
+  Receive(Request(5, "POST", "/buffered", 4) + Http2Frame(0, 0, 5, "hello") + Http2Frame(0, 1, 5, " world"));
+  ASSERT_THAT(Frames(), Contains(StartsWith("1:5:5::status: 413\n")));
+  ASSERT_EQ(rejections.bodyTooLarge, 2);
+}
+
+TEST_F(Http2ConnectionTest, whenAnsweringChunkedOrFileResponses_itShouldReframeThemAsData) {
+  Start();
+  Receive(Request(1, "GET", "/chunked"));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"1:4:1::status: 200\n", "0:0:1:hel", "0:0:1:lo", "0:1:1:"}));
+  Receive(Request(3, "GET", "/file"));
+  auto frames = Frames();
+  ASSERT_EQ(frames.size(), 2);
+  ASSERT_THAT(frames[0], AllOf(StartsWith("1:4:3::status: 200\n"), HasSubstr("content-length: 10\n")));
+  ASSERT_EQ(frames[1], "0:1:3:0123456789");
+}
+
+TEST_F(Http2ConnectionTest, whenTheResponseCannotBeFramed_itShouldResetTheStream) {
+  Start();
+  Receive(Request(1, "GET", "/bogus"));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"3:0:1:2"}));
+}
+
+TEST_F(Http2ConnectionTest, whenTheRouteIsShaped_itShouldAskForHttp1) {
+  Start();
+  EXPECT_CALL(tcpSender, Shape(_)).Times(0);
+  Receive(Request(1, "GET", "/shaped"));
+  Receive(Request(3, "GET", "/hello"));
+  ASSERT_EQ(Frames(), (std::vector<std::string>{"3:0:1:13", "1:4:3::status: 200\ncontent-length: 8\n",
+                          "0:1:3:hello h2"}));
+}
+
+TEST_F(RouterTest, whenUpgradingToH2c_itShouldAnswerTheRequestOnStreamOne) {
+  Receive(
+      "GET /hello HTTP/1.1\r\nHost: up\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+      "HTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n");
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 101 Switching Protocols\r\n"));
+  const auto head = output.find("\r\n\r\n") + 4;
+  HpackDecoder decoder;
+  ASSERT_THAT(ParseHttp2Frames(std::string_view{output}.substr(head), decoder),
+      IsSupersetOf({"1:4:1::status: 200\ncontent-length: 8\n", "0:1:1:hello up"}));
+  output.clear();
+  Receive(std::string{http2Preface} + Http2Frame(4, 0, 0, "") + Http2Frame(6, 0, 0, "pingpong"));
+  ASSERT_EQ(ParseHttp2Frames(output, decoder), (std::vector<std::string>{"4:1:0", "6:1:0:pingpong"}));
+}
+
+TEST(TcpSenderTest, whenTheFileShrinksWhileSending_itShouldStopAndDropTheConnection) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  const std::string path = testing::TempDir() + "tcp_sender_shrunk_file";
+  std::ofstream{path} << std::string(100, 'x');
+  NiceMock<TcpSenderSupervisorMock> supervisor;
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Send(os::File{path});
+  std::filesystem::resize_file(path, 4);
+  EXPECT_CALL(supervisor, MarkSenderPending(_)).Times(0);
+  sut.SendBuffered();
+  char received[128];
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), 4);
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), 0);
+  ASSERT_EQ(sut.Backlog(), 0);
+  ASSERT_EQ(sut.BufferedBytes(), 0);
+  close(fds[1]);
+  std::filesystem::remove(path);
+}
+
+
+class HttpSenderTest : public Test {
+protected:
+  HttpSenderTest() {
+    std::filesystem::create_directories(dir);
+    std::ofstream{dir / "file.txt"} << content;
+    root = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    ON_CALL(tcpSender, Send(An<std::string_view>())).WillByDefault([this](std::string_view data) {
+      output += data;
+    });
+    ON_CALL(tcpSender, Send(An<std::shared_ptr<const os::File>>())).WillByDefault([this](auto file) {
+      output += file->Read().value_or("");
+    });
+    ON_CALL(tcpSender, Send(An<std::shared_ptr<const os::File>>(), _, _))
+        .WillByDefault([this](auto file, size_t offset, size_t size) {
+          output += file->Read().value_or("").substr(offset, size);
+        });
+  }
+
+  ~HttpSenderTest() override {
+    close(root);
+    std::filesystem::remove_all(dir);
+  }
+
+  void Get(HttpHeaders headers, HttpMethod method = HttpMethod::GET) {
+    HttpRequest req;
+    req.method = method;
+    req.headers = std::move(headers);
+    sut.Prepare(req);
+    FileHttpResponse resp;
+    resp.headers.emplace("Content-Type", "text/plain");
+    resp.path = "file.txt";
+    resp.root = root;
+    sut.Send(std::move(resp));
+  }
+
+  const std::filesystem::path dir{std::filesystem::temp_directory_path() / "net_http_sender_test"};
+  const std::string content{"0123456789"};
+  int root{-1};
+  NiceMock<TcpSenderMock> tcpSender;
+  FileCache fileCache;
+  ConcreteHttpSender sut{tcpSender, HttpCaches{fileCache, nullptr, nullptr}};
+  std::string output;
+};
+
+TEST_F(HttpSenderTest, whenRequestedASingleRange_itShouldAnswerPartialContent) {
+  Get({{"range", "bytes=2-4"}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 206 Partial Content\r\n"));
+  ASSERT_THAT(output, HasSubstr("Content-Type: text/plain\r\n"));
+  ASSERT_THAT(output, HasSubstr("Content-Range: bytes 2-4/10\r\n"));
+  ASSERT_THAT(output, EndsWith("Content-Length: 3\r\n\r\n234"));
+}
+
+TEST_F(HttpSenderTest, whenNoRequestedRangeIsSatisfiable_itShouldAnswerRangeNotSatisfiable) {
+  Get({{"range", "bytes=10-20"}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 416 Range Not Satisfiable\r\n"));
+  ASSERT_THAT(output, HasSubstr("Content-Range: bytes */10\r\n"));
+  ASSERT_THAT(output, HasSubstr("Content-Length: 0\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n"));
+}
+
+TEST_F(HttpSenderTest, whenRequestedSeveralRanges_itShouldAnswerMultipartByteranges) {
+  Get({{"range", "bytes=0-1, -2"}});
+  const std::string body =
+      "--BYTERANGES\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-1/10\r\n\r\n01"
+      "\r\n--BYTERANGES\r\nContent-Type: text/plain\r\nContent-Range: bytes 8-9/10\r\n\r\n89"
+      "\r\n--BYTERANGES--\r\n";
+  ASSERT_EQ(output,
+      "HTTP/1.1 206 Partial Content\r\nContent-Type: multipart/byteranges; boundary=BYTERANGES\r\n"
+      "Content-Length: " +
+          std::to_string(body.size()) + "\r\n\r\n" + body);
+}
+
+TEST_F(HttpSenderTest, whenTheRangeIsMalformedOrStale_itShouldAnswerTheWholeFile) {
+  Get({{"range", "bytes=4-2"}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n" + content));
+  output.clear();
+  Get({{"range", "bytes=0-1"}, {"if-range", "Thu, 01 Jan 1970 00:00:00 GMT"}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n" + content));
+}
+
+
+TEST_F(HttpSenderTest, whenTheEntityTagMatches_itShouldAnswerNotModifiedWithoutBody) {
+  Get({});
+  const auto begin = output.find("ETag: ") + 6;
+  const auto etag = output.substr(begin, output.find("\r\n", begin) - begin);
+  output.clear();
+  Get({{"if-none-match", "\"other\", " + etag}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 304 Not Modified\r\n"));
+  ASSERT_THAT(output, HasSubstr("ETag: " + etag + "\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n"));
+  ASSERT_THAT(output, Not(HasSubstr(content)));
+  output.clear();
+  Get({{"if-none-match", "\"other\""}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+}
+
+TEST_F(HttpSenderTest, whenNotModifiedSince_itShouldAnswerNotModifiedWithoutBody) {
+  Get({{"if-modified-since", "Fri, 01 Jan 2100 00:00:00 GMT"}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 304 Not Modified\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n"));
+  ASSERT_THAT(output, Not(HasSubstr(content)));
+  output.clear();
+  Get({{"if-modified-since", "Thu, 01 Jan 1970 00:00:00 GMT"}});
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_THAT(output, EndsWith(content));
+}
+
+TEST_F(HttpSenderTest, whenAnsweringHead_itShouldSendTheHeadersWithoutTheBody) {
+  Get({}, HttpMethod::HEAD);
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_THAT(output, HasSubstr("Content-Length: 10\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n"));
+  output.clear();
+  HttpResponse resp;
+  resp.status = HttpStatus::OK;
+  resp.body = "body";
+  sut.Send(std::move(resp));
+  ASSERT_THAT(output, HasSubstr("Content-Length: 4\r\n"));
+  ASSERT_THAT(output, EndsWith("\r\n\r\n"));
+}
+
+
+TEST(HttpContentCodingTest, whenMatchingAcceptEncoding_itShouldHonourQValuesAndWildcards) {
+  ASSERT_TRUE(AcceptsEncoding("gzip, deflate", "gzip"));
+  ASSERT_TRUE(AcceptsEncoding("GZIP", "gzip"));
+  ASSERT_FALSE(AcceptsEncoding("deflate", "gzip"));
+  ASSERT_FALSE(AcceptsEncoding("", "gzip"));
+  ASSERT_TRUE(AcceptsEncoding("gzip;q=0.5", "gzip"));
+  ASSERT_TRUE(AcceptsEncoding("gzip; Q=0.001", "gzip"));
+  ASSERT_FALSE(AcceptsEncoding("gzip;q=0", "gzip"));
+  ASSERT_FALSE(AcceptsEncoding("gzip;q=0.000", "gzip"));
+  ASSERT_FALSE(AcceptsEncoding("gzip;level=1;q=0", "gzip"));
+  ASSERT_FALSE(AcceptsEncoding("identity;q=0", "identity"));
+  ASSERT_FALSE(AcceptsEncoding("identity;q=0", "gzip"));
+  ASSERT_TRUE(AcceptsEncoding("identity;q=0, *", "br"));
+  ASSERT_TRUE(AcceptsEncoding("*", "br"));
+  ASSERT_FALSE(AcceptsEncoding("*;q=0", "br"));
+  ASSERT_FALSE(AcceptsEncoding("*, br;q=0", "br"));
+  ASSERT_TRUE(AcceptsEncoding("*;q=0, br", "br"));
+  ASSERT_TRUE(AcceptsEncoding("br;q=0, *", "gzip"));
+}
+
+TEST(HttpContentCodingTest, whenGuessingMimeTypes_itShouldMatchTheExtension) {
+  ASSERT_EQ(MimeTypeOf("index.html"), "text/html");
+  ASSERT_EQ(MimeTypeOf("dir/app.mjs"), "text/javascript");
+  ASSERT_EQ(MimeTypeOf("font.woff2"), "font/woff2");
+  ASSERT_EQ(MimeTypeOf("font.woff"), "font/woff");
+  ASSERT_EQ(MimeTypeOf("image.jpeg"), "image/jpeg");
+  ASSERT_EQ(MimeTypeOf("archive.tar.zip"), "application/zip");
+  ASSERT_EQ(MimeTypeOf("README"), "text/plain");
+  ASSERT_EQ(MimeTypeOf("html"), "text/plain");
+}
+
+TEST_F(HttpSenderTest, whenServingPrecompressedFiles_itShouldPreferBrotliThenGzipAmongSiblings) {
+  auto get = [this](std::string acceptEncoding) {
+    output.clear();
+    HttpRequest req;
+    req.method = HttpMethod::GET;
+    if (not acceptEncoding.empty()) {
+      req.headers.emplace("accept-encoding", std::move(acceptEncoding));
+    }
+    sut.Prepare(req);
+    FileHttpResponse resp;
+    resp.path = "file.txt";
+    resp.root = root;
+    resp.precompressed = true;
+    sut.Send(std::move(resp));
+    return output;
+  };
+  std::ofstream{dir / "file.txt.gz"} << "gz";
+  std::ofstream{dir / "file.txt.br"} << "br";
+  ASSERT_THAT(get("gzip, br"), AllOf(HasSubstr("Content-Encoding: br\r\n"), EndsWith("\r\n\r\nbr")));
+  ASSERT_THAT(get("gzip, br;q=0"), AllOf(HasSubstr("Content-Encoding: gzip\r\n"), EndsWith("\r\n\r\ngz")));
+  ASSERT_THAT(get("*"), AllOf(HasSubstr("Content-Encoding: br\r\n"), EndsWith("\r\n\r\nbr")));
+  ASSERT_THAT(get("identity;q=0"), AllOf(Not(HasSubstr("Content-Encoding")), EndsWith("\r\n\r\n" + content)));
+  ASSERT_THAT(get(""), AllOf(HasSubstr("Vary: Accept-Encoding\r\n"), EndsWith("\r\n\r\n" + content)));
+}
+
+
+TEST(CompressionCacheTest, whenCompressingResponses_itShouldOnlyMemoiseRoutesMarkedCacheable) {
+  NiceMock<TcpSenderMock> tcpSender;
+  FileCache fileCache;
+  CompressionCache compressionCache;
+  ConcreteHttpSender sut{tcpSender, HttpCaches{fileCache, nullptr, &compressionCache}};
+  auto send = [&sut](bool cacheable) {
+    HttpRequest req;
+    req.method = HttpMethod::GET;
+    req.headers.emplace("accept-encoding", "gzip");
+    sut.Prepare(req);
+    HttpRouteOptions options;
+    options.compression = {.enabled = true, .minLength = 16, .cacheable = cacheable};
+    sut.Configure(options);
+    HttpResponse resp;
+    resp.status = HttpStatus::OK;
+    resp.body = std::string(1024, 'a');
+    sut.Send(std::move(resp));
+  };
+  EXPECT_CALL(tcpSender, Send(An<std::string_view>()))
+      .Times(2)
+      .WillRepeatedly([](std::string_view resp) { ASSERT_THAT(resp, HasSubstr("Content-Encoding: gzip\r\n")); });
+  send(false);
+  ASSERT_EQ(compressionCache.Size(), 0);
+  send(true);
+  ASSERT_GT(compressionCache.Size(), 1024);
+}
+
+
+TEST(HttpContentCodingTest, whenAnsweringAPost_itShouldCompressTheBody) {
+  NiceMock<TcpSenderMock> tcpSender;
+  FileCache fileCache;
+  ConcreteHttpSender sut{tcpSender, HttpCaches{fileCache, nullptr, nullptr}};
+  HttpRequest req;
+  req.method = HttpMethod::POST;
+  req.headers.emplace("accept-encoding", "gzip");
+  sut.Prepare(req);
+  HttpRouteOptions options;
+  options.compression = {.enabled = true, .minLength = 16};
+  sut.Configure(options);
+  std::string output;
+  EXPECT_CALL(tcpSender, Send(An<std::string_view>())).WillOnce([&output](std::string_view resp) { output = resp; });
+  HttpResponse resp;
+  resp.status = HttpStatus::OK;
+  resp.body = std::string(1024, 'a');
+  sut.Send(std::move(resp));
+  ASSERT_THAT(output, StartsWith("HTTP/1.1 200 OK\r\n"));
+  ASSERT_THAT(output, HasSubstr("Content-Encoding: gzip\r\n"));
+  const auto body = output.substr(output.find("\r\n\r\n") + 4);
+  ASSERT_EQ(body.substr(0, 2), "\x1f\x8b");
+  ASSERT_LT(body.size(), 1024);
+}
+
+
+TEST(FileCacheTest, whenTheRootIsMissing_itShouldNotOpenPathsRelativeToTheWorkingDirectory) {
+  const auto path = std::filesystem::current_path() / "file_cache_relative_test";
+  std::ofstream{path} << "cwd";
+  FileCache sut;
+  ASSERT_EQ(sut.Get(-1, "file_cache_relative_test"), nullptr);
+  ASSERT_NE(sut.Get(-1, path.string()), nullptr);
+  std::filesystem::remove(path);
+}
+
+TEST(FileCacheTest, whenASymlinkLeavesTheRoot_itShouldNeitherOpenNorStatItsTarget) {
+  const auto dir = std::filesystem::temp_directory_path() / "net_http_file_cache_root";
+  const auto outside = std::filesystem::temp_directory_path() / "net_http_file_cache_outside";
+  std::filesystem::create_directories(dir);
+  std::ofstream{dir / "inside"} << "inside";
+  std::ofstream{outside} << "outside";
+  std::filesystem::create_symlink(outside, dir / "link");
+  const int root = open(dir.c_str(), O_PATH | O_DIRECTORY);
+  ASSERT_TRUE(os::Status(root, "inside").has_value());
+  ASSERT_EQ(os::Status(root, "inside")->size, 6);
+  ASSERT_FALSE(os::Status(root, "link").has_value());
+  ASSERT_FALSE(os::Status(root, "../net_http_file_cache_outside").has_value());
+  FileCache sut{FileCacheOptions{.capacity = 4, .validity = std::chrono::milliseconds{0}}};
+  ASSERT_NE(sut.Get(root, "inside"), nullptr);
+  ASSERT_EQ(sut.Get(root, "link"), nullptr);
+  ASSERT_EQ(sut.Get(root, "link"), nullptr);
+  close(root);
+  std::filesystem::remove_all(dir);
+  std::filesystem::remove(outside);
+}
+
+
+TEST(TcpSenderTest, whenOnlyPartOfTheFileIsCached_itShouldSendThatPartAndResumeAfterPrefetching) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  const auto path = std::filesystem::current_path() / "tcp_sender_cold_file";
+  const std::string content(2 << 20, 'x');
+  std::ofstream{path} << content;
+  const int reader = open(path.c_str(), O_RDONLY);
+  fdatasync(reader);
+  posix_fadvise(reader, 0, 0, POSIX_FADV_DONTNEED);
+  posix_fadvise(reader, 0, 0, POSIX_FADV_RANDOM);
+  char page[4096];
+  ASSERT_EQ(pread(reader, page, sizeof page, 0), 4096);
+  NiceMock<TcpSenderSupervisorMock> supervisor;
+  std::atomic<int> resumed{0};
+  ON_CALL(supervisor, MarkSenderPending(_)).WillByDefault([&resumed](int) { resumed++; });
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Send(os::File{path.string()});
+  resumed = 0;
+  sut.SendBuffered();
+  std::string received(content.size(), '\0');
+  ASSERT_EQ(recv(fds[1], received.data(), received.size(), MSG_DONTWAIT), 4096);
+  for (int i = 0; i < 500 and resumed == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  ASSERT_GT(resumed, 0);
+  size_t total = 4096;
+  for (int i = 0; i < 10000 and total < content.size(); i++) {
+    sut.SendBuffered();
+    ssize_t n = recv(fds[1], received.data() + total, received.size() - total, MSG_DONTWAIT);
+    total += std::max<ssize_t>(n, 0);
+    if (n <= 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+  }
+  ASSERT_EQ(total, content.size());
+  ASSERT_EQ(received, content);
+  close(reader);
+  close(fds[1]);
+  std::filesystem::remove(path);
+}
+
+
+TEST(TcpSenderTest, whenEncryptingAPartlyCachedFile_itShouldPrefetchInsteadOfBlockingOnTheRead) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  const auto path = std::filesystem::current_path() / "tcp_sender_cold_encrypted_file";
+  const std::string content(2 << 20, 'x');
+  std::ofstream{path} << content;
+  const int reader = open(path.c_str(), O_RDONLY);
+  fdatasync(reader);
+  posix_fadvise(reader, 0, 0, POSIX_FADV_DONTNEED);
+  posix_fadvise(reader, 0, 0, POSIX_FADV_RANDOM);
+  char page[4096];
+  ASSERT_EQ(pread(reader, page, sizeof page, 0), 4096);
+  NiceMock<TcpSenderSupervisorMock> supervisor;
+  std::atomic<int> resumed{0};
+  ON_CALL(supervisor, MarkSenderPending(_)).WillByDefault([&resumed](int) { resumed++; });
+  NiceMock<TlsSessionMock> tls;
+  std::string written;
+  ON_CALL(tls, KernelSend()).WillByDefault(Return(false));
+  ON_CALL(tls, Flush()).WillByDefault(Return(true));
+  ON_CALL(tls, Write(_)).WillByDefault([&written](std::string_view data) { written.append(data); });
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics, &tls};
+  sut.Send(os::File{path.string()});
+  resumed = 0;
+  sut.SendBuffered();
+  ASSERT_EQ(written.size(), 4096);
+  for (int i = 0; i < 500 and resumed == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  ASSERT_GT(resumed, 0);
+  for (int i = 0; i < 10000 and written.size() < content.size(); i++) {
+    const size_t before = written.size();
+    sut.SendBuffered();
+    if (written.size() == before) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+  }
+  ASSERT_EQ(written, content);
+  ASSERT_EQ(statistics.bulkBytes, content.size());
+  close(reader);
+  close(fds[1]);
+  std::filesystem::remove(path);
+}
+
+
+class RegisteringTcpProcessor : public TcpProcessor {
+public:
+  RegisteringTcpProcessor(TcpSender& sender, std::mutex& peersMut, std::map<std::string, TcpSender*>& peers)
+      : sender{sender}, peersMut{peersMut}, peers{peers} {
+  }
+
+  void Process(std::string_view data) override {
+    std::lock_guard lock{peersMut};
+    peers.emplace(data, &sender);
+  }
+
+  bool Process(TcpReceiver&) override {
+    return false;
+  }
+
+private:
+  TcpSender& sender;
+  std::mutex& peersMut;
+  std::map<std::string, TcpSender*>& peers;
+};
+
+class RegisteringTcpProcessorFactory : public TcpProcessorFactory {
+public:
+  std::unique_ptr<TcpProcessor> Create(TcpSender& sender) const override {
+    return std::make_unique<RegisteringTcpProcessor>(sender, peersMut, peers);
+  }
+
+  TcpSender* Find(const std::string& name) const {
+    std::lock_guard lock{peersMut};
+    auto it = peers.find(name);
+    return it == peers.end() ? nullptr : it->second;
+  }
+
+  mutable std::mutex peersMut;
+  mutable std::map<std::string, TcpSender*> peers;
+};
+
+template <typename PredicateT>
+bool WaitUntil(PredicateT predicate) {
+  for (int i = 0; i < 500 and not predicate(); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  return predicate();
+}
+
+TEST(TcpLayerTest, whenBulkAndInteractiveSendersAreReadyTogether_itShouldServeTheInteractiveOneFirst) {
+  const auto path = std::filesystem::current_path() / "tcp_layer_bulk_file";
+  std::ofstream{path} << std::string(64 << 10, 'x');
+  RegisteringTcpProcessorFactory factory;
+  TcpStatistics statistics;
+  LoopbackTcpLayer sut{factory, BandwidthLimit{}, statistics};
+  std::thread loop{[&sut] { sut.Start(); }};
+  ASSERT_TRUE(WaitUntil([&sut] { return sut.Port() != 0; }));
+  const int bulk = sut.Connect();
+  const int interactive = sut.Connect();
+  ASSERT_EQ(write(bulk, "bulk", 4), 4);
+  ASSERT_EQ(write(interactive, "interactive", 11), 11);
+  ASSERT_TRUE(WaitUntil([&factory] { return factory.Find("bulk") and factory.Find("interactive"); }));
+  std::mutex servedMut;
+  std::vector<std::string> served;
+  sut.Post([&] {
+    auto serve = [&](const char* name) {
+      return [&, name] {
+        std::lock_guard lock{servedMut};
+        served.emplace_back(name);
+      };
+    };
+    auto* bulkSender = factory.Find("bulk");
+    bulkSender->Send(os::File{path.string()});
+    bulkSender->OnDrain(std::numeric_limits<std::size_t>::max(), serve("bulk"));
+    auto* interactiveSender = factory.Find("interactive");
+    interactiveSender->Send("reply");
+    interactiveSender->OnDrain(std::numeric_limits<std::size_t>::max(), serve("interactive"));
+  });
+  ASSERT_TRUE(WaitUntil([&] {
+    std::lock_guard lock{servedMut};
+    return served.size() == 2;
+  }));
+  sut.Stop();
+  loop.join();
+  ASSERT_EQ(served, (std::vector<std::string>{"interactive", "bulk"}));
+  close(bulk);
+  close(interactive);
+  std::filesystem::remove(path);
+}
+
+
+TEST(TcpSenderTest, whenShapedBelowTheQueuedSize_itShouldThrottleUntilTheTokensRefill) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  StrictMock<TcpSenderSupervisorMock> supervisor;
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Shape(BandwidthLimit{1 << 20, 16 << 10});
+  EXPECT_CALL(supervisor, MarkSenderPending(fds[0]));
+  sut.Send(std::string(32 << 10, 's'));
+  sut.SendBuffered();
+  char received[64 << 10];
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), 16 << 10);
+  Mock::VerifyAndClearExpectations(&supervisor);
+  const std::chrono::nanoseconds quantumDelay = std::chrono::milliseconds{16};
+  EXPECT_CALL(supervisor, UnmarkSenderPending(fds[0]));
+  EXPECT_CALL(supervisor, ResumeSenderAfter(fds[0], AllOf(Gt(quantumDelay / 2), Le(quantumDelay))));
+  sut.SendBuffered();
+  ASSERT_EQ(statistics.throttled, 1);
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), -1);
+  Mock::VerifyAndClearExpectations(&supervisor);
+  std::this_thread::sleep_for(quantumDelay);
+  EXPECT_CALL(supervisor, MarkSenderPending(fds[0]));
+  EXPECT_CALL(supervisor, UnmarkSenderPending(fds[0]));
+  sut.Resume();
+  sut.SendBuffered();
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), 16 << 10);
+  ASSERT_EQ(statistics.throttled, 1);
+  ASSERT_EQ(statistics.interactiveBytes, 32 << 10);
+  close(fds[1]);
+}
+
+TEST(TcpSenderTest, whenTheRouteLimitIsLifted_itShouldFallBackToTheDefaultLimit) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  NiceMock<TcpSenderSupervisorMock> supervisor;
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Shape(BandwidthLimit{1024, 4096});
+  sut.Shape(BandwidthLimit{});
+  EXPECT_CALL(supervisor, ResumeSenderAfter(_, _)).Times(0);
+  sut.Send(std::string(64 << 10, 's'));
+  sut.SendBuffered();
+  char received[128 << 10];
+  ASSERT_EQ(recv(fds[1], received, sizeof received, MSG_DONTWAIT), 64 << 10);
+  ASSERT_EQ(statistics.throttled, 0);
+  close(fds[1]);
+}
+
+
+TEST(TcpSenderTest, whenAShapedSenderHasNothingQueued_itShouldNotThrottle) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  NiceMock<TcpSenderSupervisorMock> supervisor;
+  TcpPrefetcher prefetcher;
+  TcpStatistics statistics;
+  ConcreteTcpSender sut{fds[0], supervisor, prefetcher, BandwidthLimit{}, statistics};
+  sut.Shape(BandwidthLimit{1 << 20, 16 << 10});
+  sut.Send(std::string(16 << 10, 's'));
+  sut.SendBuffered();
+  EXPECT_CALL(supervisor, ResumeSenderAfter(_, _)).Times(0);
+  sut.SendBuffered();
+  ASSERT_EQ(statistics.throttled, 0);
+  close(fds[1]);
+}
+
 }  // namespace network
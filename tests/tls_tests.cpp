@@ -0,0 +1,233 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include "network_mocks.hpp"
+#include "tcp.hpp"
+#include "tls.hpp"
+
+using namespace testing;
+
+namespace {
+
+network::TlsOptions WriteSelfSignedCertificate(const std::filesystem::path& dir) {
+  std::filesystem::create_directories(dir);
+  network::TlsOptions options{(dir / "cert.pem").string(), (dir / "key.pem").string()};
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* cert = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  auto* name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  X509_sign(cert, key, EVP_sha256());
+  FILE* f = fopen(options.certificateFile.c_str(), "w");
+  PEM_write_X509(f, cert);
+  fclose(f);
+  f = fopen(options.privateKeyFile.c_str(), "w");
+  PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+  fclose(f);
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  return options;
+}
+
+bool Wait(int fd, short events) {
+  pollfd p{fd, events, 0};
+  return poll(&p, 1, 100) >= 0;
+}
+
+std::string FetchOverTls(std::uint16_t port, std::string_view request) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  SSL* ssl = SSL_new(ctx);
+  std::string received;
+  if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0 and SSL_set_fd(ssl, s) == 1 and
+      SSL_connect(ssl) == 1) {
+    SSL_write(ssl, request.data(), request.size());
+    char buf[16384];
+    int n;
+    while ((n = SSL_read(ssl, buf, sizeof buf)) > 0) {
+      received.append(buf, n);
+    }
+  }
+  SSL_free(ssl);
+  SSL_CTX_free(ctx);
+  close(s);
+  return received;
+}
+
+class FileTcpProcessor : public network::TcpProcessor {
+public:
+  FileTcpProcessor(network::TcpSender& sender, const std::filesystem::path& path) : sender{sender}, path{path} {
+  }
+
+  void Process(std::string_view data) override {
+    sender.Send(data);
+    sender.Send(os::File{path.string()});
+    sender.Close();
+  }
+
+  bool Process(network::TcpReceiver&) override {
+    return false;
+  }
+
+private:
+  network::TcpSender& sender;
+  const std::filesystem::path& path;
+};
+
+class FileTcpProcessorFactory : public network::TcpProcessorFactory {
+public:
+  explicit FileTcpProcessorFactory(std::filesystem::path path) : path{std::move(path)} {
+  }
+
+  std::unique_ptr<network::TcpProcessor> Create(network::TcpSender& sender) const override {
+    return std::make_unique<FileTcpProcessor>(sender, path);
+  }
+
+private:
+  std::filesystem::path path;
+};
+
+}  // namespace
+
+namespace network {
+
+TEST(TlsSessionTest, whenServingOverLoopback_itShouldHandshakeAndEncryptBuffersAndFiles) {
+  const auto dir = std::filesystem::temp_directory_path() / "net_http_tls_test";
+  TlsContext context{WriteSelfSignedCertificate(dir)};
+  ASSERT_TRUE(context.Ok());
+  const std::string content(100000, 'x');
+  std::ofstream{dir / "content"} << content;
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof addr;
+  ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr), 0);
+  ASSERT_EQ(listen(listener, 1), 0);
+  ASSERT_EQ(getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &length), 0);
+
+  std::atomic<bool> done{false};
+  std::string alpn;
+  std::string received;
+  std::thread client{[&] {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_alpn_protos(ctx, reinterpret_cast<const unsigned char*>("\x08http/1.1\x02h2"), 12);
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    SSL* ssl = SSL_new(ctx);
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0 and SSL_set_fd(ssl, s) == 1 and
+        SSL_connect(ssl) == 1) {
+      const unsigned char* selected = nullptr;
+      unsigned int selectedLength = 0;
+      SSL_get0_alpn_selected(ssl, &selected, &selectedLength);
+      alpn.assign(reinterpret_cast<const char*>(selected), selectedLength);
+      SSL_write(ssl, "ping", 4);
+      char buf[16384];
+      int n;
+      while ((n = SSL_read(ssl, buf, sizeof buf)) > 0) {
+        received.append(buf, n);
+      }
+    }
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+    close(s);
+    done = true;
+  }};
+
+  int peer = accept(listener, nullptr, nullptr);
+  fcntl(peer, F_SETFL, fcntl(peer, F_GETFL) | O_NONBLOCK);
+  auto session = context.Create(peer);
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+  TlsHandshake state = TlsHandshake::WantRead;
+  while (session and state != TlsHandshake::Done and state != TlsHandshake::Failed and
+         std::chrono::steady_clock::now() < deadline) {
+    Wait(peer, state == TlsHandshake::WantWrite ? POLLOUT : POLLIN);
+    state = session->Handshake();
+  }
+  std::string request;
+  while (state == TlsHandshake::Done and request.size() < 4 and std::chrono::steady_clock::now() < deadline) {
+    Wait(peer, POLLIN);
+    char buf[16];
+    ssize_t n = session->Read(buf, sizeof buf);
+    if (n == 0 or (n < 0 and errno != EAGAIN)) {
+      break;
+    }
+    if (n > 0) {
+      request.append(buf, n);
+    }
+  }
+  if (state == TlsHandshake::Done) {
+    NiceMock<TcpSenderSupervisorMock> supervisor;
+    TcpPrefetcher prefetcher;
+    TcpStatistics statistics;
+    ConcreteTcpSender sut{peer, supervisor, prefetcher, BandwidthLimit{}, statistics, session.get()};
+    sut.Send("pong:");
+    sut.Send(os::File{(dir / "content").string()});
+    sut.Close();
+    while (not done and std::chrono::steady_clock::now() < deadline) {
+      Wait(peer, POLLOUT);
+      sut.SendBuffered();
+    }
+  } else {
+    shutdown(peer, SHUT_RDWR);
+  }
+  client.join();
+  session.reset();
+  close(peer);
+  close(listener);
+  std::filesystem::remove_all(dir);
+
+  ASSERT_EQ(state, TlsHandshake::Done);
+  ASSERT_EQ(alpn, "h2");
+  ASSERT_EQ(request, "ping");
+  ASSERT_EQ(received, "pong:" + content);
+}
+
+TEST(TlsSessionTest, whenTheLayerIsSecured_itShouldHandshakeAndServeEncryptedFilesFromTheEventLoop) {
+  const auto dir = std::filesystem::temp_directory_path() / "net_http_tls_layer_test";
+  auto options = WriteSelfSignedCertificate(dir);
+  options.kernelOffload = false;
+  TlsContext context{options};
+  ASSERT_TRUE(context.Ok());
+  const std::string content(300000, 'x');
+  std::ofstream{dir / "content"} << content;
+  FileTcpProcessorFactory factory{dir / "content"};
+  TcpStatistics statistics;
+  LoopbackTcpLayer sut{factory, BandwidthLimit{}, statistics};
+  sut.Secure(context);
+  std::thread loop{[&sut] { sut.Start(); }};
+  for (int i = 0; i < 500 and sut.Port() == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+
+  const auto received = FetchOverTls(sut.Port(), "pong:");
+  sut.Stop();
+  loop.join();
+  std::filesystem::remove_all(dir);
+
+  ASSERT_EQ(statistics.userTlsSessions, 1);
+  ASSERT_EQ(received, "pong:" + content);
+  ASSERT_EQ(statistics.bulkBytes, content.size());
+}
+
+}  // namespace network